@@ -0,0 +1,138 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for rtptrans fan-out: packets received per second when
+ * each is sent to n unicast legs, with fanout_send() (sendmmsg()
+ * where available) and with one sendmsg() per leg as rtptrans did
+ * before.  Legs point at a loopback sink whose queue is drained
+ * between packets.
+ */
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fanout.h"
+
+#define LEGS  1000
+#define LEGPKTS 400000  /* total legs sent per measurement */
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int sink, sock;
+static struct sockaddr_in to;
+
+static void drain(void)
+{
+  char buf[2048];
+
+  while (recv(sink, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+    ;
+}
+
+static void bench(int n)
+{
+  struct rtp { char hdr[12]; } rtp;
+  char payload[160];
+  struct iovec iov[2];
+  struct msghdr msg;
+  fanout_t *f = fanout_new();
+  int i, k, pkts = LEGPKTS / n;
+  double t;
+
+  memset(&rtp, 0, sizeof(rtp));
+  memset(payload, 0, sizeof(payload));
+  iov[0].iov_base = &rtp;
+  iov[0].iov_len  = sizeof(rtp);
+  iov[1].iov_base = payload;
+  iov[1].iov_len  = sizeof(payload);
+  for (i = 0; i < n; i++) fanout_add(f, sock, &to);
+
+  t = now_ns();
+  for (k = 0; k < pkts; k++) {
+    fanout_send(f, iov, 2, -1, 0);
+    drain();
+  }
+  printf("fanout.send\t%d\t%.0f\tpkt/s\n", n, pkts / ((now_ns() - t) / 1e9));
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov     = iov;
+  msg.msg_iovlen  = 2;
+  msg.msg_name    = &to;
+  msg.msg_namelen = sizeof(to);
+  t = now_ns();
+  for (k = 0; k < pkts; k++) {
+    for (i = 0; i < n; i++)
+      if (sendmsg(sock, &msg, 0) < 0) perror("sendmsg");
+    drain();
+  }
+  printf("fanout.sendmsg\t%d\t%.0f\tpkt/s\n", n, pkts / ((now_ns() - t) / 1e9));
+  fanout_free(f);
+}
+
+int main(int argc, char *argv[])
+{
+  socklen_t len = sizeof(to);
+  int size = 8 * 1024 * 1024;
+
+  sink = socket(PF_INET, SOCK_DGRAM, 0);
+  sock = socket(PF_INET, SOCK_DGRAM, 0);
+  memset(&to, 0, sizeof(to));
+  to.sin_family      = AF_INET;
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (sink < 0 || sock < 0 ||
+      bind(sink, (struct sockaddr *)&to, sizeof(to)) < 0 ||
+      getsockname(sink, (struct sockaddr *)&to, &len) < 0) {
+    perror("sink");
+    exit(1);
+  }
+  setsockopt(sink, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));
+
+  bench(10);
+  bench(100);
+  bench(LEGS);
+  return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Benchmark for rtpdump text output: MB/s of "-F hex" and "-F short"
+* lines for G.711 packets, formatted with one fprintf() per field and
+* per byte as rtpdump used to and through fmt.c, written to /dev/null.
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sysdep.h"
+#include "fmt.h"
+
+#define PACKETS 200000
+#define PLEN    160   /* G.711 20 ms payload */
+
+static unsigned char pkt[12 + PLEN];
+static FILE *out;
+static uint64_t bytes;
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void packet(long i)
+{
+  pkt[0] = 0x80;
+  pkt[2] = i >> 8;
+  pkt[3] = i;
+  pkt[4] = (i * 160) >> 24;
+  pkt[5] = (i * 160) >> 16;
+  pkt[6] = (i * 160) >> 8;
+  pkt[7] = i * 160;
+  pkt[11] = 0x42;
+  pkt[12 + i % PLEN] = i;
+}
+
+static void stdio_hex(long i, struct in_addr a)
+{
+  int j;
+
+  fprintf(out, "%ld.%06ld %s len=%d from=%s:%u ", i / 50, (long)(i % 50) * 20000,
+    "RTP", (int)sizeof(pkt), inet_ntoa(a), 5004);
+  fprintf(out,
+    "v=%d p=%d x=%d cc=%d m=%d pt=%d (%s,%d,%d) seq=%u ts=%lu ssrc=0x%lx ",
+    2, 0, 0, 0, 0, 0, "PCMU", 1, 8000, (unsigned)(i & 0xffff),
+    (unsigned long)(i * 160), 0x42UL);
+  fprintf(out, "data=");
+  for (j = 12; j < (int)sizeof(pkt); j++) fprintf(out, "%02x", pkt[j]);
+  fprintf(out, "\n");
+}
+
+static void stdio_short(long i)
+{
+  fprintf(out, "%ld.%06ld %lu %u\n", i / 50, (long)(i % 50) * 20000,
+    (unsigned long)(i * 160), (unsigned)(i & 0xffff));
+}
+
+static void fmt_write(void *ctx, const char *buf, size_t len)
+{
+  bytes += len;
+  fwrite(buf, len, 1, out);
+}
+
+static void fmt_packet(fmt_t *f, long i, const char *from)
+{
+  fmt_long(f, i / 50);
+  fmt_char(f, '.');
+  fmt_zpad(f, (i % 50) * 20000, 6);
+  fmt_str(f, " RTP len=");
+  fmt_long(f, sizeof(pkt));
+  fmt_str(f, " from=");
+  fmt_str(f, from);
+  fmt_str(f, " v=2 p=0 x=0 cc=0 m=0 pt=0 (PCMU,1,8000) seq=");
+  fmt_ulong(f, i & 0xffff);
+  fmt_str(f, " ts=");
+  fmt_ulong(f, i * 160);
+  fmt_str(f, " ssrc=0x");
+  fmt_xlong(f, 0x42);
+  fmt_str(f, " data=");
+  fmt_hex(f, pkt + 12, PLEN);
+  fmt_char(f, '\n');
+}
+
+static void fmt_short(fmt_t *f, long i)
+{
+  fmt_long(f, i / 50);
+  fmt_char(f, '.');
+  fmt_zpad(f, (i % 50) * 20000, 6);
+  fmt_char(f, ' ');
+  fmt_ulong(f, i * 160);
+  fmt_char(f, ' ');
+  fmt_ulong(f, i & 0xffff);
+  fmt_char(f, '\n');
+}
+
+/* compare the text of a few packets both ways */
+static int check(void)
+{
+  static fmt_t f;
+  FILE *save = out;
+  char a_buf[64 * 1024], b_buf[64 * 1024];
+  size_t a_len, b_len;
+  struct in_addr a;
+  long i;
+
+  a.s_addr = htonl(0x7f000001);
+  if (!(out = tmpfile())) return -1;
+  for (i = 0; i < 100; i++) {
+    packet(i);
+    stdio_hex(i, a);
+    stdio_short(i);
+  }
+  a_len = ftell(out);
+  fmt_init(&f, fmt_write, 0);
+  memset(pkt, 0, sizeof(pkt));
+  for (i = 0; i < 100; i++) {
+    packet(i);
+    fmt_packet(&f, i, "127.0.0.1:5004");
+    fmt_short(&f, i);
+  }
+  fmt_flush(&f);
+  b_len = ftell(out) - a_len;
+  rewind(out);
+  if (a_len > sizeof(a_buf) || b_len > sizeof(b_buf) ||
+      fread(a_buf, 1, a_len, out) != a_len ||
+      fread(b_buf, 1, b_len, out) != b_len) return -1;
+  fclose(out);
+  out = save;
+  memset(pkt, 0, sizeof(pkt));
+  return a_len == b_len && memcmp(a_buf, b_buf, a_len) == 0 ? 0 : -1;
+}
+
+static void report(const char *name, const char *how, uint64_t n, double t)
+{
+  printf("%s\t%s\t%.1f\tMB/s\n", name, how, n / t / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  static fmt_t f;
+  struct in_addr a;
+  long i;
+  double t;
+  int hex;
+
+
+  if (check() < 0) {
+    fprintf(stderr, "fmt and stdio output differ\n");
+    return 1;
+  }
+  if (!(out = fopen("/dev/null", "w"))) {
+    perror("/dev/null");
+    return 1;
+  }
+  a.s_addr = htonl(0x7f000001);
+  fmt_init(&f, fmt_write, 0);
+
+  for (hex = 1; hex >= 0; hex--) {
+    const char *name = hex ? "fmt.hex" : "fmt.short";
+
+    t = now_s();
+    for (i = 0; i < PACKETS; i++) {
+      packet(i);
+      if (hex) stdio_hex(i, a);
+      else stdio_short(i);
+    }
+    fflush(out);
+    t = now_s() - t;
+
+    /* same text both ways, measured with fmt */
+    bytes = 0;
+    memset(pkt, 0, sizeof(pkt));
+    for (i = 0; i < PACKETS; i++) {
+      packet(i);
+      if (hex) fmt_packet(&f, i, "127.0.0.1:5004");
+      else fmt_short(&f, i);
+    }
+    fmt_flush(&f);
+    report(name, "stdio", bytes, t);
+
+    bytes = 0;
+    memset(pkt, 0, sizeof(pkt));
+    t = now_s();
+    for (i = 0; i < PACKETS; i++) {
+      packet(i);
+      if (hex) fmt_packet(&f, i, "127.0.0.1:5004");
+      else fmt_short(&f, i);
+    }
+    fmt_flush(&f);
+    report(name, "fmt", bytes, now_s() - t);
+  }
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Deterministic synthetic rtpdump files for the benchmarks, or for
+* anyone who needs a large recording: 'n' sources cycling through
+* G.711, G.729, Opus-like and video streams, each with its own mix of
+* packet sizes, a little arrival jitter and an RTCP sender report
+* every five seconds.  The same arguments always give the same file.
+* With -c it stops after that many records, RTCP included.
+*
+*   bench-gen [-c records] [-n sources] [-t seconds] [-S seed]
+*     [-V version] [-o file]
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sysdep.h"
+#include "rtpdump.h"
+
+#define RTCP_INTERVAL 5000000000ULL  /* ns */
+#define START 1577836800             /* recording start, 2020-01-01 */
+
+typedef struct {
+  int profile;               /* PCMU, G729, OPUS, VIDEO */
+  uint32_t ssrc;
+  uint32_t seed;             /* of this source's random numbers */
+  uint16_t seq;
+  uint32_t ts;
+  uint64_t nominal;          /* time of the current packet or frame */
+  uint64_t at;               /* arrival time of the next packet */
+  uint64_t rtcp;             /* time of the next sender report */
+  uint32_t frame;            /* video frames so far */
+  int left;                  /* bytes of the current frame still to go */
+  uint32_t packets, octets;
+} source_t;
+
+enum {PCMU, G729, OPUS, VIDEO, PROFILES};
+
+static const struct {
+  int pt;
+  uint32_t rate;             /* clock rate */
+  uint64_t period;           /* ns per packet or frame */
+} profile[PROFILES] = {
+  {0,   8000,  20000000},
+  {18,  8000,  20000000},
+  {111, 48000, 20000000},
+  {96,  90000, 33333333}
+};
+
+static int version = 1;
+static FILE *out;
+static source_t *source;
+static int *heap;            /* sources by arrival of their next packet */
+static int nheap;
+static long records, limit;  /* written, and -c, 0 for no limit */
+
+
+static uint32_t lcg(uint32_t *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+static void put16(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 8; p[1] = v;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void record(source_t *s, const unsigned char *data, int len, int rtp)
+{
+  RD_packet_t h1;
+  RD_packet2_t h2;
+
+  if (limit && records == limit) return;
+  records++;
+  if (version == 2) {
+    h2.length    = htons(sizeof(h2) + len);
+    h2.plen      = htons(rtp ? len : 0);
+    h2.flags     = 0;
+    h2.offset_hi = htonl(s->at >> 32);
+    h2.offset_lo = htonl(s->at & 0xffffffff);
+    fwrite(&h2, sizeof(h2), 1, out);
+  }
+  else {
+    h1.length = htons(sizeof(h1) + len);
+    h1.plen   = htons(rtp ? len : 0);
+    h1.offset = htonl(s->at / 1000000);
+    fwrite(&h1, sizeof(h1), 1, out);
+  }
+  if (fwrite(data, len, 1, out) != 1) {
+    perror("fwrite");
+    exit(1);
+  }
+}
+
+/* RTCP sender report and CNAME of source 's' */
+static void sender_report(source_t *s, int k)
+{
+  unsigned char p[64];
+  uint64_t ntp = ((uint64_t)(START + 2208988800U + s->at / 1000000000) << 32) +
+    ((s->at % 1000000000) << 32) / 1000000000;
+  int n, words;
+
+  memset(p, 0, sizeof(p));
+  p[0] = 0x80; p[1] = 200; put16(p + 2, 6);
+  put32(p + 4, s->ssrc);
+  put32(p + 8, ntp >> 32);
+  put32(p + 12, ntp);
+  put32(p + 16, s->ts);
+  put32(p + 20, s->packets);
+  put32(p + 24, s->octets);
+  n = sprintf((char *)p + 38, "gen%d@bench", k);
+  words = (10 + n + 4) / 4;  /* with the terminating null item */
+  p[28] = 0x81; p[29] = 202; put16(p + 30, words - 1);
+  put32(p + 32, s->ssrc);
+  p[36] = 1; p[37] = n;
+  record(s, p, 28 + words * 4, 0);
+}
+
+/* size of the next RTP payload of 's', moving on to the next frame */
+static int payload_size(source_t *s)
+{
+  int len;
+
+  switch (s->profile) {
+  case PCMU:
+    return 160;
+  case G729:
+    return 20;
+  case OPUS:
+    return 40 + lcg(&s->seed) % 160;
+  default:
+    if (s->left == 0)
+      s->left = s->frame % 60 == 0 ? 20000 + lcg(&s->seed) % 20000 :
+        500 + lcg(&s->seed) % 6000;
+    len = s->left < 1200 ? s->left : 1200;
+    s->left -= len;
+    return len;
+  }
+}
+
+/* write the next packet of source 'k' and schedule the one after it */
+static void send_packet(int k)
+{
+  source_t *s = &source[k];
+  unsigned char p[12 + 1200];
+  int len = payload_size(s), last = s->left == 0;
+  uint64_t next;
+
+  if (s->at >= s->rtcp) {
+    sender_report(s, k);
+    s->rtcp += RTCP_INTERVAL;
+  }
+  p[0] = 0x80;
+  p[1] = profile[s->profile].pt | (s->profile == VIDEO && last ? 0x80 : 0);
+  put16(p + 2, s->seq++);
+  put32(p + 4, s->ts);
+  put32(p + 8, s->ssrc);
+  memset(p + 12, 0x55 + k, len);
+  record(s, p, 12 + len, 1);
+  s->packets++;
+  s->octets += len;
+
+  /* packets of a frame follow each other closely */
+  if (!last) {
+    s->at += 50000;
+    return;
+  }
+  s->frame++;
+  s->nominal += profile[s->profile].period;
+  s->ts += (uint32_t)(profile[s->profile].period *
+    profile[s->profile].rate / 1000000000);
+  next = s->nominal + lcg(&s->seed) % 2000000;  /* up to 2 ms late */
+  s->at = next > s->at ? next : s->at + 1000;
+}
+
+static int earlier(int a, int b)
+{
+  return source[heap[a]].at < source[heap[b]].at ||
+    (source[heap[a]].at == source[heap[b]].at && heap[a] < heap[b]);
+}
+
+static void sift_down(int i)
+{
+  int c, t;
+
+  for (; (c = 2 * i + 1) < nheap; i = c) {
+    if (c + 1 < nheap && earlier(c + 1, c)) c++;
+    if (!earlier(c, i)) break;
+    t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+  }
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: bench-gen [-c records] [-n sources] [-t seconds] "
+    "[-S seed] [-V version] [-o file]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  RD_hdr_t hdr;
+  uint32_t seed = 1;
+  double seconds = 60;
+  uint64_t end;
+  int n = 4, c, i;
+
+  out = stdout;
+  while ((c = getopt(argc, argv, "c:n:o:S:t:V:")) != -1) {
+    switch (c) {
+    case 'c':
+      limit = atol(optarg);
+      break;
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'o':
+      if (!(out = fopen(optarg, "wb"))) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'S':
+      seed = strtoul(optarg, 0, 0);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'V':
+      version = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (n < 1 || seconds <= 0 || limit < 0 || (version != 1 && version != 2)) usage();
+  if (!(source = calloc(n, sizeof(*source))) ||
+      !(heap = calloc(n, sizeof(*heap)))) {
+    perror("calloc");
+    return 1;
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+  /* sources start at random times within the first period */
+  for (i = 0; i < n; i++) {
+    source_t *s = &source[i];
+
+    s->profile = i % PROFILES;
+    s->seed = seed * 2654435761U + i;
+    s->ssrc = lcg(&s->seed) << 8 | (lcg(&s->seed) & 0xff);
+    s->seq  = lcg(&s->seed);
+    s->ts   = lcg(&s->seed);
+    s->nominal = lcg(&s->seed) % profile[s->profile].period;
+    s->at = s->rtcp = s->nominal;
+    heap[nheap++] = i;
+  }
+  for (i = nheap / 2; i >= 0; i--) sift_down(i);
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.start.tv_sec = htonl(START);
+  hdr.source = htonl(0x7f000001);
+  hdr.port = htons(5004);
+  fprintf(out, "#!rtpplay%s 127.0.0.1/5004\n",
+    version == 2 ? RTPFILE_VERSION2 : RTPFILE_VERSION);
+  fwrite(&hdr, sizeof(hdr), 1, out);
+
+  end = seconds * 1e9;
+  while (source[heap[0]].at < end && (limit == 0 || records < limit)) {
+    send_packet(heap[0]);
+    sift_down(0);
+  }
+  if (fclose(out) != 0) {
+    perror("fclose");
+    return 1;
+  }
+  return 0;
+}
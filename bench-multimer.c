@@ -0,0 +1,121 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark for the multiple timer package: nanoseconds per
+ * timer_set() and per expired timer with n timers pending.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sysdep.h"
+#include "notify.h"
+#include "multimer.h"
+
+#define ITER 1000000
+
+static uint32_t seed = 1;
+static unsigned long fired;
+
+static uint32_t lcg(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* random absolute time 'base' seconds after the epoch */
+static struct timeval *when(struct timeval *tv, long base)
+{
+  tv->tv_sec  = base + lcg() % 1000;
+  tv->tv_usec = lcg() % 1000000;
+  return tv;
+}
+
+/* expired timer: count it and push it far into the future */
+static Notify_value rearm(Notify_client client)
+{
+  struct timeval tv;
+
+  fired++;
+  timer_set(when(&tv, 2000000000L), rearm, client, 0);
+  return NOTIFY_DONE;
+}
+
+static void bench(unsigned long n)
+{
+  struct timeval tv, timeout;
+  unsigned long i, iter = n < ITER ? ITER : n;
+  double t;
+
+  for (i = 0; i < n; i++)
+    timer_set(when(&tv, 2000000000L), rearm, (Notify_client)i, 0);
+
+  /* reschedule random clients, heap stays at n */
+  t = now_ns();
+  for (i = 0; i < iter; i++)
+    timer_set(when(&tv, 2000000000L), rearm, (Notify_client)(lcg() % n), 0);
+  printf("multimer.set\t%lu\t%.1f\tns\n", n, (now_ns() - t) / iter);
+
+  /* move all into the past, then let timer_get() expire each once */
+  for (i = 0; i < n; i++)
+    timer_set(when(&tv, 1), rearm, (Notify_client)i, 0);
+  fired = 0;
+  t = now_ns();
+  timer_get(&timeout);
+  printf("multimer.expire\t%lu\t%.1f\tns\n", n, (now_ns() - t) / fired);
+
+  for (i = 0; i < n; i++)
+    timer_set(0, rearm, (Notify_client)i, 0);
+  if (timer_pending()) {
+    fprintf(stderr, "timers left pending\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  bench(10);
+  bench(1000);
+  bench(100000);
+  return 0;
+}
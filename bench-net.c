@@ -0,0 +1,260 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Loopback benchmarks of the tools themselves, run from the build
+* directory: packets lost by rtpdump capturing rtpsend -g streams at
+* a given packet rate, the scheduling error rtpsend reports, and the
+* timing error of rtpplay replaying a bench-gen file, measured
+* against the offsets recorded in the file, when pacing by those
+* offsets (-T) and by RTP timestamps.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtpdump.h"
+
+#define PORT    45000  /* even; rtpplay goes to PORT + 2 */
+#define STREAMS 10
+#define PLAY_S  5      /* seconds of bench-gen data for rtpplay */
+
+static char tmp[] = "/tmp/bench-net.XXXXXX";
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void run(const char *cmd)
+{
+  if (system(cmd) != 0) {
+    fprintf(stderr, "bench-net: %s failed\n", cmd);
+    exit(1);
+  }
+}
+
+/* rtpdump -F stats capturing 'pps' packets/s for a second */
+static void capture(int pps)
+{
+  char cmd[256], line[512], *p;
+  unsigned long sent = 0, received = 0;
+  FILE *f;
+
+  snprintf(cmd, sizeof(cmd), "./rtpdump -F stats -t 0.05 127.0.0.1/%d "
+    "> %s & sleep 1; ./rtpsend -g streams=%d,rate=%g,time=1 127.0.0.1/%d "
+    "2> %s.err; wait", PORT, tmp, STREAMS, (double)pps / STREAMS, PORT, tmp);
+  run(cmd);
+  if ((f = fopen(tmp, "r"))) {
+    while (fgets(line, sizeof(line), f))
+      if (strncmp(line, "stream ", 7) == 0 && (p = strstr(line, " packets=")))
+        received += strtoul(p + 9, 0, 10);
+    fclose(f);
+  }
+  snprintf(cmd, sizeof(cmd), "%s.err", tmp);
+  if ((f = fopen(cmd, "r"))) {
+    while (fgets(line, sizeof(line), f)) {
+      double mean, max;
+      unsigned long p99;
+
+      if (sscanf(line, "%lu packets in", &sent) == 1) continue;
+      if (sscanf(line, "scheduling error over %*u batches: mean %lf us, "
+          "99%% < %lu us, max %lf us", &mean, &p99, &max) == 3) {
+        printf("rtpsend.pacing.mean\t%d\t%.1f\tus\n", pps, mean);
+        printf("rtpsend.pacing.p99\t%d\t%lu\tus\n", pps, p99);
+        printf("rtpsend.pacing.max\t%d\t%.1f\tus\n", pps, max);
+      }
+    }
+    fclose(f);
+    unlink(cmd);
+  }
+  if (sent == 0) {
+    fprintf(stderr, "bench-net: no packets sent at %d packets/s\n", pps);
+    exit(1);
+  }
+  printf("capture.loss\t%d\t%.3f\t%%\n", pps,
+    received < sent ? 100.0 * (sent - received) / sent : 0);
+}
+
+/*
+* rtpplay of a bench-gen file: each RTP packet received is matched by
+* SSRC and sequence number to its record, and its error is the
+* difference between the arrival and the recorded offset, less the
+* smallest such difference.  Without 'offsets', rtpplay paces by RTP
+* timestamps, so the error includes the jitter bench-gen recorded.
+*/
+static void play(int spin, int offsets)
+{
+  const char *name = offsets ? "rtpplay" : "rtpplay.rtpts";
+  struct { uint32_t ssrc; uint16_t seq; double t; } *rec = 0;
+  struct sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+  unsigned char buf[2048];
+  double *err, t, low = 0, sum = 0;
+  long nrec = 0, size = 0, next = 0, n = 0, i;
+  int sock, rtcp, size_buf = 8 * 1024 * 1024;
+  char cmd[256];
+  struct timeval start;
+  RD_reader_t *r;
+  RD_record_t rr;
+  FILE *in, *player;
+
+  snprintf(cmd, sizeof(cmd), "./bench-gen -n 8 -t %d -V 2 -o %s", PLAY_S, tmp);
+  run(cmd);
+  memset(&sin, 0, sizeof(sin));
+  if (!(in = fopen(tmp, "rb")) || RD_header(in, &sin, &start, 0) < 0 ||
+      !(r = RD_open(in))) {
+    fprintf(stderr, "cannot read %s\n", tmp);
+    exit(1);
+  }
+  while (RD_next(r, &rr) > 0) {
+    if (rr.plen == 0 || rr.length < 12) continue;
+    if (nrec == size) {
+      size = size ? 2 * size : 4096;
+      rec = realloc(rec, size * sizeof(*rec));
+    }
+    rec[nrec].ssrc = ntohl(*(uint32_t *)(rr.data + 8));
+    rec[nrec].seq  = ntohs(*(uint16_t *)(rr.data + 2));
+    rec[nrec].t    = rr.offset_ns / 1e3;
+    nrec++;
+  }
+  RD_close(r);
+  fclose(in);
+  err = calloc(nrec, sizeof(*err));
+
+  /* RTCP goes to the next port, where it is dropped unread */
+  sock = socket(PF_INET, SOCK_DGRAM, 0);
+  rtcp = socket(PF_INET, SOCK_DGRAM, 0);
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family      = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port        = htons(PORT + 2);
+  if (sock < 0 || bind(sock, (struct sockaddr *)&sin, len) < 0) {
+    perror("bind");
+    exit(1);
+  }
+  sin.sin_port        = htons(PORT + 3);
+  if (rtcp < 0 || bind(rtcp, (struct sockaddr *)&sin, len) < 0) {
+    perror("bind");
+    exit(1);
+  }
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&size_buf,
+    sizeof(size_buf));
+
+  snprintf(cmd, sizeof(cmd), "./rtpplay %s-P %d -f %s 127.0.0.1/%d "
+    "2> /dev/null", offsets ? "-T " : "", spin, tmp, PORT + 2);
+  if (!(player = popen(cmd, "r"))) {
+    perror(cmd);
+    exit(1);
+  }
+  for (t = now_us(); now_us() - t < (PLAY_S + 2) * 1e6 && next < nrec; ) {
+    struct timeval tv = {0, 100000};
+    fd_set fds;
+    ssize_t got;
+    uint32_t ssrc;
+    uint16_t seq;
+
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    if (select(sock + 1, &fds, 0, 0, &tv) <= 0) continue;
+    if ((got = recv(sock, buf, sizeof(buf), 0)) < 12) continue;
+    ssrc = ntohl(*(uint32_t *)(buf + 8));
+    seq  = ntohs(*(uint16_t *)(buf + 2));
+    for (i = next; i < nrec; i++)
+      if (rec[i].ssrc == ssrc && rec[i].seq == seq) break;
+    if (i == nrec) continue;
+    next = i + 1;
+    err[n] = now_us() - rec[i].t;
+    if (n == 0 || err[n] < low) low = err[n];
+    n++;
+  }
+  close(sock);
+  close(rtcp);
+  if (pclose(player) != 0) {
+    fprintf(stderr, "bench-net: %s failed\n", cmd);
+    exit(1);
+  }
+  unlink(tmp);
+  if (n == 0) {
+    fprintf(stderr, "bench-net: nothing received from rtpplay\n");
+    exit(1);
+  }
+  for (i = 0; i < n; i++) {
+    err[i] -= low;
+    sum += err[i];
+  }
+  qsort(err, n, sizeof(*err), compare);
+  printf("%s.pacing.mean\t%d\t%.1f\tus\n", name, spin, sum / n);
+  printf("%s.pacing.p99\t%d\t%.1f\tus\n", name, spin, err[n * 99 / 100]);
+  printf("%s.pacing.max\t%d\t%.1f\tus\n", name, spin, err[n - 1]);
+  printf("%s.received\t%d\t%.3f\t%%\n", name, spin, 100.0 * n / nrec);
+  free(err);
+  free(rec);
+}
+
+int main(int argc, char *argv[])
+{
+  int fd;
+
+  if ((fd = mkstemp(tmp)) < 0) {
+    perror(tmp);
+    return 1;
+  }
+  close(fd);
+  capture(1000);
+  capture(10000);
+  capture(50000);
+  capture(100000);
+  play(0, 1);
+  play(200, 1);
+  play(0, 0);
+  unlink(tmp);
+  return 0;
+}
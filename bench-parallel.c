@@ -0,0 +1,111 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Scaling of rtpdump -j: records per second converted from a dump
+* file by 1 to 32 worker threads, for a few formats.  Runs the
+* rtpdump binary of the build directory, or the one given; threads 0
+* is the sequential loop without -j.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sysdep.h"
+
+#define RECORDS 1000000
+#define STREAMS 16
+
+static char path[] = "/tmp/bench-parallel.XXXXXX";
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a version 1 dump of RECORDS records of STREAMS sources */
+static void generate(void)
+{
+  char cmd[128];
+
+  snprintf(cmd, sizeof(cmd), "./bench-gen -n %d -t 1e9 -c %d -V 1 -o %s",
+    STREAMS, RECORDS, path);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "%s failed\n", cmd);
+    unlink(path);
+    exit(1);
+  }
+}
+
+static void bench(const char *rtpdump, const char *format, int threads)
+{
+  char cmd[256], j[16] = "";
+  double t;
+
+  if (threads) snprintf(j, sizeof(j), "-j %d ", threads);
+  snprintf(cmd, sizeof(cmd), "%s %s-F %s -f %s > /dev/null", rtpdump, j,
+    format, path);
+  t = now_s();
+  if (system(cmd) != 0) {
+    fprintf(stderr, "%s failed\n", cmd);
+    unlink(path);
+    exit(1);
+  }
+  printf("parallel.%s\t%d\t%.0f\trec/s\n", format, threads,
+    RECORDS / (now_s() - t));
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *formats[] = {"stats", "short", "dump", 0};
+  const char *rtpdump = argc > 1 ? argv[1] : "./rtpdump";
+  int fd = mkstemp(path);
+  int i, n;
+
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  close(fd);
+  generate();
+  for (i = 0; formats[i]; i++) {
+    bench(rtpdump, formats[i], 0);
+    for (n = 1; n <= 32; n *= 2) bench(rtpdump, formats[i], n);
+  }
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+* Benchmark for reading rtpdump files: records per second through
+* RD_read() and through the RD_next() reader, mapped and streaming.
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sysdep.h"
+#include "rtpdump.h"
+
+#define RECORDS 1000000
+
+static char path[] = "/tmp/bench-rd.XXXXXX";
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a version 1 dump of RECORDS records of one G.711 source */
+static void generate(void)
+{
+  char cmd[128];
+
+  snprintf(cmd, sizeof(cmd), "./bench-gen -n 1 -t 1e9 -c %d -V 1 -o %s",
+    RECORDS, path);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "%s failed\n", cmd);
+    unlink(path);
+    exit(1);
+  }
+}
+
+static FILE *input(int pipe)
+{
+  struct sockaddr_in sin;
+  struct timeval start;
+  char cmd[80];
+  FILE *in;
+
+  if (pipe) {
+    snprintf(cmd, sizeof(cmd), "cat %s", path);
+    in = popen(cmd, "r");
+  }
+  else in = fopen(path, "rb");
+  memset(&sin, 0, sizeof(sin));
+  if (!in || RD_header(in, &sin, &start, 0) < 0) {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(1);
+  }
+  return in;
+}
+
+static void report(const char *name, long n, unsigned sum, double t)
+{
+  if (n != RECORDS) {
+    fprintf(stderr, "%s: read %ld records (sum %u)\n", name, n, sum);
+    exit(1);
+  }
+  printf("%s\t%d\t%.0f\trec/s\n", name, RECORDS, n / t);
+}
+
+static void bench_read(void)
+{
+  static RD_buffer_t b;
+  FILE *in = input(0);
+  unsigned sum = 0;
+  long n = 0;
+  double t = now_s();
+
+  while (RD_read(in, &b) > 0) {
+    sum += (unsigned char)b.p.data[3];
+    n++;
+  }
+  report("rd.read", n, sum, now_s() - t);
+  fclose(in);
+}
+
+static void bench_next(int pipe)
+{
+  FILE *in = input(pipe);
+  RD_reader_t *r = RD_open(in);
+  RD_record_t rec;
+  unsigned sum = 0;
+  long n = 0;
+  double t = now_s();
+
+  while (RD_next(r, &rec) > 0) {
+    sum += (unsigned char)rec.data[3];
+    n++;
+  }
+  report(pipe ? "rd.next.stream" : "rd.next.mmap", n, sum, now_s() - t);
+  RD_close(r);
+  if (pipe) pclose(in);
+  else fclose(in);
+}
+
+int main(int argc, char *argv[])
+{
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  close(fd);
+  generate();
+  bench_read();
+  bench_next(0);
+  bench_next(1);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Benchmark for the packet parser: RTP and RTCP packets per second
+* through rtpparse.c on the records of a dump file, bark.rtp by
+* default, held in memory.
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "sysdep.h"
+#include "rtpdump.h"
+#include "rtpparse.h"
+
+#define PACKETS 10000000  /* parsed per run */
+
+typedef struct {
+  unsigned char *data;
+  int len;
+} packet_t;
+
+static packet_t *rtp, *rtcp;
+static int nrtp, nrtcp;
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* copy the packets of dump file 'name' into 'rtp' and 'rtcp' */
+static void load(const char *name)
+{
+  FILE *in = fopen(name, "rb");
+  struct sockaddr_in sin;
+  struct timeval start;
+  RD_reader_t *r;
+  RD_record_t rec;
+  packet_t *p;
+  int max = 0;
+
+  if (!in || RD_header(in, &sin, &start, 0) < 0 || !(r = RD_open(in))) {
+    fprintf(stderr, "cannot read %s\n", name);
+    exit(1);
+  }
+  while (RD_next(r, &rec) > 0) {
+    if (nrtp + nrtcp == max) {
+      max = max ? 2 * max : 1024;
+      rtp  = realloc(rtp, max * sizeof(*rtp));
+      rtcp = realloc(rtcp, max * sizeof(*rtcp));
+    }
+    p = rec.plen ? &rtp[nrtp++] : &rtcp[nrtcp++];
+    p->len  = rec.length;
+    p->data = malloc(rec.length);
+    memcpy(p->data, rec.data, rec.length);
+  }
+  RD_close(r);
+  fclose(in);
+}
+
+static void report(const char *name, const char *file, long n, double t)
+{
+  printf("%s\t%s\t%.0f\tpkt/s\n", name, file, n / t);
+}
+
+static unsigned long bench_rtp(const char *file)
+{
+  rtp_info_t info;
+  unsigned long sum = 0;
+  long i;
+  double t = now_s();
+
+  for (i = 0; i < PACKETS; i++) {
+    packet_t *p = &rtp[i % nrtp];
+
+    if (rtp_parse(p->data, p->len, &info) == 0)
+      sum += info.seq + info.plen;
+  }
+  report("rtpparse.rtp", file, PACKETS, now_s() - t);
+  return sum;
+}
+
+static unsigned long bench_rtcp(const char *file)
+{
+  rtcp_iter_t it;
+  rtcp_info_t c;
+  rtcp_rr_info_t rr;
+  unsigned long sum = 0;
+  long i;
+  int j;
+  double t = now_s();
+
+  for (i = 0; i < PACKETS; i++) {
+    packet_t *p = &rtcp[i % nrtcp];
+
+    rtcp_begin(&it, p->data, p->len);
+    while (rtcp_next(&it, &c) > 0) {
+      for (j = 0; j < c.nrr; j++) {
+        rtcp_report(&c, j, &rr);
+        sum += rr.jitter;
+      }
+      sum += c.ssrc;
+    }
+  }
+  report("rtpparse.rtcp", file, PACKETS, now_s() - t);
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *file = argc > 1 ? argv[1] : "bark.rtp";
+  unsigned long sum = 0;
+
+  load(file);
+  if (nrtp) sum += bench_rtp(file);
+  if (nrtcp) sum += bench_rtcp(file);
+  if (!nrtp && !nrtcp) {
+    fprintf(stderr, "%s: no packets\n", file);
+    return 1;
+  }
+  /* keep the compiler from dropping the loops */
+  if (sum == 1) printf("\n");
+  return 0;
+}
@@ -0,0 +1,49 @@
+#ifdef __cplusplus
+#error "Do not use C++"
+#endif
+
+#if !defined(__GNUC__) || (__GNUC__ < 4)
+#define __attribute__(x)
+#endif
+
+#if defined(__linux__) || defined(__MINT__)
+#define _GNU_SOURCE	/* See have-*.c for what needs this. */
+#endif
+
+#define HAVE_CLOCK_GETTIME 1
+#define HAVE_CLOCK_NANOSLEEP 1
+#define HAVE_ERR 1
+#define HAVE_GETOPT 1
+#define HAVE_GETTIMEOFDAY 1
+#define HAVE_PROGNAME 0
+#define HAVE_STRTONUM 0
+
+/*
+#define HAVE_NTOHL 
+#define HAVE_REALLOCARRAY 
+#define HAVE_RECALLOCARRAY 
+#define HAVE_STRCASESTR 
+#define HAVE_STRINGLIST 
+#define HAVE_STRLCAT 
+#define HAVE_STRLCPY 
+#define HAVE_STRNDUP 
+*/
+
+#define RTP_BIG_ENDIAN 0
+#define HAVE_MSGCONTROL 1
+#define HAVE_RECVMMSG 1
+#define HAVE_SENDMMSG 1
+#define HAVE_UDP_SEGMENT 1
+#define HAVE_TIMESTAMPNS 1
+#define HAVE_TIMESTAMPING 1
+#define HAVE_MMAP 1
+#define HAVE_TPACKET 1
+#define HAVE_EPOLL 1
+#define HAVE_KQUEUE 0
+#define HAVE_PTHREAD 1
+#define HAVE_ZLIB 1
+#define HAVE_ZSTD 0
+
+extern 	const char *getprogname(void);
+extern	void	  setprogname(const char *);
+extern	long long strtonum(const char *, long long, long long, const char **);
@@ -0,0 +1,508 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Counters shared by the long-running tools, see counters.h, and
+* their report: a line of totals, a dump of every block, or the
+* Prometheus text format served on a local TCP port by a thread of
+* its own.
+*/
+
+#include "sysdep.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "counters.h"
+#include "ssrcmap.h"
+
+extern int host2ip(char*, struct in_addr*);
+
+#define SSRC_SLOTS (2 * COUNTERS_SSRCS)  /* power of 2 */
+#define SSRC_BITS  9
+
+/* how counters of blocks with the same name are combined */
+#define SUM 0
+#define MAX 1
+
+static const struct {
+  const char *name;     /* in lines and dumps */
+  const char *metric;   /* Prometheus name, after "rtptools_" */
+  const char *help;
+  int gauge;
+  int combine;
+} info[CTR_COUNT] = {
+  {"rx_packets",  "rx_packets_total", "Packets received.", 0, SUM},
+  {"rx_bytes",    "rx_bytes_total", "Bytes received.", 0, SUM},
+  {"tx_packets",  "tx_packets_total", "Packets sent.", 0, SUM},
+  {"tx_bytes",    "tx_bytes_total", "Bytes sent.", 0, SUM},
+  {"drops",       "drops_total",
+    "Packets dropped by the kernel, receive queue full.", 0, SUM},
+  {"send_errors", "send_errors_total", "Failed sends.", 0, SUM},
+  {"write_drops", "write_drops_total",
+    "Records dropped, writer ring full.", 0, SUM},
+  {"ssrc_other",  "ssrc_other_packets_total",
+    "Packets of SSRCs not counted separately.", 0, SUM},
+  {"timers",      "timers_total", "Timers expired.", 0, SUM},
+  {"timer_late_us", "timer_late_microseconds_total",
+    "Total lateness of expired timers.", 0, SUM},
+  {"timer_max_us", "timer_late_max_microseconds",
+    "Most lateness of an expired timer.", 1, MAX},
+  {"queue",       "writer_queue_bytes", "Bytes buffered for writing.", 1, SUM},
+  {"queue_max",   "writer_queue_max_bytes",
+    "Most bytes buffered for writing.", 1, MAX},
+  {"held",        "reorder_held_packets_total",
+    "Packets held for reordering.", 0, SUM},
+  {"duplicates",  "reorder_duplicate_packets_total",
+    "Duplicate packets dropped.", 0, SUM},
+  {"late",        "reorder_late_packets_total",
+    "Packets dropped, arriving after their turn.", 0, SUM},
+  {"lost",        "reorder_lost_packets_total",
+    "Sequence numbers given up on.", 0, SUM}
+};
+
+static counters_t *blocks;
+
+typedef struct {
+  uint64_t packets, bytes;
+} ssrc_sum_t;
+
+/* counters of all blocks with one name */
+typedef struct {
+  const char *name;
+  uint64_t v[CTR_COUNT];
+  ssrcmap_t *ssrc;      /* ssrc_sum_t, or 0 */
+} total_t;
+
+
+/*
+* New block of counters called 'name', with per-SSRC counts if
+* 'ssrcs' is set.  Exits if out of memory.
+*/
+counters_t *counters_new(const char *name, int ssrcs)
+{
+  counters_t *c = calloc(1, sizeof(counters_t));
+
+  if (!c || (ssrcs && !(c->ssrc = calloc(SSRC_SLOTS, sizeof(*c->ssrc))))) {
+    perror("counters");
+    exit(1);
+  }
+  snprintf(c->name, sizeof(c->name), "%s", name);
+#if HAVE_PTHREAD
+  c->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&blocks, &c->next, c, 0,
+      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#else
+  c->next = blocks;
+  blocks = c;
+#endif
+  return c;
+} /* counters_new */
+
+
+/*
+* Count a packet of 'bytes' from 'ssrc' in block 'c'.
+*/
+void counters_ssrc(counters_t *c, uint32_t ssrc, unsigned bytes)
+{
+  counters_ssrc_t *e;
+  unsigned i;
+
+  if (!c || !c->ssrc) return;
+  for (i = (ssrc * 2654435761U) >> (32 - SSRC_BITS); ;
+       i = (i + 1) & (SSRC_SLOTS - 1)) {
+    e = &c->ssrc[i];
+    if (e->used && e->ssrc == ssrc) break;
+    if (!e->used) {
+      if (c->ssrcs == COUNTERS_SSRCS) {
+        counters_add(c, CTR_SSRC_OTHER, 1);
+        return;
+      }
+      c->ssrcs++;
+      e->ssrc = ssrc;
+#if HAVE_PTHREAD
+      __atomic_store_n(&e->used, 1, __ATOMIC_RELEASE);
+#else
+      e->used = 1;
+#endif
+      break;
+    }
+  }
+  CTR_STORE(&e->packets, e->packets + 1);
+  CTR_STORE(&e->bytes, e->bytes + bytes);
+} /* counters_ssrc */
+
+
+/*
+* Add the counters of 'c' to 't'.
+*/
+static void total_add(total_t *t, counters_t *c)
+{
+  ssrc_sum_t *s;
+  uint64_t v;
+  int i, k;
+
+  for (k = 0; k < CTR_COUNT; k++) {
+    v = CTR_LOAD(&c->v[k]);
+    if (info[k].combine == SUM) t->v[k] += v;
+    else if (v > t->v[k]) t->v[k] = v;
+  }
+  for (i = 0; c->ssrc && i < SSRC_SLOTS; i++) {
+    counters_ssrc_t *e = &c->ssrc[i];
+
+#if HAVE_PTHREAD
+    if (!__atomic_load_n(&e->used, __ATOMIC_ACQUIRE)) continue;
+#else
+    if (!e->used) continue;
+#endif
+    if (!t->ssrc && !(t->ssrc = ssrcmap_new(sizeof(ssrc_sum_t)))) continue;
+    if (!(s = ssrcmap_find(t->ssrc, e->ssrc)) &&
+        !(s = ssrcmap_insert(t->ssrc, e->ssrc))) continue;
+    s->packets += CTR_LOAD(&e->packets);
+    s->bytes   += CTR_LOAD(&e->bytes);
+  }
+} /* total_add */
+
+
+/*
+* Sum the blocks by name, in the order they were created.  Returns
+* the number of names; '*tp' is to be freed with totals_free().
+*/
+static int totals(total_t **tp)
+{
+  counters_t *c, *first;
+  total_t *t;
+  int n = 0, i;
+
+#if HAVE_PTHREAD
+  first = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+#else
+  first = blocks;
+#endif
+  for (c = first; c; c = c->next) n++;
+  if (!(t = calloc(n ? n : 1, sizeof(*t)))) {
+    *tp = 0;
+    return 0;
+  }
+  for (n = 0, c = first; c; c = c->next) {
+    for (i = 0; i < n && strcmp(t[i].name, c->name); i++);
+    if (i == n) t[n++].name = c->name;
+    total_add(&t[i], c);
+  }
+  /* newest first: reverse */
+  for (i = 0; i < n / 2; i++) {
+    total_t x = t[i];
+
+    t[i] = t[n - 1 - i];
+    t[n - 1 - i] = x;
+  }
+  *tp = t;
+  return n;
+} /* totals */
+
+static void totals_free(total_t *t, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) ssrcmap_free(t[i].ssrc);
+  free(t);
+} /* totals_free */
+
+
+typedef struct {
+  FILE *out;
+  const char *name;
+  int format;
+  int k;                /* CTR_RX_PACKETS or CTR_RX_BYTES, Prometheus */
+} ssrc_arg_t;
+
+/*
+* ssrcmap_foreach() callback: print the counts of one SSRC.
+*/
+static int ssrc_print(uint32_t ssrc, void *entry, void *arg)
+{
+  ssrc_sum_t *s = entry;
+  ssrc_arg_t *a = arg;
+
+  if (a->format == COUNTERS_TEXT)
+    fprintf(a->out, "  ssrc=0x%08lx packets=%llu bytes=%llu\n",
+      (unsigned long)ssrc, (unsigned long long)s->packets,
+      (unsigned long long)s->bytes);
+  else
+    fprintf(a->out, "rtptools_ssrc_%s{socket=\"%s\",ssrc=\"0x%08lx\"} "
+      "%llu\n", a->k == CTR_RX_PACKETS ? "packets_total" : "bytes_total",
+      a->name, (unsigned long)ssrc,
+      (unsigned long long)(a->k == CTR_RX_PACKETS ? s->packets : s->bytes));
+  return 0;
+} /* ssrc_print */
+
+static void ssrc_metric(FILE *out, total_t *t, int n, int k)
+{
+  ssrc_arg_t a;
+  int i;
+
+  fprintf(out, "# HELP rtptools_ssrc_%s %s received per SSRC.\n",
+    k == CTR_RX_PACKETS ? "packets_total" : "bytes_total",
+    k == CTR_RX_PACKETS ? "Packets" : "Bytes");
+  fprintf(out, "# TYPE rtptools_ssrc_%s counter\n",
+    k == CTR_RX_PACKETS ? "packets_total" : "bytes_total");
+  a.out = out;
+  a.format = COUNTERS_PROMETHEUS;
+  a.k = k;
+  for (i = 0; i < n; i++) {
+    if (!t[i].ssrc) continue;
+    a.name = t[i].name;
+    ssrcmap_foreach(t[i].ssrc, ssrc_print, &a);
+  }
+} /* ssrc_metric */
+
+
+/*
+* Write the counters to 'out' in 'format', COUNTERS_*.  Values of
+* other threads may be slightly behind.
+*/
+void counters_report(FILE *out, int format)
+{
+  total_t *t, all;
+  ssrc_arg_t a;
+  int n = totals(&t), i, k;
+
+  switch (format) {
+  case COUNTERS_LINE:
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < n; i++) {
+      for (k = 0; k < CTR_COUNT; k++) {
+        if (info[k].combine == SUM) all.v[k] += t[i].v[k];
+        else if (t[i].v[k] > all.v[k]) all.v[k] = t[i].v[k];
+      }
+    }
+    fprintf(out, "counters:");
+    for (k = 0; k < CTR_COUNT; k++)
+      fprintf(out, " %s=%llu", info[k].name, (unsigned long long)all.v[k]);
+    fprintf(out, "\n");
+    break;
+
+  case COUNTERS_TEXT:
+    a.out = out;
+    a.format = format;
+    for (i = 0; i < n; i++) {
+      fprintf(out, "%s:", t[i].name);
+      for (k = 0; k < CTR_COUNT; k++) {
+        if (t[i].v[k])
+          fprintf(out, " %s=%llu", info[k].name,
+            (unsigned long long)t[i].v[k]);
+      }
+      fprintf(out, "\n");
+      if (t[i].ssrc) ssrcmap_foreach(t[i].ssrc, ssrc_print, &a);
+    }
+    break;
+
+  case COUNTERS_PROMETHEUS:
+    for (k = 0; k < CTR_COUNT; k++) {
+      fprintf(out, "# HELP rtptools_%s %s\n", info[k].metric, info[k].help);
+      fprintf(out, "# TYPE rtptools_%s %s\n", info[k].metric,
+        info[k].gauge ? "gauge" : "counter");
+      for (i = 0; i < n; i++) {
+        if (t[i].v[k])
+          fprintf(out, "rtptools_%s{socket=\"%s\"} %llu\n", info[k].metric,
+            t[i].name, (unsigned long long)t[i].v[k]);
+      }
+    }
+    ssrc_metric(out, t, n, CTR_RX_PACKETS);
+    ssrc_metric(out, t, n, CTR_RX_BYTES);
+    break;
+  }
+  fflush(out);
+  totals_free(t, n);
+} /* counters_report */
+
+
+#if HAVE_PTHREAD
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0            /* see SO_NOSIGPIPE in serve() */
+#endif
+
+static int server = -1;         /* listening socket, or -1 */
+static double line_interval;    /* seconds between lines, or 0 */
+
+/*
+* Answer a connection to the server with the Prometheus report,
+* whatever the request.
+*/
+static void serve(int sock)
+{
+  struct timeval tv;
+  char buf[4096];
+  char *report, *p;
+  size_t size;
+  FILE *out;
+  ssize_t n;
+  int len = 0;
+
+  /* read the request head, if any, within a second */
+  tv.tv_sec  = 1;
+  tv.tv_usec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
+  while (len < (int)sizeof(buf) - 1 &&
+         (n = recv(sock, buf + len, sizeof(buf) - 1 - len, 0)) > 0) {
+    len += n;
+    buf[len] = '\0';
+    if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n")) break;
+  }
+  /* a client that hangs up early must not raise SIGPIPE */
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+  {
+    int one = 1;
+
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (char *)&one, sizeof(one));
+  }
+#endif
+  if ((out = open_memstream(&report, &size))) {
+    fprintf(out, "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n\r\n");
+    counters_report(out, COUNTERS_PROMETHEUS);
+    fclose(out);
+    /* EPIPE or ECONNRESET: the client is gone, so is the connection */
+    for (p = report; size > 0; p += n, size -= n) {
+      if ((n = send(sock, p, size, SEND_FLAGS)) < 0) {
+        if (errno == EINTR) n = 0;
+        else break;
+      }
+    }
+    free(report);
+  }
+  close(sock);
+} /* serve */
+
+
+/*
+* Thread of the server and the periodic line.
+*/
+static void *serve_main(void *arg)
+{
+  struct timeval now, next, tv;
+  fd_set fds;
+  double left;
+  int sock;
+
+  gettimeofday(&next, 0);
+  for (;;) {
+    left = 3600;
+    if (line_interval > 0) {
+      gettimeofday(&now, 0);
+      left = (next.tv_sec - now.tv_sec) + (next.tv_usec - now.tv_usec) / 1e6;
+      if (left <= 0) {
+        if (next.tv_sec) counters_report(stderr, COUNTERS_LINE);
+        next.tv_sec  = now.tv_sec + (long)line_interval;
+        next.tv_usec = now.tv_usec +
+          (long)((line_interval - (long)line_interval) * 1e6);
+        if (next.tv_usec >= 1000000) {
+          next.tv_sec++;
+          next.tv_usec -= 1000000;
+        }
+        continue;
+      }
+    }
+    tv.tv_sec  = left;
+    tv.tv_usec = (left - tv.tv_sec) * 1e6;
+    FD_ZERO(&fds);
+    if (server >= 0) FD_SET(server, &fds);
+    if (select(server + 1, &fds, 0, 0, &tv) <= 0) continue;
+    if ((sock = accept(server, 0, 0)) >= 0) serve(sock);
+  }
+  return 0;
+} /* serve_main */
+#endif /* HAVE_PTHREAD */
+
+
+/*
+* Serve the counters on TCP [address/]port 'spec', the loopback
+* address by default, unless 'spec' is 0, and print the line of
+* totals to stderr every 'interval' seconds, unless 0.  Returns -1
+* with errno set on failure.
+*/
+int counters_serve(char *spec, double interval)
+{
+#if HAVE_PTHREAD
+  struct sockaddr_in sin;
+  pthread_t thread;
+  char *port;
+  int reuse = 1;
+
+  if (spec) {
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family      = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((port = strchr(spec, '/'))) {
+      *port++ = '\0';
+      if (host2ip(spec, &sin.sin_addr) < 0) {
+        errno = EINVAL;
+        return -1;
+      }
+    }
+    else port = spec;
+    if (atoi(port) <= 0 || atoi(port) > 65535) {
+      errno = EINVAL;
+      return -1;
+    }
+    sin.sin_port = htons(atoi(port));
+    if ((server = socket(PF_INET, SOCK_STREAM, 0)) < 0) return -1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse,
+      sizeof(reuse));
+    if (bind(server, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        listen(server, 8) < 0)
+      return -1;
+  }
+  line_interval = interval;
+  if ((errno = pthread_create(&thread, 0, serve_main, 0))) return -1;
+  pthread_detach(thread);
+  return 0;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+} /* counters_serve */
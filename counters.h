@@ -0,0 +1,111 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Counters of the long-running tools.  A thread counts into blocks of
+* its own, one per socket or destination, and nobody else writes
+* them; readers sum the blocks of the same name with relaxed atomic
+* loads, so counting takes no locks and no read-modify-write
+* instructions.  Blocks live until the program exits.  Include
+* sysdep.h first.
+*/
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum {
+  CTR_RX_PACKETS,       /* packets received */
+  CTR_RX_BYTES,
+  CTR_TX_PACKETS,       /* packets sent */
+  CTR_TX_BYTES,
+  CTR_DROPS,            /* dropped by the kernel, receive queue full */
+  CTR_SEND_ERRORS,
+  CTR_WRITE_DROPS,      /* records dropped, writer ring full */
+  CTR_SSRC_OTHER,       /* packets of SSRCs beyond COUNTERS_SSRCS */
+  CTR_TIMERS,           /* timers expired */
+  CTR_TIMER_LATE,       /* their total lateness, usec */
+  CTR_TIMER_MAX,        /* gauge: most lateness, usec */
+  CTR_QUEUE,            /* gauge: bytes buffered for the writer */
+  CTR_QUEUE_MAX,        /* gauge: most bytes buffered */
+  CTR_HELD,             /* packets held for reordering, -q */
+  CTR_DUPLICATES,       /* ... dropped as duplicates */
+  CTR_LATE,             /* ... dropped, arriving after their turn */
+  CTR_LOST,             /* sequence numbers given up on */
+  CTR_COUNT
+};
+
+#define COUNTERS_SSRCS 256  /* SSRCs counted per block */
+
+/* counters_report() formats */
+#define COUNTERS_LINE       0  /* totals on one line */
+#define COUNTERS_TEXT       1  /* every block and SSRC */
+#define COUNTERS_PROMETHEUS 2  /* Prometheus text exposition format */
+
+typedef struct {
+  uint32_t used;        /* set once 'ssrc' is valid */
+  uint32_t ssrc;
+  uint64_t packets, bytes;
+} counters_ssrc_t;
+
+typedef struct counters {
+  struct counters *next;  /* all blocks, newest first */
+  char name[64];
+  uint64_t v[CTR_COUNT];
+  counters_ssrc_t *ssrc;  /* 2 * COUNTERS_SSRCS slots, or 0 */
+  unsigned ssrcs;         /* ... in use */
+} counters_t;
+
+#if HAVE_PTHREAD
+#define CTR_LOAD(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#define CTR_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#else
+#define CTR_LOAD(p)     (*(p))
+#define CTR_STORE(p, v) (*(p) = (v))
+#endif
+
+/* by the owner of block 'c' only; 'c' may be 0 */
+#define counters_add(c, k, n) do { \
+    if (c) CTR_STORE(&(c)->v[k], (c)->v[k] + (n)); \
+  } while (0)
+#define counters_set(c, k, n) do { \
+    if (c) CTR_STORE(&(c)->v[k], (n)); \
+  } while (0)
+#define counters_max(c, k, n) do { \
+    if ((c) && (uint64_t)(n) > (c)->v[k]) CTR_STORE(&(c)->v[k], (n)); \
+  } while (0)
+
+extern counters_t *counters_new(const char *name, int ssrcs);
+extern void counters_ssrc(counters_t *c, uint32_t ssrc, unsigned bytes);
+extern void counters_report(FILE *out, int format);
+extern int counters_serve(char *spec, double interval);
+
+#endif /* COUNTERS_H */
@@ -0,0 +1,272 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Send one packet, given as an iovec, to a table of destinations.  The
+* iovec is shared by all messages, so a header built once per packet
+* goes to every leg without copying.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#endif
+
+#include "fanout.h"
+#include "counters.h"
+#include "trace.h"
+
+#define BATCH 1024  /* messages per sendmmsg(), UIO_MAXIOV on Linux */
+
+typedef struct {
+  int sock;                 /* socket to send from */
+  struct sockaddr_in sin;   /* destination */
+  counters_t *counters;     /* CTR_TX_*, CTR_SEND_ERRORS, or 0 */
+} leg_t;
+
+struct fanout {
+  leg_t *leg;
+  int legs;                 /* legs in use */
+  int max;                  /* allocated legs */
+#if HAVE_SENDMMSG
+  struct mmsghdr *msg;      /* one per allocated leg, up to BATCH */
+  leg_t **to;               /* leg of each message */
+#endif
+};
+
+
+/*
+* Create an empty fan-out table.
+*/
+fanout_t *fanout_new(void)
+{
+  return calloc(1, sizeof(fanout_t));
+} /* fanout_new */
+
+
+/*
+* Free fan-out table; does not close the sockets.
+*/
+void fanout_free(fanout_t *f)
+{
+  if (!f) return;
+  free(f->leg);
+#if HAVE_SENDMMSG
+  free(f->msg);
+  free(f->to);
+#endif
+  free(f);
+} /* fanout_free */
+
+
+/*
+* Add leg sending from 'sock' to 'sin'.  Returns the leg number, or -1
+* if out of memory.
+*/
+int fanout_add(fanout_t *f, int sock, struct sockaddr_in *sin)
+{
+  if (f->legs == f->max) {
+    int max = f->max ? 2 * f->max : 16;
+    leg_t *leg = realloc(f->leg, max * sizeof(leg_t));
+
+    if (!leg) return -1;
+    f->leg = leg;
+#if HAVE_SENDMMSG
+    {
+      int n = max < BATCH ? max : BATCH;
+      struct mmsghdr *msg = realloc(f->msg, n * sizeof(struct mmsghdr));
+      leg_t **to;
+
+      if (!msg) return -1;
+      f->msg = msg;
+      if (!(to = realloc(f->to, n * sizeof(leg_t *)))) return -1;
+      f->to = to;
+    }
+#endif
+    f->max = max;
+  }
+  f->leg[f->legs].sock = sock;
+  f->leg[f->legs].sin  = *sin;
+  f->leg[f->legs].counters = 0;
+  return f->legs++;
+} /* fanout_add */
+
+
+/*
+* Count what is sent to 'leg' in 'c', which belongs to the thread
+* calling fanout_send().
+*/
+void fanout_counters(fanout_t *f, int leg, counters_t *c)
+{
+  if (leg >= 0 && leg < f->legs) f->leg[leg].counters = c;
+} /* fanout_counters */
+
+
+/*
+* Return number of legs.
+*/
+int fanout_legs(fanout_t *f)
+{
+  return f->legs;
+} /* fanout_legs */
+
+
+#if HAVE_SENDMMSG
+/*
+* Send 'n' prepared messages of 'len' bytes on 'sock' to legs 'to'.
+* A failed message is reported and skipped.
+*/
+static void flush(int sock, struct mmsghdr *msg, leg_t **to, int n,
+  size_t len)
+{
+  int sent, i;
+
+  while (n > 0) {
+    sent = sendmmsg(sock, msg, n, 0);
+    TRACE(TRACE_SEND, sent > 0 ? sent : 0);
+    if (sent < 0) {
+      perror("sendmmsg");
+      counters_add(to[0]->counters, CTR_SEND_ERRORS, 1);
+      sent = 1;  /* skip the message that failed */
+    }
+    else {
+      for (i = 0; i < sent; i++) {
+        counters_add(to[i]->counters, CTR_TX_PACKETS, 1);
+        counters_add(to[i]->counters, CTR_TX_BYTES, len);
+      }
+    }
+    msg += sent;
+    to  += sent;
+    n   -= sent;
+  }
+} /* flush */
+#endif
+
+
+/*
+* Send packet 'iov' to all legs except 'skip' (-1 for none).  Legs
+* addressed to INADDR_ANY only get it if 'any' is set.  Returns the
+* number of legs sent to.
+*/
+int fanout_send(fanout_t *f, struct iovec *iov, int iovcnt, int skip,
+  int any)
+{
+  int i, count = 0;
+#if HAVE_SENDMMSG
+  int n = 0, sock = -1;
+  size_t len = 0;
+
+  for (i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+  for (i = 0; i < f->legs; i++) {
+    leg_t *l = &f->leg[i];
+    struct msghdr *h;
+
+    if (i == skip || (!any && l->sin.sin_addr.s_addr == INADDR_ANY))
+      continue;
+    if (n > 0 && (l->sock != sock || n == BATCH)) {
+      flush(sock, f->msg, f->to, n, len);
+      n = 0;
+    }
+    sock = l->sock;
+    f->to[n] = l;
+    h = &f->msg[n++].msg_hdr;
+    memset(h, 0, sizeof(*h));
+    h->msg_name    = &l->sin;
+    h->msg_namelen = sizeof(l->sin);
+    h->msg_iov     = iov;
+    h->msg_iovlen  = iovcnt;
+    count++;
+  }
+  if (n > 0) flush(sock, f->msg, f->to, n, len);
+#elif defined(WIN32)
+  /* Windows does not support sendmsg(), use copying instead */
+  char buf[65536];
+  int len = 0, sent;
+
+  for (i = 0; i < iovcnt; i++) {
+    if (len + iov[i].iov_len > sizeof(buf)) return -1;
+    memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  for (i = 0; i < f->legs; i++) {
+    leg_t *l = &f->leg[i];
+
+    if (i == skip || (!any && l->sin.sin_addr.s_addr == INADDR_ANY))
+      continue;
+    sent = sendto(l->sock, buf, len, 0, (struct sockaddr *)&l->sin,
+      sizeof(l->sin));
+    TRACE(TRACE_SEND, sent >= 0);
+    if (sent < 0) {
+      perror("sendto");
+      counters_add(l->counters, CTR_SEND_ERRORS, 1);
+    }
+    else {
+      counters_add(l->counters, CTR_TX_PACKETS, 1);
+      counters_add(l->counters, CTR_TX_BYTES, len);
+    }
+    count++;
+  }
+#else
+  struct msghdr msg;
+  ssize_t sent;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = iovcnt;
+  for (i = 0; i < f->legs; i++) {
+    leg_t *l = &f->leg[i];
+
+    if (i == skip || (!any && l->sin.sin_addr.s_addr == INADDR_ANY))
+      continue;
+    msg.msg_name    = (char *)&l->sin;
+    msg.msg_namelen = sizeof(l->sin);
+    sent = sendmsg(l->sock, &msg, 0);
+    TRACE(TRACE_SEND, sent >= 0);
+    if (sent < 0) {
+      perror("sendmsg");
+      counters_add(l->counters, CTR_SEND_ERRORS, 1);
+    }
+    else {
+      counters_add(l->counters, CTR_TX_PACKETS, 1);
+      counters_add(l->counters, CTR_TX_BYTES, sent);
+    }
+    count++;
+  }
+#endif
+  return count;
+} /* fanout_send */
@@ -0,0 +1,187 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Record filter for rtpdump -s.  A filter is a comma-separated list
+* of predicates, all of which a record has to satisfy:
+*
+*   rtp, rtcp           only data or only control packets
+*   ssrc=N              RTP SSRC, or sender SSRC of an RTCP packet;
+*                       may be given several times for any of them
+*   pt=N[-M]            RTP payload types; may be given several times
+*   seq=N-M             RTP sequence numbers, wrapping if N > M
+*   time=S-T            seconds since the start of the recording,
+*                       either end may be left out
+*
+* The predicates are evaluated on the record header and the first
+* bytes of the packet, without parsing it.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <sys/time.h>
+#include <netinet/in.h>
+#endif
+
+#include "sysdep.h"
+#include "rtpdump.h"
+#include "filter.h"
+
+/* big-endian fields of the packet */
+#define BYTE(p, i) ((unsigned char)(p)[i])
+#define GET16(p)   ((uint16_t)(BYTE(p, 0) << 8 | BYTE(p, 1)))
+#define GET32(p)   ((uint32_t)GET16(p) << 16 | GET16((p) + 2))
+
+
+/*
+* Parse range "N-M", "N-", "-M" or "N" of 'value' into '*from' and
+* '*to', which keep their values for a missing end.  Returns -1 if
+* not a range.
+*/
+static int range(const char *value, double *from, double *to)
+{
+  const char *dash = strchr(value, '-');
+  char *end;
+
+  if (!dash) {
+    *from = *to = strtod(value, &end);
+    return *end || end == value ? -1 : 0;
+  }
+  if (dash > value) {
+    *from = strtod(value, &end);
+    if (end != dash) return -1;
+  }
+  if (dash[1]) {
+    *to = strtod(dash + 1, &end);
+    if (*end) return -1;
+  }
+  return 0;
+} /* range */
+
+
+/*
+* Parse filter 'spec' into 'f'.  Returns 0 if ok, -1 if it is not
+* valid.  Modifies 'spec'.
+*/
+int filter_parse(filter_t *f, char *spec)
+{
+  char *word;
+  double from, to;
+  int i;
+
+  memset(f, 0, sizeof(*f));
+  f->to_ns = (uint64_t)-1;
+  for (word = strtok(spec, ","); word; word = strtok(0, ",")) {
+    char *value = strchr(word, '=');
+
+    if (value) *value++ = '\0';
+    if (strcmp(word, "rtp") == 0 && !value) f->kinds |= FILTER_RTP;
+    else if (strcmp(word, "rtcp") == 0 && !value) f->kinds |= FILTER_RTCP;
+    else if (!value) return -1;
+    else if (strcmp(word, "ssrc") == 0) {
+      if (f->nssrc == FILTER_SSRCS) return -1;
+      f->ssrc[f->nssrc++] = strtoul(value, 0, 0);
+    }
+    else if (strcmp(word, "pt") == 0) {
+      from = 0; to = 127;
+      if (range(value, &from, &to) < 0 || from < 0 || to > 127 || from > to)
+        return -1;
+      for (i = from; i <= to; i++) f->pt[i / 32] |= (uint32_t)1 << i % 32;
+      f->has_pt = 1;
+    }
+    else if (strcmp(word, "seq") == 0) {
+      from = 0; to = 65535;
+      if (range(value, &from, &to) < 0 || from < 0 || to > 65535) return -1;
+      f->seq_from = from;
+      f->seq_to = to;
+      f->has_seq = 1;
+    }
+    else if (strcmp(word, "time") == 0) {
+      from = 0; to = -1;
+      if (range(value, &from, &to) < 0 || from < 0) return -1;
+      f->from_ns = from * 1e9;
+      if (to >= 0) f->to_ns = to * 1e9;
+      if (f->to_ns < f->from_ns) return -1;
+    }
+    else return -1;
+  }
+  if (!f->kinds) f->kinds = FILTER_RTP | FILTER_RTCP;
+  return 0;
+} /* filter_parse */
+
+
+/*
+* Return 1 if record 'rec' passes filter 'f', 0 if not, and -1 if it
+* is past the end of the time range, as are all that follow.
+*/
+int filter_match(const filter_t *f, const RD_record_t *rec)
+{
+  const char *p = rec->data;
+  uint16_t seq;
+  int pt, i;
+
+  if (rec->offset_ns > f->to_ns) return -1;
+  if (rec->offset_ns < f->from_ns) return 0;
+
+  /* RTCP: only the sender SSRC of the first packet is looked at */
+  if (rec->plen == 0) {
+    if (!(f->kinds & FILTER_RTCP) || f->has_pt || f->has_seq) return 0;
+    if (!f->nssrc) return 1;
+    if (rec->length < 8) return 0;
+    for (i = 0; i < f->nssrc; i++) {
+      if (GET32(p + 4) == f->ssrc[i]) return 1;
+    }
+    return 0;
+  }
+
+  if (!(f->kinds & FILTER_RTP)) return 0;
+  if (!f->has_pt && !f->has_seq && !f->nssrc) return 1;
+  /* the fixed header of RTP version 2 */
+  if (rec->length < 12 || ((unsigned char)p[0] >> 6) != 2) return 0;
+  pt = p[1] & 0x7f;
+  if (f->has_pt && !(f->pt[pt / 32] & (uint32_t)1 << pt % 32)) return 0;
+  if (f->has_seq) {
+    seq = GET16(p + 2);
+    if (f->seq_from <= f->seq_to ?
+        seq < f->seq_from || seq > f->seq_to :
+        seq < f->seq_from && seq > f->seq_to)
+      return 0;
+  }
+  if (!f->nssrc) return 1;
+  for (i = 0; i < f->nssrc; i++) {
+    if (GET32(p + 8) == f->ssrc[i]) return 1;
+  }
+  return 0;
+} /* filter_match */
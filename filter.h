@@ -0,0 +1,62 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Record filter for rtpdump -s: predicates on the source, payload
+* type, sequence number and time of recorded packets, evaluated on
+* the record header and the first bytes of the packet.
+*/
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+/* RD_record_t from rtpdump.h */
+
+#define FILTER_SSRCS 16  /* sources that can be asked for */
+
+#define FILTER_RTP  0x01
+#define FILTER_RTCP 0x02
+
+typedef struct {
+  int kinds;                   /* FILTER_RTP | FILTER_RTCP */
+  uint64_t from_ns, to_ns;     /* time range, inclusive */
+  int nssrc;                   /* any of 'ssrc', if non-zero */
+  uint32_t ssrc[FILTER_SSRCS];
+  int has_pt;
+  uint32_t pt[4];              /* set of payload types, one bit each */
+  int has_seq;
+  uint16_t seq_from, seq_to;   /* inclusive, may wrap */
+} filter_t;
+
+extern int filter_parse(filter_t *f, char *spec);
+extern int filter_match(const filter_t *f, const RD_record_t *rec);
+
+#endif /* FILTER_H */
@@ -0,0 +1,248 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Buffered text output; see fmt.h.  Decimal numbers are converted two
+* digits at a time from a table, and hex dumps sixteen bytes at a time
+* with SSE2 or else a byte at a time from a table.
+*/
+
+#include "sysdep.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fmt.h"
+
+static const char digits[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233"
+  "34353637383940414243444546474849505152535455565758596061626364656667"
+  "6869707172737475767778798081828384858687888990919293949596979899";
+
+static const char xdigits[] = "0123456789abcdef";
+
+/* "00" to "ff" */
+static char xpairs[512];
+
+
+/*
+* Set up 'f' to hand full buffers to 'write' with 'ctx'.
+*/
+void fmt_init(fmt_t *f, fmt_write_t write, void *ctx)
+{
+  int i;
+
+  f->p = f->buf;
+  f->write = write;
+  f->ctx = ctx;
+  if (!xpairs[0]) {
+    for (i = 0; i < 256; i++) {
+      xpairs[2 * i]     = xdigits[i >> 4];
+      xpairs[2 * i + 1] = xdigits[i & 15];
+    }
+  }
+} /* fmt_init */
+
+
+/*
+* Hand everything buffered in 'f' to its write function.
+*/
+void fmt_flush(fmt_t *f)
+{
+  if (f->p > f->buf) f->write(f->ctx, f->buf, f->p - f->buf);
+  f->p = f->buf;
+} /* fmt_flush */
+
+
+/* make room for 'n' bytes, at most FMT_SIZE */
+#define room(f, n) \
+  do { if ((size_t)((f)->buf + FMT_SIZE - (f)->p) < (n)) fmt_flush(f); } \
+  while (0)
+
+
+void fmt_mem(fmt_t *f, const void *s, size_t len)
+{
+  if (len > FMT_SIZE / 2) {
+    fmt_flush(f);
+    f->write(f->ctx, s, len);
+    return;
+  }
+  room(f, len);
+  memcpy(f->p, s, len);
+  f->p += len;
+} /* fmt_mem */
+
+
+void fmt_str(fmt_t *f, const char *s)
+{
+  fmt_mem(f, s, strlen(s));
+} /* fmt_str */
+
+
+void fmt_char(fmt_t *f, int c)
+{
+  room(f, 1);
+  *f->p++ = c;
+} /* fmt_char */
+
+
+/*
+* Write the decimal digits of 'v' backwards from 'end', returning the
+* first.
+*/
+static char *decimal(char *end, unsigned long v)
+{
+  while (v >= 100) {
+    end -= 2;
+    memcpy(end, digits + 2 * (v % 100), 2);
+    v /= 100;
+  }
+  if (v >= 10) {
+    end -= 2;
+    memcpy(end, digits + 2 * v, 2);
+  }
+  else *--end = '0' + v;
+  return end;
+} /* decimal */
+
+
+void fmt_ulong(fmt_t *f, unsigned long v)
+{
+  char tmp[24], *s = decimal(tmp + sizeof(tmp), v);
+  size_t n = tmp + sizeof(tmp) - s;
+
+  room(f, n);
+  memcpy(f->p, s, n);
+  f->p += n;
+} /* fmt_ulong */
+
+
+void fmt_long(fmt_t *f, long v)
+{
+  if (v < 0) {
+    fmt_char(f, '-');
+    fmt_ulong(f, -(unsigned long)v);
+  }
+  else fmt_ulong(f, v);
+} /* fmt_long */
+
+
+/*
+* Decimal 'v' with leading zeros to at least 'width' digits.
+*/
+void fmt_zpad(fmt_t *f, unsigned long v, int width)
+{
+  char tmp[24], *s = decimal(tmp + sizeof(tmp), v);
+  size_t n = tmp + sizeof(tmp) - s;
+
+  if (width > FMT_ROOM) width = FMT_ROOM;
+  room(f, (size_t)width + n);
+  for (; (int)n < width; width--) *f->p++ = '0';
+  memcpy(f->p, s, n);
+  f->p += n;
+} /* fmt_zpad */
+
+
+void fmt_xlong(fmt_t *f, unsigned long v)
+{
+  char tmp[24], *s = tmp + sizeof(tmp);
+  size_t n;
+
+  do {
+    *--s = xdigits[v & 15];
+    v >>= 4;
+  } while (v);
+  n = tmp + sizeof(tmp) - s;
+  room(f, n);
+  memcpy(f->p, s, n);
+  f->p += n;
+} /* fmt_xlong */
+
+
+/*
+* Two lower-case hex digits for each of 'len' bytes at 'buf'.
+*/
+void fmt_hex(fmt_t *f, const void *buf, size_t len)
+{
+  const unsigned char *b = buf;
+  size_t n;
+  char *p;
+
+  while (len > 0) {
+    n = len < FMT_SIZE / 4 ? len : FMT_SIZE / 4;
+    room(f, 2 * n);
+    p = f->p;
+    len -= n;
+#if defined(__SSE2__)
+    {
+      const __m128i mask = _mm_set1_epi8(0x0f);
+      const __m128i nine = _mm_set1_epi8(9);
+      const __m128i zero = _mm_set1_epi8('0');
+      const __m128i af   = _mm_set1_epi8('a' - '0' - 10);
+
+      for (; n >= 16; n -= 16, b += 16, p += 32) {
+        __m128i x  = _mm_loadu_si128((const __m128i *)b);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+        __m128i lo = _mm_and_si128(x, mask);
+
+        /* digit, plus the distance to 'a' for digits above 9 */
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+               _mm_and_si128(_mm_cmpgt_epi8(hi, nine), af));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+               _mm_and_si128(_mm_cmpgt_epi8(lo, nine), af));
+        _mm_storeu_si128((__m128i *)p, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(p + 16), _mm_unpackhi_epi8(hi, lo));
+      }
+    }
+#endif
+    for (; n > 0; n--, p += 2) memcpy(p, xpairs + 2 * *b++, 2);
+    f->p = p;
+  }
+} /* fmt_hex */
+
+
+/*
+* Anything else, through vsnprintf(); at most FMT_ROOM bytes.
+*/
+void fmt_printf(fmt_t *f, const char *format, ...)
+{
+  va_list ap;
+  int n;
+
+  room(f, FMT_ROOM);
+  va_start(ap, format);
+  n = vsnprintf(f->p, FMT_ROOM, format, ap);
+  va_end(ap);
+  if (n > 0) f->p += n < FMT_ROOM ? n : FMT_ROOM - 1;
+} /* fmt_printf */
@@ -0,0 +1,70 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Buffered text output for rtpdump.  Numbers, strings and hex dumps
+* are formatted straight into a fixed buffer, which is handed to a
+* write function when it fills up or on fmt_flush().  Nothing is
+* allocated, and the output is the same as that of the printf()
+* conversions noted below.
+*/
+#ifndef FMT_H
+#define FMT_H
+
+#include <stddef.h>
+
+#define FMT_SIZE  (64 * 1024)  /* buffer size */
+#define FMT_ROOM  64           /* bytes reserved for one number */
+
+typedef void (*fmt_write_t)(void *ctx, const char *buf, size_t len);
+
+typedef struct {
+  char *p;              /* next free byte of 'buf' */
+  fmt_write_t write;
+  void *ctx;
+  char buf[FMT_SIZE];
+} fmt_t;
+
+/* bytes waiting in 'f' */
+#define fmt_pending(f) ((size_t)((f)->p - (f)->buf))
+
+extern void fmt_init(fmt_t *f, fmt_write_t write, void *ctx);
+extern void fmt_flush(fmt_t *f);
+extern void fmt_mem(fmt_t *f, const void *s, size_t len);  /* %*.*s */
+extern void fmt_str(fmt_t *f, const char *s);              /* %s */
+extern void fmt_char(fmt_t *f, int c);                     /* %c */
+extern void fmt_ulong(fmt_t *f, unsigned long v);          /* %lu */
+extern void fmt_long(fmt_t *f, long v);                    /* %ld */
+extern void fmt_zpad(fmt_t *f, unsigned long v, int width);/* %0*lu */
+extern void fmt_xlong(fmt_t *f, unsigned long v);          /* %lx */
+extern void fmt_hex(fmt_t *f, const void *buf, size_t len);/* %02x each */
+extern void fmt_printf(fmt_t *f, const char *format, ...);
+
+#endif /* FMT_H */
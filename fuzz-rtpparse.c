@@ -0,0 +1,214 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Fuzz target for the packet parser.  Every parser in rtpparse.c is
+* run on the input, and any result that points outside of it aborts.
+*
+* With libFuzzer:
+*   clang -g -fsanitize=fuzzer,address -DLIBFUZZER -o fuzz-rtpparse \
+*     fuzz-rtpparse.c rtpparse.c
+*   ./fuzz-rtpparse corpus/
+*
+* Otherwise "make fuzz" builds a driver that runs each file given as an
+* argument through the target or, without arguments, mutates the
+* packets of bark.rtp with random bit flips, truncations and length
+* fields for a fixed number of rounds.  Building it with
+* -fsanitize=address also catches reads outside the input.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "sysdep.h"
+#include "rtp.h"
+#include "rtpparse.h"
+
+#define ROUNDS 2000000  /* mutations without arguments */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* abort unless 'p' .. 'p' + 'len' lies within 'data' .. 'data' + 'size' */
+static void within(const uint8_t *data, size_t size, const unsigned char *p,
+  long len)
+{
+  if (len < 0 || p < data || p + len > data + size) abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  rtp_info_t r;
+  rtcp_iter_t it, sdes;
+  rtcp_info_t c;
+  rtcp_rr_info_t rr;
+  vat_ctrl_t v;
+  const unsigned char *p;
+  uint32_t src;
+  int i, n, type, len, hlen;
+
+  if (size > 65535) return 0;
+
+  if (rtp_parse(data, size, &r) == 0) {
+    if (r.hlen > (int)size) abort();
+    within(data, size, r.payload, r.plen);
+    if (r.version == 2) {
+      within(data, size, r.csrc, r.cc * 4);
+      for (i = 0; i < r.cc; i++) src = rtp_csrc(&r, i);
+      if (r.x) within(data, size, r.ext, r.ext_len * 4);
+    }
+  }
+  hlen = rtp_hlen(data, size);
+  if (hlen < 0 || hlen > (int)size) abort();
+  vat_ctrl_parse(data, size, &v);
+
+  rtcp_begin(&it, data, size);
+  while ((n = rtcp_next(&it, &c)) > 0) {
+    within(data, size, c.body, c.length * 4);
+    if (c.nrr) within(data, size, c.rr, c.nrr * 24);
+    for (i = 0; i < c.nrr; i++) rtcp_report(&c, i, &rr);
+    for (i = 0; i < c.count && i < c.length; i++) src = rtcp_source(&c, i);
+    if (c.pt == RTCP_SDES) {
+      rtcp_sdes_begin(&sdes, &c);
+      for (i = 0; i < c.count; i++) {
+        if (rtcp_sdes_chunk(&sdes, &src) < 0) break;
+        while ((n = rtcp_sdes_item(&sdes, &type, &p, &len)) > 0)
+          within(data, size, p, len);
+        if (n < 0) break;
+      }
+    }
+    if (c.pt == RTCP_BYE && rtcp_bye_reason(&c, &p, &len) > 0)
+      within(data, size, p, len);
+  }
+  (void)src;
+  return 0;
+}
+
+#ifndef LIBFUZZER
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/* run the target on a copy of exactly 'len' bytes, so that ASan sees overreads */
+static void run(const unsigned char *buf, size_t len)
+{
+  uint8_t *copy = malloc(len ? len : 1);
+
+  memcpy(copy, buf, len);
+  LLVMFuzzerTestOneInput(copy, len);
+  free(copy);
+}
+
+static size_t slurp(const char *name, unsigned char *buf, size_t max)
+{
+  FILE *f = fopen(name, "rb");
+  size_t n;
+
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  n = fread(buf, 1, max, f);
+  fclose(f);
+  return n;
+}
+
+/* packets of bark.rtp, found by walking the version 1 records */
+static int seeds(unsigned char *file, size_t n, unsigned char **pkt,
+  int *plen, int max)
+{
+  unsigned char *p = memchr(file, '\n', n);
+  int count = 0, len;
+
+  if (!p) return 0;
+  p += 1 + 16;  /* RD_hdr_t */
+  while (p + 8 <= file + n && count < max) {
+    len = (p[0] << 8 | p[1]) - 8;
+    if (len < 0 || p + 8 + len > file + n) break;
+    pkt[count] = p + 8;
+    plen[count++] = len;
+    p += 8 + len;
+  }
+  return count;
+}
+
+int main(int argc, char *argv[])
+{
+  static unsigned char file[1 << 20], buf[2048];
+  static unsigned char *pkt[4096];
+  static int plen[4096];
+  size_t n;
+  long i;
+  int j, count, len;
+
+  if (argc > 1) {
+    for (j = 1; j < argc; j++) {
+      n = slurp(argv[j], file, sizeof(file));
+      run(file, n);
+    }
+    return 0;
+  }
+
+  count = seeds(file, slurp("bark.rtp", file, sizeof(file)), pkt, plen, 4096);
+  if (count == 0) {
+    fprintf(stderr, "bark.rtp: no packets\n");
+    return 1;
+  }
+  for (i = 0; i < ROUNDS; i++) {
+    j = lcg() % count;
+    len = plen[j] < (int)sizeof(buf) ? plen[j] : (int)sizeof(buf);
+    memcpy(buf, pkt[j], len);
+    switch (lcg() % 4) {
+    case 0:  /* flip bits */
+      for (j = lcg() % 8; len && j >= 0; j--)
+        buf[lcg() % len] ^= 1 << (lcg() % 8);
+      break;
+    case 1:  /* truncate */
+      len = lcg() % (len + 1);
+      break;
+    case 2:  /* random first word: version, counts, lengths */
+      for (j = 0; j < 4 && j < len; j++) buf[j] = lcg();
+      break;
+    case 3:  /* random bytes */
+      len = lcg() % sizeof(buf);
+      for (j = 0; j < len; j++) buf[j] = lcg();
+      break;
+    }
+    run(buf, len);
+  }
+  printf("fuzz-rtpparse\t%d\t%ld\trounds\n", count, i);
+  return 0;
+}
+#endif /* LIBFUZZER */
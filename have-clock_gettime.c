@@ -0,0 +1,11 @@
+#include <time.h>
+
+int
+main(void)
+{
+	struct timespec ts;
+
+	if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,13 @@
+#include <time.h>
+
+int
+main(void)
+{
+	struct timespec ts;
+
+	if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 1;
+	if (0 != clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+		return 2;
+	return 0;
+}
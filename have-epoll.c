@@ -0,0 +1,19 @@
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+int
+main(void)
+{
+	struct epoll_event ev;
+	int ep, tfd;
+
+	if (-1 == (ep = epoll_create1(EPOLL_CLOEXEC)))
+		return 1;
+	if (-1 == (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)))
+		return 2;
+	ev.events = EPOLLIN;
+	ev.data.fd = tfd;
+	if (-1 == epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev))
+		return 3;
+	return 0;
+}
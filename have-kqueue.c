@@ -0,0 +1,18 @@
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+int
+main(void)
+{
+	struct kevent ev;
+	struct timespec ts = { 0, 0 };
+	int kq;
+
+	if (-1 == (kq = kqueue()))
+		return 1;
+	EV_SET(&ev, kq, EVFILT_READ, EV_ADD, 0, 0, 0);
+	if (-1 == kevent(kq, &ev, 1, NULL, 0, &ts))
+		return 2;
+	return 0;
+}
@@ -0,0 +1,16 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stddef.h>
+
+int
+main(void)
+{
+	void *p;
+
+	p = mmap(NULL, 4096, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED)
+		return 1;
+	if (madvise(p, 4096, MADV_SEQUENTIAL) == -1)
+		return 2;
+	return munmap(p, 4096) == -1;
+}
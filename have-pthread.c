@@ -0,0 +1,22 @@
+#include <pthread.h>
+#include <stddef.h>
+
+static void *
+start(void *arg)
+{
+	return arg;
+}
+
+int
+main(void)
+{
+	static int arg;
+	pthread_t t;
+	void *ret = NULL;
+
+	if (pthread_create(&t, NULL, start, &arg) != 0)
+		return 1;
+	if (pthread_join(t, &ret) != 0)
+		return 1;
+	return ret != &arg;
+}
@@ -0,0 +1,20 @@
+#if defined(__linux__) || defined(__MINT__)
+#define _GNU_SOURCE	/* recvmmsg */
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+
+int
+main(void)
+{
+	struct mmsghdr msg[2];
+	int sock;
+
+	if (-1 == (sock = socket(AF_INET, SOCK_DGRAM, 0)))
+		return 1;
+	if (-1 == recvmmsg(sock, msg, 0, MSG_DONTWAIT, NULL))
+		return 0; /* linked, that's enough */
+	return 0;
+}
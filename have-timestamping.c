@@ -0,0 +1,20 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+int
+main(void)
+{
+	int flags = SOF_TIMESTAMPING_RX_HARDWARE |
+	    SOF_TIMESTAMPING_RAW_HARDWARE |
+	    SOF_TIMESTAMPING_RX_SOFTWARE |
+	    SOF_TIMESTAMPING_SOFTWARE;
+	int sock;
+
+	if (-1 == (sock = socket(AF_INET, SOCK_DGRAM, 0)))
+		return 1;
+	if (-1 == setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING,
+	    &flags, sizeof(flags)))
+		return 2;
+	return SCM_TIMESTAMPING == 0;
+}
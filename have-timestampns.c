@@ -0,0 +1,16 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int
+main(void)
+{
+	int one = 1;
+	int sock;
+
+	if (-1 == (sock = socket(AF_INET, SOCK_DGRAM, 0)))
+		return 1;
+	if (-1 == setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+	    &one, sizeof(one)))
+		return 2;
+	return SCM_TIMESTAMPNS == 0;
+}
@@ -0,0 +1,21 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <stddef.h>
+
+int
+main(void)
+{
+	struct tpacket_req3 req;
+	struct tpacket_block_desc bd;
+	struct tpacket3_hdr h;
+	struct sock_fprog prog;
+	int v = TPACKET_V3;
+
+	(void)req;
+	(void)bd;
+	(void)h;
+	(void)prog;
+	return v == 0 || PACKET_RX_RING == 0 || SO_ATTACH_FILTER == 0;
+}
@@ -0,0 +1,18 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+int
+main(void)
+{
+	int size = 1000;
+	int sock;
+
+	if (-1 == (sock = socket(AF_INET, SOCK_DGRAM, 0)))
+		return 1;
+	if (-1 == setsockopt(sock, SOL_UDP, UDP_SEGMENT,
+	    &size, sizeof(size)))
+		return 2;
+	return 0;
+}
@@ -0,0 +1,16 @@
+#include <string.h>
+#include <zlib.h>
+
+int
+main(void)
+{
+	char in[64], out[128], back[64];
+	uLongf olen = sizeof(out), blen = sizeof(back);
+
+	memset(in, 'a', sizeof(in));
+	if (compress2((Bytef *)out, &olen, (Bytef *)in, sizeof(in), 1) != Z_OK)
+		return 1;
+	if (uncompress((Bytef *)back, &blen, (Bytef *)out, olen) != Z_OK)
+		return 1;
+	return blen != sizeof(in) || memcmp(in, back, blen) != 0;
+}
@@ -0,0 +1,20 @@
+#include <string.h>
+#include <zstd.h>
+
+int
+main(void)
+{
+	char in[64], out[128], back[64];
+	ZSTD_CCtx *c;
+	size_t olen;
+
+	memset(in, 'a', sizeof(in));
+	if ((c = ZSTD_createCCtx()) == NULL)
+		return 1;
+	olen = ZSTD_compressCCtx(c, out, sizeof(out), in, sizeof(in), 3);
+	ZSTD_freeCCtx(c);
+	if (ZSTD_isError(olen))
+		return 1;
+	return ZSTD_decompress(back, sizeof(back), out, olen) != sizeof(in) ||
+	    memcmp(in, back, sizeof(in)) != 0;
+}
@@ -38,12 +38,19 @@
 /*      timeout mechanism of the select() call, or onto the single          */
 /*      interval timer provided by setitimer().                             */
 /*                                                                          */
+/*      The queue is a binary heap ordered by expiration time, and a        */
+/*      hash table maps each client to its pending timer, so setting,       */
+/*      cancelling and expiring a timer is O(log n) in the number of        */
+/*      pending timers.                                                     */
+/*                                                                          */
 /****************************************************************************/
 
 #include <sys/types.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #ifndef WIN32
 #include <sys/time.h>
@@ -52,21 +59,49 @@
 #include "sysdep.h"
 #include "notify.h"
 #include "multimer.h"
+#include "counters.h"
+#include "trace.h"
 
 typedef struct TQE {
-    struct TQE *link;           /* link to next timer */
+    struct TQE *link;           /* next in hash chain, or in free queue */
     struct timeval time;        /* expiration time */
     struct timeval interval;    /* next interval */
     Notify_func func;           /* function to be invoked */
     Notify_client client;
     int  which;                 /* type; currently always ITIMER_REAL */
+    int  slot;                  /* position in the heap */
+    uint64_t order;             /* insertion order, breaks ties in time */
 } TQE;
 
-/* active timer queue, in time order */
-static TQE *timerQ = (TQE *)0;
+/* histogram of expiry lateness, in buckets of 2^i microseconds */
+#define TIMER_HIST 24
+
+/* timers of one event loop */
+struct timer_queue {
+  /* active timers, as a binary heap on (time, order) */
+  TQE **timerQ;
+  int timerQ_len;               /* number of pending timers */
+  int timerQ_max;               /* allocated heap slots */
+
+  /* client -> pending timer, chained through 'link'; size is a power of 2 */
+  TQE **clientQ;
+  unsigned int clientQ_bits;
+
+  /* queue of free Timer Queue Elements */
+  TQE *freeTQEQ;
 
-/* queue of free Timer Queue Elements */
-static TQE *freeTQEQ = (TQE *)0;
+  /* incremented for every timer set, so equal times expire in FIFO order */
+  uint64_t timer_order;
+
+  struct {
+    int on;
+    unsigned long n;            /* timers expired */
+    double sum;                 /* total lateness (usec) */
+    long max;                   /* maximum lateness (usec) */
+    unsigned long bucket[TIMER_HIST];
+  } stats;
+  counters_t *counters;         /* CTR_TIMER*, or 0 */
+};
 
 #ifndef timeradd
 void timeradd(struct timeval *a, struct timeval *b,
@@ -83,6 +118,23 @@ void timeradd(struct timeval *a, struct timeval *b,
 } /* timeradd */
 #endif
 
+/*
+* Current time of the timer clock.  This is CLOCK_MONOTONIC where
+* available, so absolute timers must be computed from this time.
+*/
+void timer_now(struct timeval *now)
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now->tv_sec  = ts.tv_sec;
+  now->tv_usec = ts.tv_nsec / 1000;
+#else
+  (void) gettimeofday(now, NULL);
+#endif
+} /* timer_now */
+
 /*
 * Return 1 if a < b, 0 otherwise.
 */
@@ -93,15 +145,159 @@ static int timerless(struct timeval *a, struct timeval *b)
   return 0;
 } /* timerless */
 
-static void timer_check(void)
+/*
+* Return 1 if timer a expires before timer b, 0 otherwise.
+*/
+static int tqeless(TQE *a, TQE *b)
+{
+  if (timerless(&a->time, &b->time)) return 1;
+  if (timerless(&b->time, &a->time)) return 0;
+  return a->order < b->order;
+} /* tqeless */
+
+#ifdef DEBUG
+static void timer_check(timer_queue_t *q)
 {
-  register struct TQE *np;
+  int i, n = 0;
+  unsigned int h;
+  TQE *np;
 
-  for (np = timerQ; np; np = np->link) {
+  for (i = 0; i < q->timerQ_len; i++) {
+    np = q->timerQ[i];
+    assert(np->slot == i);
     assert(np->time.tv_usec < 1000000);
     assert(np->interval.tv_usec < 1000000);
+    assert(i == 0 || !tqeless(np, q->timerQ[(i - 1) / 2]));
   }
+  for (h = 0; q->clientQ && h < (1U << q->clientQ_bits); h++) {
+    for (np = q->clientQ[h]; np; np = np->link) {
+      assert(q->timerQ[np->slot] == np);
+      n++;
+    }
+  }
+  assert(n == q->timerQ_len);
 } /* timer_check */
+#else
+#define timer_check(q)
+#endif
+
+
+/*
+* Hash bucket of 'client' (Fibonacci hashing).
+*/
+static unsigned int client_hash(timer_queue_t *q, Notify_client client)
+{
+  return (unsigned int)(((uint64_t)client * 0x9e3779b97f4a7c15ULL)
+    >> (64 - q->clientQ_bits));
+} /* client_hash */
+
+/*
+* Double the client table. Return 0 if ok, -1 if out of memory.
+*/
+static int client_grow(timer_queue_t *q)
+{
+  unsigned int bits = q->clientQ_bits ? q->clientQ_bits + 1 : 4;
+  unsigned int h, old = q->clientQ ? 1U << q->clientQ_bits : 0;
+  TQE **oq = q->clientQ, *np, *next;
+
+  if (!(q->clientQ = calloc(1U << bits, sizeof(TQE *)))) {
+    q->clientQ = oq;
+    return -1;
+  }
+  q->clientQ_bits = bits;
+  for (h = 0; h < old; h++) {
+    for (np = oq[h]; np; np = next) {
+      next = np->link;
+      np->link = q->clientQ[client_hash(q, np->client)];
+      q->clientQ[client_hash(q, np->client)] = np;
+    }
+  }
+  free(oq);
+  return 0;
+} /* client_grow */
+
+/*
+* Return the pending timer of 'client' and optionally unlink it
+* from the client table.
+*/
+static TQE *client_find(timer_queue_t *q, Notify_client client, int unlink)
+{
+  TQE **op, *np;
+
+  if (!q->clientQ) return 0;
+  for (op = &q->clientQ[client_hash(q, client)]; (np = *op); op = &np->link) {
+    if (np->client == client) {
+      if (unlink) *op = np->link;
+      return np;
+    }
+  }
+  return 0;
+} /* client_find */
+
+
+/*
+* Move the timer in heap position 'i' towards the root or the leaves
+* until the heap is ordered again.
+*/
+static void heap_fix(timer_queue_t *q, int i)
+{
+  TQE *tp = q->timerQ[i];
+  int c;
+
+  while (i > 0 && tqeless(tp, q->timerQ[(i - 1) / 2])) {
+    q->timerQ[i] = q->timerQ[(i - 1) / 2];
+    q->timerQ[i]->slot = i;
+    i = (i - 1) / 2;
+  }
+  while ((c = 2 * i + 1) < q->timerQ_len) {
+    if (c + 1 < q->timerQ_len && tqeless(q->timerQ[c + 1], q->timerQ[c])) c++;
+    if (!tqeless(q->timerQ[c], tp)) break;
+    q->timerQ[i] = q->timerQ[c];
+    q->timerQ[i]->slot = i;
+    i = c;
+  }
+  q->timerQ[i] = tp;
+  tp->slot = i;
+} /* heap_fix */
+
+/*
+* Remove the timer at heap position 'i'.
+*/
+static void heap_remove(timer_queue_t *q, int i)
+{
+  if (--q->timerQ_len > i) {
+    q->timerQ[i] = q->timerQ[q->timerQ_len];
+    heap_fix(q, i);
+  }
+} /* heap_remove */
+
+
+/*
+* Create an empty timer queue.  Return 0 if out of memory.
+*/
+timer_queue_t *timer_queue_new(void)
+{
+  return calloc(1, sizeof(timer_queue_t));
+} /* timer_queue_new */
+
+/*
+* Free timer queue 'q' with all its pending timers.
+*/
+void timer_queue_free(timer_queue_t *q)
+{
+  TQE *np;
+  int i;
+
+  if (!q) return;
+  for (i = 0; i < q->timerQ_len; i++) free(q->timerQ[i]);
+  while ((np = q->freeTQEQ)) {
+    q->freeTQEQ = np->link;
+    free(np);
+  }
+  free(q->timerQ);
+  free(q->clientQ);
+  free(q);
+} /* timer_queue_free */
 
 
 /*
@@ -117,65 +313,92 @@ static void timer_check(void)
 * client:    in: first argument for the handler function
 * relative:  in: flag; set relative to current time
 */
-struct timeval *timer_set(struct timeval *interval,
+static struct timeval *queue_set(timer_queue_t *q, struct timeval *interval,
   Notify_func func, Notify_client client, int relative)
 {
-  register struct TQE *np, *op, *tp;    /* To scan the timer queue */
+  register struct TQE *tp;
 
-  /* scan the timer queue to see if client has pending timer */
-  op = (struct TQE *)&timerQ;           /* Fudge OK since link is first */
-  for (np = timerQ; np; op = np, np = np->link)
-    if (np->client == client) {
-      op->link = np->link;              /* Yes, remove the timer from Q */
-      break;                            /*  and stop the search */
-    }
+  /* see if client has pending timer */
+  tp = client_find(q, client, interval == 0);
 
   /*  if the requested interval is zero, just free the timer  */
   if (interval == 0) {
-    if (np) {                   /* If we found a timer, */
-      np->link = freeTQEQ;      /* link TQE at head of free Q */
-      freeTQEQ = np;
+    if (tp) {                   /* If we found a timer, */
+      heap_remove(q, tp->slot); /* take it off the heap and */
+      tp->link = q->freeTQEQ;   /* link TQE at head of free Q */
+      q->freeTQEQ = tp;
     }
+    timer_check(q); /*DEBUG*/
     return 0;                   /* return, no timer set */
   }
 
   /*  nonzero interval, calculate new expiration time  */
-  if (!(tp = np)) {     /* If no previous timer, get a TQE */
+  if (!tp) {            /* If no previous timer, get a TQE */
+    if (q->timerQ_len == q->timerQ_max) {
+      int max = q->timerQ_max ? 2 * q->timerQ_max : 16;
+      TQE **nq = realloc(q->timerQ, max * sizeof(TQE *));
+      if (!nq) return 0;
+      q->timerQ = nq;
+      q->timerQ_max = max;
+    }
+    if ((!q->clientQ || q->timerQ_len >= (1 << q->clientQ_bits)) &&
+        client_grow(q) < 0)
+      return 0;
     /* allocate timer */
-    if (!freeTQEQ) {
-      freeTQEQ = (TQE *)malloc(sizeof(TQE));
-      freeTQEQ->link = (TQE *)0;
-      freeTQEQ->interval.tv_usec = 0;
-      freeTQEQ->interval.tv_sec  = 0;
+    if (!q->freeTQEQ) {
+      q->freeTQEQ = (TQE *)malloc(sizeof(TQE));
+      if (!q->freeTQEQ) return 0;
+      q->freeTQEQ->link = (TQE *)0;
     }
-    tp = freeTQEQ;
-    freeTQEQ = tp->link;
+    tp = q->freeTQEQ;
+    q->freeTQEQ = tp->link;
+    tp->interval.tv_usec = 0;
+    tp->interval.tv_sec  = 0;
+    tp->client = client;
+    tp->link = q->clientQ[client_hash(q, client)];
+    q->clientQ[client_hash(q, client)] = tp;
+    tp->slot = q->timerQ_len;
+    q->timerQ[q->timerQ_len++] = tp;
   }
 
   /* calculate expiration time */
   if (relative) {
-    (void) gettimeofday(&(tp->time), NULL);
+    timer_now(&(tp->time));
     timeradd(&(tp->time), interval, &(tp->time));
     assert(tp->time.tv_usec < 1000000);
   }
   else tp->time = *interval;
 #ifdef DEBUG
-  printf("timer_set(): %d.%06d\n", tp->time.tv_sec, tp->time.tv_usec);
+  printf("timer_set(): %ld.%06ld\n", (long)tp->time.tv_sec,
+    (long)tp->time.tv_usec);
 #endif
   tp->func   = func;
-  tp->client = client;
   tp->which  = ITIMER_REAL;
+  tp->order  = q->timer_order++;
 
-  /*  insert new timer into timer queue  */
-  op = (struct TQE *)&timerQ;           /* fudge OK since link is first */
-  for (np = timerQ; np; op = np, np=np->link) {
-    if (timerless(&tp->time, &np->time)) break;
-  }
-  op->link = tp;    /* point prev TQE to new one */
-  tp->link = np;    /* point new TQE to next one */
+  /*  move timer to its place in the heap  */
+  heap_fix(q, tp->slot);
 
-  timer_check(); /*DEBUG*/
+  timer_check(q); /*DEBUG*/
   return &(tp->interval);
+} /* queue_set */
+
+/*
+* Timers belong to event loop 'loop'; timer_set() uses the default loop.
+*/
+struct timeval *timer_set_ex(notify_loop_t *loop, struct timeval *interval,
+  Notify_func func, Notify_client client, int relative)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+
+  return q ? queue_set(q, interval, func, client, relative) : 0;
+} /* timer_set_ex */
+
+struct timeval *timer_set(struct timeval *interval,
+  Notify_func func, Notify_client client, int relative)
+{
+  return timer_set_ex(notify_loop_default(), interval, func, client,
+    relative);
 } /* timer_set */
 
 /*
@@ -189,21 +412,27 @@ struct timeval *timer_set(struct timeval *interval,
 * routine leads to another select() call!  Therefore, we just take one timer
 * at a time, and don't use static variables.
 */
-struct timeval *timer_get(struct timeval *timeout)
+struct timeval *timer_get_ex(notify_loop_t *loop, struct timeval *timeout)
 {
+  timer_queue_t *q = notify_loop_timers(loop);
   register struct TQE *tp;      /* to scan the timer queue */
   struct timeval now;           /* current time */
+  struct timeval next, interval;
+  Notify_func func;
+  Notify_client client;
 
-  timer_check(); /*DEBUG*/
+  if (!q) return (struct timeval *)0;
+  timer_check(q); /*DEBUG*/
   for (;;) {
     /* return null pointer if there is no timer pending. */
-    if (!timerQ) return (struct timeval *)0;
+    if (!q->timerQ_len) return (struct timeval *)0;
 
     /* check head of timer queue to see if timer has expired */
-    (void) gettimeofday(&now, NULL);
-    if (timerless(&now, &timerQ->time)) { /* unexpired, calc timeout */
-      timeout->tv_sec  = timerQ->time.tv_sec  - now.tv_sec;
-      timeout->tv_usec = timerQ->time.tv_usec - now.tv_usec;
+    tp = q->timerQ[0];
+    timer_now(&now);
+    if (timerless(&now, &tp->time)) { /* unexpired, calc timeout */
+      timeout->tv_sec  = tp->time.tv_sec  - now.tv_sec;
+      timeout->tv_usec = tp->time.tv_usec - now.tv_usec;
       if (timeout->tv_usec < 0) {
         timeout->tv_usec += 1000000L;
         --timeout->tv_sec;
@@ -211,25 +440,132 @@ struct timeval *timer_get(struct timeval *timeout)
       assert(timeout->tv_usec < 1000000);
       return timeout;     /* timeout until timer expires */
     } else {              /* head timer has expired, */
-      tp = timerQ;        /* so remove it from the */
-      timerQ = tp->link;  /* timer queue, */
-      tp->link = freeTQEQ;
-      freeTQEQ = tp;
+      if (q->stats.on || q->counters || trace_ring) {
+        long late = (now.tv_sec - tp->time.tv_sec) * 1000000L +
+                    (now.tv_usec - tp->time.tv_usec);
+        int i;
+
+        if (q->stats.on) {
+          for (i = 0; i < TIMER_HIST - 1 && late >= (1L << i); i++);
+          q->stats.bucket[i]++;
+          q->stats.n++;
+          q->stats.sum += late;
+          if (late > q->stats.max) q->stats.max = late;
+        }
+        counters_add(q->counters, CTR_TIMERS, 1);
+        counters_add(q->counters, CTR_TIMER_LATE, late);
+        counters_max(q->counters, CTR_TIMER_MAX, late);
+        TRACE(TRACE_TIMER, late);
+      }
+      func     = tp->func;
+      client   = tp->client;
+      interval = tp->interval;
+      next     = tp->time;
+      queue_set(q, 0, func, client, 0);  /* so remove it from the queue */
       /* restart timer (absolute) */
-      if (tp->interval.tv_sec || tp->interval.tv_usec) {
-        timeradd(&tp->interval, &tp->time, &tp->time);
-        timer_set(&tp->time, tp->func, tp->client, 0);
+      if (interval.tv_sec || interval.tv_usec) {
+        struct timeval *ip;
+
+        timeradd(&interval, &next, &next);
+        if ((ip = queue_set(q, &next, func, client, 0))) *ip = interval;
       }
-      (*(tp->func))(tp->client); /* call the event handler */
+      (*func)(client); /* call the event handler */
+      TRACE(TRACE_TIMED, 0);
     }
   } /* loop to see if another timer expired */
+} /* timer_get_ex */
+
+struct timeval *timer_get(struct timeval *timeout)
+{
+  return timer_get_ex(notify_loop_default(), timeout);
 } /* timer_get */
 
 
 /*
 * Return 1 if the timer queue is not empty.
 */
+int timer_pending_ex(notify_loop_t *loop)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+
+  return q && q->timerQ_len != 0;
+} /* timer_pending_ex */
+
 int timer_pending(void)
 {
-  return timerQ != 0;
+  return timer_pending_ex(notify_loop_default());
 } /* timer_pending */
+
+
+/*
+* Fill in the absolute expiration time of the next timer on the
+* timer_now() clock.  Return 0 if no timer is pending.
+*/
+struct timeval *timer_next_ex(notify_loop_t *loop, struct timeval *when)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+
+  if (!q || !q->timerQ_len) return (struct timeval *)0;
+  *when = q->timerQ[0]->time;
+  return when;
+} /* timer_next_ex */
+
+struct timeval *timer_next(struct timeval *when)
+{
+  return timer_next_ex(notify_loop_default(), when);
+} /* timer_next */
+
+
+/*
+* Start (on = 1) or stop (on = 0) recording how late timers expire.
+*/
+void timer_stats_ex(notify_loop_t *loop, int on)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+
+  if (q) q->stats.on = on;
+} /* timer_stats_ex */
+
+void timer_stats(int on)
+{
+  timer_stats_ex(notify_loop_default(), on);
+} /* timer_stats */
+
+
+/*
+* Count expired timers and their lateness in 'c' (0 to stop), which
+* belongs to the thread running 'loop'.
+*/
+void timer_counters_ex(notify_loop_t *loop, counters_t *c)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+
+  if (q) q->counters = c;
+} /* timer_counters_ex */
+
+
+/*
+* Print the histogram of timer lateness to 'out'.
+*/
+void timer_report_ex(notify_loop_t *loop, FILE *out)
+{
+  timer_queue_t *q = notify_loop_timers(loop);
+  int i, lo, hi;
+
+  if (!q) return;
+  fprintf(out, "timer lateness: %lu timers, mean %.1f us, max %ld us\n",
+    q->stats.n, q->stats.n ? q->stats.sum / q->stats.n : 0., q->stats.max);
+  for (lo = 0; lo < TIMER_HIST && !q->stats.bucket[lo]; lo++);
+  for (hi = TIMER_HIST - 1; hi > lo && !q->stats.bucket[hi]; hi--);
+  for (i = lo; i <= hi; i++) {
+    if (i == TIMER_HIST - 1)
+      fprintf(out, "  >= %8ld us: %lu\n", 1L << (i - 1), q->stats.bucket[i]);
+    else
+      fprintf(out, "  < %9ld us: %lu\n", 1L << i, q->stats.bucket[i]);
+  }
+} /* timer_report_ex */
+
+void timer_report(FILE *out)
+{
+  timer_report_ex(notify_loop_default(), out);
+} /* timer_report */
@@ -2,3 +2,30 @@ extern struct timeval *timer_set(struct timeval *interval,
   Notify_func func, Notify_client client, int relative);
 extern struct timeval *timer_get(struct timeval *timeout);
 extern int timer_pending(void);
+extern struct timeval *timer_next(struct timeval *when);
+extern void timer_now(struct timeval *now);
+extern void timer_stats(int on);
+extern void timer_report(FILE *out);
+
+/*
+* The same on the timers of event loop 'loop'.
+*/
+extern struct timeval *timer_set_ex(notify_loop_t *loop,
+  struct timeval *interval, Notify_func func, Notify_client client,
+  int relative);
+extern struct timeval *timer_get_ex(notify_loop_t *loop,
+  struct timeval *timeout);
+extern int timer_pending_ex(notify_loop_t *loop);
+extern struct timeval *timer_next_ex(notify_loop_t *loop,
+  struct timeval *when);
+extern void timer_stats_ex(notify_loop_t *loop, int on);
+extern void timer_report_ex(notify_loop_t *loop, FILE *out);
+struct counters;
+extern void timer_counters_ex(notify_loop_t *loop, struct counters *c);
+
+/*
+* Timer queue of one event loop, see notify_loop_timers().
+*/
+typedef struct timer_queue timer_queue_t;
+extern timer_queue_t *timer_queue_new(void);
+extern void timer_queue_free(timer_queue_t *q);
@@ -10,6 +10,7 @@ Copyright 1993 by AT&T Bell Laboratories; all rights reserved
 #include <signal.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #ifndef WIN32
 #include <sys/select.h>
@@ -19,6 +20,16 @@ Copyright 1993 by AT&T Bell Laboratories; all rights reserved
 #include "sysdep.h"
 #include "notify.h"
 #include "multimer.h"
+#include "trace.h"
+
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#elif HAVE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
 
 #ifdef hp
 #define CAST int *
@@ -26,125 +37,447 @@ Copyright 1993 by AT&T Bell Laboratories; all rights reserved
 #define CAST fd_set *
 #endif
 
+/* conditions watched on a file descriptor */
+#define N_READ   1
+#define N_WRITE  2
+#define N_EXCEPT 4
+
+/* handlers, indexed by file descriptor */
 typedef struct event_t {
-  struct event_t *next;
-  Notify_client client;
+  Notify_client client;       /* input handler */
   Notify_func_input func;
-  int fd;
-  enum type_t {N_input, N_itimer} type;
+  Notify_client out_client;   /* output handler */
+  Notify_func out_func;
+  int sock;                   /* conditions set by notify_set_socket() */
+  int mask;                   /* conditions given to the poller */
 } event_t;
 
-static event_t *el;   /* event list */
-static int max_fd;    /* highest file descriptor used */
-static fd_set Readfds, Writefds, Exceptfds;
-static int stop;
+/* signal handler */
+typedef struct {
+  Notify_client client;
+  Notify_func_signal signal_func;
+  Notify_signal_mode when;
+} signal_t;
+
+/* state of one event loop */
+struct notify_loop {
+  event_t *el;        /* event table */
+  int el_len;         /* number of entries in the table */
+  int nevents;        /* number of handlers installed */
+  int max_fd;         /* highest file descriptor used */
+  volatile int stop;  /* may be set from another thread */
+  long precise;       /* busy-wait before timers (usec), -1 if off */
+  int initialized;    /* poller set up */
+#if HAVE_EPOLL
+  int epfd;
+  int tfd;            /* timerfd for timeouts finer than a millisecond */
+#elif HAVE_KQUEUE
+  int kq;
+#else
+  fd_set Readfds, Writefds, Exceptfds;
+#endif
+  struct timer_queue *timers;
+  signal_t s[NSIG];   /* signal handlers */
+};
 
-/* signal list */
-static struct {
-    Notify_client client;
-    Notify_func_signal signal_func;
-    Notify_signal_mode when;
-} s[NSIG];
+static notify_loop_t default_loop = { .precise = -1 };
 
+/* signals are per process: the loop that last set a handler gets it */
+static notify_loop_t *sig_loop[NSIG];
 
-static event_t *search(
-  Notify_client client,  /* ignored if fd >= 0 */
-  int fd,
-  enum type_t type,
-  event_t **prev         /* element before target */
-)
+
+/*
+* Create a new event loop.  Return 0 if out of memory.
+*/
+notify_loop_t *notify_loop_new(void)
 {
-  event_t *e;
+  notify_loop_t *l = calloc(1, sizeof(notify_loop_t));
+
+  if (l) l->precise = -1;
+  return l;
+} /* notify_loop_new */
 
-  *prev = 0;
-  for (e = el; e; *prev = e, e = e->next) {
-    if (e->type == type && e->fd == fd && (fd >= 0 || e->client == client))
-      return e;
+/*
+* Free event loop 'l', which must not be running.  Descriptors watched
+* by the loop are not closed.
+*/
+void notify_loop_free(notify_loop_t *l)
+{
+  int sig;
+
+  if (!l || l == &default_loop) return;
+  for (sig = 1; sig < NSIG; sig++) {
+    if (sig_loop[sig] == l) notify_set_signal_func_ex(l, 0, 0, sig, 0);
+  }
+#if HAVE_EPOLL
+  if (l->initialized) {
+    close(l->epfd);
+    close(l->tfd);
   }
+#elif HAVE_KQUEUE
+  if (l->initialized) close(l->kq);
+#endif
+  timer_queue_free(l->timers);
+  free(l->el);
+  free(l);
+} /* notify_loop_free */
+
+/*
+* Return the loop used by the functions without a loop argument.
+*/
+notify_loop_t *notify_loop_default(void)
+{
+  return &default_loop;
+} /* notify_loop_default */
+
+/*
+* Return the timer queue of loop 'l', creating it on first use.
+*/
+struct timer_queue *notify_loop_timers(notify_loop_t *l)
+{
+  if (!l->timers) l->timers = timer_queue_new();
+  return l->timers;
+} /* notify_loop_timers */
+
+
+/****************************************************************************/
+/*  Poller backends.  Each provides poller_init(), poller_update() to       */
+/*  change the conditions watched on one descriptor, and poller_wait()      */
+/*  to wait for the next events and pass them to dispatch().                */
+/****************************************************************************/
+
+static void dispatch(notify_loop_t *l, int fd, int mask);
+
+#if HAVE_EPOLL
+
+#define POLLER_EVENTS 64
+
+static int poller_init(notify_loop_t *l)
+{
+  struct epoll_event ev;
+
+  if ((l->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) return -1;
+  if ((l->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK)) < 0)
+    return -1;
+  memset(&ev, 0, sizeof(ev));
+  ev.events  = EPOLLIN;
+  ev.data.fd = l->tfd;
+  return epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->tfd, &ev);
+} /* poller_init */
+
+static int poller_update(notify_loop_t *l, int fd, int old, int mask)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events  = (mask & N_READ   ? EPOLLIN  : 0) |
+               (mask & N_WRITE  ? EPOLLOUT : 0) |
+               (mask & N_EXCEPT ? EPOLLPRI : 0);
+  ev.data.fd = fd;
+  return epoll_ctl(l->epfd,
+    !old ? EPOLL_CTL_ADD : !mask ? EPOLL_CTL_DEL : EPOLL_CTL_MOD, fd, &ev);
+} /* poller_update */
+
+static int poller_wait(notify_loop_t *l, struct timeval *timeout)
+{
+  struct epoll_event ev[POLLER_EVENTS];
+  int ms = -1;
+  int found, i;
+
+  if (timeout) {
+    if (timeout->tv_sec > 86400) {
+      ms = 86400 * 1000;  /* waking up early is harmless */
+    }
+    else if (timeout->tv_usec % 1000 == 0) {
+      ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+    }
+    else {
+      /* epoll_wait() only knows milliseconds; let the timerfd wake us */
+      struct itimerspec its;
+
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec  = timeout->tv_sec;
+      its.it_value.tv_nsec = timeout->tv_usec * 1000;
+      if (timerfd_settime(l->tfd, 0, &its, NULL) < 0) return -1;
+    }
+  }
+
+  found = epoll_wait(l->epfd, ev, POLLER_EVENTS, ms);
+  for (i = 0; i < found; i++) {
+    if (ev[i].data.fd == l->tfd) {
+      uint64_t expired;
+      (void) read(l->tfd, &expired, sizeof(expired));
+      continue;
+    }
+    dispatch(l, ev[i].data.fd,
+      (ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR) ? N_READ : 0) |
+      (ev[i].events & EPOLLOUT ? N_WRITE : 0) |
+      (ev[i].events & EPOLLPRI ? N_EXCEPT : 0));
+  }
+  return found;
+} /* poller_wait */
+
+#elif HAVE_KQUEUE
+
+#define POLLER_EVENTS 64
+
+static int poller_init(notify_loop_t *l)
+{
+  return (l->kq = kqueue()) < 0 ? -1 : 0;
+} /* poller_init */
+
+static int poller_update(notify_loop_t *l, int fd, int old, int mask)
+{
+  struct kevent ch[2];
+  int n = 0;
+
+  if ((old ^ mask) & N_READ) {
+    EV_SET(&ch[n], fd, EVFILT_READ, mask & N_READ ? EV_ADD : EV_DELETE,
+      0, 0, 0);
+    n++;
+  }
+  if ((old ^ mask) & N_WRITE) {
+    EV_SET(&ch[n], fd, EVFILT_WRITE, mask & N_WRITE ? EV_ADD : EV_DELETE,
+      0, 0, 0);
+    n++;
+  }
+  /* exceptional conditions have no kqueue filter */
+  return n ? kevent(l->kq, ch, n, NULL, 0, NULL) : 0;
+} /* poller_update */
+
+static int poller_wait(notify_loop_t *l, struct timeval *timeout)
+{
+  struct kevent ev[POLLER_EVENTS];
+  struct timespec ts, *tsp = NULL;
+  int found, i;
+
+  if (timeout) {
+    ts.tv_sec  = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_usec * 1000;
+    tsp = &ts;
+  }
+  found = kevent(l->kq, NULL, 0, ev, POLLER_EVENTS, tsp);
+  for (i = 0; i < found; i++) {
+    dispatch(l, (int)ev[i].ident, ev[i].filter == EVFILT_WRITE ? N_WRITE : N_READ);
+  }
+  return found;
+} /* poller_wait */
+
+#else /* select() */
+
+static int poller_init(notify_loop_t *l)
+{
+  FD_ZERO(&l->Readfds);
+  FD_ZERO(&l->Writefds);
+  FD_ZERO(&l->Exceptfds);
   return 0;
-} /* search */
+} /* poller_init */
 
-/* Clear all three "fd-set"s.
- * This is called only once in the first call for initilaization.
- */
-static void check_clr_fd(void)
+static int poller_update(notify_loop_t *l, int fd, int old, int mask)
+{
+  if (mask & N_READ)   FD_SET(fd, &l->Readfds);   else FD_CLR(fd, &l->Readfds);
+  if (mask & N_WRITE)  FD_SET(fd, &l->Writefds);  else FD_CLR(fd, &l->Writefds);
+  if (mask & N_EXCEPT) FD_SET(fd, &l->Exceptfds); else FD_CLR(fd, &l->Exceptfds);
+  return 0;
+} /* poller_update */
+
+static int poller_wait(notify_loop_t *l, struct timeval *timeout)
+{
+  fd_set readfds, writefds, exceptfds;
+  int found, fd, n;
+
+  readfds   = l->Readfds;
+  writefds  = l->Writefds;
+  exceptfds = l->Exceptfds;
+
+  found = select(l->max_fd+1, (CAST)&readfds, (CAST)&writefds, (CAST)&exceptfds,
+                  timeout);
+
+  for (fd = 0, n = found; fd <= l->max_fd && n > 0; fd++) {
+    int mask = (FD_ISSET(fd, &readfds)   ? N_READ   : 0) |
+               (FD_ISSET(fd, &writefds)  ? N_WRITE  : 0) |
+               (FD_ISSET(fd, &exceptfds) ? N_EXCEPT : 0);
+    if (mask) {
+      dispatch(l, fd, mask);
+      n--;
+    }
+  }
+  return found;
+} /* poller_wait */
+
+#endif /* poller backends */
+
+
+/*
+* Initialize the poller, once.
+*/
+static int check_init(notify_loop_t *l)
 {
-  static int cleared = -1;
+  if (!l->initialized) {
+    if (poller_init(l) < 0) {
+      perror("notify: poller");
+      return -1;
+    }
+    l->initialized = 1;  /* set for only once */
+  }
+  return 0;
+} /* check_init */
 
-  if (cleared == -1) {
-    FD_ZERO(&Readfds);
-    FD_ZERO(&Writefds);
-    FD_ZERO(&Exceptfds);
-    cleared = 0;  /* set for only once */
+/*
+* Return the table entry for 'fd', growing the table if 'create' is set.
+*/
+static event_t *lookup(notify_loop_t *l, int fd, int create)
+{
+  if (fd < 0) return 0;
+  if (fd >= l->el_len) {
+    event_t *e;
+    int len = l->el_len ? l->el_len : 64;
+
+    if (!create) return 0;
+    while (len <= fd) len *= 2;
+    if (!(e = realloc(l->el, len * sizeof(event_t)))) return 0;
+    memset(e + l->el_len, 0, (len - l->el_len) * sizeof(event_t));
+    l->el = e;
+    l->el_len = len;
   }
-}
+  return &l->el[fd];
+} /* lookup */
 
 /*
-* Find maximum file descriptor number used.
+* Tell the poller about changed conditions on 'fd'.
 */
-static void set_max_fd(void)
+static void update(notify_loop_t *l, int fd, event_t *e)
 {
-  event_t *e;
+  int mask = e->sock | (e->func ? N_READ : 0) | (e->out_func ? N_WRITE : 0);
+
+  if (mask != e->mask) {
+    if (poller_update(l, fd, e->mask, mask) < 0) perror("notify: update");
+    e->mask = mask;
+  }
+  if (mask && fd > l->max_fd) l->max_fd = fd;
+  else if (!mask && fd == l->max_fd) {
+    while (l->max_fd > 0 && !l->el[l->max_fd].mask) l->max_fd--;
+  }
+} /* update */
 
-  max_fd = 0;
-  for (e = el; e; e = e->next) {
-    if (e->fd > max_fd) max_fd = e->fd;
+/*
+* Call the handlers for conditions 'mask' on 'fd'.
+*/
+static void dispatch(notify_loop_t *l, int fd, int mask)
+{
+  event_t *e = lookup(l, fd, 0);
+
+  TRACE(TRACE_WAKEUP, fd);
+  /* skip conditions no longer watched, e.g. removed by an earlier handler */
+  if ((mask & N_READ) && e && (e->mask & N_READ)) {
+    if (e->func) {
+      (e->func)(e->client, fd);
+      e = lookup(l, fd, 0);   /* handler may have changed the table */
+    }
+    else {
+      fprintf(stderr, "No handler for fd %d\n", fd);
+    }
   }
-} /* set_max */
+  if ((mask & N_WRITE) && e && e->out_func) {
+    (e->out_func)(e->out_client);
+  }
+} /* dispatch */
 
 
 /*
 * Install input handler function 'func' for file descriptor 'fd'.
 * func=NOTIFY_FUNC_NULL removes handler.
 */
-Notify_func_input notify_set_input_func(
+Notify_func_input notify_set_input_func_ex(
+  notify_loop_t *l,       /* event loop */
   Notify_client client,   /* argument passed to function */
   Notify_func_input func, /* function to be called: func(client, fd) */
   int fd)                 /* file descriptor */
 {
-  event_t *e, *prev;
+  event_t *e;
 
-  check_clr_fd();
-  e = search(client, fd, N_input, &prev);
-  if (!e) {  /* create new event */
+  if (check_init(l) < 0) return 0;
+  e = lookup(l, fd, func != NOTIFY_FUNC_INPUT_NULL);
+  if (!e || !e->func) {  /* create new event */
     if (func == NOTIFY_FUNC_INPUT_NULL) return func;
-    e = (event_t *)malloc(sizeof(event_t));
     if (!e) return 0;
-    e->next = el;   /* put at head of list */
-    el = e;
-    if (fd > max_fd) max_fd = fd;
-    e->type   = N_input;
+    l->nevents++;
     e->client = client;
     e->func   = func;
-    e->fd     = fd;
-    FD_SET(fd, &Readfds);
+    update(l, fd, e);
   }
   else {
     if (func == NOTIFY_FUNC_INPUT_NULL) {
-      FD_CLR(fd, &Readfds);
-      if (prev) prev->next = e->next;
-      else el = e->next;
-      free(e);
-      set_max_fd();  /* find new maximum fd */
+      l->nevents--;
+      e->func = func;
+      update(l, fd, e);
       return func;
     }
     else e->func = func;
   }
   return 0;
+} /* notify_set_input_func_ex */
+
+Notify_func_input notify_set_input_func(Notify_client client,
+  Notify_func_input func, int fd)
+{
+  return notify_set_input_func_ex(&default_loop, client, func, fd);
 } /* notify_set_input_func */
 
 
+/*
+* Install output handler function 'func' for file descriptor 'fd'.
+* func=NOTIFY_FUNC_NULL removes handler.
+*/
+Notify_func notify_set_output_func_ex(
+  notify_loop_t *l,       /* event loop */
+  Notify_client client,   /* argument passed to function */
+  Notify_func func,       /* function to be called: func(client) */
+  int fd)                 /* file descriptor */
+{
+  event_t *e;
+
+  if (check_init(l) < 0) return 0;
+  e = lookup(l, fd, func != NOTIFY_FUNC_NULL);
+  if (!e || !e->out_func) {  /* create new event */
+    if (func == NOTIFY_FUNC_NULL) return func;
+    if (!e) return 0;
+    l->nevents++;
+    e->out_client = client;
+    e->out_func   = func;
+    update(l, fd, e);
+  }
+  else {
+    if (func == NOTIFY_FUNC_NULL) {
+      l->nevents--;
+      e->out_func = func;
+      update(l, fd, e);
+      return func;
+    }
+    else e->out_func = func;
+  }
+  return 0;
+} /* notify_set_output_func_ex */
+
+Notify_func notify_set_output_func(Notify_client client, Notify_func func,
+  int fd)
+{
+  return notify_set_output_func_ex(&default_loop, client, func, fd);
+} /* notify_set_output_func */
+
+
 /*
 * Don't wait if there are no other events.
 */
-static struct timeval *timer_get_pending(struct timeval *timeout, int max_fd)
+static struct timeval *timer_get_pending(notify_loop_t *l,
+  struct timeval *timeout)
 {
   struct timeval *tvp;
 
-  tvp = timer_get(timeout);
-  if (!tvp && !max_fd) {
+  tvp = timer_get_ex(l, timeout);
+  if (!tvp && !l->nevents) {
     timeout->tv_sec = timeout->tv_usec = 0;
-    notify_stop();
+    notify_stop_ex(l);
     return timeout;     /* added by Akira 12/11/01 */
   }
   if (!tvp)
@@ -155,26 +488,76 @@ static struct timeval *timer_get_pending(struct timeval *timeout, int max_fd)
 
 
 /*
-* Main loop. Return 0 if stopped, -1 if error.
+* Precise mode: wait for the next timer with a sleep on the timer clock
+* until 'precise' microseconds before it expires, then busy-wait for
+* the rest.  Return the result of the poller, or 0 if we slept.
 */
-Notify_error notify_start(void)
+static int precise_wait(notify_loop_t *l, struct timeval *deadline)
 {
-  struct timeval timeout;
-  event_t *e, *prev;
-  int fd;
+  struct timeval now, wake, spin;
+  int found = 0;
+
+  spin.tv_sec  = l->precise / 1000000;
+  spin.tv_usec = l->precise % 1000000;
+  timersub(deadline, &spin, &wake);
+  timer_now(&now);
+
+  if (timercmp(&now, &wake, <)) {
+#if HAVE_CLOCK_NANOSLEEP
+    if (!l->nevents) {
+      /* nothing else to watch: sleep until the absolute wake-up time */
+      struct timespec ts;
+
+      ts.tv_sec  = wake.tv_sec;
+      ts.tv_nsec = wake.tv_usec * 1000;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+        == EINTR && !l->stop);
+    }
+    else
+#endif
+    {
+      struct timeval timeout;
+
+      timersub(&wake, &now, &timeout);
+      if ((found = poller_wait(l, &timeout)) != 0) return found;
+    }
+  }
+  else if (l->nevents) {
+    /* look at ready descriptors, but don't block */
+    struct timeval zero = {0, 0};
+
+    if ((found = poller_wait(l, &zero)) != 0) return found;
+  }
+
+  do {
+    timer_now(&now);
+  } while (timercmp(&now, deadline, <));
+  return 0;
+} /* precise_wait */
+
+
+/*
+* Main loop of event loop 'l'. Return 0 if stopped, -1 if error.
+*/
+Notify_error notify_start_ex(notify_loop_t *l)
+{
+  struct timeval timeout, deadline, *tvp;
   int found;
-  fd_set readfds, writefds, exceptfds;
 
-  stop = 0;
-  while (!stop) {
-    readfds   = Readfds;
-    writefds  = Writefds;
-    exceptfds = Exceptfds;
+  if (check_init(l) < 0) return -1;
+  l->stop = 0;
+  while (!l->stop) {
     timeout.tv_sec  = 0;
     timeout.tv_usec = 100000;     /* modified from 0 by Akira 12/11/01 */
 
-    found = select(max_fd+1, (CAST)&readfds, (CAST)&writefds, (CAST)&exceptfds,
-                    timer_get_pending(&timeout, max_fd));
+    /* found = 0: just a timer -> do nothing,
+                  timer_get() will execute the handler */
+    /* found > 0: handlers have been called by poller_wait() */
+    tvp = timer_get_pending(l, &timeout);
+    if (l->precise >= 0 && !l->stop && timer_next_ex(l, &deadline))
+      found = precise_wait(l, &deadline);
+    else
+      found = poller_wait(l, tvp);
 
 #if defined(WIN32)
     if (found < 0 && WSAGetLastError() != WSAEINVAL) {
@@ -189,37 +572,45 @@ Notify_error notify_start(void)
       return -1;
     }
 #endif
-
-    /* found = 0: just a timer -> do nothing,
-                  timer_get() will execute the handler */
-    /* found > 0: scan the fd_event */
-    if (found) {
-      for (fd = 0; fd <= max_fd && found > 0; fd++) {
-        if (FD_ISSET(fd, &readfds)) {
-          e = search((Notify_client)0, fd, N_input, &prev);
-          if (e) {
-            if (e->func) (e->func)(e->client, fd);
-          }
-          else {
-            fprintf(stderr, "No handler for fd %d\n", fd);
-          }
-        }
-      } /* for() */
-    }
-
   } /* while() */
 
   return 0;
+} /* notify_start_ex */
+
+Notify_error notify_start(void)
+{
+  return notify_start_ex(&default_loop);
 } /* notify_start */
 
 
+/*
+* Schedule timers precisely: sleep on the timer clock instead of
+* polling with a timeout, and busy-wait the last 'spin' microseconds
+* before a timer expires.  A negative 'spin' turns this off.
+*/
+void notify_set_precise_ex(notify_loop_t *l, long spin)
+{
+  l->precise = spin;
+} /* notify_set_precise_ex */
+
+void notify_set_precise(long spin)
+{
+  notify_set_precise_ex(&default_loop, spin);
+} /* notify_set_precise */
+
+
 /*
 * Stop the event loop. Noticed only at next event.
 */
-Notify_error notify_stop(void)
+Notify_error notify_stop_ex(notify_loop_t *l)
 {
-  stop = 1;
+  l->stop = 1;
   return 0;  /* kludge */
+} /* notify_stop_ex */
+
+Notify_error notify_stop(void)
+{
+  return notify_stop_ex(&default_loop);
 } /* notify_stop */
 
 
@@ -228,43 +619,64 @@ Notify_error notify_stop(void)
 */
 static void sig_handler(int sig)
 {
-  (*s[sig].signal_func)(s[sig].client, sig, s[sig].when);
+  notify_loop_t *l = sig_loop[sig];
+
+  if (l && l->s[sig].signal_func)
+    (*l->s[sig].signal_func)(l->s[sig].client, sig, l->s[sig].when);
 } /* sig_handler */
 
 
 /*
-* Install signal handler.
+* Install signal handler on loop 'l', taking the signal over from any
+* other loop.  signal_func=NOTIFY_FUNC_SIGNAL_NULL removes the handler
+* and restores the default action.  Return the previous handler of 'l'.
 */
-Notify_func_signal notify_set_signal_func(Notify_client client,
-  Notify_func_signal signal_func, int sig, Notify_signal_mode when)
+Notify_func_signal notify_set_signal_func_ex(notify_loop_t *l,
+  Notify_client client, Notify_func_signal signal_func, int sig,
+  Notify_signal_mode when)
 {
-  Notify_func_signal old_func = s[sig].signal_func;
-  s[sig].signal_func = signal_func;
-  s[sig].when        = when;
-  s[sig].client      = client;
+  Notify_func_signal old_func;
 
-  signal(sig, sig_handler);
+  if (sig <= 0 || sig >= NSIG) return NOTIFY_FUNC_SIGNAL_NULL;
+  old_func = l->s[sig].signal_func;
+  l->s[sig].signal_func = signal_func;
+  l->s[sig].when        = when;
+  l->s[sig].client      = client;
+
+  if (signal_func) {
+    sig_loop[sig] = l;
+    signal(sig, sig_handler);
+  }
+  else if (sig_loop[sig] == l) {
+    signal(sig, SIG_DFL);
+    sig_loop[sig] = 0;
+  }
   return old_func;
+} /* notify_set_signal_func_ex */
+
+Notify_func_signal notify_set_signal_func(Notify_client client,
+  Notify_func_signal signal_func, int sig, Notify_signal_mode when)
+{
+  return notify_set_signal_func_ex(&default_loop, client, signal_func, sig,
+    when);
 } /* notify_set_signal_func */
 
 
 /*
- * Sets the value of fd_sets Rreadfds, Writefds, Exceptfds.
+ * Watch 'sock' for input (flag = 0), output (1) or exceptions (2)
+ * without installing a handler.
  */
+void notify_set_socket_ex(notify_loop_t *l, int sock, int flag)
+{
+  event_t *e;
+
+  if (check_init(l) < 0 || flag < 0 || flag > 2) return;
+  if (!(e = lookup(l, sock, 1))) return;
+  e->sock |= 1 << flag;
+  update(l, sock, e);
+} /* notify_set_socket_ex */
+
 void notify_set_socket(int sock, int flag)
 {
-  check_clr_fd();
-  switch (flag) {
-  case 0:
-    FD_SET(sock, &Readfds);
-    break;
-  case 1:
-    FD_SET(sock, &Writefds);
-    break;
-  case 2:
-    FD_SET(sock, &Exceptfds);
-    break;
-  default:
-    break;
-  }
+  notify_set_socket_ex(&default_loop, sock, flag);
 } /* notify_set_socket */
@@ -47,6 +47,13 @@ typedef enum notify_signal_mode {
  */
 typedef	unsigned long Notify_client;
 
+/*
+ * Event loop.  Each loop has its own handlers and timers and may run
+ * in its own thread; the functions without a loop argument use the
+ * default loop.
+ */
+typedef struct notify_loop notify_loop_t;
+
 /*
  * A pointer to functions returning a Notify_value.
  */
@@ -95,6 +102,22 @@ extern void notify_set_periodic_func(Notify_client client, Notify_func
 */
 extern  Notify_error  notify_start(void);
 
+/*
+* Create and free event loops; notify_loop_default() is the loop used
+* by the functions without a loop argument.  notify_loop_timers()
+* returns the timer queue of 'loop', creating it if necessary.
+*/
+extern notify_loop_t *notify_loop_new(void);
+extern void notify_loop_free(notify_loop_t *loop);
+extern notify_loop_t *notify_loop_default(void);
+extern struct timer_queue *notify_loop_timers(notify_loop_t *loop);
+
+/*
+* Wait for timers with a sleep on the timer clock, busy-waiting the
+* last 'spin' microseconds before each expires; spin < 0 turns this off.
+*/
+extern void notify_set_precise(long spin);
+
 /*
 * Abort event handler.
 */
@@ -107,6 +130,25 @@ extern Notify_func_signal notify_set_signal_func(Notify_client nclient,
   Notify_func_signal func, int sig, Notify_signal_mode mode);
 
 /*
-* Initialize Readfds (flag = 0), Writefds (1), Exceptfds (2).
+* Watch 'sock' for input (flag = 0), output (1) or exceptions (2)
+* without installing a handler.
 */
 extern void notify_set_socket(int sock, int flag);
+
+/*
+* The same on event loop 'loop'.  A loop may run in its own thread,
+* and only that thread may change it while it runs, except for
+* notify_stop_ex().  Signals belong to the process: a signal is
+* passed to the loop that last set a handler for it.
+*/
+extern Notify_func_input notify_set_input_func_ex(notify_loop_t *loop,
+  Notify_client nclient, Notify_func_input func, int fd);
+extern Notify_func notify_set_output_func_ex(notify_loop_t *loop,
+  Notify_client nclient, Notify_func func, int fd);
+extern Notify_error notify_start_ex(notify_loop_t *loop);
+extern void notify_set_precise_ex(notify_loop_t *loop, long spin);
+extern Notify_error notify_stop_ex(notify_loop_t *loop);
+extern Notify_func_signal notify_set_signal_func_ex(notify_loop_t *loop,
+  Notify_client nclient, Notify_func_signal func, int sig,
+  Notify_signal_mode mode);
+extern void notify_set_socket_ex(notify_loop_t *loop, int sock, int flag);
@@ -29,6 +29,7 @@
  */
 
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -41,8 +42,111 @@
 #endif
 
 #include "rtpdump.h"
+#include "rdz.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#if HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+* File format version of each open input, as found by RD_header(),
+* and whether it is compressed.  Files not in the table are plain
+* version 1.  The table grows as needed, rtpplay may have many inputs
+* open at once.
+*/
+static struct rd_file {
+  FILE *in;
+  int version;
+  int z;
+} *files;
+static int nfiles;
+
+
+/*
+* Return file format version (1 or 2) of input 'in'.
+*/
+int RD_version(FILE *in)
+{
+  int i;
+
+  for (i = 0; i < nfiles; i++) {
+    if (files[i].in == in) return files[i].version;
+  }
+  return 1;
+} /* RD_version */
+
+
+/*
+* Return non-zero if input 'in' is a compressed dump file.
+*/
+int RD_compressed(FILE *in)
+{
+  int i;
+
+  for (i = 0; i < nfiles; i++) {
+    if (files[i].in == in) return files[i].z;
+  }
+  return 0;
+} /* RD_compressed */
+
+
+/*
+* Remember file format version of input 'in' and whether it is
+* compressed.
+*/
+static void set_version(FILE *in, int version, int z)
+{
+  int i, slot = -1;
+
+  for (i = 0; i < nfiles; i++) {
+    if (files[i].in == in) {
+      slot = i;
+      break;
+    }
+    if (slot < 0 && files[i].in == NULL) slot = i;
+  }
+  if (version == 1 && !z) {
+    if (slot >= 0 && files[slot].in == in) files[slot].in = NULL;
+    return;
+  }
+  if (slot < 0) {
+    struct rd_file *nf = realloc(files, (nfiles + 16) * sizeof(*files));
+
+    if (nf == NULL) {
+      perror("RD_header");
+      exit(1);
+    }
+    memset(nf + nfiles, 0, 16 * sizeof(*files));
+    files = nf;
+    slot = nfiles;
+    nfiles += 16;
+  }
+  files[slot].in = in;
+  files[slot].version = version;
+  files[slot].z = z;
+} /* set_version */
+
+
+/*
+* Return 0 if 'line' is the first line of a file of 'version', 1 if
+* of a compressed one, -1 if neither.
+*/
+static int file_magic(const char *line, const char *version)
+{
+  char magic[80];
+
+  sprintf(magic, "#!rtpplay%s ", version);
+  if (strncmp(line, magic, strlen(magic)) == 0) return 0;
+  sprintf(magic, "#!rtpplay%s%s ", version, RTPFILE_Z);
+  if (strncmp(line, magic, strlen(magic)) == 0) return 1;
+  return -1;
+} /* file_magic */
 
-#define RTPFILE_VERSION "1.0"
 
 /*
 * Read header. Return -1 if not valid, 0 if ok.
@@ -51,11 +155,17 @@ int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verb
 {
   RD_hdr_t hdr;
   time_t tt;
-  char line[80], magic[80];
+  char line[80];
+  int z;
 
   if (fgets(line, sizeof(line), in) == NULL) return -1;
-  sprintf(magic, "#!rtpplay%s ", RTPFILE_VERSION);
-  if (strncmp(line, magic, strlen(magic)) != 0) return -1;
+  if ((z = file_magic(line, RTPFILE_VERSION)) >= 0) {
+    set_version(in, 1, z);
+  }
+  else {
+    if ((z = file_magic(line, RTPFILE_VERSION2)) < 0) return -1;
+    set_version(in, 2, z);
+  }
   if (fread((char *)&hdr, sizeof(hdr), 1, in) == 0) return -1;
   start->tv_sec  = ntohl(hdr.start.tv_sec);
   start->tv_usec = ntohl(hdr.start.tv_usec);
@@ -79,20 +189,68 @@ int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verb
 
 
 /*
-* Read next record from input file.
+* Read version 2 record header into 'b'.  Return 0 at end of file.
+*/
+static int read_header2(FILE *in, RD_buffer_t *b)
+{
+  RD_packet2_t hdr;
+  RD_source_t src;
+  int length;
+
+  if (fread((char *)&hdr, sizeof(hdr), 1, in) == 0) return 0;
+  length = ntohs(hdr.length) - (int)sizeof(hdr);
+  b->p.flags = ntohl(hdr.flags);
+  b->p.offset_ns = (uint64_t)ntohl(hdr.offset_hi) << 32 | ntohl(hdr.offset_lo);
+  b->p.source = 0;
+  b->p.port = 0;
+  if (b->p.flags & RD_F_SOURCE) {
+    if (fread((char *)&src, sizeof(src), 1, in) == 0) return 0;
+    length -= sizeof(src);
+    b->p.source = src.source;
+    b->p.port   = src.port;
+  }
+  b->p.hdr.length = length < 0 ? 0 : length;
+  b->p.hdr.plen   = ntohs(hdr.plen);
+  b->p.hdr.offset = b->p.offset_ns / 1000000;
+  return 1;
+} /* read_header2 */
+
+
+/*
+* Read next record from input file.  Compressed files can only be
+* read with RD_next().
 */
 int RD_read(FILE *in, RD_buffer_t *b)
 {
-  /* read packet header from file */
-  if (fread((char *)b->byte, sizeof(b->p.hdr), 1, in) == 0) {
-    /* we are done */
+  if (RD_compressed(in)) {
+    fprintf(stderr, "RD_read: compressed file, use RD_next()\n");
     return 0;
   }
+  if (RD_version(in) == 2) {
+    if (read_header2(in, b) == 0) return 0;
+  }
+  else {
+    /* read packet header from file */
+    if (fread((char *)b->byte, sizeof(b->p.hdr), 1, in) == 0) {
+      /* we are done */
+      return 0;
+    }
 
-  /* convert to host byte order */
-  b->p.hdr.length = ntohs(b->p.hdr.length) - sizeof(b->p.hdr);
-  b->p.hdr.offset = ntohl(b->p.hdr.offset);
-  b->p.hdr.plen   = ntohs(b->p.hdr.plen);
+    /* convert to host byte order */
+    b->p.hdr.length = ntohs(b->p.hdr.length) - sizeof(b->p.hdr);
+    b->p.hdr.offset = ntohl(b->p.hdr.offset);
+    b->p.hdr.plen   = ntohs(b->p.hdr.plen);
+    b->p.offset_ns  = (uint64_t)b->p.hdr.offset * 1000000;
+    b->p.flags  = 0;
+    b->p.source = 0;
+    b->p.port   = 0;
+  }
+
+  if (b->p.hdr.length > sizeof(b->p.data)) {
+    fprintf(stderr, "RD_read: record of %u bytes too long\n",
+      (unsigned)b->p.hdr.length);
+    return 0;
+  }
 
   /* read actual packet */
   if (fread(b->p.data, b->p.hdr.length, 1, in) == 0) {
@@ -100,3 +258,683 @@ int RD_read(FILE *in, RD_buffer_t *b)
   }
   return b->p.hdr.length;
 } /* RD_read */
+
+
+/*
+* Record reader.  Regular files are mapped and records are returned
+* in place; other inputs are read in large blocks into 'buf', which
+* holds at least one maximum-size record.
+*
+* Compressed files are decoded a block at a time into one of
+* RD_AHEAD slots, and records are returned from there.  With threads,
+* a decoder thread keeps the slots filled ahead of the reader, so
+* decompression does not delay the caller.
+*/
+#define RD_BLOCK    (128 * 1024)
+#define RD_RECMAX   65536  /* 16-bit record length */
+#define RD_AHEAD    4      /* decoded blocks buffered */
+#define RD_SLACK    64     /* zeroed bytes after a decoded block */
+
+enum {SLOT_EMPTY, SLOT_FULL, SLOT_END};
+
+typedef struct {
+  char *buf;         /* plain records */
+  size_t size;
+  size_t len;
+  uint64_t pos;      /* file position of the block */
+  int state;         /* SLOT_* */
+} rd_slot_t;
+
+struct RD_reader {
+  FILE *in;
+  int version;
+  int mapped;        /* 'base' is a file mapping */
+  int shared;        /* ... of another reader, see RD_range() */
+  char *base;        /* mapping or buffer */
+  size_t size;       /* size of mapping or buffer */
+  size_t len;        /* valid bytes at 'base' */
+  size_t pos;        /* next record at 'base' */
+  uint64_t fpos;     /* file position of 'base + pos' */
+  char *bounce;      /* copy of a record that must not be used in place */
+  /* compressed files */
+  int z;
+  rd_slot_t slot[RD_AHEAD];
+  int cur;           /* slot being read, -1 before the first */
+  int fill;          /* slot the decoder fills next */
+  uint64_t zpos;     /* file position of the next block to decode */
+  char *cbuf;        /* compressed block */
+  size_t csize;
+  char *tmp;         /* scratch for rdz_decode() */
+  size_t tmpsize;
+#if HAVE_PTHREAD
+  int started, stop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+};
+
+
+/*
+* Open a reader on 'in', positioned after the file header, i.e.,
+* after RD_header().  Returns NULL if out of memory.
+*/
+RD_reader_t *RD_open(FILE *in)
+{
+  RD_reader_t *r;
+  long start;
+
+  if ((r = calloc(1, sizeof(*r))) == NULL) return NULL;
+  r->in = in;
+  r->version = RD_version(in);
+  start = ftell(in);
+  if (start < 0) start = 0;
+  r->fpos = start;
+
+  if (RD_compressed(in)) {
+    r->z = 1;
+    r->cur = -1;
+    r->zpos = start;
+#if HAVE_PTHREAD
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+#endif
+    return r;
+  }
+
+#if HAVE_MMAP
+  {
+    struct stat st;
+    void *p;
+
+    if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > start && (uint64_t)st.st_size == (size_t)st.st_size) {
+      p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+      if (p != MAP_FAILED) {
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        r->mapped = 1;
+        r->base = p;
+        r->size = r->len = st.st_size;
+        r->pos  = start;
+        r->fpos = 0;
+      }
+    }
+  }
+#endif
+
+  if (!r->mapped && (r->base = malloc(RD_BLOCK + RD_RECMAX)) == NULL) {
+    free(r);
+    return NULL;
+  }
+  if (!r->mapped) r->size = RD_BLOCK + RD_RECMAX;
+  return r;
+} /* RD_open */
+
+
+/*
+* Return non-zero if the reader returns records in place, i.e., the
+* data pointers stay valid until RD_close().
+*/
+int RD_mapped(RD_reader_t *r)
+{
+  return r->mapped;
+} /* RD_mapped */
+
+
+/*
+* Read and decode the block at the input position into 'slot'.
+* Returns SLOT_FULL, or SLOT_END at the block index, end of file or
+* error.
+*/
+static int read_block(RD_reader_t *r, rd_slot_t *slot)
+{
+  char h[sizeof(RD_zblock_t)];
+  rdz_block_t b;
+  int ok;
+
+  if (fread(h, sizeof(h), 1, r->in) == 0 || (ok = rdz_parse(h, &b)) == 0)
+    return SLOT_END;
+  if (ok < 0) {
+    fprintf(stderr, "RD_next: invalid block at %llu\n",
+      (unsigned long long)r->zpos);
+    return SLOT_END;
+  }
+  if (b.clen > r->csize) {
+    free(r->cbuf);
+    if (!(r->cbuf = malloc(b.clen))) {
+      r->csize = 0;
+      perror("RD_next");
+      return SLOT_END;
+    }
+    r->csize = b.clen;
+  }
+  if (b.ulen + RD_SLACK > slot->size) {
+    free(slot->buf);
+    if (!(slot->buf = malloc(b.ulen + RD_SLACK))) {
+      slot->size = 0;
+      perror("RD_next");
+      return SLOT_END;
+    }
+    slot->size = b.ulen + RD_SLACK;
+  }
+  if (fread(r->cbuf, 1, b.clen, r->in) != b.clen ||
+      rdz_decode(&b, r->version, r->cbuf, slot->buf, &r->tmp,
+        &r->tmpsize) < 0) {
+    fprintf(stderr, "RD_next: corrupt block at %llu\n",
+      (unsigned long long)r->zpos);
+    return SLOT_END;
+  }
+  memset(slot->buf + b.ulen, 0, RD_SLACK);
+  slot->len = b.ulen;
+  slot->pos = r->zpos;
+  r->zpos += sizeof(h) + b.clen;
+  return SLOT_FULL;
+} /* read_block */
+
+
+#if HAVE_PTHREAD
+/*
+* Decoder thread: fill the slots in turn until the end of the file.
+*/
+static void *decode_main(void *arg)
+{
+  RD_reader_t *r = arg;
+  rd_slot_t *slot;
+  int state;
+
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    slot = &r->slot[r->fill];
+    while (!r->stop && slot->state != SLOT_EMPTY)
+      pthread_cond_wait(&r->cond, &r->lock);
+    if (r->stop) break;
+    pthread_mutex_unlock(&r->lock);
+
+    state = read_block(r, slot);
+
+    pthread_mutex_lock(&r->lock);
+    slot->state = state;
+    r->fill = (r->fill + 1) % RD_AHEAD;
+    pthread_cond_broadcast(&r->cond);
+    if (state == SLOT_END) break;
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+} /* decode_main */
+#endif
+
+
+/*
+* Move on to the next decoded block of a compressed file.  Returns 0
+* at the end.
+*/
+static int next_block(RD_reader_t *r)
+{
+  rd_slot_t *slot;
+
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&r->lock);
+  if (!r->started) {
+    r->started = 1;
+    if (pthread_create(&r->thread, NULL, decode_main, r) != 0) {
+      perror("RD_next");
+      r->started = 0;
+      r->stop = 1;
+    }
+  }
+  if (r->cur >= 0) {
+    if (r->slot[r->cur].state == SLOT_END) {
+      pthread_mutex_unlock(&r->lock);
+      return 0;
+    }
+    r->slot[r->cur].state = SLOT_EMPTY;
+    pthread_cond_broadcast(&r->cond);
+  }
+  r->cur = (r->cur + 1) % RD_AHEAD;
+  slot = &r->slot[r->cur];
+  while (slot->state == SLOT_EMPTY && !r->stop)
+    pthread_cond_wait(&r->cond, &r->lock);
+  if (slot->state == SLOT_EMPTY) slot->state = SLOT_END;
+  pthread_mutex_unlock(&r->lock);
+#else
+  r->cur = 0;
+  slot = &r->slot[0];
+  if (slot->state != SLOT_END) slot->state = read_block(r, slot);
+#endif
+  if (slot->state == SLOT_END) return 0;
+  r->base = slot->buf;
+  r->len  = slot->len;
+  r->pos  = 0;
+  r->fpos = slot->pos;
+  return 1;
+} /* next_block */
+
+
+/*
+* Make at least 'n' bytes available at 'base + pos'.  Returns the
+* number of bytes available, less than 'n' only at end of file.
+*/
+static size_t avail(RD_reader_t *r, size_t n)
+{
+  size_t got;
+
+  /* records do not span blocks */
+  if (r->z) {
+    if (r->pos == r->len && !next_block(r)) return 0;
+    return r->len - r->pos;
+  }
+  if (r->mapped || r->len - r->pos >= n) return r->len - r->pos;
+
+  /* move partial record to front and refill */
+  memmove(r->base, r->base + r->pos, r->len - r->pos);
+  r->fpos += r->pos;
+  r->len  -= r->pos;
+  r->pos   = 0;
+  while (r->len < n) {
+    got = fread(r->base + r->len, 1, r->size - r->len, r->in);
+    if (got == 0) break;
+    r->len += got;
+  }
+  return r->len;
+} /* avail */
+
+
+/*
+* Return next record in 'rec'.  Returns 1 if ok, 0 at end of file and
+* -1 for an invalid record.
+*/
+int RD_next(RD_reader_t *r, RD_record_t *rec)
+{
+  RD_packet_t h1;
+  RD_packet2_t h2;
+  RD_source_t src;
+  size_t hlen, length;
+  char *p;
+
+  hlen = r->version == 2 ? sizeof(h2) : sizeof(h1);
+  if (avail(r, hlen) < hlen) return 0;
+  p = r->base + r->pos;
+
+  /* copy header fields, records need not be aligned */
+  if (r->version == 2) {
+    memcpy(&h2, p, sizeof(h2));
+    length         = ntohs(h2.length);
+    rec->plen      = ntohs(h2.plen);
+    rec->flags     = ntohl(h2.flags);
+    rec->offset_ns = (uint64_t)ntohl(h2.offset_hi) << 32 | ntohl(h2.offset_lo);
+    rec->source    = 0;
+    rec->port      = 0;
+    if (rec->flags & RD_F_SOURCE) {
+      hlen += sizeof(src);
+      if (avail(r, hlen) < hlen) return 0;
+      p = r->base + r->pos;
+      memcpy(&src, p + sizeof(h2), sizeof(src));
+      rec->source = src.source;
+      rec->port   = src.port;
+    }
+  }
+  else {
+    memcpy(&h1, p, sizeof(h1));
+    length         = ntohs(h1.length);
+    rec->plen      = ntohs(h1.plen);
+    rec->flags     = 0;
+    rec->offset_ns = (uint64_t)ntohl(h1.offset) * 1000000;
+    rec->source    = 0;
+    rec->port      = 0;
+  }
+
+  if (length < hlen) {
+    fprintf(stderr, "RD_next: invalid record length %u\n", (unsigned)length);
+    return -1;
+  }
+  if (avail(r, length) < length) return 0;
+  p = r->base + r->pos;
+
+  rec->data   = p + hlen;
+  rec->length = length - hlen;
+  rec->hlen   = hlen;
+  rec->pos    = r->z ? r->fpos : r->fpos + r->pos;
+  r->pos += length;
+
+  /*
+   * The packet parsers may look a few bytes past a truncated record;
+   * do not let them run off the end of the mapping.
+   */
+  if (r->mapped && r->pos == r->len) {
+    if (!r->bounce && (r->bounce = calloc(1, RD_RECMAX)) == NULL) return -1;
+    memcpy(r->bounce, p, length);
+    rec->data = r->bounce + hlen;
+  }
+  return 1;
+} /* RD_next */
+
+
+/*
+* Release reader 'r'.  Does not close the input file.
+*/
+void RD_close(RD_reader_t *r)
+{
+  int i;
+
+  if (r == NULL) return;
+  if (r->z) {
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    if (r->started) pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+#endif
+    for (i = 0; i < RD_AHEAD; i++) free(r->slot[i].buf);
+    free(r->cbuf);
+    free(r->tmp);
+    free(r);
+    return;
+  }
+#if HAVE_MMAP
+  if (r->mapped && !r->shared) munmap(r->base, r->size);
+#endif
+  if (!r->mapped) free(r->base);
+  free(r->bounce);
+  free(r);
+} /* RD_close */
+
+
+/*
+* Position reader 'r' at file position 'pos', which must be the start
+* of a record.  Returns 0 if ok, -1 if the input is not seekable.
+*/
+static int seek_pos(RD_reader_t *r, uint64_t pos)
+{
+  if (r->mapped) {
+    if (pos > r->len) return -1;
+    r->pos = pos;
+    return 0;
+  }
+  if (fseek(r->in, (long)pos, SEEK_SET) < 0) return -1;
+  r->fpos = pos;
+  r->pos = r->len = 0;
+  return 0;
+} /* seek_pos */
+
+
+/*
+* Return non-zero if a plausible record of file version 'version'
+* starts at 'p', with 'n' bytes until the end of the mapping.  Sets
+* '*length' and '*offset_ns'.
+*/
+static int plausible(int version, const char *p, size_t n, size_t *length,
+  uint64_t *offset_ns)
+{
+  RD_packet_t h1;
+  RD_packet2_t h2;
+  size_t hlen;
+  unsigned plen, flags = 0;
+  unsigned char v;
+
+  if (version == 2) {
+    hlen = sizeof(h2);
+    if (n < hlen) return 0;
+    memcpy(&h2, p, sizeof(h2));
+    *length = ntohs(h2.length);
+    plen = ntohs(h2.plen);
+    flags = ntohl(h2.flags);
+    if (flags & ~(RD_F_SOURCE | RD_F_HWTIME)) return 0;
+    if (flags & RD_F_SOURCE) hlen += sizeof(RD_source_t);
+    *offset_ns = (uint64_t)ntohl(h2.offset_hi) << 32 | ntohl(h2.offset_lo);
+  }
+  else {
+    hlen = sizeof(h1);
+    if (n < hlen) return 0;
+    memcpy(&h1, p, sizeof(h1));
+    *length = ntohs(h1.length);
+    plen = ntohs(h1.plen);
+    *offset_ns = (uint64_t)ntohl(h1.offset) * 1000000;
+  }
+  /* RTP records may be truncated, RTCP records are complete */
+  if (*length <= hlen + 4 || *length > n) return 0;
+  if (plen && plen < *length - hlen) return 0;
+  /* RTP/RTCP version 2 or vat */
+  v = (unsigned char)p[hlen] >> 6;
+  return v == 2 || v == 0;
+} /* plausible */
+
+
+/*
+* Return position of the first record boundary at or after 'pos' in
+* the mapping, recognized by a chain of plausible records, or 0 if
+* none is found.  Sets '*offset_ns' to the offset of that record.
+*/
+static uint64_t resync(RD_reader_t *r, uint64_t pos, uint64_t *offset_ns)
+{
+  size_t chain;
+  uint64_t q, c, ns, last;
+  int k;
+
+  for (q = pos; q < r->len && q < pos + RD_RECMAX; q++) {
+    c = q;
+    last = 0;
+    for (k = 0; k < 4 && c < r->len; k++) {
+      if (!plausible(r->version, r->base + c, r->len - c, &chain, &ns) ||
+          (k > 0 && ns < last))
+        break;
+      if (k == 0) *offset_ns = ns;
+      last = ns;
+      c += chain;
+    }
+    /* four records in a row, or a shorter chain ending the file */
+    if (k == 4 || (k > 0 && c == r->len)) return q;
+  }
+  return 0;
+} /* resync */
+
+
+/*
+* Look up 'offset_ns' in index file 'index'.  Returns the position to
+* start reading from, or 0 if there is no usable entry.
+*/
+static uint64_t index_lookup(RD_reader_t *r, uint64_t offset_ns,
+  const char *index)
+{
+  RD_index_entry_t e;
+  uint64_t ns, pos, found = 0, found_ns = 0;
+  size_t n, length;
+  char line[80];
+  FILE *in;
+
+  if (!index || !(in = fopen(index, "rb"))) return 0;
+  if (fgets(line, sizeof(line), in) == NULL ||
+      strcmp(line, "#!rtpidx" RTPIDX_VERSION "\n") != 0) {
+    fclose(in);
+    return 0;
+  }
+  while (fread((char *)&e, sizeof(e), 1, in) == 1) {
+    ns  = (uint64_t)ntohl(e.offset_hi) << 32 | ntohl(e.offset_lo);
+    pos = (uint64_t)ntohl(e.pos_hi) << 32 | ntohl(e.pos_lo);
+    if (ns > offset_ns) break;
+    found = pos;
+    found_ns = ns;
+  }
+  fclose(in);
+
+  /* make sure the index belongs to this file */
+  if (found == 0 || seek_pos(r, found) < 0) return 0;
+  n = avail(r, RD_RECMAX);
+  if (!plausible(r->version, r->base + r->pos, n, &length, &ns) ||
+      ns != found_ns) {
+    return 0;
+  }
+  return found;
+} /* index_lookup */
+
+
+/*
+* Position reader 'r' of a compressed file at the block holding the
+* first record at 'offset_ns' or later, using the block index at the
+* end of the file.  Returns 0 if ok, -1 if there is no index or the
+* input is not seekable.
+*/
+static int find_block(RD_reader_t *r, uint64_t offset_ns)
+{
+  RD_ztrailer_t tr;
+  RD_index_entry_t e;
+  char h[sizeof(RD_zblock_t)];
+  rdz_block_t b;
+  uint64_t pos, found = r->zpos;
+  uint32_t i;
+
+  if (fseek(r->in, -(long)sizeof(tr), SEEK_END) < 0 ||
+      fread((char *)&tr, sizeof(tr), 1, r->in) == 0 ||
+      ntohl(tr.magic) != RD_ZTRAIL_MAGIC)
+    goto fail;
+  pos = (uint64_t)ntohl(tr.pos_hi) << 32 | ntohl(tr.pos_lo);
+  if (fseek(r->in, (long)pos, SEEK_SET) < 0 ||
+      fread(h, sizeof(h), 1, r->in) == 0 || rdz_parse(h, &b) != 0 ||
+      b.count != ntohl(tr.count))
+    goto fail;
+  for (i = 0; i < b.count; i++) {
+    if (fread((char *)&e, sizeof(e), 1, r->in) == 0) goto fail;
+    if (((uint64_t)ntohl(e.offset_hi) << 32 | ntohl(e.offset_lo)) > offset_ns)
+      break;
+    found = (uint64_t)ntohl(e.pos_hi) << 32 | ntohl(e.pos_lo);
+  }
+  if (fseek(r->in, (long)found, SEEK_SET) < 0) goto fail;
+  r->zpos = found;
+  return 0;
+
+fail:
+  fseek(r->in, (long)r->zpos, SEEK_SET);
+  return -1;
+} /* find_block */
+
+
+/*
+* Position reader 'r', which has not returned any records yet, at or
+* shortly before the first record at 'offset_ns' or later.  Uses seek
+* index 'index' if given and valid, else a binary search over the
+* mapped file.  Compressed files carry their own index.  Returns 0 if
+* ok, -1 if the input cannot be searched; the reader is then unchanged
+* and the caller has to skip records.
+*/
+int RD_find(RD_reader_t *r, uint64_t offset_ns, const char *index)
+{
+  uint64_t first = r->fpos + r->pos;  /* first record */
+  uint64_t lo, hi, mid, q, ns;
+
+  if (r->z) return find_block(r, offset_ns);
+  if ((q = index_lookup(r, offset_ns, index)) != 0)
+    return seek_pos(r, q);
+  if (!r->mapped) {
+    seek_pos(r, first);
+    return -1;
+  }
+
+  /* lo is always a record boundary at or before the target */
+  lo = first;
+  hi = r->len;
+  while (hi - lo > RD_BLOCK) {
+    mid = lo + (hi - lo) / 2;
+    q = resync(r, mid, &ns);
+    if (q == 0 || q >= hi || ns >= offset_ns) hi = mid;
+    else lo = q;
+  }
+  return seek_pos(r, lo);
+} /* RD_find */
+
+
+/*
+* Return the file position of the first record at or after file
+* position 'pos' of mapped reader 'r', found as by RD_find(), or the
+* end of the file if there is none.  The same 'pos' always gives the
+* same boundary, so neighbouring RD_range() readers meet there.
+*/
+uint64_t RD_boundary(RD_reader_t *r, uint64_t pos)
+{
+  uint64_t first = r->fpos + r->pos, q, ns;
+
+  if (pos <= first) return first;
+  if (pos >= r->len || (q = resync(r, pos, &ns)) == 0) return r->len;
+  return q;
+} /* RD_boundary */
+
+
+/*
+* Open a reader for the records between file positions 'from' and
+* 'to' of mapped reader 'r', e.g., from RD_boundary().  It shares the
+* mapping and must be closed before 'r'.  Several may be used at the
+* same time, by different threads.  Returns NULL if 'r' is not mapped
+* or out of memory.
+*/
+RD_reader_t *RD_range(RD_reader_t *r, uint64_t from, uint64_t to)
+{
+  RD_reader_t *c;
+
+  if (!r->mapped || from > to || to > r->len ||
+      (c = calloc(1, sizeof(*c))) == NULL)
+    return NULL;
+  c->in = r->in;
+  c->version = r->version;
+  c->mapped = c->shared = 1;
+  c->base = r->base;
+  c->size = r->size;
+  c->len  = to;
+  c->pos  = from;
+  return c;
+} /* RD_range */
+
+
+/*
+* Return the file position of the next record of 'r', or of the end of
+* the last one read, for uncompressed files.
+*/
+uint64_t RD_tell(RD_reader_t *r)
+{
+  return r->fpos + r->pos;
+} /* RD_tell */
+
+
+/*
+* Create seek index 'file'.  Returns 0 if ok, -1 on error.
+*/
+int RD_index_open(RD_index_t *x, const char *file)
+{
+  x->next = 0;
+  if (!(x->out = fopen(file, "wb"))) return -1;
+  fprintf(x->out, "#!rtpidx%s\n", RTPIDX_VERSION);
+  return 0;
+} /* RD_index_open */
+
+
+/*
+* Note record at file position 'pos' with 'offset_ns'; adds an index
+* entry for the first record of each interval.
+*/
+void RD_index_add(RD_index_t *x, uint64_t offset_ns, uint64_t pos)
+{
+  RD_index_entry_t e;
+
+  if (!x->out || offset_ns < x->next) return;
+  e.offset_hi = htonl(offset_ns >> 32);
+  e.offset_lo = htonl(offset_ns & 0xffffffff);
+  e.pos_hi    = htonl(pos >> 32);
+  e.pos_lo    = htonl(pos & 0xffffffff);
+  if (fwrite((char *)&e, sizeof(e), 1, x->out) < 1) {
+    perror("index");
+    fclose(x->out);
+    x->out = NULL;
+    return;
+  }
+  x->next = (offset_ns / RD_INDEX_INTERVAL + 1) * RD_INDEX_INTERVAL;
+} /* RD_index_add */
+
+
+/*
+* Close seek index.
+*/
+void RD_index_close(RD_index_t *x)
+{
+  if (x->out) fclose(x->out);
+  x->out = NULL;
+} /* RD_index_close */
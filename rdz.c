@@ -0,0 +1,713 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Compressed dump file blocks.  Within a block, each record is coded
+* against the one before it: a tag byte says what changed, followed
+* by the time offset as a delta, the data length and, for RTP, the
+* header as deltas of sequence number and timestamp.  Anything else
+* is kept as is, so decoding gives back the plain records byte for
+* byte.  Records that do not fit the scheme are stored raw.  Every
+* block starts from a zero state and decodes on its own.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* blocks are written with the best codec available, read with any */
+#if HAVE_ZSTD
+#define RDZ_CODEC RD_Z_ZSTD
+#elif HAVE_ZLIB
+#define RDZ_CODEC RD_Z_ZLIB
+#else
+#define RDZ_CODEC RD_Z_NONE
+#endif
+
+#include "rtpdump.h"
+#include "rdz.h"
+
+/* record tag bits */
+#define T_RAW  0x01   /* record stored as is */
+#define T_RTP  0x02   /* data starts with a coded RTP header */
+#define T_PLEN 0x04   /* plen differs from the data length */
+#define T_CTRL 0x08   /* RTCP, plen is 0 */
+#define T_META 0x10   /* flags or sender changed (version 2) */
+#define T_HDR  0x20   /* first two RTP header bytes changed */
+#define T_SSRC 0x40   /* SSRC changed */
+#define T_SEQ  0x80   /* sequence number did not advance by one */
+
+/* coding state, reset for every block */
+typedef struct {
+  uint64_t t;          /* offset of previous record, ms or ns */
+  uint32_t flags;
+  uint32_t source;     /* network order */
+  uint16_t port;       /* network order */
+  uint8_t b0, b1;      /* V/P/X/CC and M/PT */
+  uint16_t seq;
+  uint32_t ts, ssrc;
+} state_t;
+
+/* frame handed from the encoder to rdz_out_frame() */
+typedef struct {
+  uint32_t type;       /* 0 block, 1 end of file */
+  uint32_t count;
+  uint32_t ulen;
+  uint32_t padding;
+  uint64_t first;      /* ns */
+} frame_t;
+
+struct rdz_enc {
+  int version;
+  char *buf;           /* frame_t, then coded records */
+  size_t len, size;
+  uint32_t count, ulen;
+  state_t st;
+};
+
+struct rdz_out {
+  uint64_t pos;        /* file position of next block */
+  char *buf;
+  size_t size;
+  RD_index_entry_t *index;
+  uint32_t n, max;
+#if HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+#endif
+};
+
+
+static char *put_varint(char *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  return p;
+} /* put_varint */
+
+
+/*
+* Read varint at 'p' before 'end' into 'v'.  Returns NULL if truncated.
+*/
+static const char *get_varint(const char *p, const char *end, uint64_t *v)
+{
+  int shift = 0;
+
+  *v = 0;
+  while (p < end && shift < 64) {
+    *v |= (uint64_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) return p;
+    shift += 7;
+  }
+  return NULL;
+} /* get_varint */
+
+
+static uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+} /* zigzag */
+
+
+static int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+} /* unzigzag */
+
+
+/*
+* Create an encoder for records of file format 'version'.
+*/
+rdz_enc_t *rdz_enc_new(int version)
+{
+  rdz_enc_t *e = calloc(1, sizeof(rdz_enc_t));
+
+  if (!e) return 0;
+  e->version = version;
+  e->size = RDZ_BLOCK + RDZ_BLOCK / 4;
+  if (!(e->buf = malloc(e->size))) {
+    free(e);
+    return 0;
+  }
+  e->len = sizeof(frame_t);
+  return e;
+} /* rdz_enc_new */
+
+
+void rdz_enc_free(rdz_enc_t *e)
+{
+  if (!e) return;
+  free(e->buf);
+  free(e);
+} /* rdz_enc_free */
+
+
+/*
+* Add the record with header 'hdr' of 'hlen' bytes and 'len' bytes of
+* 'data', as it would be written to a plain file.  Returns 1 when the
+* block is full and should be taken with rdz_enc_frame(), -1 if out
+* of memory.
+*/
+int rdz_enc_add(rdz_enc_t *e, const void *hdr, size_t hlen,
+  const void *data, size_t len)
+{
+  const unsigned char *d = data;
+  RD_packet_t h1;
+  RD_packet2_t h2;
+  RD_source_t src;
+  size_t length = 0, plen = 0, minlen;
+  uint32_t flags = 0;
+  uint64_t t = e->st.t;
+  unsigned tag = 0;
+  char *p, *tp;
+  frame_t *f;
+
+  /* room for the worst case, a raw record */
+  if (e->len + hlen + len + 32 > e->size) {
+    size_t size = e->len + hlen + len + 32 + RDZ_BLOCK / 4;
+    char *buf = realloc(e->buf, size);
+
+    if (!buf) return -1;
+    e->buf = buf;
+    e->size = size;
+  }
+
+  minlen = e->version == 2 ? sizeof(h2) : sizeof(h1);
+  if (hlen < minlen) {
+    tag = T_RAW;
+  }
+  else if (e->version == 2) {
+    memcpy(&h2, hdr, sizeof(h2));
+    length = ntohs(h2.length);
+    plen   = ntohs(h2.plen);
+    flags  = ntohl(h2.flags);
+    t = (uint64_t)ntohl(h2.offset_hi) << 32 | ntohl(h2.offset_lo);
+    if (flags & RD_F_SOURCE) {
+      minlen += sizeof(src);
+      if (hlen >= minlen) memcpy(&src, (const char *)hdr + sizeof(h2), sizeof(src));
+      if (hlen < minlen || src.padding) tag = T_RAW;
+    }
+  }
+  else {
+    memcpy(&h1, hdr, sizeof(h1));
+    length = ntohs(h1.length);
+    plen   = ntohs(h1.plen);
+    t = ntohl(h1.offset);
+  }
+  if (hlen != minlen || length != hlen + len) tag = T_RAW;
+
+  if (e->count == 0) {
+    memset(&e->st, 0, sizeof(e->st));
+    e->st.t = t;
+    f = (frame_t *)e->buf;
+    f->first = e->version == 2 ? t : t * 1000000;
+  }
+  e->count++;
+  e->ulen += hlen + len;
+
+  p = tp = e->buf + e->len;
+  p++;
+  if (tag == T_RAW) {
+    p = put_varint(p, hlen + len);
+    memcpy(p, hdr, hlen);
+    memcpy(p + hlen, data, len);
+    *tp = T_RAW;
+    e->len = p + hlen + len - e->buf;
+    return e->ulen >= RDZ_BLOCK;
+  }
+
+  p = put_varint(p, zigzag((int64_t)(t - e->st.t)));
+  e->st.t = t;
+  p = put_varint(p, len);
+  if (plen == 0) tag |= T_CTRL;
+  else if (plen != len) {
+    tag |= T_PLEN;
+    p = put_varint(p, plen);
+  }
+  if (e->version == 2 && (flags != e->st.flags || ((flags & RD_F_SOURCE) &&
+      (src.source != e->st.source || src.port != e->st.port)))) {
+    tag |= T_META;
+    p = put_varint(p, flags);
+    e->st.flags = flags;
+    if (flags & RD_F_SOURCE) {
+      memcpy(p, &src.source, 4);
+      memcpy(p + 4, &src.port, 2);
+      p += 6;
+      e->st.source = src.source;
+      e->st.port = src.port;
+    }
+  }
+  if (plen != 0 && len >= 12 && (d[0] >> 6) == 2) {
+    uint16_t seq = d[2] << 8 | d[3];
+    uint32_t ts = (uint32_t)d[4] << 24 | d[5] << 16 | d[6] << 8 | d[7];
+    uint32_t ssrc;
+
+    memcpy(&ssrc, d + 8, 4);
+    tag |= T_RTP;
+    if (d[0] != e->st.b0 || d[1] != e->st.b1) {
+      tag |= T_HDR;
+      *p++ = d[0];
+      *p++ = d[1];
+      e->st.b0 = d[0];
+      e->st.b1 = d[1];
+    }
+    if (ssrc != e->st.ssrc) {
+      tag |= T_SSRC;
+      memcpy(p, &ssrc, 4);
+      p += 4;
+      e->st.ssrc = ssrc;
+    }
+    if ((uint16_t)(seq - e->st.seq) != 1) {
+      tag |= T_SEQ;
+      p = put_varint(p, zigzag((int16_t)(seq - e->st.seq)));
+    }
+    p = put_varint(p, zigzag((int32_t)(ts - e->st.ts)));
+    e->st.seq = seq;
+    e->st.ts = ts;
+    memcpy(p, d + 12, len - 12);
+    p += len - 12;
+  }
+  else {
+    memcpy(p, d, len);
+    p += len;
+  }
+  *tp = (char)tag;
+  e->len = p - e->buf;
+  return e->ulen >= RDZ_BLOCK;
+} /* rdz_enc_add */
+
+
+/*
+* Take the records added so far as a frame for rdz_out_frame().
+* Returns NULL if there are none.  The frame stays valid until the
+* next rdz_enc_add().
+*/
+const char *rdz_enc_frame(rdz_enc_t *e, size_t *len)
+{
+  frame_t *f = (frame_t *)e->buf;
+
+  if (e->count == 0) return NULL;
+  f->type  = 0;
+  f->count = e->count;
+  f->ulen  = e->ulen;
+  *len = e->len;
+  e->count = e->ulen = 0;
+  e->len = sizeof(frame_t);
+  return e->buf;
+} /* rdz_enc_frame */
+
+
+/*
+* Frame that ends the file with the block index.
+*/
+const char *rdz_end_frame(size_t *len)
+{
+  static frame_t end = { 1, 0, 0, 0, 0 };
+
+  *len = sizeof(end);
+  return (const char *)&end;
+} /* rdz_end_frame */
+
+
+/*
+* Create the compressing half for a file whose first block goes to
+* file position 'pos'.
+*/
+rdz_out_t *rdz_out_new(uint64_t pos)
+{
+  rdz_out_t *o = calloc(1, sizeof(rdz_out_t));
+
+  if (!o) return 0;
+  o->pos = pos;
+#if HAVE_ZSTD
+  if (!(o->cctx = ZSTD_createCCtx())) {
+    free(o);
+    return 0;
+  }
+#endif
+  return o;
+} /* rdz_out_new */
+
+
+void rdz_out_free(rdz_out_t *o)
+{
+  if (!o) return;
+#if HAVE_ZSTD
+  ZSTD_freeCCtx(o->cctx);
+#endif
+  free(o->buf);
+  free(o->index);
+  free(o);
+} /* rdz_out_free */
+
+
+/*
+* Make room for 'size' bytes of output in 'o'.
+*/
+static int out_room(rdz_out_t *o, size_t size)
+{
+  char *buf;
+
+  if (size <= o->size) return 0;
+  if (!(buf = realloc(o->buf, size))) return -1;
+  o->buf = buf;
+  o->size = size;
+  return 0;
+} /* out_room */
+
+
+static void put_block(char *p, uint32_t magic, int codec, uint32_t count,
+  uint32_t clen, uint32_t dlen, uint32_t ulen, uint64_t first)
+{
+  RD_zblock_t h;
+
+  memset(&h, 0, sizeof(h));
+  h.magic    = htonl(magic);
+  h.codec    = codec;
+  h.count    = htonl(count);
+  h.clen     = htonl(clen);
+  h.dlen     = htonl(dlen);
+  h.ulen     = htonl(ulen);
+  h.first_hi = htonl(first >> 32);
+  h.first_lo = htonl(first & 0xffffffff);
+  memcpy(p, &h, sizeof(h));
+} /* put_block */
+
+
+/*
+* Turn 'frame' of 'len' bytes into the bytes to write, returned in
+* 'out'.  Has the signature of a writer_encode_t, 'ctx' is the
+* rdz_out_t.  Exits if out of memory.
+*/
+size_t rdz_out_frame(void *ctx, const char *frame, size_t len,
+  const char **out)
+{
+  rdz_out_t *o = ctx;
+  const frame_t *f = (const frame_t *)frame;
+  const char *d = frame + sizeof(frame_t);
+  size_t dlen = len - sizeof(frame_t), clen, total;
+  int codec = RDZ_CODEC;
+  RD_ztrailer_t tr;
+  uint32_t i;
+
+  /* end of file: block index and trailer */
+  if (f->type == 1) {
+    total = sizeof(RD_zblock_t) + o->n * sizeof(RD_index_entry_t) +
+      sizeof(tr);
+    if (out_room(o, total) < 0) {
+      perror("rdz_out_frame");
+      exit(1);
+    }
+    put_block(o->buf, RD_ZINDEX_MAGIC, RD_Z_NONE, o->n,
+      o->n * sizeof(RD_index_entry_t), 0, 0, 0);
+    memcpy(o->buf + sizeof(RD_zblock_t), o->index,
+      o->n * sizeof(RD_index_entry_t));
+    tr.magic  = htonl(RD_ZTRAIL_MAGIC);
+    tr.count  = htonl(o->n);
+    tr.pos_hi = htonl(o->pos >> 32);
+    tr.pos_lo = htonl(o->pos & 0xffffffff);
+    memcpy(o->buf + total - sizeof(tr), &tr, sizeof(tr));
+    o->pos += total;
+    *out = o->buf;
+    return total;
+  }
+
+#if HAVE_ZSTD
+  clen = ZSTD_compressBound(dlen);
+#elif HAVE_ZLIB
+  clen = compressBound(dlen);
+#else
+  clen = dlen;
+#endif
+  if (clen < dlen) clen = dlen;
+  if (out_room(o, sizeof(RD_zblock_t) + clen) < 0) {
+    perror("rdz_out_frame");
+    exit(1);
+  }
+#if HAVE_ZSTD
+  clen = ZSTD_compressCCtx(o->cctx, o->buf + sizeof(RD_zblock_t), clen,
+    d, dlen, 3);
+  if (ZSTD_isError(clen)) clen = dlen;
+#elif HAVE_ZLIB
+  {
+    uLongf n = clen;
+
+    clen = compress2((Bytef *)o->buf + sizeof(RD_zblock_t), &n,
+      (const Bytef *)d, dlen, 1) == Z_OK ? n : dlen;
+  }
+#endif
+  /* keep incompressible blocks as they are */
+  if (clen >= dlen) {
+    codec = RD_Z_NONE;
+    clen = dlen;
+    memcpy(o->buf + sizeof(RD_zblock_t), d, dlen);
+  }
+  put_block(o->buf, RD_ZBLOCK_MAGIC, codec, f->count, clen, dlen, f->ulen,
+    f->first);
+
+  /* note block in the index */
+  if (o->n == o->max) {
+    RD_index_entry_t *x = realloc(o->index,
+      (o->max + 256) * sizeof(RD_index_entry_t));
+
+    if (!x) {
+      perror("rdz_out_frame");
+      exit(1);
+    }
+    o->index = x;
+    o->max += 256;
+  }
+  i = o->n++;
+  o->index[i].offset_hi = htonl(f->first >> 32);
+  o->index[i].offset_lo = htonl(f->first & 0xffffffff);
+  o->index[i].pos_hi    = htonl(o->pos >> 32);
+  o->index[i].pos_lo    = htonl(o->pos & 0xffffffff);
+
+  total = sizeof(RD_zblock_t) + clen;
+  o->pos += total;
+  *out = o->buf;
+  return total;
+} /* rdz_out_frame */
+
+
+/*
+* Parse block header at 'p' into 'b'.  Returns 1 for a block, 0 for
+* the block index and -1 if invalid.
+*/
+int rdz_parse(const void *p, rdz_block_t *b)
+{
+  RD_zblock_t h;
+  uint32_t magic;
+
+  memcpy(&h, p, sizeof(h));
+  magic    = ntohl(h.magic);
+  b->codec = h.codec;
+  b->count = ntohl(h.count);
+  b->clen  = ntohl(h.clen);
+  b->dlen  = ntohl(h.dlen);
+  b->ulen  = ntohl(h.ulen);
+  b->first = (uint64_t)ntohl(h.first_hi) << 32 | ntohl(h.first_lo);
+  if (magic == RD_ZINDEX_MAGIC) return 0;
+  if (magic != RD_ZBLOCK_MAGIC || b->clen > 64 * RDZ_BLOCK ||
+      b->dlen > 64 * RDZ_BLOCK || b->ulen > 64 * RDZ_BLOCK)
+    return -1;
+  return 1;
+} /* rdz_parse */
+
+
+/*
+* Decode block 'b' of a file of 'version' from the 'clen' bytes at
+* 'in' into the 'ulen' bytes of plain records at 'out'.  '*tmp' of
+* '*tmpsize' bytes is a scratch buffer that is grown as needed.
+* Returns 0 if ok, -1 for a corrupt or unsupported block.
+*/
+int rdz_decode(const rdz_block_t *b, int version, const char *in,
+  char *out, char **tmp, size_t *tmpsize)
+{
+  const char *p, *end;
+  char *o = out, *oend = out + b->ulen;
+  state_t st;
+  uint64_t v, len, plen;
+  uint32_t i, flags;
+  unsigned tag;
+
+  /* undo compression */
+  switch (b->codec) {
+  case RD_Z_NONE:
+    if (b->clen != b->dlen) return -1;
+    p = in;
+    break;
+#if HAVE_ZLIB
+  case RD_Z_ZLIB:
+#endif
+#if HAVE_ZSTD
+  case RD_Z_ZSTD:
+#endif
+#if HAVE_ZLIB || HAVE_ZSTD
+    if (*tmpsize < b->dlen) {
+      char *t = realloc(*tmp, b->dlen);
+
+      if (!t) return -1;
+      *tmp = t;
+      *tmpsize = b->dlen;
+    }
+#if HAVE_ZLIB
+    if (b->codec == RD_Z_ZLIB) {
+      uLongf n = b->dlen;
+
+      if (uncompress((Bytef *)*tmp, &n, (const Bytef *)in, b->clen) != Z_OK ||
+          n != b->dlen)
+        return -1;
+    }
+#endif
+#if HAVE_ZSTD
+    if (b->codec == RD_Z_ZSTD &&
+        ZSTD_decompress(*tmp, b->dlen, in, b->clen) != b->dlen)
+      return -1;
+#endif
+    p = *tmp;
+    break;
+#endif
+  default:
+    fprintf(stderr, "rdz: block compressed with unsupported codec %d\n",
+      b->codec);
+    return -1;
+  }
+  end = p + b->dlen;
+
+  /* undo delta coding */
+  memset(&st, 0, sizeof(st));
+  st.t = version == 2 ? b->first : b->first / 1000000;
+  for (i = 0; i < b->count; i++) {
+    if (p >= end) return -1;
+    tag = (unsigned char)*p++;
+    if (tag & T_RAW) {
+      if (!(p = get_varint(p, end, &len)) || len > (uint64_t)(end - p) ||
+          len > (uint64_t)(oend - o))
+        return -1;
+      memcpy(o, p, len);
+      o += len;
+      p += len;
+      continue;
+    }
+    if (!(p = get_varint(p, end, &v))) return -1;
+    st.t += unzigzag(v);
+    if (!(p = get_varint(p, end, &len))) return -1;
+    plen = len;
+    if (tag & T_CTRL) plen = 0;
+    else if ((tag & T_PLEN) && !(p = get_varint(p, end, &plen))) return -1;
+    if (tag & T_META) {
+      if (!(p = get_varint(p, end, &v))) return -1;
+      st.flags = (uint32_t)v;
+      if (st.flags & RD_F_SOURCE) {
+        if (end - p < 6) return -1;
+        memcpy(&st.source, p, 4);
+        memcpy(&st.port, p + 4, 2);
+        p += 6;
+      }
+    }
+    flags = version == 2 ? st.flags : 0;
+
+    /* record header */
+    if (version == 2) {
+      RD_packet2_t h2;
+      RD_source_t src;
+      size_t hlen = sizeof(h2) + (flags & RD_F_SOURCE ? sizeof(src) : 0);
+
+      if (hlen + len > 0xffff || (uint64_t)(oend - o) < hlen + len) return -1;
+      h2.length    = htons(hlen + len);
+      h2.plen      = htons(plen);
+      h2.flags     = htonl(flags);
+      h2.offset_hi = htonl(st.t >> 32);
+      h2.offset_lo = htonl(st.t & 0xffffffff);
+      memcpy(o, &h2, sizeof(h2));
+      o += sizeof(h2);
+      if (flags & RD_F_SOURCE) {
+        src.source  = st.source;
+        src.port    = st.port;
+        src.padding = 0;
+        memcpy(o, &src, sizeof(src));
+        o += sizeof(src);
+      }
+    }
+    else {
+      RD_packet_t h1;
+
+      if (sizeof(h1) + len > 0xffff || (uint64_t)(oend - o) < sizeof(h1) + len)
+        return -1;
+      h1.length = htons(sizeof(h1) + len);
+      h1.plen   = htons(plen);
+      h1.offset = htonl((uint32_t)st.t);
+      memcpy(o, &h1, sizeof(h1));
+      o += sizeof(h1);
+    }
+
+    /* record data */
+    if (tag & T_RTP) {
+      uint16_t seq;
+
+      if (len < 12) return -1;
+      if (tag & T_HDR) {
+        if (end - p < 2) return -1;
+        st.b0 = p[0];
+        st.b1 = p[1];
+        p += 2;
+      }
+      if (tag & T_SSRC) {
+        if (end - p < 4) return -1;
+        memcpy(&st.ssrc, p, 4);
+        p += 4;
+      }
+      if (tag & T_SEQ) {
+        if (!(p = get_varint(p, end, &v))) return -1;
+        st.seq += (uint16_t)unzigzag(v);
+      }
+      else st.seq++;
+      if (!(p = get_varint(p, end, &v))) return -1;
+      st.ts += (uint32_t)unzigzag(v);
+      seq = st.seq;
+      o[0] = st.b0;
+      o[1] = st.b1;
+      o[2] = seq >> 8;
+      o[3] = seq & 0xff;
+      o[4] = st.ts >> 24;
+      o[5] = (st.ts >> 16) & 0xff;
+      o[6] = (st.ts >> 8) & 0xff;
+      o[7] = st.ts & 0xff;
+      memcpy(o + 8, &st.ssrc, 4);
+      o += 12;
+      len -= 12;
+    }
+    if ((uint64_t)(end - p) < len) return -1;
+    memcpy(o, p, len);
+    o += len;
+    p += len;
+  }
+  return o == oend && p == end ? 0 : -1;
+} /* rdz_decode */
@@ -0,0 +1,77 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Compressed dump files: delta coding and compression of record
+* blocks, and their decoding.  The file format is in rtpdump.h.
+*
+* The writing side has two halves, so that compression can run in the
+* writer thread: an encoder delta-codes records into a frame, and
+* rdz_out_frame() turns each frame into a compressed block and keeps
+* the block index, which the end frame writes out.
+*/
+#ifndef RDZ_H
+#define RDZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RDZ_BLOCK (256 * 1024)  /* plain record bytes per block */
+
+typedef struct rdz_enc rdz_enc_t;
+typedef struct rdz_out rdz_out_t;
+
+/* RD_zblock_t in host byte order */
+typedef struct {
+  int codec;           /* RD_Z_* */
+  uint32_t count;      /* records, or index entries */
+  uint32_t clen;       /* bytes that follow */
+  uint32_t dlen;       /* bytes of delta-coded records */
+  uint32_t ulen;       /* bytes of plain records */
+  uint64_t first;      /* offset of first record (ns) */
+} rdz_block_t;
+
+extern rdz_enc_t *rdz_enc_new(int version);
+extern void rdz_enc_free(rdz_enc_t *e);
+extern int rdz_enc_add(rdz_enc_t *e, const void *hdr, size_t hlen,
+  const void *data, size_t len);
+extern const char *rdz_enc_frame(rdz_enc_t *e, size_t *len);
+extern const char *rdz_end_frame(size_t *len);
+
+extern rdz_out_t *rdz_out_new(uint64_t pos);
+extern void rdz_out_free(rdz_out_t *o);
+extern size_t rdz_out_frame(void *o, const char *frame, size_t len,
+  const char **out);
+
+extern int rdz_parse(const void *p, rdz_block_t *b);
+extern int rdz_decode(const rdz_block_t *b, int version, const char *in,
+  char *out, char **tmp, size_t *tmpsize);
+
+#endif /* RDZ_H */
@@ -0,0 +1,373 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Reordering and removal of duplicates of RTP packets, see reorder.h.
+* Packets that arrive in order are passed on without being copied;
+* only those that overtake a missing one are held in the ring.  The
+* ring also remembers the sequence numbers it passed on, so that a
+* second copy, as from a redundant stream, is told from one that
+* merely came too late.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sysdep.h"
+#include "ssrcmap.h"
+#include "reorder.h"
+
+#define MASK (REORDER_SLOTS - 1)
+#define FIFO (2 * REORDER_SLOTS)
+
+enum {EMPTY, HELD, SENT, LOST};
+
+typedef struct {
+  int state;
+  uint16_t seq;
+  uint64_t arrival;         /* of a held packet, ns */
+  reorder_packet_t p;       /* data is the buffer below */
+  int size;                 /* of 'p.data' */
+} slot_t;
+
+typedef struct {
+  slot_t *slot;             /* REORDER_SLOTS, by sequence number */
+  uint16_t next;            /* lowest sequence number not passed on */
+  int held;                 /* packets in the ring */
+  uint16_t *fifo;           /* sequence numbers held, in arrival order */
+  unsigned head, tail;      /* some may have been passed on since */
+} stream_t;
+
+struct reorder {
+  ssrcmap_t *streams;
+  uint64_t hold_ns;
+  reorder_emit_t emit;
+  void *arg;
+  reorder_stats_t st;
+  uint64_t due;             /* earliest hold time ending, see flush() */
+};
+
+
+/*
+* Reorder packets, holding them for up to 'hold_ns', and pass each
+* on to function 'emit' with 'arg'.
+*/
+reorder_t *reorder_new(uint64_t hold_ns, reorder_emit_t emit, void *arg)
+{
+  reorder_t *r = calloc(1, sizeof(*r));
+
+  if (!r) return NULL;
+  if (!(r->streams = ssrcmap_new(sizeof(stream_t)))) {
+    free(r);
+    return NULL;
+  }
+  r->hold_ns = hold_ns;
+  r->emit = emit;
+  r->arg = arg;
+  return r;
+} /* reorder_new */
+
+
+/*
+* Pass on the packet in slot 'e' of stream 't'.
+*/
+static void send_slot(reorder_t *r, stream_t *t, slot_t *e)
+{
+  r->emit(r->arg, &e->p);
+  r->st.packets++;
+  r->st.held++;
+  e->state = SENT;
+  t->held--;
+} /* send_slot */
+
+
+/*
+* Pass on the packets held in stream 't' that are next in sequence.
+*/
+static void drain(reorder_t *r, stream_t *t)
+{
+  slot_t *e;
+
+  for (e = &t->slot[t->next & MASK]; e->state == HELD && e->seq == t->next;
+       e = &t->slot[t->next & MASK]) {
+    send_slot(r, t, e);
+    t->next++;
+  }
+} /* drain */
+
+
+/*
+* Move the start of the window of stream 't' to sequence number 'to':
+* pass on what is held before it, in order, and give up on the rest.
+*/
+static void advance(reorder_t *r, stream_t *t, uint16_t to)
+{
+  slot_t *e;
+
+  for (; t->next != to; t->next++) {
+    e = &t->slot[t->next & MASK];
+    if (e->state == HELD && e->seq == t->next) send_slot(r, t, e);
+    else {
+      e->state = LOST;
+      e->seq = t->next;
+      r->st.lost++;
+    }
+  }
+} /* advance */
+
+
+/*
+* Start stream 't' over at sequence number 'seq': pass on what is
+* held, in order.  The sequence numbers skipped are not lost, only
+* left behind, so the walk stops at the last packet held.
+*/
+static void restart(reorder_t *r, stream_t *t, uint16_t seq)
+{
+  slot_t *e;
+  int i;
+
+  for (i = 0; t->held > 0 && i < REORDER_SLOTS; i++, t->next++) {
+    e = &t->slot[t->next & MASK];
+    if (e->state == HELD && e->seq == t->next) send_slot(r, t, e);
+  }
+  t->next = seq;
+} /* restart */
+
+
+/*
+* Copy packet 'p' with sequence number 'seq' into its slot of stream
+* 't', to wait for the ones before it.
+*/
+static void hold(reorder_t *r, stream_t *t, uint16_t seq, uint64_t now_ns,
+  reorder_packet_t *p)
+{
+  slot_t *e = &t->slot[seq & MASK];
+  char *data;
+
+  if (e->size < p->len) {
+    if (!(data = realloc(e->p.data, p->len))) {
+      /* cannot hold it: better out of order than lost */
+      r->emit(r->arg, p);
+      r->st.packets++;
+      return;
+    }
+    e->p.data = data;
+    e->size = p->len;
+  }
+  data = e->p.data;
+  e->p = *p;
+  e->p.data = data;
+  memcpy(data, p->data, p->len);
+  e->state = HELD;
+  e->seq = seq;
+  e->arrival = now_ns;
+  t->held++;
+
+  /* a full list of hold times ends the oldest one early */
+  if (t->tail - t->head == FIFO) {
+    uint16_t first = t->fifo[t->head++ % FIFO];
+
+    e = &t->slot[first & MASK];
+    if (e->state == HELD && e->seq == first) {
+      advance(r, t, first + 1);
+      drain(r, t);
+    }
+  }
+  t->fifo[t->tail++ % FIFO] = seq;
+  if (r->due == 0 || now_ns + r->hold_ns < r->due)
+    r->due = now_ns + r->hold_ns;
+} /* hold */
+
+
+/*
+* Take packet 'p', received at 'now_ns': pass it on, hold it or drop
+* it.  Packets that are not RTP version 2 are passed on as they are.
+*/
+void reorder_put(reorder_t *r, uint64_t now_ns, reorder_packet_t *p)
+{
+  const unsigned char *b = (const unsigned char *)p->data;
+  uint32_t ssrc;
+  uint16_t seq;
+  stream_t *t;
+  slot_t *e;
+  int d;
+
+  if (p->len < 12 || (b[0] >> 6) != 2) {
+    r->emit(r->arg, p);
+    r->st.packets++;
+    return;
+  }
+  seq  = b[2] << 8 | b[3];
+  ssrc = (uint32_t)b[8] << 24 | b[9] << 16 | b[10] << 8 | b[11];
+
+  if (!(t = ssrcmap_find(r->streams, ssrc))) {
+    if (!(t = ssrcmap_insert(r->streams, ssrc)) ||
+        !(t->slot = calloc(REORDER_SLOTS, sizeof(slot_t))) ||
+        !(t->fifo = malloc(FIFO * sizeof(uint16_t)))) {
+      if (t) {
+        free(t->slot);
+        ssrcmap_remove(r->streams, ssrc);
+      }
+      r->emit(r->arg, p);
+      r->st.packets++;
+      return;
+    }
+    t->next = seq;
+  }
+
+  d = (int16_t)(seq - t->next);
+  if (d < 0) {
+    if (d >= -REORDER_SLOTS) {
+      e = &t->slot[seq & MASK];
+      if (e->state == SENT && e->seq == seq) r->st.duplicates++;
+      else r->st.late++;
+      return;
+    }
+    /* far behind: the source started over */
+    restart(r, t, seq);
+    d = 0;
+  }
+  else if (d >= REORDER_SLOTS) {
+    advance(r, t, seq - REORDER_SLOTS + 1);
+    drain(r, t);
+  }
+
+  e = &t->slot[seq & MASK];
+  if (e->state == HELD && e->seq == seq) {
+    r->st.duplicates++;
+    return;
+  }
+  if (seq != t->next) {
+    hold(r, t, seq, now_ns, p);
+    return;
+  }
+  r->emit(r->arg, p);
+  r->st.packets++;
+  e->state = SENT;
+  e->seq = seq;
+  t->next++;
+  drain(r, t);
+} /* reorder_put */
+
+
+typedef struct {
+  reorder_t *r;
+  uint64_t now_ns;          /* UINT64_MAX to pass on everything */
+  uint64_t due;
+} flush_t;
+
+/*
+* Pass on the packets of stream 'entry' held for the hold time, with
+* all before them.
+*/
+static int flush(uint32_t ssrc, void *entry, void *arg)
+{
+  flush_t *f = arg;
+  stream_t *t = entry;
+  reorder_t *r = f->r;
+  slot_t *e;
+  uint16_t seq;
+
+  while (t->head != t->tail) {
+    seq = t->fifo[t->head % FIFO];
+    e = &t->slot[seq & MASK];
+    if (e->state != HELD || e->seq != seq) {
+      t->head++;            /* passed on already */
+      continue;
+    }
+    if (f->now_ns != UINT64_MAX && e->arrival + r->hold_ns > f->now_ns) {
+      if (f->due == 0 || e->arrival + r->hold_ns < f->due)
+        f->due = e->arrival + r->hold_ns;
+      break;
+    }
+    advance(r, t, seq + 1);
+    drain(r, t);
+    t->head++;
+  }
+  return 0;
+} /* flush */
+
+
+/*
+* Pass on what has been held for the hold time at 'now_ns'.  Returns
+* when the next hold time ends, 0 if nothing is held.
+*/
+uint64_t reorder_flush(reorder_t *r, uint64_t now_ns)
+{
+  flush_t f;
+
+  if (r->due == 0 || r->due > now_ns) return r->due;
+  f.r = r;
+  f.now_ns = now_ns;
+  f.due = 0;
+  ssrcmap_foreach(r->streams, flush, &f);
+  r->due = f.due;
+  return r->due;
+} /* reorder_flush */
+
+
+void reorder_stats(reorder_t *r, reorder_stats_t *st)
+{
+  *st = r->st;
+} /* reorder_stats */
+
+
+/*
+* Free stream 'entry' after passing on what it holds.
+*/
+static int release(uint32_t ssrc, void *entry, void *arg)
+{
+  stream_t *t = entry;
+  int i;
+
+  flush(ssrc, entry, arg);
+  for (i = 0; i < REORDER_SLOTS; i++) free(t->slot[i].p.data);
+  free(t->slot);
+  free(t->fifo);
+  return 1;
+} /* release */
+
+
+/*
+* Pass on all packets still held and free reorderer 'r'.
+*/
+void reorder_free(reorder_t *r)
+{
+  flush_t f;
+
+  if (!r) return;
+  f.r = r;
+  f.now_ns = UINT64_MAX;
+  f.due = 0;
+  ssrcmap_foreach(r->streams, release, &f);
+  ssrcmap_free(r->streams);
+  free(r);
+} /* reorder_free */
@@ -0,0 +1,75 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Reordering and removal of duplicates of RTP packets, per SSRC,
+* before they are recorded.  Each source has a ring of packets indexed
+* by sequence number; a packet is passed on as soon as all before it
+* have been, or once it has been held for the hold time, giving up on
+* the ones still missing.
+*/
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define REORDER_SLOTS 4096  /* packets per source, a power of two */
+
+typedef struct reorder reorder_t;
+
+/* a packet, as received */
+typedef struct {
+  struct timespec ts;       /* receive time */
+  uint32_t addr;            /* sender, network byte order */
+  uint16_t port;
+  uint32_t flags;           /* RD_F_HWTIME */
+  int len;
+  char *data;
+} reorder_packet_t;
+
+typedef struct {
+  uint64_t packets;         /* passed on */
+  uint64_t held;            /* ... after waiting for an earlier one */
+  uint64_t duplicates;      /* dropped, seen before */
+  uint64_t late;            /* dropped, arrived after their turn */
+  uint64_t lost;            /* sequence numbers given up on */
+} reorder_stats_t;
+
+typedef void (*reorder_emit_t)(void *arg, reorder_packet_t *p);
+
+extern reorder_t *reorder_new(uint64_t hold_ns, reorder_emit_t emit,
+  void *arg);
+extern void reorder_free(reorder_t *r);
+extern void reorder_put(reorder_t *r, uint64_t now_ns, reorder_packet_t *p);
+extern uint64_t reorder_flush(reorder_t *r, uint64_t now_ns);
+extern void reorder_stats(reorder_t *r, reorder_stats_t *st);
+
+#endif /* REORDER_H */
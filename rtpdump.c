@@ -28,6 +28,8 @@
  * SUCH DAMAGE.
  */
 
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
 #include <sys/types.h>
 #include <stdlib.h>
 
@@ -38,6 +40,10 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#if HAVE_TIMESTAMPING
+#include <linux/net_tstamp.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <err.h>
@@ -47,14 +53,30 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include "rtp.h"
 #include "vat.h"
 #include "payload.h"
+#include "rtpparse.h"
+#include "fmt.h"
 #include "rtpdump.h"
-#include "sysdep.h"
+#include "writer.h"
+#include "rdz.h"
+#include "stats.h"
+#include "filter.h"
+#include "reorder.h"
+#include "counters.h"
+#include "trace.h"
+#if HAVE_TPACKET
+#include "tpacket.h"
+#endif
 
-#define RTPFILE_VERSION "1.0"
+/* -j: worker threads over a mapped file, output collected in memory */
+#define HAVE_PARALLEL (HAVE_PTHREAD && HAVE_MMAP)
+#if HAVE_PARALLEL
+#include <pthread.h>
+#endif
 
 extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 extern struct pt payload[];
@@ -62,6 +84,66 @@ extern struct pt payload[];
 typedef uint32_t member_t;
 
 static int verbose = 0; /* decode */
+static int version = 1; /* dump file format version */
+static int in_version;  /* ... of the input file */
+static filter_t filter; /* records to process from a file, -s */
+static int filtering;
+
+/*
+* A capture session: one address/port and its output file.  Reading
+* from a file, there is a single session.
+*/
+typedef struct {
+  int sock[2];              /* data and control socket, -1 if unused */
+  struct sockaddr_in rtp;   /* address for the file header */
+  char *name;               /* output file name, NULL for stdout */
+  int seq;                  /* number of the current file, from 0 */
+  char *file;               /* name of the current file */
+  FILE *out;                /* output file, NULL to collect in 'mem' */
+  char *mem;                /* output of a -j chunk */
+  size_t mlen, msize;
+  struct timeval base;      /* time that record offsets are relative to */
+  writer_file_t *wf;        /* buffered dump records, if any */
+  RD_index_t idx;           /* seek index being written */
+  uint64_t opos;            /* output file position, before compression */
+  rdz_enc_t *z;             /* block being compressed, with -Z */
+  rdz_out_t *zout;
+  fmt_t *text;              /* text output being formatted */
+  struct sockaddr_in from;  /* last sender shown ... */
+  char from_text[24];       /* ... as "address:port", "" if none yet */
+  stats_t *stats;           /* per-SSRC statistics of the current file */
+  counters_t *counters[2];  /* of the sockets, capturing */
+} session_t;
+
+/* counters of the writer and file of session 's' */
+#define SESSION_COUNTERS(s) ((s)->counters[0] ? (s)->counters[0] : \
+  (s)->counters[1])
+
+/* an output file that is done with, to be closed and compressed */
+typedef struct {
+  FILE *out;
+  char *file;
+  rdz_out_t *zout;
+} finished_t;
+
+static writer_t *writer;    /* shared by all sessions */
+static size_t wsize = 0;    /* writer ring size per session */
+static int wflags = 0;      /* WRITER_DROP, WRITER_DIRECT */
+static int write_index = 0; /* write seek index with dump */
+static int zdump = 0;       /* write compressed dump files */
+static char *compress;      /* command run on each finished file */
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t report; /* SIGUSR1: dump the counters */
+static reorder_t *reorder;  /* -q: RTP packets to session 0 go through it */
+
+/* dump file record header, either version */
+typedef union {
+  RD_packet_t v1;
+  struct {
+    RD_packet2_t hdr;
+    RD_source_t source;
+  } v2;
+} record_t;
 
 typedef enum {
 	F_invalid,
@@ -71,22 +153,39 @@ typedef enum {
 	F_rtcp,
 	F_short,
 	F_payload,
-	F_ascii
+	F_ascii,
+	F_index,
+	F_stats
 } t_format;
 
 static void usage(const char *argv0)
 {
   fprintf(stderr, "usage: %s "
-	"[-F hex|ascii|rtcp|short|payload|dump|header] "
-	"[-f infile] [-o outfile] [-t minutes] [-x bytes] "
-	"[address]/port > file\n", argv0);
+	"[-DIZ] [-B kbytes] [-F hex|ascii|rtcp|short|payload|dump|header|index|stats] "
+	"[-f infile] [-i interface] [-j threads] [-M [address/]port] [-m seconds] "
+	"[-O block|drop] [-o outfile] [-q msec] [-R kbytes] [-r minutes] "
+	"[-s filter] "
+	"[-t minutes] [-V version] [-x bytes] [-z command] "
+	"[address]/port [...] > file\n", argv0);
 }
 
 
+/*
+* Buffered output and held packets are written out before exiting; see
+* main().
+*/
 static void done(int sig)
 {
-  exit(0);
+  if (!writer && !reorder) exit(0);
+  stop = 1;
+}
+
+#ifdef SIGUSR1
+static void report_signal(int sig)
+{
+  report = 1;
 }
+#endif
 
 /*
 * Convert timeval 'a' to double.
@@ -97,17 +196,58 @@ static double tdbl(struct timeval *a)
 }
 
 
+#if HAVE_RECVMMSG
 /*
-* Print buffer 'buf' of length 'len' bytes in hex format to file 'out'.
+* Receive timestamps for batched capture, see receive_batch().
+* SO_TIMESTAMPING delivers software, (deprecated) and raw hardware
+* timestamps; the latter is only set if the interface has hardware
+* timestamping enabled, and then is used in preference.
 */
-static void hex(FILE *out, char *buf, int len)
-{
-  int i;
+#if HAVE_TIMESTAMPING
+#define TS_TYPE  SCM_TIMESTAMPING
+#define TS_SIZE  (3 * sizeof(struct timespec))
+#elif HAVE_TIMESTAMPNS
+#define TS_TYPE  SCM_TIMESTAMPNS
+#define TS_SIZE  sizeof(struct timespec)
+#elif defined(SO_TIMESTAMP)
+#define TS_TYPE  SCM_TIMESTAMP
+#define TS_SIZE  sizeof(struct timeval)
+#endif
 
-  for (i = 0; i < len; i++) {
-    fprintf(out, "%02x", (unsigned char)buf[i]);
-  }
-} /* hex */
+/* and the drop count of the socket, see packet_drops() */
+#ifdef TS_TYPE
+#ifdef SO_RXQ_OVFL
+#define CONTROL_SIZE (CMSG_SPACE(TS_SIZE) + CMSG_SPACE(sizeof(uint32_t)))
+#else
+#define CONTROL_SIZE CMSG_SPACE(TS_SIZE)
+#endif
+#endif
+
+
+/*
+* Enable per-packet receive timestamps on socket 'sock'.
+*/
+static void set_timestamp(int sock)
+{
+#ifdef TS_TYPE
+  int one = 1;
+
+#if HAVE_TIMESTAMPING
+  one = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+        SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, (char *) &one,
+      sizeof(one)) == -1)
+#elif HAVE_TIMESTAMPNS
+  if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (char *) &one,
+      sizeof(one)) == -1)
+#else
+  if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, (char *) &one,
+      sizeof(one)) == -1)
+#endif
+    perror("setsockopt: timestamp");
+#endif
+} /* set_timestamp */
+#endif /* HAVE_RECVMMSG */
 
 
 /*
@@ -174,6 +314,15 @@ static int open_network(char *host, int data, int sock[], struct
       }
     }
 
+#if HAVE_RECVMMSG
+    set_timestamp(sock[i]);
+#endif
+#if defined(SO_RXQ_OVFL) && defined(CONTROL_SIZE)
+    if (setsockopt(sock[i], SOL_SOCKET, SO_RXQ_OVFL, (char *) &one,
+           sizeof(one)) == -1)
+      perror("setsockopt: SO_RXQ_OVFL");
+#endif
+
     if (IN_CLASSD(ntohl(mreq.imr_multiaddr.s_addr))) {
       if (setsockopt(sock[i], IPPROTO_IP,
         IP_ADD_MEMBERSHIP, (char *)&mreq, sizeof(mreq)) < 0) {
@@ -196,7 +345,8 @@ static void rtpdump_header(FILE *out, struct sockaddr_in *sin,
 {
   RD_hdr_t hdr;
 
-  fprintf(out, "#!rtpplay%s %s/%d\n", RTPFILE_VERSION,
+  fprintf(out, "#!rtpplay%s%s %s/%d\n",
+    version == 2 ? RTPFILE_VERSION2 : RTPFILE_VERSION, zdump ? RTPFILE_Z : "",
     inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
   hdr.start.tv_sec  = htonl(start->tv_sec);
   hdr.start.tv_usec = htonl(start->tv_usec);
@@ -213,129 +363,190 @@ static void rtpdump_header(FILE *out, struct sockaddr_in *sin,
 /*
 * Return type of packet, either "RTP", "RTCP", "VATD" or "VATC".
 */
-static const char *parse_type(int type, char *buf)
+static const char *parse_type(int type, char *buf, int len)
 {
-  if (type == 0) {
-    rtp_hdr_t *r = (rtp_hdr_t *)buf;
-    return r->version == RTP_VERSION ? "RTP" : "VATD";
-  }
-  else {
-    rtcp_t *r = (rtcp_t *)buf;
-    return r->common.version == RTP_VERSION ? "RTCP" : "VATC";
-  }
+  int v = len > 0 ? (unsigned char)buf[0] >> 6 : -1;
+
+  if (type == 0) return v == RTP_VERSION ? "RTP" : "VATD";
+  else return v == RTP_VERSION ? "RTCP" : "VATC";
 } /* parse_type */
 
 
 /*
-* Return header length of RTP packet contained in 'buf'.
+* Show data packet contents.  Return header length.
 */
-static int parse_header(char *buf)
+static int parse_data(fmt_t *out, char *buf, int len)
 {
-  rtp_hdr_t *r = (rtp_hdr_t *)buf;
-  rtp_hdr_ext_t *ext;
-  int ext_len;
-  int hlen = 0;
+  rtp_info_t r;
+  struct pt *pt;
+  int i, n;
 
-  if (r->version == 0) {
-    vat_hdr_t *v = (vat_hdr_t *)buf;
-    hlen = 8 + v->nsid * 4;
+  rtp_parse(buf, len, &r);
+
+  /* Show vat format packets. */
+  if (r.version == 0) {
+    fmt_str(out, "nsid=");
+    fmt_ulong(out, r.nsid);
+    fmt_str(out, " flags=0x");
+    fmt_xlong(out, r.flags);
+    fmt_str(out, " confid=");
+    fmt_ulong(out, r.confid);
+    fmt_str(out, " ts=");
+    fmt_ulong(out, r.vts);
+    fmt_char(out, '\n');
   }
-  else if (r->version == RTP_VERSION) {
-    hlen = 12 + r->cc * 4;
-    if (r->x) {  /* header extension */
-      ext = (rtp_hdr_ext_t *)((char *)buf + hlen);
-      ext_len = ntohs(ext->len);
-      hlen += 4 + (ext_len * 4);
+  else if (r.version == RTP_VERSION) {
+    if (r.error == RTPP_SHORT && len < 12 + r.cc * 4) {
+      fmt_printf(out, "RTP header too short (%d bytes for %d CSRCs).\n",
+         len, r.cc);
+      return r.hlen;
+    }
+    /* types past the end of the table share its terminating entry */
+    for (pt = payload; pt->enc && pt - payload < r.pt; pt++)
+      ;
+    /* "v=%d p=%d x=%d cc=%d m=%d pt=%d (%s,%d,%d) seq=%u ts=%lu ssrc=0x%lx " */
+    fmt_str(out, "v=2 p=");
+    fmt_char(out, '0' + r.p);
+    fmt_str(out, " x=");
+    fmt_char(out, '0' + r.x);
+    fmt_str(out, " cc=");
+    fmt_ulong(out, r.cc);
+    fmt_str(out, " m=");
+    fmt_char(out, '0' + r.m);
+    fmt_str(out, " pt=");
+    fmt_ulong(out, r.pt);
+    fmt_str(out, " (");
+    fmt_str(out, pt->enc ? pt->enc : "(null)");  /* as printf() has it */
+    fmt_char(out, ',');
+    fmt_ulong(out, pt->ch);
+    fmt_char(out, ',');
+    fmt_long(out, (int)pt->rate);
+    fmt_str(out, ") seq=");
+    fmt_ulong(out, r.seq);
+    fmt_str(out, " ts=");
+    fmt_ulong(out, r.ts);
+    fmt_str(out, " ssrc=0x");
+    fmt_xlong(out, r.ssrc);
+    fmt_char(out, ' ');
+    for (i = 0; i < r.cc; i++) {
+      fmt_str(out, "csrc[");
+      fmt_ulong(out, i);
+      fmt_str(out, "]=0x");
+      fmt_xlong(out, rtp_csrc(&r, i));
+      fmt_char(out, ' ');
+    }
+    if (r.ext) {  /* header extension */
+      fmt_str(out, "ext_type=0x");
+      fmt_xlong(out, r.ext_type);
+      fmt_str(out, " ext_len=");
+      fmt_ulong(out, r.ext_len);
+      fmt_char(out, ' ');
+
+      if (r.ext_len) {
+        fmt_str(out, "ext_data=");
+        n = len - (int)(r.ext - (unsigned char *)buf);
+        fmt_hex(out, r.ext, r.ext_len * 4 < n ? r.ext_len * 4 : n);
+        fmt_char(out, ' ');
+      }
     }
   }
+  else {
+    fmt_printf(out, "RTP version wrong (%d).\n", r.version);
+  }
+  return r.hlen;
+} /* parse_data */
 
-  return hlen;
-} /* parse_header */
+
+/*
+* Show time 'now' as seconds and microseconds, negative if 'mark'.
+*/
+static void show_time(fmt_t *out, struct timeval now, int mark)
+{
+  fmt_long(out, mark ? -now.tv_sec : now.tv_sec);
+  fmt_char(out, '.');
+  fmt_zpad(out, now.tv_usec, 6);
+} /* show_time */
 
 
 /*
-* Return header length.
+* Show the start of a text line for a packet of type 'type' and 'len'
+* bytes from 'sin' received at 'now'.
 */
-static int parse_data(FILE *out, char *buf, int len)
+static void show_packet(session_t *s, struct timeval now, const char *type,
+  int len, struct sockaddr_in *sin)
 {
-  rtp_hdr_t *r = (rtp_hdr_t *)buf;
-  rtp_hdr_ext_t *ext;
-  int i, ext_len;
-  int hlen = 0;
+  fmt_t *out = s->text;
 
-  /* Show vat format packets. */
-  if (r->version == 0) {
-    vat_hdr_t *v = (vat_hdr_t *)buf;
-    fprintf(out, "nsid=%d flags=0x%x confid=%u ts=%u\n",
-      v->nsid, v->flags, v->confid, v->ts);
-    hlen = 8 + v->nsid * 4;
-  }
-  else if (r->version == RTP_VERSION) {
-    hlen = 12 + r->cc * 4;
-    if (len < hlen) {
-      fprintf(out, "RTP header too short (%d bytes for %d CSRCs).\n",
-         len, r->cc);
-      return hlen;
-    }
-    fprintf(out,
-    "v=%d p=%d x=%d cc=%d m=%d pt=%d (%s,%d,%d) seq=%u ts=%lu ssrc=0x%lx ",
-      r->version, r->p, r->x, r->cc, r->m,
-      r->pt, payload[r->pt].enc, payload[r->pt].ch, payload[r->pt].rate,
-      ntohs(r->seq),
-      (unsigned long)ntohl(r->ts),
-      (unsigned long)ntohl(r->ssrc));
-    for (i = 0; i < r->cc; i++) {
-      fprintf(out, "csrc[%d]=0x%0lx ", i, (long)r->csrc[i]);
-    }
-    if (r->x) {  /* header extension */
-      ext = (rtp_hdr_ext_t *)((char *)buf + hlen);
-      ext_len = ntohs(ext->len);
-
-      fprintf(out, "ext_type=0x%x ", ntohs(ext->ext_type));
-      fprintf(out, "ext_len=%d ", ext_len);
-
-      if (ext_len) {
-        fprintf(out, "ext_data=");
-        hex(out, (char *)(ext+1), (ext_len*4));
-        fprintf(out, " ");
-      }
-    }
-  }
-  else {
-    fprintf(out, "RTP version wrong (%d).\n", r->version);
+  /* senders rarely change from one packet to the next */
+  if (!s->from_text[0] || sin->sin_addr.s_addr != s->from.sin_addr.s_addr ||
+      sin->sin_port != s->from.sin_port) {
+    const unsigned char *a = (const unsigned char *)&sin->sin_addr;
+
+    /* as inet_ntoa(), which need not be safe in -j worker threads */
+    s->from = *sin;
+    sprintf(s->from_text, "%u.%u.%u.%u:%u", a[0], a[1], a[2], a[3],
+      ntohs(sin->sin_port));
   }
-  return hlen;
-} /* parse_data */
+  show_time(out, now, 0);
+  fmt_char(out, ' ');
+  fmt_str(out, type);
+  fmt_str(out, " len=");
+  fmt_long(out, len);
+  fmt_str(out, " from=");
+  fmt_str(out, s->from_text);
+  fmt_char(out, ' ');
+} /* show_packet */
 
 
 /*
 * Print minimal per-packet information: time, timestamp, sequence number.
 */
-static void parse_short(FILE *out, struct timeval now, char *buf, int len)
+static void parse_short(fmt_t *out, struct timeval now, char *buf, int len)
 {
-  rtp_hdr_t *r = (rtp_hdr_t *)buf;
-
-  if (r->version == 0) {
-    vat_hdr_t *v = (vat_hdr_t *)buf;
-    fprintf(out, "%ld.%06ld %lu\n",
-      (v->flags ? -now.tv_sec : now.tv_sec), (long)now.tv_usec,
-      (unsigned long)ntohl(v->ts));
+  rtp_info_t r;
+
+  rtp_parse(buf, len, &r);
+  if (r.version == 0 && len >= 8) {
+    show_time(out, now, r.flags);
+    fmt_char(out, ' ');
+    fmt_ulong(out, r.vts);
+    fmt_char(out, '\n');
   }
-  else if (r->version == 2) {
-    fprintf(out, "%ld.%06ld %lu %u\n",
-      (r->m ? -now.tv_sec : now.tv_sec), (long)now.tv_usec,
-      (unsigned long)ntohl(r->ts), ntohs(r->seq));
+  else if (r.version == RTP_VERSION && len >= 12) {
+    show_time(out, now, r.m);
+    fmt_char(out, ' ');
+    fmt_ulong(out, r.ts);
+    fmt_char(out, ' ');
+    fmt_ulong(out, r.seq);
+    fmt_char(out, '\n');
+  }
+  else if (r.error == RTPP_SHORT) {
+    fmt_printf(out, "RTP header too short (%d bytes).\n", len);
   }
   else {
-    fprintf(out, "RTP version wrong (%d).\n", r->version);
+    fmt_printf(out, "RTP version wrong (%d).\n", r.version);
   }
 } /* parse_short */
 
 
 /*
-* Show SDES information for one member.
+* Show 'len' bytes of text as "%*.*s" does: up to the first NUL, padded
+* with blanks.
+*/
+static void show_text(fmt_t *out, const unsigned char *b, int len)
+{
+  const unsigned char *nul = memchr(b, 0, len);
+  int n = nul ? (int)(nul - b) : len;
+
+  fmt_mem(out, b, n);
+  for (; n < len; n++) fmt_char(out, ' ');
+} /* show_text */
+
+
+/*
+* Show one SDES item.
 */
-static void member_sdes(FILE *out, member_t m, rtcp_sdes_type_t t, char *b, int len)
+static void member_sdes(fmt_t *out, int t, const unsigned char *b, int len)
 {
   static struct {
     rtcp_sdes_type_t t;
@@ -354,441 +565,1889 @@ static void member_sdes(FILE *out, member_t m, rtcp_sdes_type_t t, char *b, int
     {0,0}
   };
   int i;
-  char num[10];
 
-  sprintf(num, "%d", t);
   for (i = 0; map[i].name; i++) {
-    if (map[i].t == t) break;
+    if ((int)map[i].t == t) break;
   }
-  fprintf(out, "%s=\"%*.*s\" ",
-    map[i].name ? map[i].name : num, len, len, b);
+  if (map[i].name) fmt_str(out, map[i].name);
+  else fmt_ulong(out, t);
+  fmt_str(out, "=\"");
+  show_text(out, b, len);
+  fmt_str(out, "\" ");
 } /* member_sdes */
 
 
 /*
-* Parse one SDES chunk (one SRC description). Total length is 'len'.
-* Return new buffer position or zero if error.
+* Show the chunks of SDES packet 'c'.  Return 0, or -1 on error.
 */
-static char *rtp_read_sdes(FILE *out, char *b, int len)
+static int rtp_read_sdes(fmt_t *out, rtcp_info_t *c)
 {
-  rtcp_sdes_item_t *rsp;
-  uint32_t src = *(uint32_t *)b;
-  int total_len = 0;
-
-  len -= 4;  /* subtract SSRC from available bytes */
-  if (len <= 0) {
-    return 0;
-  }
-  rsp = (rtcp_sdes_item_t *)(b + 4);
-  for (; rsp->type; rsp = (rtcp_sdes_item_t *)((char *)rsp + rsp->length + 2)) {
-    member_sdes(out, src, rsp->type, rsp->data, rsp->length);
-    total_len += rsp->length + 2;
-  }
-  if (total_len >= len) {
-    fprintf(stderr,
-      "Remaining length of %d bytes for SSRC item too short (has %u bytes)\n",
-      len, total_len);
-    return 0;
+  rtcp_iter_t it;
+  const unsigned char *data;
+  uint32_t src;
+  int i, type, len, n;
+
+  rtcp_sdes_begin(&it, c);
+  for (i = 0; i < c->count; i++) {
+    if (rtcp_sdes_chunk(&it, &src) < 0) {
+      fprintf(stderr, "Missing SDES chunk %d of %d.\n", i + 1, c->count);
+      return -1;
+    }
+    fmt_str(out, "  (src=0x");
+    fmt_xlong(out, src);
+    fmt_char(out, ' ');
+    while ((n = rtcp_sdes_item(&it, &type, &data, &len)) > 0)
+      member_sdes(out, type, data, len);
+    if (n < 0) {
+      fprintf(stderr, "SDES items for SSRC 0x%lx exceed packet length.\n",
+        (unsigned long)src);
+      return -1;
+    }
+    fmt_str(out, ")\n");
   }
-  b = (char *)rsp + 1;
-  /* skip padding */
-  return b + ((4 - ((intptr_t)b & 0x3)) & 0x3);
+  return 0;
 } /* rtp_read_sdes */
 
 
 /*
-* Return length parsed, -1 on error.
+* Show the first line of RTCP packet 'c' of type 'name'.
 */
-static int parse_control(FILE *out, char *buf, int len)
+static void show_rtcp(fmt_t *out, const char *name, rtcp_info_t *c, int ssrc)
 {
-  rtcp_t *r;         /* RTCP header */
-  int i;
+  fmt_str(out, " (");
+  fmt_str(out, name);
+  if (ssrc) {
+    fmt_str(out, " ssrc=0x");
+    fmt_xlong(out, c->ssrc);
+  }
+  fmt_str(out, " p=");
+  fmt_char(out, '0' + c->p);
+  fmt_str(out, " count=");
+  fmt_ulong(out, c->count);
+  fmt_str(out, " len=");
+  fmt_ulong(out, c->length);
+  fmt_char(out, '\n');
+} /* show_rtcp */
+
+
+/*
+* Show the control packet.  Return 0, or -1 on error.
+*/
+static int parse_control(fmt_t *out, char *buf, int len)
+{
+  rtcp_iter_t it;
+  rtcp_info_t c;
+  rtcp_rr_info_t rr;
+  const unsigned char *reason;
+  int i, n, rlen;
+  int v = len > 0 ? (unsigned char)buf[0] >> 6 : -1;
 
-  r = (rtcp_t *)buf;
   /* Backwards compatibility: VAT header. */
-  if (r->common.version == 0) {
-    struct CtrlMsgHdr *v = (struct CtrlMsgHdr *)buf;
+  if (v == 0) {
+    vat_ctrl_t vc;
 
-    fprintf(out, "flags=0x%x type=0x%x confid=%u\n",
-      v->flags, v->type, v->confid);
+    if (vat_ctrl_parse(buf, len, &vc) < 0) {
+      fmt_printf(out, "VAT control packet too short (%d bytes).\n", len);
+      return -1;
+    }
+    fmt_str(out, "flags=0x");
+    fmt_xlong(out, vc.flags);
+    fmt_str(out, " type=0x");
+    fmt_xlong(out, vc.type);
+    fmt_str(out, " confid=");
+    fmt_ulong(out, vc.confid);
+    fmt_char(out, '\n');
   }
-  else if (r->common.version == RTP_VERSION) {
-    fprintf(out, "\n");
-    while (len > 0) {
-      len -= (ntohs(r->common.length) + 1) << 2;
-      if (len < 0) {
+  else if (v == RTP_VERSION) {
+    fmt_char(out, '\n');
+    rtcp_begin(&it, buf, len);
+    while ((n = rtcp_next(&it, &c)) != 0) {
+      if (n < 0) {
         /* something wrong with packet format */
-        fprintf(out, "Illegal RTCP packet length %d words.\n",
-           ntohs(r->common.length));
+        fmt_printf(out, "Illegal RTCP packet length %d words.\n", c.length);
         return -1;
       }
 
-      switch (r->common.pt) {
+      switch (c.pt) {
       case RTCP_SR:
-        fprintf(out, " (SR ssrc=0x%lx p=%d count=%d len=%d\n",
-          (unsigned long)ntohl(r->r.rr.ssrc),
-          r->common.p, r->common.count,
-          ntohs(r->common.length));
-        fprintf(out, "  ntp=%lu.%lu ts=%lu psent=%lu osent=%lu\n",
-          (unsigned long)ntohl(r->r.sr.ntp_sec),
-          (unsigned long)ntohl(r->r.sr.ntp_frac),
-          (unsigned long)ntohl(r->r.sr.rtp_ts),
-          (unsigned long)ntohl(r->r.sr.psent),
-          (unsigned long)ntohl(r->r.sr.osent));
-        for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc=0x%lx fraction=%g lost=%ld last_seq=%lu jit=%lu lsr=%lu dlsr=%lu )\n",
-           (unsigned long)ntohl(r->r.sr.rr[i].ssrc),
-           r->r.sr.rr[i].fraction / 256.,
-           (long)RTCP_GET_LOST(&r->r.sr.rr[i]),
-           (unsigned long)ntohl(r->r.sr.rr[i].last_seq),
-           (unsigned long)ntohl(r->r.sr.rr[i].jitter),
-           (unsigned long)ntohl(r->r.sr.rr[i].lsr),
-           (unsigned long)ntohl(r->r.sr.rr[i].dlsr));
-        }
-        fprintf(out, " )\n");
-        break;
-
+        show_rtcp(out, "SR", &c, 1);
+        fmt_str(out, "  ntp=");
+        fmt_ulong(out, c.ntp_sec);
+        fmt_char(out, '.');
+        fmt_ulong(out, c.ntp_frac);
+        fmt_str(out, " ts=");
+        fmt_ulong(out, c.rtp_ts);
+        fmt_str(out, " psent=");
+        fmt_ulong(out, c.psent);
+        fmt_str(out, " osent=");
+        fmt_ulong(out, c.osent);
+        fmt_char(out, '\n');
+        /* FALLTHROUGH */
       case RTCP_RR:
-        fprintf(out, " (RR ssrc=0x%lx p=%d count=%d len=%d\n",
-          (unsigned long)ntohl(r->r.rr.ssrc), r->common.p, r->common.count,
-          ntohs(r->common.length));
-        for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc=0x%lx fraction=%g lost=%ld last_seq=%lu jit=%lu lsr=%lu dlsr=%lu )\n",
-            (unsigned long)ntohl(r->r.rr.rr[i].ssrc),
-            r->r.rr.rr[i].fraction / 256.,
-            (long)RTCP_GET_LOST(&r->r.rr.rr[i]),
-            (unsigned long)ntohl(r->r.rr.rr[i].last_seq),
-            (unsigned long)ntohl(r->r.rr.rr[i].jitter),
-            (unsigned long)ntohl(r->r.rr.rr[i].lsr),
-            (unsigned long)ntohl(r->r.rr.rr[i].dlsr));
+        if (c.pt == RTCP_RR) show_rtcp(out, "RR", &c, 1);
+        for (i = 0; i < c.nrr; i++) {
+          rtcp_report(&c, i, &rr);
+          fmt_str(out, "  (ssrc=0x");
+          fmt_xlong(out, rr.ssrc);
+          fmt_printf(out, " fraction=%g", rr.fraction / 256.);
+          fmt_str(out, " lost=");
+          fmt_long(out, rr.lost);
+          fmt_str(out, " last_seq=");
+          fmt_ulong(out, rr.last_seq);
+          fmt_str(out, " jit=");
+          fmt_ulong(out, rr.jitter);
+          fmt_str(out, " lsr=");
+          fmt_ulong(out, rr.lsr);
+          fmt_str(out, " dlsr=");
+          fmt_ulong(out, rr.dlsr);
+          fmt_str(out, " )\n");
         }
-        fprintf(out, " )\n");
+        fmt_str(out, " )\n");
         break;
 
       case RTCP_SDES:
-        fprintf(out, " (SDES p=%d count=%d len=%d\n",
-          r->common.p, r->common.count, ntohs(r->common.length));
-        buf = (char *)&r->r.sdes;
-        for (i = 0; i < r->common.count; i++) {
-          int remaining = (ntohs(r->common.length) << 2) -
-                          (buf - (char *)&r->r.sdes);
-
-          fprintf(out, "  (src=0x%lx ",
-            (unsigned long)ntohl(((struct rtcp_sdes *)buf)->src));
-          if (remaining > 0) {
-            buf = rtp_read_sdes(out, buf,
-              (ntohs(r->common.length) << 2) - (buf - (char *)&r->r.sdes));
-            if (!buf) return -1;
-          }
-          else {
-            fprintf(stderr, "Missing at least %d bytes.\n", -remaining);
-            return -1;
-          }
-          fprintf(out, ")\n");
-        }
-        fprintf(out, " )\n");
+        show_rtcp(out, "SDES", &c, 0);
+        if (rtp_read_sdes(out, &c) < 0) return -1;
+        fmt_str(out, " )\n");
         break;
 
       case RTCP_BYE:
-        fprintf(out, " (BYE p=%d count=%d len=%d\n",
-          r->common.p, r->common.count, ntohs(r->common.length));
-        for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc[%d]=0x%0lx ", i,
-            (unsigned long)ntohl(r->r.bye.src[i]));
+        show_rtcp(out, "BYE", &c, 0);
+        for (i = 0; i < c.count && i < c.length; i++) {
+          fmt_str(out, "  (ssrc[");
+          fmt_ulong(out, i);
+          fmt_str(out, "]=0x");
+          fmt_xlong(out, rtcp_source(&c, i));
+          fmt_char(out, ' ');
         }
-        fprintf(out, ")\n");
-        if (ntohs(r->common.length) > r->common.count) {
-          buf = (char *)&r->r.bye.src[r->common.count];
-          fprintf(out, "reason=\"%*.*s\"", *buf, *buf, buf+1);
+        fmt_str(out, ")\n");
+        if (rtcp_bye_reason(&c, &reason, &rlen) > 0) {
+          fmt_str(out, "reason=\"");
+          show_text(out, reason, rlen);
+          fmt_char(out, '"');
         }
-        fprintf(out, " )\n");
+        fmt_str(out, " )\n");
         break;
 
       /* invalid type */
       default:
-        fprintf(out, "(? pt=%d src=0x%lx)\n", r->common.pt,
-          (unsigned long)ntohl(r->r.sdes.src));
+        fmt_str(out, "(? pt=");
+        fmt_ulong(out, c.pt);
+        fmt_str(out, " src=0x");
+        fmt_xlong(out, c.ssrc);
+        fmt_str(out, ")\n");
       break;
       }
-      r = (rtcp_t *)((uint32_t *)r + ntohs(r->common.length) + 1);
     }
   }
   else {
-    fprintf(out, "invalid version %d\n", r->common.version);
+    fmt_printf(out, "invalid version %d\n", v);
   }
-  return len;
+  return 0;
 } /* parse_control */
 
 
 /*
-* Process one packet and write it to file 'out' using format 'format'.
+* Fill in the dump record header 'rec' for a packet of '*len' bytes
+* in 'data' received at 'now', 'base' being the start of the
+* recording.  'from' is the sender, if known, and 'flags' holds
+* RD_F_HWTIME.  Sets '*len' to the number of packet bytes that follow
+* the header in the dump file and returns the size of the header.
 */
-static void packet_handler(FILE *out, t_format format, int trunc,
-  double dstart, struct timeval now, int ctrl,
-  struct sockaddr_in sin, int len, RD_buffer_t *packet)
+static int dump_record(record_t *rec, t_format format, int trunc,
+  struct timeval *base, struct timespec *now, int ctrl,
+  struct sockaddr_in *from, uint32_t flags, char *data, int *len)
 {
-  double dnow = tdbl(&now);
   int hlen;   /* header length */
-  int offset;
+  int rlen;   /* record header length */
+  int plen = *len;
+  int64_t ns;
+
+  hlen = ctrl ? plen : rtp_hlen(data, plen);
+  /* leave only header */
+  if (format == F_header) {
+    if (ctrl == 0) *len = hlen;
+  }
+  /* truncation of payload */
+  else if (!ctrl && (plen - hlen > trunc)) *len = hlen + trunc;
+
+  if (version == 2) {
+    ns = (int64_t)(now->tv_sec - base->tv_sec) * 1000000000 +
+         now->tv_nsec - (int64_t)base->tv_usec * 1000;
+    if (ns < 0) ns = 0;
+    rlen = sizeof(rec->v2.hdr);
+    if (from->sin_addr.s_addr != INADDR_ANY || from->sin_port != 0) {
+      flags |= RD_F_SOURCE;
+      rec->v2.source.source  = from->sin_addr.s_addr;
+      rec->v2.source.port    = from->sin_port;
+      rec->v2.source.padding = 0;
+      rlen += sizeof(rec->v2.source);
+    }
+    rec->v2.hdr.plen      = ctrl ? 0 : htons(plen);
+    rec->v2.hdr.flags     = htonl(flags);
+    rec->v2.hdr.offset_hi = htonl((uint64_t)ns >> 32);
+    rec->v2.hdr.offset_lo = htonl((uint64_t)ns & 0xffffffff);
+    rec->v2.hdr.length    = htons(*len + rlen);
+  }
+  else {
+    /* in integers, so that converting from version 2 is exact */
+    ns = (int64_t)(now->tv_sec - base->tv_sec) * 1000000000 +
+         now->tv_nsec - (int64_t)base->tv_usec * 1000;
+    rlen = sizeof(rec->v1);
+    rec->v1.offset = htonl((int32_t)(ns / 1000000));
+    rec->v1.plen   = ctrl ? 0 : htons(plen);
+    rec->v1.length = htons(*len + rlen);
+  }
+  return rlen;
+} /* dump_record */
 
-  switch(format) {
-    case F_header:
-      offset = (dnow - dstart) * 1000;
-      packet->p.hdr.offset = htonl(offset);
-      packet->p.hdr.plen   = ctrl ? 0 : htons(len);
-      /* leave only header */
-      if (ctrl == 0) len = parse_header(packet->p.data);
-      packet->p.hdr.length = htons(len + sizeof(packet->p.hdr));
-      if (fwrite((char *)&packet, len + sizeof(packet->p.hdr), 1, out) == 0) {
-        perror("fwrite");
-        exit(1);
-      }
+
+/*
+* Advance the output position past record 'rec' with 'rlen' header
+* and 'len' packet bytes, noting it in the seek index if one is
+* being written.
+*/
+static void index_note(session_t *s, record_t *rec, int rlen, int len)
+{
+  uint64_t ns;
+
+  if (s->idx.out) {
+    if (version == 2)
+      ns = (uint64_t)ntohl(rec->v2.hdr.offset_hi) << 32 |
+           ntohl(rec->v2.hdr.offset_lo);
+    else
+      ns = (uint64_t)ntohl(rec->v1.offset) * 1000000;
+    RD_index_add(&s->idx, ns, s->opos);
+  }
+  s->opos += rlen + len;
+} /* index_note */
+
+
+/*
+* Hand the records of session 's' collected so far to compression as
+* one block.
+*/
+static void session_block(session_t *s)
+{
+  const char *frame, *out;
+  size_t len;
+
+  if (!s->z || !(frame = rdz_enc_frame(s->z, &len))) return;
+  if (s->wf) {
+    writer_write(s->wf, frame, len);
+    return;
+  }
+  len = rdz_out_frame(s->zout, frame, len, &out);
+  if (fwrite(out, len, 1, s->out) == 0) {
+    perror("fwrite");
+    exit(1);
+  }
+} /* session_block */
+
+
+/*
+* Write 'len' bytes at 'buf' to the output file of session 's', or
+* append them to the output collected in memory.
+*/
+static void session_write(session_t *s, const void *buf, size_t len)
+{
+  size_t size;
+  char *p;
+
+  if (s->out) {
+    TRACE(TRACE_WRITE, len);
+    if (fwrite(buf, len, 1, s->out) == 0) {
+      perror("fwrite");
+      exit(1);
+    }
+    TRACE(TRACE_WRITTEN, 0);
+    return;
+  }
+  if (s->mlen + len > s->msize) {
+    for (size = s->msize ? s->msize : 65536; size < s->mlen + len; size *= 2);
+    if (!(p = realloc(s->mem, size))) {
+      perror("realloc");
+      exit(1);
+    }
+    s->mem = p;
+    s->msize = size;
+  }
+  memcpy(s->mem + s->mlen, buf, len);
+  s->mlen += len;
+} /* session_write */
+
+
+/*
+* Write dump record 'rec' of 'hlen' bytes with 'len' bytes of 'data'
+* to session 's', directly, through its writer or into the block
+* being compressed.  Returns -1 if the writer dropped it.
+*/
+static int session_record(session_t *s, void *rec, int hlen, char *data,
+  int len)
+{
+  struct iovec iov[2];
+
+  if (s->z) {
+    switch (rdz_enc_add(s->z, rec, hlen, data, len)) {
+    case -1:
+      perror("rdz_enc_add");
+      exit(1);
+    case 1:
+      session_block(s);
       break;
+    }
+    return 0;
+  }
+  if (s->wf) {
+    iov[0].iov_base = rec;
+    iov[0].iov_len  = hlen;
+    iov[1].iov_base = data;
+    iov[1].iov_len  = len;
+    if (writer_writev(s->wf, iov, 2) < 0) {
+      counters_add(SESSION_COUNTERS(s), CTR_WRITE_DROPS, 1);
+      return -1;
+    }
+    return 0;
+  }
+  session_write(s, rec, hlen);
+  if (len > 0) session_write(s, data, len);
+  return 0;
+} /* session_record */
 
+
+/*
+* Process one packet and write it to the output of session 's' using
+* format 'format'.
+*/
+static void packet_handler(session_t *s, t_format format, int trunc,
+  struct timeval *base, struct timespec *ts, int ctrl,
+  struct sockaddr_in sin, uint32_t flags, int len, char *data)
+{
+  struct timeval now;
+  record_t rec;
+  int hlen;   /* header length */
+
+  TRACE(TRACE_HANDLER, len);
+  now.tv_sec  = ts->tv_sec;
+  now.tv_usec = ts->tv_nsec / 1000;
+
+  switch(format) {
+    case F_header:
     case F_dump:
-      hlen = ctrl ? len : parse_header(packet->p.data);
-      offset = (dnow - dstart) * 1000;
-      packet->p.hdr.offset = htonl(offset);
-      packet->p.hdr.plen   = ctrl ? 0 : htons(len);
-      /* truncation of payload */
-      if (!ctrl && (len - hlen > trunc)) len = hlen + trunc;
-      packet->p.hdr.length = htons(len + sizeof(packet->p.hdr));
-      if (fwrite((char *)packet, len + sizeof(packet->p.hdr), 1, out) == 0) {
-        perror("fwrite");
-        exit(1);
-      }
+      hlen = dump_record(&rec, format, trunc, base, ts, ctrl, &sin, flags,
+        data, &len);
+      if (session_record(s, &rec, hlen, data, len) < 0) break;
+      index_note(s, &rec, hlen, len);
       break;
 
     case F_payload:
       if (ctrl == 0) {
-        hlen = parse_header(packet->p.data);
-        if (fwrite(packet->p.data + hlen, len - hlen, 1, out) == 0) {
-          perror("fwrite");
-          exit(1);
+        hlen = rtp_hlen(data, len);
+        if (hlen == len) break;
+        if (s->wf) {
+          if (writer_write(s->wf, data + hlen, len - hlen) == 0)
+            s->opos += len - hlen;
+          else counters_add(SESSION_COUNTERS(s), CTR_WRITE_DROPS, 1);
         }
+        else session_write(s, data + hlen, len - hlen);
       }
       break;
 
     case F_short:
-      if (ctrl == 0) parse_short(out, now, packet->p.data, len);
+      if (ctrl == 0) parse_short(s->text, now, data, len);
       break;
 
     case F_hex:
     case F_ascii:
       if (ctrl == 0) {
-        fprintf(out, "%ld.%06ld %s len=%d from=%s:%u ",
-                now.tv_sec, (long)now.tv_usec, parse_type(ctrl, packet->p.data),
-                len, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
-        parse_data(out, packet->p.data, len);
+        show_packet(s, now, parse_type(ctrl, data, len), len, &sin);
+        parse_data(s->text, data, len);
         if (format == F_hex) {
-          hlen = parse_header(packet->p.data);
-          fprintf(out, "data=");
-          hex(out, packet->p.data + hlen, trunc < len ? trunc : len - hlen);
+          hlen = rtp_hlen(data, len);
+          fmt_str(s->text, "data=");
+          fmt_hex(s->text, data + hlen,
+            trunc < len - hlen ? trunc : len - hlen);
         }
-        fprintf(out, "\n");
+        fmt_char(s->text, '\n');
       }
     case F_rtcp:
       if (ctrl == 1) {
-        fprintf(out, "%ld.%06ld %s len=%d from=%s:%u ",
-                now.tv_sec, (long)now.tv_usec, parse_type(ctrl, packet->p.data),
-                len, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
-        parse_control(out, packet->p.data, len);
+        show_packet(s, now, parse_type(ctrl, data, len), len, &sin);
+        parse_control(s->text, data, len);
       }
       break;
 
+    case F_stats:
+      if (ctrl == 0)
+        stats_rtp(s->stats, (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec,
+          data, len);
+      else stats_rtcp(s->stats, len);
+      break;
+
+    case F_index:
     case F_invalid:
       break;
   }
+  TRACE(TRACE_HANDLED, 0);
 } /* packet_handler */
 
 
-int main(int argc, char *argv[])
+/*
+* Process record 'rec' of a dump file in session 's', if it passes
+* the filter.  Returns -1 if no more records will.
+*/
+static int record_handler(session_t *s, t_format format, int trunc,
+  RD_record_t *rec)
 {
+  struct sockaddr_in sin;
+  struct timespec ts;
   int c;
-  static struct {
-    const char *name;
-    t_format format;
-  } formats[] = {
-    {"dump",    F_dump},
-    {"header",  F_header},
-    {"hex",     F_hex},
-    {"rtcp",    F_rtcp},
-    {"short",   F_short},
-    {"payload", F_payload},
-    {"ascii",   F_ascii},
-    {0,0}
-  };
-  t_format format = F_ascii;
-  struct sockaddr_in sin, rtp;
-  struct timeval start;
-  struct timeval timeout;   /* timeout to limit recording */
-  double dstart;            /* time as double */
-  float duration = 1000000; /* maximum duration in seconds */
-  int trunc    = 1000000;   /* bytes to show for F_hex and F_dump */
-  enum {FromFile, FromNetwork} source;
-  int sock[2];
-  FILE *in = stdin;         /* input file to use instead of sockets */
-  FILE *out = stdout;       /* output file */
-  fd_set readfds;
-  extern char *optarg;
-  extern int optind;
-  int i;
-  int nfds = 0;
-  extern double tdbl(struct timeval *);
 
-  startupSocket();
-  while ((c = getopt(argc, argv, "F:f:o:t:x:h")) != EOF) {
-    switch(c) {
-    /* output format */
-    case 'F':
-      format = F_invalid;
-      for (i = 0; formats[i].name; i++) {
-        if (strncasecmp(formats[i].name, optarg, strlen(optarg)) == 0) {
-          format = formats[i].format;
-          break;
-        }
-      }
-      if (format == F_invalid) {
-        usage(argv[0]);
-        exit(1);
-      }
-      break;
+  if (filtering && (c = filter_match(&filter, rec)) <= 0) return c;
 
-    /* input file (instead of network connection) */
-    case 'f':
-      if (!(in = fopen(optarg, "rb"))) {
-        perror(optarg);
-        exit(1);
-      }
-      break;
+  /* a dump in the version of the file takes the records as they are */
+  if (format == F_dump && version == in_version && trunc >= rec->length) {
+    if (s->idx.out) RD_index_add(&s->idx, rec->offset_ns, s->opos);
+    session_record(s, rec->data - rec->hlen, rec->hlen, rec->data,
+      rec->length);
+    s->opos += rec->hlen + rec->length;
+    return 0;
+  }
 
-    /* output file */
-    case 'o':
-      if (!(out = fopen(optarg, "wb"))) {
-        perror(optarg);
-        exit(1);
-      }
-      break;
+  ts.tv_sec  = rec->offset_ns / 1000000000;
+  ts.tv_nsec = rec->offset_ns % 1000000000;
+  /* sender if recorded, else arbitrary, obviously invalid value */
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  if (rec->flags & RD_F_SOURCE) {
+    sin.sin_addr.s_addr = rec->source; sin.sin_port = rec->port;
+  }
+  else {
+    sin.sin_addr.s_addr = INADDR_ANY; sin.sin_port = 0;
+  }
+  /* plen>0: data =0: control */
+  packet_handler(s, format, trunc, &s->base, &ts, rec->plen == 0, sin,
+    rec->flags & RD_F_HWTIME, rec->length, rec->data);
+  return 0;
+} /* record_handler */
 
-    /* recording duration in minutes or fractions thereof */
-    case 't':
-      duration = atof(optarg) * 60;
-      break;
 
-    /* bytes to show for F_hex or F_dump */
-    case 'x':
-      if (0 == (trunc = atoi(optarg))) {
-	  warnx("Invalid -x value");
-	  usage(argv[0]);
-	  exit(1);
-      }
-      break;
+/*
+* Count a packet of 'len' bytes at 'data' received on the data
+* (ctrl = 0) or control socket of session 's'.
+*/
+static void count_packet(session_t *s, int ctrl, const char *data, int len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  counters_t *c = s->counters[ctrl];
 
-    case '?':
-    case 'h':
-      usage(argv[0]);
-      exit(1);
-      break;
-    }
-  }
+  counters_add(c, CTR_RX_PACKETS, 1);
+  counters_add(c, CTR_RX_BYTES, len);
+  if (ctrl == 0 && len >= 12 && (p[0] >> 6) == RTP_VERSION)
+    counters_ssrc(c, (uint32_t)p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11],
+      len);
+} /* count_packet */
 
-#if defined(WIN32)
-  /* On Windows, make sure stdout and stdin use the binary format
-   * if using F_dump or F_header. */
-  if (format == F_dump || format == F_header) {
-    if (out == stdout) {
-      setmode(fileno(stdout), O_BINARY);
-    }
-  }
-  if (in == stdin) {
-    setmode(fileno(stdin), O_BINARY);
-  }
-#endif
 
-  /* set maximum time to gather packets */
-  timeout.tv_sec  = duration;
-  timeout.tv_usec = (duration - (float)timeout.tv_sec) * 1000000.0;
+/* where the packets of all addresses go with -q */
+static struct {
+  session_t *s;
+  t_format format;
+  int trunc;
+  struct timespec last;     /* latest record time, they do not go back */
+} merged;
 
-  /* if no optional arguments, we are reading from a file */
-  if (optind == argc) {
-    source = FromFile;
-    sock[0] = fileno(in);  /* stdin */
-    sock[1] = -1;          /* not used */
-    memset(&sin, 0, sizeof(struct sockaddr_in));
-    RD_header(in, &sin, &start, 0);
-    dstart = 0.;
-  }
-  else {
-    source = FromNetwork;
-    if (hpt(argv[optind], &sin, NULL) == -1) {
+/*
+* Write a packet to the merged output.  Packets held for reordering
+* are recorded no earlier than those passed on before them.
+*/
+static void merged_packet(struct timespec *ts, int ctrl,
+  struct sockaddr_in sin, uint32_t flags, int len, char *data)
+{
+  struct timespec t = *ts;
+
+  if (t.tv_sec < merged.last.tv_sec ||
+      (t.tv_sec == merged.last.tv_sec && t.tv_nsec < merged.last.tv_nsec))
+    t = merged.last;
+  else merged.last = t;
+  packet_handler(merged.s, merged.format, merged.trunc, &merged.s->base, &t,
+    ctrl, sin, flags, len, data);
+} /* merged_packet */
+
+
+/*
+* Pass on a packet that the reordering let through.
+*/
+static void reorder_emit(void *arg, reorder_packet_t *p)
+{
+  struct sockaddr_in sin;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = p->addr;
+  sin.sin_port = p->port;
+  merged_packet(&p->ts, 0, sin, p->flags, p->len, p->data);
+} /* reorder_emit */
+
+
+/*
+* Hand a packet received on session 's' to the output format, or, with
+* -q, data packets to the reordering and control packets to the merged
+* output.  'wakeup' is the time select() returned.
+*/
+static void deliver(session_t *s, t_format format, int trunc,
+  struct timespec *ts, int ctrl, struct sockaddr_in *from, uint32_t flags,
+  int len, char *data, struct timeval *wakeup)
+{
+  reorder_packet_t p;
+
+  if (!reorder) {
+    packet_handler(s, format, trunc, &s->base, ts, ctrl, *from, flags, len,
+      data);
+    return;
+  }
+  if (len <= 0) return;
+  if (ctrl) {
+    merged_packet(ts, ctrl, *from, flags, len, data);
+    return;
+  }
+  p.ts    = *ts;
+  p.addr  = from->sin_addr.s_addr;
+  p.port  = from->sin_port;
+  p.flags = flags;
+  p.len   = len;
+  p.data  = data;
+  reorder_put(reorder, (uint64_t)wakeup->tv_sec * 1000000000 +
+    wakeup->tv_usec * 1000, &p);
+} /* deliver */
+
+
+#if HAVE_RECVMMSG
+/*
+* Batched capture: drain a socket with recvmmsg() into a ring of
+* packet buffers, then write all dump records of the batch with one
+* writev().  Each packet carries its kernel receive timestamp, so the
+* batching does not change the recorded offsets.
+*/
+#define BATCH 64
+
+static RD_buffer_t ring[BATCH];
+
+
+/*
+* Set 'now' to the receive time of message 'msg', or to 'wakeup' if
+* the kernel did not supply one.  Returns RD_F_HWTIME for a hardware
+* timestamp, else 0.
+*/
+static uint32_t packet_time(struct msghdr *msg, struct timeval *wakeup,
+  struct timespec *now)
+{
+#ifdef TS_TYPE
+  struct cmsghdr *cm;
+#endif
+
+  now->tv_sec  = wakeup->tv_sec;
+  now->tv_nsec = wakeup->tv_usec * 1000;
+#ifdef TS_TYPE
+  for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != TS_TYPE)
+      continue;
+#if HAVE_TIMESTAMPING
+    {
+      struct timespec ts[3];  /* software, legacy, raw hardware */
+
+      memcpy(ts, CMSG_DATA(cm), sizeof(ts));
+      if (ts[2].tv_sec || ts[2].tv_nsec) {
+        *now = ts[2];
+        return RD_F_HWTIME;
+      }
+      if (ts[0].tv_sec || ts[0].tv_nsec) *now = ts[0];
+    }
+#elif HAVE_TIMESTAMPNS
+    memcpy(now, CMSG_DATA(cm), sizeof(*now));
+#else
+    {
+      struct timeval tv;
+
+      memcpy(&tv, CMSG_DATA(cm), sizeof(tv));
+      now->tv_sec  = tv.tv_sec;
+      now->tv_nsec = tv.tv_usec * 1000;
+    }
+#endif
+    break;
+  }
+#endif
+  return 0;
+} /* packet_time */
+
+
+/*
+* Set the drop count of the socket in 'ctr' from message 'msg', if it
+* carries one.
+*/
+static void packet_drops(struct msghdr *msg, counters_t *ctr)
+{
+#if defined(SO_RXQ_OVFL) && defined(CONTROL_SIZE)
+  struct cmsghdr *cm;
+  uint32_t drops;
+
+  for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+      counters_set(ctr, CTR_DROPS, drops);
+    }
+  }
+#endif
+} /* packet_drops */
+
+
+/*
+* Write 'n' iovecs to 'fd', restarting after short writes.
+*/
+static void write_records(int fd, struct iovec *iov, int n)
+{
+  ssize_t w;
+
+  if (trace_ring) {
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < n; i++) len += iov[i].iov_len;
+    TRACE(TRACE_WRITE, len);
+  }
+  while (n > 0) {
+    w = writev(fd, iov, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      perror("writev");
+      exit(1);
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  TRACE(TRACE_WRITTEN, 0);
+} /* write_records */
+
+
+/*
+* Receive all packets queued on the data (ctrl = 0) or control socket
+* of session 's' and hand them to the output format.  'wakeup' is the
+* time select() returned.
+*/
+static void receive_batch(session_t *s, t_format format, int trunc,
+  struct timeval *base, int ctrl, struct timeval *wakeup)
+{
+  int sock = s->sock[ctrl];
+  struct mmsghdr msg[BATCH];
+  struct iovec iov[BATCH];
+  struct iovec wiov[2 * BATCH];
+  struct sockaddr_in from[BATCH];
+  record_t rec[BATCH];
+#ifdef CONTROL_SIZE
+  char control[BATCH][CONTROL_SIZE];
+#endif
+  struct timespec now;
+  uint32_t flags;
+  int i, n, w, len;
+
+  do {
+    memset(msg, 0, sizeof(msg));
+    for (i = 0; i < BATCH; i++) {
+      iov[i].iov_base = ring[i].p.data;
+      iov[i].iov_len  = sizeof(ring[i].p.data);
+      msg[i].msg_hdr.msg_name    = &from[i];
+      msg[i].msg_hdr.msg_namelen = sizeof(from[i]);
+      msg[i].msg_hdr.msg_iov     = &iov[i];
+      msg[i].msg_hdr.msg_iovlen  = 1;
+#ifdef CONTROL_SIZE
+      msg[i].msg_hdr.msg_control    = control[i];
+      msg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+#endif
+    }
+
+    n = recvmmsg(sock, msg, BATCH, MSG_DONTWAIT, NULL);
+    TRACE(TRACE_RECV, n > 0 ? n : 0);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+      perror("recvmmsg");
+      exit(1);
+    }
+
+    if (n > 0) packet_drops(&msg[n - 1].msg_hdr, s->counters[ctrl]);
+    for (i = 0, w = 0; i < n; i++) {
+      flags = packet_time(&msg[i].msg_hdr, wakeup, &now);
+      len = msg[i].msg_len;
+      count_packet(s, ctrl, ring[i].p.data, len);
+      if ((format == F_dump || format == F_header) && !reorder) {
+        TRACE(TRACE_HANDLER, len);
+        wiov[w].iov_base = &rec[i];
+        wiov[w].iov_len  = dump_record(&rec[i], format, trunc, base, &now,
+          ctrl, &from[i], flags, ring[i].p.data, &len);
+        wiov[w+1].iov_base = ring[i].p.data;
+        wiov[w+1].iov_len  = len;
+        /* the writer takes records one by one, it may drop some */
+        if (s->wf || s->z) {
+          if (session_record(s, &rec[i], wiov[w].iov_len, ring[i].p.data,
+              len) == 0)
+            index_note(s, &rec[i], wiov[w].iov_len, len);
+          TRACE(TRACE_HANDLED, 0);
+          continue;
+        }
+        index_note(s, &rec[i], wiov[w].iov_len, len);
+        w += 2;
+        TRACE(TRACE_HANDLED, 0);
+      }
+      else {
+        deliver(s, format, trunc, &now, ctrl, &from[i], flags, len,
+          ring[i].p.data, wakeup);
+      }
+    }
+    if (w > 0) write_records(fileno(s->out), wiov, w);
+  } while (n == BATCH);
+} /* receive_batch */
+#endif /* HAVE_RECVMMSG */
+
+
+#if HAVE_TPACKET
+/*
+* Open a packet ring on interface 'ifname' for the 'n' sessions 's'.
+* Their sockets stay bound, so that the host keeps accepting the
+* traffic and stays in the multicast groups, but receive hardly
+* anything themselves.
+*/
+static tpacket_t *open_ring(const char *ifname, session_t *s, int n)
+{
+  tpacket_dest_t *d = malloc(n * sizeof(*d));
+  tpacket_t *t;
+  int i, k, small = 1;
+
+  if (!d) {
+    perror("malloc");
+    exit(1);
+  }
+  for (k = 0; k < n; k++) {
+    d[k].addr = s[k].rtp.sin_addr.s_addr;
+    d[k].port = s[k].rtp.sin_port;
+    for (i = 0; i < 2; i++) {
+      if (s[k].sock[i] >= 0)
+        setsockopt(s[k].sock[i], SOL_SOCKET, SO_RCVBUF, (char *)&small,
+          sizeof(small));
+    }
+  }
+  if (!(t = tpacket_open(ifname, d, n, 0))) {
+    perror(ifname);
+    exit(1);
+  }
+  free(d);
+  return t;
+} /* open_ring */
+
+
+/*
+* Hand all packets ready in ring 't' to their sessions.
+*/
+static void receive_ring(tpacket_t *t, session_t *session, t_format format,
+  int trunc, struct timeval *wakeup)
+{
+  tpacket_frame_t f;
+  struct sockaddr_in sin;
+  session_t *s;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  while (tpacket_next(t, &f)) {
+    TRACE(TRACE_RECV, 1);
+    s = &session[f.dest];
+    if (s->sock[f.ctrl] < 0) continue;  /* not captured in this format */
+    sin.sin_addr.s_addr = f.saddr;
+    sin.sin_port = f.sport;
+    count_packet(s, f.ctrl, f.data, f.len);
+    deliver(s, format, trunc, &f.ts, f.ctrl, &sin, f.flags, f.len, f.data,
+      wakeup);
+  }
+} /* receive_ring */
+#endif /* HAVE_TPACKET */
+
+
+/*
+* Name of file 'seq' of session 's', started at 'when': the name is
+* expanded by strftime() if it has conversions, else every file
+* after the first gets its number appended.
+*/
+static char *session_name(session_t *s, struct timeval *when)
+{
+  size_t len = 2 * strlen(s->name) + 256;
+  char *name = malloc(len);
+  time_t t = when->tv_sec;
+
+  if (!name) {
+    perror("malloc");
+    exit(1);
+  }
+  if (strchr(s->name, '%')) {
+    if (strftime(name, len, s->name, localtime(&t)) == 0) {
+      warnx("%s: file name too long", s->name);
+      exit(1);
+    }
+  }
+  else if (s->seq > 0)
+    sprintf(name, "%s.%d", s->name, s->seq);
+  else
+    strcpy(name, s->name);
+  return name;
+} /* session_name */
+
+
+/*
+* Write 'len' bytes of text output of session 'arg'.
+*/
+static void session_text(void *arg, const char *buf, size_t len)
+{
+  session_write(arg, buf, len);
+} /* session_text */
+
+
+/*
+* Open the next output file of session 's' and write the dump file
+* header with start time 'start'.
+*/
+static void session_open(session_t *s, t_format format, struct timeval *start)
+{
+  char *index;
+
+  if (s->name) {
+    s->file = session_name(s, start);
+    if (!(s->out = fopen(s->file, "wb"))) {
+      perror(s->file);
+      exit(1);
+    }
+  }
+  if (write_index && s->file) {
+    if (!(index = malloc(strlen(s->file) + 5))) {
+      perror("malloc");
+      exit(1);
+    }
+    sprintf(index, "%s.idx", s->file);
+    if (RD_index_open(&s->idx, index) < 0) {
+      perror(index);
+      exit(1);
+    }
+    free(index);
+  }
+  s->opos = 0;
+  if (format == F_stats && !(s->stats = stats_new())) {
+    perror("stats_new");
+    exit(1);
+  }
+  if (format == F_dump || format == F_header) {
+    rtpdump_header(s->out, &s->rtp, start);
+    s->opos = ftell(s->out);
+    if (zdump && (!(s->z = rdz_enc_new(version)) ||
+        !(s->zout = rdz_out_new(s->opos)))) {
+      perror("rdz_enc_new");
+      exit(1);
+    }
+  }
+  /* batched and buffered records bypass stdio */
+  fflush(s->out);
+  if (writer) {
+    if (!(s->wf = writer_open(writer, fileno(s->out), wsize, wflags))) {
+      perror("writer_open");
+      exit(1);
+    }
+    /* compress in the writer thread */
+    if (s->zout) writer_encode(s->wf, rdz_out_frame, s->zout);
+  }
+} /* session_open */
+
+
+/*
+* Bytes in the current output file of session 's'.
+*/
+static uint64_t session_size(session_t *s, t_format format)
+{
+  if (s->wf || format == F_dump || format == F_header) return s->opos;
+  return ftell(s->out);
+} /* session_size */
+
+
+/*
+* Close finished output file 'arg' and compress it, if asked to.
+* Called by the writer thread for buffered output.
+*/
+static void finished(void *arg)
+{
+  finished_t *f = arg;
+
+  if (f->out != stdout && fclose(f->out) != 0) perror(f->file);
+  rdz_out_free(f->zout);
+#if !defined(WIN32)
+  if (compress && f->file) {
+    switch (fork()) {
+    case -1:
+      perror("fork");
+      break;
+    case 0:
+      execlp(compress, compress, f->file, (char *)0);
+      perror(compress);
+      _exit(1);
+    }
+  }
+#endif
+  free(f->file);
+  free(f);
+} /* finished */
+
+
+/*
+* Be done with the current output file of session 's'.  Buffered
+* output is written, closed and compressed in the background.
+*/
+static void session_finish(session_t *s)
+{
+  finished_t *f = malloc(sizeof(finished_t));
+
+  if (!f) {
+    perror("malloc");
+    exit(1);
+  }
+  if (s->text) fmt_flush(s->text);
+  if (s->stats) {
+    stats_write(s->stats, s->out);
+    stats_free(s->stats);
+    s->stats = NULL;
+  }
+  /* last block and the block index */
+  if (s->z) {
+    const char *frame, *out;
+    size_t len;
+
+    session_block(s);
+    frame = rdz_end_frame(&len);
+    if (s->wf) writer_write(s->wf, frame, len);
+    else {
+      len = rdz_out_frame(s->zout, frame, len, &out);
+      if (fwrite(out, len, 1, s->out) == 0) perror("fwrite");
+    }
+    rdz_enc_free(s->z);
+    s->z = NULL;
+  }
+  f->out  = s->out;
+  f->file = s->file;
+  f->zout = s->zout;
+  s->file = NULL;
+  s->zout = NULL;
+  RD_index_close(&s->idx);
+  if (s->wf) {
+    writer_retire(s->wf, finished, f);
+    s->wf = NULL;
+  }
+  else {
+    fflush(f->out);
+    finished(f);
+  }
+} /* session_finish */
+
+
+#if HAVE_PARALLEL
+/*
+* Parallel processing of a mapped dump file, -j: the records are cut
+* into chunks at record boundaries, and worker threads process each
+* chunk into output and statistics of their own, in memory.  The main
+* thread writes out the chunks and merges the statistics in file
+* order, so the result is that of a single pass.  Record boundaries
+* are found by heuristics; where a chunk does not end exactly where
+* the next one starts, the rest of the file is read sequentially.
+*/
+#define CHUNK_SIZE  (4 * 1024 * 1024)  /* record bytes per chunk */
+
+enum {CHUNK_FREE, CHUNK_BUSY, CHUNK_DONE};
+
+typedef struct {
+  int state;                /* CHUNK_* */
+  unsigned index;           /* number of the chunk */
+  uint64_t from, to;        /* file positions of its records */
+  uint64_t end;             /* where its records ended */
+  int status;               /* 1 if all read, else of RD_next() */
+  session_t s;              /* output and statistics of the chunk; */
+} chunk_t;                  /* buffers stay for the next in the slot */
+
+typedef struct {
+  RD_reader_t *reader;
+  t_format format;
+  int trunc;
+  uint64_t first, size;     /* bytes of records to split */
+  int has_base;             /* -F stats seconds count from 'base_ns' */
+  uint64_t base_ns;
+  unsigned nchunks;
+  unsigned next;            /* next chunk to claim */
+  unsigned written;         /* chunks written out, in order */
+  unsigned ahead;           /* at most this many chunks in memory */
+  chunk_t *chunk;           /* chunk i in slot i % ahead */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} pool_t;
+
+
+/*
+* Process the records of chunk 'c' of pool 'p'.
+*/
+static void chunk_run(pool_t *p, chunk_t *c)
+{
+  session_t *s = &c->s;
+  RD_reader_t *r;
+  RD_record_t rec;
+
+  s->mlen = 0;
+  if (!s->text && (p->format == F_ascii || p->format == F_hex ||
+      p->format == F_rtcp || p->format == F_short)) {
+    if (!(s->text = malloc(sizeof(fmt_t)))) {
+      perror("malloc");
+      exit(1);
+    }
+    fmt_init(s->text, session_text, s);
+  }
+  if (p->format == F_stats) {
+    if (!(s->stats = stats_new())) {
+      perror("stats_new");
+      exit(1);
+    }
+    if (p->has_base) stats_base(s->stats, p->base_ns);
+  }
+  if (!(r = RD_range(p->reader, c->from, c->to))) {
+    perror("RD_range");
+    exit(1);
+  }
+  while ((c->status = RD_next(r, &rec)) > 0) {
+    if (rec.length == 0 || record_handler(s, p->format, p->trunc, &rec) < 0)
+      break;
+  }
+  /* 1 at the end of the chunk, 0 at a stop record or past the filter */
+  c->status = c->status == 0 ? 1 : c->status > 0 ? 0 : -1;
+  c->end = RD_tell(r);
+  RD_close(r);
+  if (s->text) fmt_flush(s->text);
+} /* chunk_run */
+
+
+static void *pool_main(void *arg)
+{
+  pool_t *p = arg;
+  chunk_t *c;
+  unsigned i;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->next < p->nchunks && p->next >= p->written + p->ahead)
+      pthread_cond_wait(&p->cond, &p->lock);
+    if (p->next >= p->nchunks) break;
+    i = p->next++;
+    c = &p->chunk[i % p->ahead];
+    c->state = CHUNK_BUSY;
+    c->index = i;
+    pthread_mutex_unlock(&p->lock);
+
+    /* neighbours find the same boundary between them */
+    c->from = RD_boundary(p->reader, p->first + p->size * i / p->nchunks);
+    c->to = RD_boundary(p->reader, p->first + p->size * (i+1) / p->nchunks);
+    chunk_run(p, c);
+
+    pthread_mutex_lock(&p->lock);
+    c->state = CHUNK_DONE;
+    pthread_cond_broadcast(&p->cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+} /* pool_main */
+
+
+/*
+* Find the arrival of the first RTP packet that passes the filter in
+* the records of 'r' from file position 'first', which -F stats
+* counts the seconds from.
+*/
+static int first_rtp(RD_reader_t *r, uint64_t first, uint64_t *ns)
+{
+  RD_reader_t *scan = RD_range(r, first, RD_boundary(r, (uint64_t)-1));
+  RD_record_t rec;
+  rtp_info_t info;
+  int found = 0, k;
+
+  if (!scan) return 0;
+  while (RD_next(scan, &rec) > 0 && rec.length > 0) {
+    if (filtering && (k = filter_match(&filter, &rec)) <= 0) {
+      if (k < 0) break;
+      continue;
+    }
+    if (rec.plen > 0 && rtp_parse(rec.data, rec.length, &info) == RTPP_OK &&
+        info.version == RTP_VERSION) {
+      *ns = rec.offset_ns;
+      found = 1;
+      break;
+    }
+  }
+  RD_close(scan);
+  return found;
+} /* first_rtp */
+
+
+/*
+* Process the records of mapped reader 'r' with 'threads' worker
+* threads, writing to session 's'.  Returns NULL if done, with
+* '*status' set as for the sequential loop, or a reader for the
+* records that are still to be read.
+*/
+static RD_reader_t *parallel(RD_reader_t *r, session_t *s, t_format format,
+  int trunc, int threads, int *status)
+{
+  pool_t pool, *p = &pool;
+  pthread_t *thread;
+  RD_reader_t *rest = NULL;
+  uint64_t end = RD_boundary(r, (uint64_t)-1);
+  chunk_t *c;
+  unsigned i;
+  int k;
+
+  memset(p, 0, sizeof(*p));
+  p->reader = r;
+  p->format = format;
+  p->trunc  = trunc;
+  p->first  = RD_tell(r);
+  p->size   = end - p->first;
+  /* a few chunks per thread even for small files, to balance them */
+  p->nchunks = p->size / CHUNK_SIZE;
+  if (p->nchunks < (unsigned)threads * 4) p->nchunks = threads * 4;
+  if (p->nchunks > p->size / 65536) p->nchunks = p->size / 65536;
+  if (p->nchunks == 0) p->nchunks = 1;
+  p->ahead = threads * 2;
+  if (format == F_stats)
+    p->has_base = first_rtp(r, p->first, &p->base_ns);
+  if (!(p->chunk = calloc(p->ahead, sizeof(chunk_t))) ||
+      !(thread = calloc(threads, sizeof(pthread_t)))) {
+    perror("calloc");
+    exit(1);
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  for (k = 0; k < threads; k++) {
+    if (pthread_create(&thread[k], NULL, pool_main, p) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  *status = 0;
+  if (s->text) fmt_flush(s->text);
+  fflush(s->out);
+  pthread_mutex_lock(&p->lock);
+  for (i = 0; i < p->nchunks; i++) {
+    c = &p->chunk[i % p->ahead];
+    while (c->state != CHUNK_DONE || c->index != i)
+      pthread_cond_wait(&p->cond, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+
+    if (c->s.mlen > 0) session_write(s, c->s.mem, c->s.mlen);
+    if (c->s.stats) {
+      stats_merge(s->stats, c->s.stats);
+      stats_free(c->s.stats);
+      c->s.stats = NULL;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    c->state = CHUNK_FREE;
+    p->written = i + 1;
+    pthread_cond_broadcast(&p->cond);
+    /* an invalid or stop record, or a boundary that was none */
+    if (c->status <= 0) {
+      *status = c->status < 0;
+      break;
+    }
+    if (c->end != c->to) {
+      if (!(rest = RD_range(r, c->end, end))) {
+        perror("RD_range");
+        exit(1);
+      }
+      break;
+    }
+  }
+
+  /* no more chunks; drop those done beyond a stop */
+  p->next = p->nchunks;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  for (k = 0; k < threads; k++) pthread_join(thread[k], NULL);
+  for (i = 0; i < p->ahead; i++) {
+    c = &p->chunk[i];
+    stats_free(c->s.stats);
+    free(c->s.mem);
+    free(c->s.text);
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  free(p->chunk);
+  free(thread);
+  fflush(s->out);
+  return rest;
+} /* parallel */
+#endif /* HAVE_PARALLEL */
+
+
+int main(int argc, char *argv[])
+{
+  int c;
+  static struct {
+    const char *name;
+    t_format format;
+  } formats[] = {
+    {"dump",    F_dump},
+    {"header",  F_header},
+    {"hex",     F_hex},
+    {"rtcp",    F_rtcp},
+    {"short",   F_short},
+    {"payload", F_payload},
+    {"ascii",   F_ascii},
+    {"index",   F_index},
+    {"stats",   F_stats},
+    {0,0}
+  };
+  t_format format = F_ascii;
+  struct sockaddr_in sin;
+  struct timeval start;
+  struct timeval timeout;   /* timeout to limit recording */
+  struct timeval flushed;   /* last time buffered output was written */
+  double dstart;            /* time as double */
+  double left;              /* recording time left */
+  float duration = 1000000; /* maximum duration in seconds */
+  int trunc    = 1000000;   /* bytes to show for F_hex and F_dump */
+  enum {FromFile, FromNetwork} source;
+  session_t *session;       /* sessions, one per address */
+  int nsession;
+  int nout;                 /* ... with an output, all but -q have one */
+  FILE *in = stdin;         /* input file to use instead of sockets */
+  RD_reader_t *reader = NULL;
+  char *infile = NULL;      /* name of input file */
+  char *outfile = NULL;     /* name of output file */
+  char *index = NULL;       /* name of seek index */
+  char *ifname = NULL;      /* capture from a packet ring on interface */
+#if HAVE_TPACKET
+  tpacket_t *ring = NULL;
+#endif
+  int threads = 0;          /* worker threads for a file, -j */
+  char *metrics = NULL;     /* serve the counters on this port */
+  double interval = 0;      /* seconds between lines of counters */
+#if HAVE_TPACKET
+  counters_t *ring_counters = NULL;
+  struct timeval polled;    /* last time the ring drops were read */
+#endif
+  double hold = 0;          /* milliseconds to hold packets for, -q */
+  counters_t *reorder_counters = NULL;
+  uint64_t due = 0;         /* end of the next hold time, ns */
+  double rotate_time = 0;   /* start a new file after seconds */
+  uint64_t rotate_size = 0; /* start a new file after bytes */
+  extern char *optarg;
+  extern int optind;
+  int i, k;
+  int nfds = 0;
+  int status = 0;
+  extern double tdbl(struct timeval *);
+
+  trace_init();
+  startupSocket();
+  while ((c = getopt(argc, argv, "B:DF:f:Ii:j:M:m:O:o:q:R:r:s:t:V:x:Zz:h")) != EOF) {
+    switch(c) {
+    /* ring buffer size of each session's writer */
+    case 'B':
+      if ((wsize = atoi(optarg) * (size_t)1024) == 0) {
+        warnx("Invalid -B value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* write dump files with O_DIRECT */
+    case 'D':
+      wflags |= WRITER_DIRECT;
+      break;
+
+    /* output format */
+    case 'F':
+      format = F_invalid;
+      for (i = 0; formats[i].name; i++) {
+        if (strncasecmp(formats[i].name, optarg, strlen(optarg)) == 0) {
+          format = formats[i].format;
+          break;
+        }
+      }
+      if (format == F_invalid) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* input file (instead of network connection) */
+    case 'f':
+      if (!(in = fopen(optarg, "rb"))) {
+        perror(optarg);
+        exit(1);
+      }
+      infile = optarg;
+      break;
+
+    /* write seek index along with dump */
+    case 'I':
+      write_index = 1;
+      break;
+
+    /* capture from a packet ring rather than the sockets */
+    case 'i':
+#if !HAVE_TPACKET
+      warnx("-i is not supported");
+      exit(1);
+#endif
+      ifname = optarg;
+      break;
+
+    /* serve the counters, print them periodically */
+    case 'M':
+    case 'm':
+#if !HAVE_PTHREAD
+      warnx("-%c is not supported", c);
+      exit(1);
+#endif
+      if (c == 'M') metrics = optarg;
+      else if ((interval = atof(optarg)) <= 0) {
+        warnx("Invalid -m value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* process an input file in parallel */
+    case 'j':
+#if !HAVE_PARALLEL
+      warnx("-j is not supported");
+      exit(1);
+#endif
+      if ((threads = atoi(optarg)) <= 0) {
+        warnx("Invalid -j value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* writer overflow policy */
+    case 'O':
+      if (strcmp(optarg, "drop") == 0)
+        wflags |= WRITER_DROP;
+      else if (strcmp(optarg, "block") == 0)
+        wflags &= ~WRITER_DROP;
+      else {
+        warnx("Invalid -O value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* output file */
+    case 'o':
+      outfile = optarg;
+      break;
+
+    /* reorder and remove duplicates, merging all addresses */
+    case 'q':
+      if ((hold = atof(optarg)) <= 0) {
+        warnx("Invalid -q value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* start a new file after a size or time */
+    case 'R':
+      if ((rotate_size = atof(optarg) * 1024) == 0) {
+        warnx("Invalid -R value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    case 'r':
+      if ((rotate_time = atof(optarg) * 60) <= 0) {
+        warnx("Invalid -r value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* records to process from a file */
+    case 's':
+      if (filter_parse(&filter, optarg) < 0) {
+        warnx("Invalid -s value");
+        usage(argv[0]);
+        exit(1);
+      }
+      filtering = 1;
+      break;
+
+    /* write compressed dump files */
+    case 'Z':
+      zdump = 1;
+      break;
+
+    /* command to compress finished files with */
+    case 'z':
+#if defined(WIN32)
+      warnx("-z is not supported");
+      exit(1);
+#endif
+      compress = optarg;
+      break;
+
+    /* recording duration in minutes or fractions thereof */
+    case 't':
+      duration = atof(optarg) * 60;
+      break;
+
+    /* dump file format version */
+    case 'V':
+      version = atoi(optarg);
+      if (version != 1 && version != 2) {
+        warnx("Invalid -V value");
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* bytes to show for F_hex or F_dump */
+    case 'x':
+      if (0 == (trunc = atoi(optarg))) {
+	  warnx("Invalid -x value");
+	  usage(argv[0]);
+	  exit(1);
+      }
+      break;
+
+    case '?':
+    case 'h':
       usage(argv[0]);
       exit(1);
+      break;
+    }
+  }
+
+  /* seek index: -F index builds one for a file, -I writes one along */
+  if (format == F_index) {
+    if (optind != argc || (!infile && !outfile)) {
+      warnx("-F index needs -f infile or -o outfile");
+      usage(argv[0]);
+      exit(1);
+    }
+    if (outfile) index = strdup(outfile);
+    else if ((index = malloc(strlen(infile) + 5)))
+      sprintf(index, "%s.idx", infile);
+    outfile = NULL;
+    write_index = 0;  /* the index is the output, -I has nothing to add */
+  }
+  else if (write_index) {
+    if (!outfile || (format != F_dump && format != F_header)) {
+      warnx("-I needs -o outfile and the dump or header format");
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (ifname && optind == argc) {
+    warnx("-i needs an address");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if ((metrics || interval > 0) && optind == argc) {
+    warnx("-M and -m need an address");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (hold > 0 && optind == argc) {
+    warnx("-q needs an address");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (zdump && ((format != F_dump && format != F_header) || write_index)) {
+    warnx("-Z needs the dump or header format and cannot be used with -I");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (filtering && (optind != argc || format == F_index)) {
+    warnx("-s needs an input file and cannot be used with -F index");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (threads && (optind != argc || format == F_index || write_index ||
+      zdump)) {
+    warnx("-j needs an input file and cannot be used with -F index, -I or -Z");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if ((rotate_time > 0 || rotate_size > 0) && (!outfile || optind == argc)) {
+    warnx("-R and -r need -o outfile and an address");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  /*
+  * several addresses: session n writes to outfile.n, as multidump did,
+  * unless -q merges them into one
+  */
+  nsession = optind == argc ? 1 : argc - optind;
+  nout = hold > 0 ? 1 : nsession;
+  if (nout > 1 && !outfile) {
+    warnx("several addresses need -o filebase");
+    usage(argv[0]);
+    exit(1);
+  }
+  if (!(session = calloc(nsession, sizeof(session_t)))) {
+    perror("calloc");
+    exit(1);
+  }
+  for (k = 0; k < nsession; k++) {
+    session_t *s = &session[k];
+
+    s->out = stdout;
+    s->name = outfile;
+    if (format == F_ascii || format == F_hex || format == F_rtcp ||
+        format == F_short) {
+      if (!(s->text = malloc(sizeof(fmt_t)))) {
+        perror("malloc");
+        exit(1);
+      }
+      fmt_init(s->text, session_text, s);
+    }
+    if (outfile && nout > 1) {
+      if (!(s->name = malloc(strlen(outfile) + 12))) {
+        perror("malloc");
+        exit(1);
+      }
+      sprintf(s->name, "%s.%d", outfile, k + 1);
+    }
+  }
+  if (index && RD_index_open(&session[0].idx, index) < 0) {
+    perror(index);
+    exit(1);
+  }
+  if (compress) signal(SIGCHLD, SIG_IGN);
+
+#if defined(WIN32)
+  /* On Windows, make sure stdout and stdin use the binary format
+   * if using F_dump or F_header. */
+  if (format == F_dump || format == F_header) {
+    if (session[0].out == stdout) {
+      setmode(fileno(stdout), O_BINARY);
+    }
+  }
+  if (in == stdin) {
+    setmode(fileno(stdin), O_BINARY);
+  }
+#endif
+
+  /* if no optional arguments, we are reading from a file */
+  if (optind == argc) {
+    source = FromFile;
+    session[0].sock[0] = fileno(in);  /* stdin */
+    session[0].sock[1] = -1;          /* not used */
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    RD_header(in, &sin, &start, 0);
+    in_version = RD_version(in);
+    if ((reader = RD_open(in)) == NULL) {
+      perror("RD_open");
+      exit(1);
+    }
+    /* skip to the time range, with the seek index if there is one */
+    if (filtering && filter.from_ns > 0) {
+      char *idx = infile ? malloc(strlen(infile) + 5) : NULL;
+
+      if (idx) sprintf(idx, "%s.idx", infile);
+      RD_find(reader, filter.from_ns, idx);
+      free(idx);
+    }
+    timerclear(&session[0].base);
+    dstart = 0.;
+  }
+  else {
+    source = FromNetwork;
+    for (k = 0; k < nsession; k++) {
+      session_t *s = &session[k];
+
+      if (hpt(argv[optind + k], &sin, NULL) == -1) {
+        usage(argv[0]);
+        exit(1);
+      }
+      s->rtp = sin;
+      i = open_network(argv[optind + k], format != F_rtcp, s->sock, &sin);
+      if (i > nfds) nfds = i;
+      for (i = 0; i < 2; i++) {
+        char name[64];
+
+        if (s->sock[i] < 0) continue;
+        snprintf(name, sizeof(name), "%s %s/%d", i ? "rtcp" : "rtp",
+          inet_ntoa(s->rtp.sin_addr), ntohs(s->rtp.sin_port) + i);
+        s->counters[i] = counters_new(name, i == 0);
+      }
+    }
+#if HAVE_TPACKET
+    if (ifname) {
+      char name[64];
+
+      ring = open_ring(ifname, session, nsession);
+      if (tpacket_fd(ring) > nfds) nfds = tpacket_fd(ring);
+      snprintf(name, sizeof(name), "ring %s", ifname);
+      ring_counters = counters_new(name, 0);
+    }
+#endif
+    if ((metrics || interval > 0) && counters_serve(metrics, interval) < 0) {
+      perror(metrics ? metrics : "counters");
+      exit(1);
     }
-    rtp = sin;
-    nfds = open_network(argv[optind], format != F_rtcp, sock, &sin);
     gettimeofday(&start, 0);
+    for (k = 0; k < nsession; k++) session[k].base = start;
     dstart = tdbl(&start);
   }
 
-  /* write header for dump file */
-  if (format == F_dump || format == F_header)
-    rtpdump_header(out, &rtp, &start);
+  /* captured records go through the shared writer */
+  if (source == FromNetwork &&
+      (format == F_dump || format == F_header || format == F_payload))
+    writer = writer_new();
+
+  /* open output files and write header for dump file */
+  for (k = 0; k < nout; k++) session_open(&session[k], format, &start);
+  if (hold > 0) {
+    merged.s = &session[0];
+    merged.format = format;
+    merged.trunc = trunc;
+    if (!(reorder = reorder_new(hold * 1000000, reorder_emit, NULL))) {
+      perror("reorder_new");
+      exit(1);
+    }
+    reorder_counters = counters_new("reorder", 0);
+  }
+  flushed = start;
+#if HAVE_TPACKET
+  polled = start;
+#endif
+
+#if HAVE_PARALLEL
+  /* a regular, uncompressed file is processed in chunks */
+  if (threads && RD_mapped(reader))
+    reader = parallel(reader, &session[0], format, trunc, threads, &status);
+#endif
 
   /* signal handler */
   signal(SIGINT, done);
   signal(SIGTERM, done);
   signal(SIGHUP, done);
+#ifdef SIGUSR1
+  signal(SIGUSR1, report_signal);
+#endif
 
   /* main loop */
-  while (1) {
+  while (!stop) {
+#if !HAVE_RECVMMSG
     int len;
     RD_buffer_t packet;
+    struct timespec ts;
+#endif
+    RD_record_t rec;
     struct timeval now;
-    double dnow;
 
+    if (report) {
+      report = 0;
+      counters_report(stderr, COUNTERS_TEXT);
+    }
     if (source == FromNetwork) {
+      fd_set readfds;
+
+      /* wake up at the end of the recording time, or to flush output */
+      gettimeofday(&now, 0);
+      left = duration - (tdbl(&now) - dstart);
+      if (left <= 0) {
+        if (verbose)
+          fprintf(stderr, "Time limit reached.\n");
+        break;
+      }
+      if ((writer || rotate_time > 0 || metrics || interval > 0) && left > 1)
+        left = 1;
+      if (due) {
+        double wait = (due - ((uint64_t)now.tv_sec * 1000000000 +
+          now.tv_usec * 1000)) / 1e9;
+
+        if (wait < left) left = wait > 0 ? wait : 0;
+      }
+      timeout.tv_sec  = left;
+      timeout.tv_usec = (left - timeout.tv_sec) * 1000000.0;
+
       FD_ZERO(&readfds);
-      if (sock[0] >= 0) FD_SET(sock[0], &readfds);
-      if (sock[1] >= 0) FD_SET(sock[1], &readfds);
+#if HAVE_TPACKET
+      if (ring) FD_SET(tpacket_fd(ring), &readfds);
+      else
+#endif
+      for (k = 0; k < nsession; k++) {
+        for (i = 0; i < 2; i++) {
+          if (session[k].sock[i] >= 0) FD_SET(session[k].sock[i], &readfds);
+        }
+      }
       c = select(nfds+1, &readfds, 0, 0, &timeout);
+      TRACE(TRACE_WAKEUP, c > 0 ? c : 0);
       if (c < 0) {
+        if (errno == EINTR) continue;
         perror("select");
         exit(1);
       }
-      /* end of recording time reached */
-      else if (c == 0) {
-        if (verbose)
-          fprintf(stderr, "Time limit reached.\n");
-        exit(0);
+      gettimeofday(&now, 0);
+#if HAVE_TPACKET
+      if (ring) {
+        if (c > 0) receive_ring(ring, session, format, trunc, &now);
+        c = 0;
       }
-      for (i = 0; i < 2; i++) {
-        if (sock[i] >= 0 && FD_ISSET(sock[i], &readfds)) {
-          socklen_t alen = sizeof(sin);
-
-          /* subtract elapsed time from remaining timeout */
-          gettimeofday(&now, 0);
-          dnow = tdbl(&now);
-          timeout.tv_sec = duration - (dnow - dstart);
-          if (timeout.tv_sec < 0) timeout.tv_sec = 0;
-
-          len = recvfrom(sock[i], packet.p.data, sizeof(packet.p.data),
-            0, (struct sockaddr *)&sin, &alen);
-          packet_handler(out, format, trunc, dstart, now, i, sin, len, &packet);
+#endif
+      for (k = 0; k < nsession && c > 0; k++) {
+        session_t *s = &session[k];
+
+        for (i = 0; i < 2; i++) {
+          if (s->sock[i] >= 0 && FD_ISSET(s->sock[i], &readfds)) {
+#if HAVE_RECVMMSG
+            receive_batch(s, format, trunc, &s->base, i, &now);
+#else
+            socklen_t alen = sizeof(sin);
+
+            len = recvfrom(s->sock[i], packet.p.data, sizeof(packet.p.data),
+              0, (struct sockaddr *)&sin, &alen);
+            TRACE(TRACE_RECV, len >= 0);
+            ts.tv_sec  = now.tv_sec;
+            ts.tv_nsec = now.tv_usec * 1000;
+            if (len > 0) count_packet(s, i, packet.p.data, len);
+            deliver(s, format, trunc, &ts, i, &sin, 0, len, packet.p.data,
+              &now);
+#endif
+            c--;
+          }
+        }
+      }
+
+      /* pass on what was held long enough */
+      if (reorder) {
+        reorder_stats_t st;
+
+        due = reorder_flush(reorder, (uint64_t)now.tv_sec * 1000000000 +
+          now.tv_usec * 1000);
+        reorder_stats(reorder, &st);
+        counters_set(reorder_counters, CTR_HELD, st.held);
+        counters_set(reorder_counters, CTR_DUPLICATES, st.duplicates);
+        counters_set(reorder_counters, CTR_LATE, st.late);
+        counters_set(reorder_counters, CTR_LOST, st.lost);
+      }
+
+      /* show what came in right away */
+      for (k = 0; k < nout; k++) {
+        if (session[k].text) fmt_flush(session[k].text);
+      }
+#if HAVE_TPACKET
+      /* reading the drops resets the kernel's count, once a second */
+      if (ring && tdbl(&now) - tdbl(&polled) >= 1) {
+        counters_set(ring_counters, CTR_DROPS, tpacket_drops(ring));
+        polled = now;
+      }
+#endif
+
+      /* do not leave quiet sessions in the buffers for long */
+      if (writer && tdbl(&now) - tdbl(&flushed) >= 1) {
+        for (k = 0; k < nout; k++) {
+          counters_t *ctr = SESSION_COUNTERS(&session[k]);
+          writer_stats_t st;
+
+          session_block(&session[k]);
+          writer_flush(session[k].wf);
+          writer_stats(session[k].wf, &st);
+          counters_set(ctr, CTR_QUEUE, writer_queued(session[k].wf));
+          counters_set(ctr, CTR_QUEUE_MAX, st.high);
+        }
+        flushed = now;
+      }
+
+      /* move on to new files, keeping the sockets open */
+      for (k = 0; k < nout && (rotate_time > 0 || rotate_size > 0); k++) {
+        session_t *s = &session[k];
+
+        if ((rotate_time > 0 && tdbl(&now) - tdbl(&s->base) >= rotate_time) ||
+            (rotate_size > 0 && session_size(s, format) >= rotate_size)) {
+          session_finish(s);
+          s->seq++;
+          s->base = now;
+          session_open(s, format, &now);
         }
       }
     }
     else {
-      len = RD_read(in, &packet);
-      if (len == 0) exit(0);
-      now.tv_sec = packet.p.hdr.offset / 1000.;
-      now.tv_usec = (packet.p.hdr.offset % 1000) * 1000;
-      dnow = tdbl(&now);
-      /* plen>0: data =0: control */
-      i = (packet.p.hdr.plen == 0);
-      /* arbitrary, obviously invalid value */
-      sin.sin_addr.s_addr = INADDR_ANY; sin.sin_port = 0;
-      packet_handler(out, format, trunc, dstart, now, i, sin, len, &packet);
+      if (!reader) break;
+      if ((c = RD_next(reader, &rec)) <= 0 || rec.length == 0) {
+        status = c < 0;
+        break;
+      }
+      if (format == F_index) {
+        RD_index_add(&session[0].idx, rec.offset_ns, rec.pos);
+        continue;
+      }
+      if (record_handler(&session[0], format, trunc, &rec) < 0) break;
     }
   }
-  return 0;
+
+  /* end of recording: write out what is buffered, tell of overflows */
+  if (reorder) {
+    reorder_stats_t st;
+
+    reorder_flush(reorder, UINT64_MAX);
+    reorder_stats(reorder, &st);
+    reorder_free(reorder);
+    if (st.held || st.duplicates || st.late || st.lost)
+      fprintf(stderr, "reorder: %llu packets, %llu held, %llu duplicates, "
+        "%llu late, %llu lost\n", (unsigned long long)st.packets,
+        (unsigned long long)st.held, (unsigned long long)st.duplicates,
+        (unsigned long long)st.late, (unsigned long long)st.lost);
+  }
+  for (k = 0; k < nout; k++) {
+    writer_stats_t st;
+
+    if (!session[k].wf) continue;
+    writer_stats(session[k].wf, &st);
+    if (st.dropped || st.stalls)
+      fprintf(stderr, "session %d: %llu records, %llu dropped, "
+        "%llu stalls, buffered up to %lu of %lu bytes\n", k + 1,
+        (unsigned long long)st.records, (unsigned long long)st.dropped,
+        (unsigned long long)st.stalls, (unsigned long)st.high,
+        (unsigned long)st.size);
+  }
+#if HAVE_TPACKET
+  if (ring) {
+    uint64_t drops = tpacket_drops(ring);
+
+    if (drops)
+      fprintf(stderr, "%s: %llu packets dropped by the kernel\n", ifname,
+        (unsigned long long)drops);
+    tpacket_close(ring);
+  }
+#endif
+  for (k = 0; k < nout; k++) session_finish(&session[k]);
+  writer_free(writer);
+  return status;
 } /* main */
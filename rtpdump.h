@@ -42,10 +42,20 @@
 * based on SSRC.  This saves (a little) space, avoids non-IPv4
 * problems and privacy/security concerns. The header is followed by
 * the RTP/RTCP header and (optionally) the actual payload.
+*
+* Version 2.0 files (#!rtpplay2.0) have the same first line and
+* RD_hdr_t, but each record starts with an RD_packet2_t carrying
+* a nanosecond offset; if RD_F_SOURCE is set in its flags, an
+* RD_source_t with the sender of the packet follows before the data.
+* RD_read() reads both versions and fills in the decoded fields of
+* RD_buffer_t.
 */
 #include <stdint.h>
 #include "sysdep.h"
 
+#define RTPFILE_VERSION  "1.0"  /* RD_packet_t records */
+#define RTPFILE_VERSION2 "2.0"  /* RD_packet2_t records */
+
 typedef struct {
   struct timeval32 {
       uint32_t tv_sec;    /* start of recording (GMT) (seconds) */
@@ -63,13 +73,129 @@ typedef struct {
   uint32_t offset;   /* milliseconds since the start of recording */
 } RD_packet_t;
 
+typedef struct {
+  uint16_t length;    /* length of record, including this header and
+                         RD_source_t if present */
+  uint16_t plen;      /* actual header+payload length for RTP, 0 for RTCP */
+  uint32_t flags;     /* RD_F_* */
+  uint32_t offset_hi; /* nanoseconds since the start of recording, */
+  uint32_t offset_lo; /* high and low 32 bits */
+} RD_packet2_t;
+
+#define RD_F_SOURCE 0x01  /* RD_source_t follows */
+#define RD_F_HWTIME 0x02  /* offset is from a hardware timestamp */
+
+typedef struct {
+  uint32_t source;   /* sender IPv4 address */
+  uint16_t port;     /* sender UDP port */
+  uint16_t padding;  /* padding */
+} RD_source_t;
+
 typedef union {
   struct {
     RD_packet_t hdr;
     char data[8000];
+    /* filled in by RD_read() in host byte order, for either version */
+    uint64_t offset_ns; /* nanoseconds since the start of recording */
+    uint32_t flags;     /* RD_F_* */
+    uint32_t source;    /* sender address if RD_F_SOURCE (network order) */
+    uint16_t port;      /* sender port if RD_F_SOURCE (network order) */
   } p;
   char byte[8192];
 } RD_buffer_t;
 
+/*
+* Record returned by RD_next().  'data' points into the mapped file
+* or into the reader's buffer and stays valid until the next call
+* (mapped: until RD_close()); it must not be modified.  The 'hlen'
+* bytes before it are the record header, so the whole record can be
+* copied as it is.
+*/
+typedef struct {
+  char *data;         /* recorded packet, 'length' bytes */
+  uint16_t length;    /* bytes recorded */
+  uint16_t plen;      /* actual header+payload length for RTP, 0 for RTCP */
+  uint32_t flags;     /* RD_F_* */
+  uint64_t offset_ns; /* nanoseconds since the start of recording */
+  uint32_t source;    /* sender address if RD_F_SOURCE (network order) */
+  uint16_t port;      /* sender port if RD_F_SOURCE (network order) */
+  uint64_t pos;       /* file position of the record */
+  uint16_t hlen;      /* record header before 'data', as in the file */
+} RD_record_t;
+
+typedef struct RD_reader RD_reader_t;
+
+/*
+* Seek index, written to <dumpfile>.idx: the line "#!rtpidx1.0\n"
+* followed by one RD_index_entry_t, in network byte order, for the
+* first record at or after each RD_INDEX_INTERVAL of recording time.
+*/
+#define RTPIDX_VERSION    "1.0"
+#define RD_INDEX_INTERVAL 1000000000  /* ns */
+
+typedef struct {
+  uint32_t offset_hi;  /* record offset (ns), high and low 32 bits */
+  uint32_t offset_lo;
+  uint32_t pos_hi;     /* file position of record, high and low 32 bits */
+  uint32_t pos_lo;
+} RD_index_entry_t;
+
+typedef struct {
+  FILE *out;           /* index file */
+  uint64_t next;       /* offset of next entry */
+} RD_index_t;
+
+/*
+* Compressed dump files have the first line of a plain file of that
+* version with a "z" appended (#!rtpplay1.0z 224.2.0.1/3456) and the
+* usual RD_hdr_t.  Then follow blocks, each an RD_zblock_t and 'clen'
+* bytes which decode on their own to 'count' records of a plain file.
+* The records are delta-coded (see rdz.c), then compressed with
+* 'codec'.  After the last block, an RD_zblock_t with magic
+* RD_ZINDEX_MAGIC is followed by one RD_index_entry_t per block with
+* its first record offset and file position, and an RD_ztrailer_t
+* that ends the file.  All fields are in network byte order.
+*/
+#define RTPFILE_Z       "z"
+#define RD_ZBLOCK_MAGIC 0x52445a42  /* "RDZB" */
+#define RD_ZINDEX_MAGIC 0x52445a49  /* "RDZI" */
+#define RD_ZTRAIL_MAGIC 0x52445a58  /* "RDZX" */
+
+#define RD_Z_NONE 0    /* delta coding only */
+#define RD_Z_ZLIB 1
+#define RD_Z_ZSTD 2
+
+typedef struct {
+  uint32_t magic;      /* RD_ZBLOCK_MAGIC, or RD_ZINDEX_MAGIC */
+  uint8_t  codec;      /* RD_Z_* */
+  uint8_t  padding[3];
+  uint32_t count;      /* records in block, or index entries */
+  uint32_t clen;       /* bytes that follow */
+  uint32_t dlen;       /* bytes of delta-coded records */
+  uint32_t ulen;       /* bytes of plain records */
+  uint32_t first_hi;   /* offset of first record (ns), high and low */
+  uint32_t first_lo;
+} RD_zblock_t;
+
+typedef struct {
+  uint32_t magic;      /* RD_ZTRAIL_MAGIC */
+  uint32_t count;      /* index entries */
+  uint32_t pos_hi;     /* file position of the index RD_zblock_t */
+  uint32_t pos_lo;
+} RD_ztrailer_t;
+
 extern int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verbose);
 extern int RD_read(FILE *in, RD_buffer_t *b);
+extern int RD_version(FILE *in);
+extern int RD_compressed(FILE *in);
+extern RD_reader_t *RD_open(FILE *in);
+extern int RD_next(RD_reader_t *r, RD_record_t *rec);
+extern int RD_mapped(RD_reader_t *r);
+extern void RD_close(RD_reader_t *r);
+extern int RD_find(RD_reader_t *r, uint64_t offset_ns, const char *index);
+extern uint64_t RD_boundary(RD_reader_t *r, uint64_t pos);
+extern RD_reader_t *RD_range(RD_reader_t *r, uint64_t from, uint64_t to);
+extern uint64_t RD_tell(RD_reader_t *r);
+extern int RD_index_open(RD_index_t *x, const char *file);
+extern void RD_index_add(RD_index_t *x, uint64_t offset_ns, uint64_t pos);
+extern void RD_index_close(RD_index_t *x);
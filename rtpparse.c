@@ -0,0 +1,344 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* RTP, RTCP and vat packet parsing; see rtpparse.h.  All multi-byte
+* fields are assembled from single bytes, which compilers turn into a
+* load and a byte swap where unaligned loads are allowed.
+*/
+
+#include "sysdep.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rtp.h"
+#include "rtpparse.h"
+
+static uint16_t get16(const unsigned char *p)
+{
+  return (uint16_t)(p[0] << 8 | p[1]);
+} /* get16 */
+
+static uint32_t get32(const unsigned char *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+         (uint32_t)p[2] << 8 | p[3];
+} /* get32 */
+
+
+/*
+* Decode the RTP or vat data packet of 'len' bytes at 'buf' into 'r'.
+* Returns 0 if valid, else -1 with 'r->error' set; the fields up to
+* the point of the error are filled in.
+*/
+int rtp_parse(const void *buf, int len, rtp_info_t *r)
+{
+  const unsigned char *b = buf;
+  int pad;
+
+  memset(r, 0, sizeof(*r));
+  if (len < 1) {
+    r->error = RTPP_SHORT;
+    r->version = -1;
+    return -1;
+  }
+  r->version = b[0] >> 6;
+
+  /* vat: nsid, flags, conference id, timestamp, source ids */
+  if (r->version == 0) {
+    r->nsid = b[0] & 0x3f;
+    r->hlen = 8 + r->nsid * 4;
+    if (len < 8) {
+      r->error = RTPP_SHORT;
+      return -1;
+    }
+    r->flags  = b[1];
+    r->confid = get16(b + 2);
+    r->vts    = get32(b + 4);
+    if (len < r->hlen) {
+      r->error = RTPP_SHORT;
+      return -1;
+    }
+    r->payload = b + r->hlen;
+    r->plen    = len - r->hlen;
+    return 0;
+  }
+  if (r->version != RTP_VERSION) {
+    r->error = RTPP_VERSION;
+    return -1;
+  }
+
+  r->p  = (b[0] >> 5) & 1;
+  r->x  = (b[0] >> 4) & 1;
+  r->cc = b[0] & 0x0f;
+  r->hlen = 12 + r->cc * 4;
+  if (len < 12) {
+    r->error = RTPP_SHORT;
+    return -1;
+  }
+  r->m    = b[1] >> 7;
+  r->pt   = b[1] & 0x7f;
+  r->seq  = get16(b + 2);
+  r->ts   = get32(b + 4);
+  r->ssrc = get32(b + 8);
+  r->csrc = b + 12;
+  if (len < r->hlen) {
+    r->error = RTPP_SHORT;
+    return -1;
+  }
+  if (r->x) {
+    if (len < r->hlen + 4) {
+      r->hlen += 4;
+      r->error = RTPP_SHORT;
+      return -1;
+    }
+    r->ext_type = get16(b + r->hlen);
+    r->ext_len  = get16(b + r->hlen + 2);
+    r->ext      = b + r->hlen + 4;
+    r->hlen += 4 + r->ext_len * 4;
+    if (len < r->hlen) {
+      r->error = RTPP_SHORT;
+      return -1;
+    }
+  }
+  r->payload = b + r->hlen;
+  r->plen    = len - r->hlen;
+  if (r->p && r->plen > 0) {
+    pad = b[len - 1];
+    if (pad > r->plen) {
+      r->error = RTPP_PADDING;
+      return -1;
+    }
+    r->plen -= pad;
+  }
+  return 0;
+} /* rtp_parse */
+
+
+/*
+* Return the header length of the RTP or vat packet of 'len' bytes at
+* 'buf', with CSRCs and extension, as far as it is within the packet;
+* 0 if neither RTP nor vat.
+*/
+int rtp_hlen(const void *buf, int len)
+{
+  const unsigned char *b = buf;
+  int hlen;
+
+  if (len < 1) return 0;
+  switch (b[0] >> 6) {
+  case 0:
+    hlen = 8 + (b[0] & 0x3f) * 4;
+    break;
+  case RTP_VERSION:
+    hlen = 12 + (b[0] & 0x0f) * 4;
+    if ((b[0] & 0x10) && len >= hlen + 4)
+      hlen += 4 + get16(b + hlen + 2) * 4;
+    break;
+  default:
+    return 0;
+  }
+  return hlen < len ? hlen : len;
+} /* rtp_hlen */
+
+
+/*
+* Return CSRC 'i', less than 'r->cc', of a header decoded by rtp_parse().
+*/
+uint32_t rtp_csrc(const rtp_info_t *r, int i)
+{
+  return get32(r->csrc + i * 4);
+} /* rtp_csrc */
+
+
+/*
+* Start going through the RTCP compound packet of 'len' bytes at 'buf'.
+*/
+void rtcp_begin(rtcp_iter_t *it, const void *buf, int len)
+{
+  it->base = it->p = buf;
+  it->end = it->p + (len > 0 ? len : 0);
+} /* rtcp_begin */
+
+
+/*
+* Decode the next packet of a compound packet into 'c'.  Returns 1 if
+* there is one, 0 at the end and -1 if the next packet does not fit
+* into what is left; 'c->length' then holds its length, if known.
+*/
+int rtcp_next(rtcp_iter_t *it, rtcp_info_t *c)
+{
+  const unsigned char *b = it->p;
+  int words;
+
+  memset(c, 0, sizeof(*c));
+  if (b >= it->end) return 0;
+  if (it->end - b < 4) return -1;
+  c->version = b[0] >> 6;
+  c->p       = (b[0] >> 5) & 1;
+  c->count   = b[0] & 0x1f;
+  c->pt      = b[1];
+  c->length  = get16(b + 2);
+  if ((it->end - b) / 4 < c->length + 1) return -1;
+  c->body = b + 4;
+  words = c->length;
+  if (words >= 1) c->ssrc = get32(c->body);
+
+  switch (c->pt) {
+  case RTCP_SR:
+    if (words >= 6) {
+      c->ntp_sec  = get32(c->body + 4);
+      c->ntp_frac = get32(c->body + 8);
+      c->rtp_ts   = get32(c->body + 12);
+      c->psent    = get32(c->body + 16);
+      c->osent    = get32(c->body + 20);
+      c->rr  = c->body + 24;
+      c->nrr = (words - 6) / 6;
+    }
+    break;
+  case RTCP_RR:
+    if (words >= 1) {
+      c->rr  = c->body + 4;
+      c->nrr = (words - 1) / 6;
+    }
+    break;
+  }
+  if (c->nrr > c->count) c->nrr = c->count;
+  it->p = b + 4 + words * 4;
+  return 1;
+} /* rtcp_next */
+
+
+/*
+* Return word 'i', less than 'c->length', of the body of 'c', such
+* as the sources of a BYE packet.
+*/
+uint32_t rtcp_source(const rtcp_info_t *c, int i)
+{
+  return get32(c->body + i * 4);
+} /* rtcp_source */
+
+
+/*
+* Decode report block 'i', less than 'c->nrr', into 'rr'.
+*/
+void rtcp_report(const rtcp_info_t *c, int i, rtcp_rr_info_t *rr)
+{
+  const unsigned char *b = c->rr + i * 24;
+  uint32_t lost = (uint32_t)b[5] << 16 | b[6] << 8 | b[7];
+
+  rr->ssrc     = get32(b);
+  rr->fraction = b[4];
+  rr->lost     = lost & 0x800000 ? (int32_t)lost - 0x1000000 : (int32_t)lost;
+  rr->last_seq = get32(b + 8);
+  rr->jitter   = get32(b + 12);
+  rr->lsr      = get32(b + 16);
+  rr->dlsr     = get32(b + 20);
+} /* rtcp_report */
+
+
+/*
+* Start going through the chunks of SDES packet 'c'.
+*/
+void rtcp_sdes_begin(rtcp_iter_t *it, const rtcp_info_t *c)
+{
+  it->base = it->p = c->body;
+  it->end = c->body + c->length * 4;
+} /* rtcp_sdes_begin */
+
+
+/*
+* Start the next SDES chunk, setting 'src'.  Returns 1 if ok, -1 if
+* the packet ends.
+*/
+int rtcp_sdes_chunk(rtcp_iter_t *it, uint32_t *src)
+{
+  /* chunks start on a word boundary */
+  it->p = it->base + (it->p - it->base + 3) / 4 * 4;
+  if (it->end - it->p < 4) return -1;
+  *src = get32(it->p);
+  it->p += 4;
+  return 1;
+} /* rtcp_sdes_chunk */
+
+
+/*
+* Return the next item of the current SDES chunk in 'type', 'data' and
+* 'len'.  Returns 1 if ok, 0 at the end of the chunk and -1 if the
+* item does not fit into the packet.
+*/
+int rtcp_sdes_item(rtcp_iter_t *it, int *type, const unsigned char **data,
+  int *len)
+{
+  if (it->p >= it->end) return -1;
+  if ((*type = it->p[0]) == RTCP_SDES_END) {
+    it->p++;
+    return 0;
+  }
+  if (it->end - it->p < 2 || it->end - it->p - 2 < it->p[1]) return -1;
+  *len  = it->p[1];
+  *data = it->p + 2;
+  it->p += 2 + *len;
+  return 1;
+} /* rtcp_sdes_item */
+
+
+/*
+* Set 'reason' and 'len' to the reason for leaving in BYE packet 'c'.
+* Returns 1 if there is one, 0 if not and -1 if it does not fit into
+* the packet.
+*/
+int rtcp_bye_reason(const rtcp_info_t *c, const unsigned char **reason,
+  int *len)
+{
+  const unsigned char *b = c->body + c->count * 4;
+
+  if (c->length <= c->count) return 0;
+  *len = b[0];
+  *reason = b + 1;
+  return 1 + *len <= (c->length - c->count) * 4 ? 1 : -1;
+} /* rtcp_bye_reason */
+
+
+/*
+* Decode the vat control message header of 'len' bytes at 'buf'.
+* Returns 0 if ok, -1 if too short.
+*/
+int vat_ctrl_parse(const void *buf, int len, vat_ctrl_t *v)
+{
+  const unsigned char *b = buf;
+
+  if (len < 4) return -1;
+  v->flags  = b[0];
+  v->type   = b[1];
+  v->confid = get16(b + 2);
+  return 0;
+} /* vat_ctrl_parse */
@@ -0,0 +1,130 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* RTP, RTCP and vat packet parsing.  Each call validates and decodes
+* a packet or one part of it in a single pass into a flat structure in
+* host byte order, reading the wire format byte by byte rather than
+* through the bitfields of rtp.h, so the result does not depend on
+* the alignment of the packet or the byte order of the host.  Nothing
+* is allocated; pointers in the results point into the packet.
+*/
+#ifndef RTPPARSE_H
+#define RTPPARSE_H
+
+#include <stdint.h>
+
+/* rtp_info_t errors */
+#define RTPP_OK      0
+#define RTPP_SHORT   1  /* packet ends inside the header */
+#define RTPP_VERSION 2  /* neither RTP version 2 nor vat */
+#define RTPP_PADDING 3  /* padding longer than the payload */
+
+/* RTP or vat data packet */
+typedef struct {
+  int error;                  /* RTPP_* */
+  int version;                /* 2 for RTP, 0 for vat */
+  int hlen;                   /* header length by the header, with
+                                 CSRCs and extension; may exceed the
+                                 packet if RTPP_SHORT */
+  const unsigned char *payload;  /* payload without padding */
+  int plen;
+  /* RTP */
+  int p, x, cc, m, pt;
+  uint16_t seq;
+  uint32_t ts;
+  uint32_t ssrc;
+  const unsigned char *csrc;  /* 'cc' CSRCs, network order */
+  uint16_t ext_type;          /* if 'x' */
+  uint16_t ext_len;           /* extension length in words */
+  const unsigned char *ext;   /* extension data */
+  /* vat */
+  int nsid;
+  int flags;
+  uint16_t confid;
+  uint32_t vts;               /* vat timestamp */
+} rtp_info_t;
+
+/* one packet of an RTCP compound packet */
+typedef struct {
+  int version;
+  int p;
+  int count;                  /* reports, chunks or sources */
+  int pt;                     /* RTCP_* */
+  int length;                 /* in words, without the first */
+  const unsigned char *body;  /* 'length' words after the first */
+  uint32_t ssrc;              /* first word of body, 0 if none */
+  /* RTCP_SR sender info */
+  uint32_t ntp_sec, ntp_frac, rtp_ts, psent, osent;
+  /* RTCP_SR and RTCP_RR */
+  const unsigned char *rr;    /* report blocks */
+  int nrr;                    /* report blocks within the packet */
+} rtcp_info_t;
+
+/* reception report block */
+typedef struct {
+  uint32_t ssrc;
+  int fraction;               /* fraction lost, 1/256 */
+  int32_t lost;               /* cumulative number lost */
+  uint32_t last_seq;
+  uint32_t jitter;
+  uint32_t lsr;
+  uint32_t dlsr;
+} rtcp_rr_info_t;
+
+/* vat control message header */
+typedef struct {
+  int flags;
+  int type;                   /* 1 for an ID message */
+  uint16_t confid;
+} vat_ctrl_t;
+
+/* position in a compound packet or in SDES chunks */
+typedef struct {
+  const unsigned char *p, *end, *base;
+} rtcp_iter_t;
+
+extern int rtp_parse(const void *buf, int len, rtp_info_t *r);
+extern int rtp_hlen(const void *buf, int len);
+extern uint32_t rtp_csrc(const rtp_info_t *r, int i);
+
+extern void rtcp_begin(rtcp_iter_t *it, const void *buf, int len);
+extern int rtcp_next(rtcp_iter_t *it, rtcp_info_t *c);
+extern uint32_t rtcp_source(const rtcp_info_t *c, int i);
+extern void rtcp_report(const rtcp_info_t *c, int i, rtcp_rr_info_t *rr);
+extern void rtcp_sdes_begin(rtcp_iter_t *it, const rtcp_info_t *c);
+extern int rtcp_sdes_chunk(rtcp_iter_t *it, uint32_t *src);
+extern int rtcp_sdes_item(rtcp_iter_t *it, int *type,
+  const unsigned char **data, int *len);
+extern int rtcp_bye_reason(const rtcp_info_t *c, const unsigned char **reason,
+  int *len);
+extern int vat_ctrl_parse(const void *buf, int len, vat_ctrl_t *v);
+
+#endif /* RTPPARSE_H */
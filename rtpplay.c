@@ -29,6 +29,8 @@
  */
 
 
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
 #include <sys/types.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -40,69 +42,136 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
 
-#include "sysdep.h"
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if HAVE_UDP_SEGMENT
+#include <errno.h>
+#include <netinet/udp.h>
+#endif
 #include "notify.h"
 #include "rtp.h"
 #include "rtpdump.h"
 #include "multimer.h"
 #include "payload.h"
-
-#define READAHEAD 16 /* must be power of 2 */
+#include "ssrcmap.h"
+#include "trace.h"
+
+#define RING_MIN   (128 << 10) /* bytes of a ring, more than a packet */
+#define RING_MAX   (4 << 20)   /* most bytes read ahead per stream */
+#define PLAY_BATCH 64        /* most packets sent at once */
+#define GSO_MAX    64        /* most segments the kernel takes in one send */
+
+/* the ring is shared by the reader thread and the timer handler */
+#if HAVE_PTHREAD
+#define RING_LOAD(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define RING_LOAD(p)      (*(p))
+#define RING_STORE(p, v)  (*(p) = (v))
+#endif
 
 extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 extern struct pt payload[];
 
 static int verbose = 0;        /* be chatty about packets sent */
 static int wallclock = 0;      /* use wallclock time rather than timestamps */
-static uint32_t begin = 0;      /* time of first packet to send */
-static uint32_t end = UINT32_MAX; /* when to stop sending */
-static FILE *in;               /* input file */
-static int sock[2];            /* output sockets */
-static int first = -1;         /* time offset of first packet */
-static RD_buffer_t buffer[READAHEAD];
+static uint64_t begin = 0;      /* time of first packet to send (ns) */
+static uint64_t end = UINT64_MAX; /* when to stop sending (ns) */
+static long precise = -1;      /* precise timing: busy-wait (usec) */
+static long window = 0;        /* send packets due this soon together (usec) */
+static struct timeval lookahead = {1, 0};  /* read this far ahead */
+static double speed = 1;       /* playback speed, 0 as fast as possible */
+static struct timeval start;   /* common start of playback */
+static int playing = 0;        /* 'start' is set */
+static unsigned long sent_packets, sent_bytes;  /* for the report */
+static struct timeval last_sent;  /* when the last packet was sent */
 
 struct rtts {
 	struct timeval	rt; /* real time */
 	unsigned long	ts; /* timestamp */
 };
 
+/* playout state of each source, by SSRC */
 struct ssrc {
-	uint32_t	ssrc;
 	struct rtts	rtts;
-	struct ssrc*	next;
-} *list = NULL;
+};
 
-static struct ssrc*
-find(uint32_t ssrc)
-{
-	struct ssrc* this = NULL;
-	for (this = list; this; this = this->next)
-		if (ssrc == this->ssrc)
-			return this;
-	return NULL;
-}
-
-static void
-insert(struct ssrc* ssrc)
-{
-	if (ssrc == NULL)
-		return;
-	if (list)
-		ssrc->next = list;
-	else
-		list = ssrc;
-}
+/*
+* Packet in the ring, followed by its data.  The playout time is
+* relative to the start of playback.  A zero size marks the end of the
+* ring, as does too little room left for a header.
+*/
+typedef struct packet {
+  struct timeval due;          /* playout time */
+  uint64_t offset_ns;          /* time offset in the file */
+  uint32_t size;               /* bytes in the ring, header included */
+  uint16_t length;             /* of the data */
+  uint16_t plen;               /* 0 for RTCP */
+} packet_t;
+
+/*
+* One input file and the session it is played to.  A reader, a thread
+* where there are threads, reads the file into a ring of packets up to
+* 'lookahead' ahead of playback; the timer handler of the stream only
+* takes packets off the ring and sends them, and wakes the reader when
+* that makes room.  The ring starts at twice the bytes of the first
+* 'lookahead' of the file.  The timer queue merges all streams into
+* one time-ordered schedule.
+*/
+typedef struct stream {
+  FILE *in;                    /* input file */
+  char *file;                  /* name of input file, NULL for stdin */
+  struct sockaddr_in sin;      /* destination */
+  unsigned char ttl;
+  int sock[2];                 /* output sockets */
+  int done;                    /* past end time, read no more */
+  int64_t first;               /* time offset of first packet (ns) */
+  RD_reader_t *reader;         /* records of input file */
+  ssrcmap_t *sources;
+  size_t gso;                  /* segments shorter than this may be
+                                  offloaded, 0 if UDP GSO fails */
+
+  /* reader side */
+  RD_record_t next;            /* record read, not yet in the ring */
+  struct timeval next_due;
+  int pending;                 /* 'next' is valid */
+  struct timeval last_due;     /* playout time of the last packet queued */
+
+  /* the ring: 'head' is written by the reader, 'tail' by the handler */
+  char *ring;
+  uint32_t size;               /* of the ring, a power of 2 */
+  uint64_t head, tail;         /* byte positions, only ever grow */
+  int eof;                     /* reader is done, the ring is all */
+  int stalled;                 /* ring ran dry before the reader was done */
+  unsigned long stalls;        /* times that happened */
+#if HAVE_PTHREAD
+  pthread_t thread;
+  pthread_mutex_t lock;        /* for the fields below */
+  pthread_cond_t wake;
+  int waiting;                 /* reader waits for these: */
+  uint64_t refill_tail;        /* half the ring is free */
+  struct timeval refill_due;   /* half the lookahead is left */
+#endif
+} stream_t;
+
+static stream_t *streams;
+static int nstreams;
+
+static Notify_value play_handler(Notify_client client);
 
 static void usage(char *argv0)
 {
   fprintf(stderr, "usage: %s "
-	"[-hTv] [-b begin] [-e end] [-f file] [-s port] "
-	"address/port[/ttl]\n", argv0);
+	"[-hTv] [-b begin] [-e end] [-f file[=address/port[/ttl]]] ... "
+	"[-L lookahead] [-P spin] [-r speed] [-s port] [-w window] "
+	"[address/port[/ttl]]\n", argv0);
   exit(1);
 } /* usage */
 
@@ -113,128 +182,117 @@ static double tdbl(struct timeval *a)
 } /* tdbl */
 
 
+static void report(void)
+{
+  timer_report(stderr);
+} /* report */
+
+
 /*
-* Transmit RTP/RTCP packet on output socket and mark as read.
+* Tell how often the reader of each stream fell behind, and how fast
+* the packets went out if not in real time.
 */
-static void play_transmit(int b)
+static void play_report(void)
 {
-  if (b >= 0 && buffer[b].p.hdr.length) {
-    if (send(sock[buffer[b].p.hdr.plen == 0],
-        buffer[b].p.data, buffer[b].p.hdr.length, 0) < 0) {
-      perror("write");
-    }
+  int i;
+
+  if (speed != 1 || verbose) {
+    struct timeval t;
+    double d;
 
-    buffer[b].p.hdr.length = 0;
+    timersub(&last_sent, &start, &t);
+    d = tdbl(&t) > 0 ? tdbl(&t) : 1e-6;
+    fprintf(stderr, "%lu packets, %lu bytes in %.3f s: "
+      "%.0f packets/s, %.1f Mbit/s\n", sent_packets, sent_bytes,
+      sent_packets ? tdbl(&t) : 0, sent_packets / d, sent_bytes * 8 / d / 1e6);
   }
-} /* play_transmit */
+
+  for (i = 0; i < nstreams; i++) {
+    if (streams[i].stalls || verbose) {
+      fprintf(stderr, "%s: reader fell behind %lu times\n",
+        streams[i].file ? streams[i].file : "stdin", streams[i].stalls);
+    }
+  }
+} /* play_report */
 
 
 /*
-* Timer handler: read next record from file and insert into timer
-* handler.
+* Clock rate of payload type 'pt', 0 if not a static type we know.
 */
-static Notify_value play_handler(Notify_client client)
+static uint32_t clock_rate(int pt)
+{
+  int i;
+
+  for (i = 0; payload[i].enc && i < pt; i++);
+  return payload[i].enc ? payload[i].rate : 0;
+} /* clock_rate */
+
+
+/*
+* Read next record of stream 's' into s->next and compute its playout
+* time.  Returns 0 at end of file or past the end time.
+*/
+static int play_read(stream_t *s)
 {
-  static struct timeval start;  /* generation time of first played back p. */
-  struct timeval now;           /* current time */
   struct timeval next;          /* next packet generation time */
   struct ssrc* ssrc = NULL;
   struct rtts t;
   uint32_t ts  = 0;
   uint8_t  pt  = 0;
   rtp_hdr_t *r;
-  int b = (int)client;  /* buffer to be played now */
-  int rp;        /* read pointer */
-
-  gettimeofday(&now, 0);
-
-  /* playback scheduled packet */
-  play_transmit(b);
 
   /* If we are done, skip rest. */
-  if (end == 0) return NOTIFY_DONE;
-
-  if (verbose > 0 && b >= 0) {
-    printf("! %1.3f %s(%3d;%3d) t=%6lu",
-      tdbl(&now), buffer[b].p.hdr.plen ? "RTP " : "RTCP",
-      buffer[b].p.hdr.length, buffer[b].p.hdr.plen,
-      (unsigned long)buffer[b].p.hdr.offset);
-
-    if (buffer[b].p.hdr.plen) {
-      r = (rtp_hdr_t *)buffer[b].p.data;
-      printf(" pt=%u ssrc=%8lx %cts=%9lu seq=%5u",
-        (unsigned int)r->pt,
-        (unsigned long)ntohl(r->ssrc), r->m ? '*' : ' ',
-        (unsigned long)ntohl(r->ts), ntohs(r->seq));
-    }
-    printf("\n");
-  }
-
-  /* Find available buffer. */
-  for (rp = 0; rp < READAHEAD; rp++) {
-    if (!buffer[rp].p.hdr.length) break;
-  }
+  if (s->done) return 0;
 
   /* Get next packet; try again if we haven't reached the begin time. */
   do {
-    if (RD_read(in, &buffer[rp]) == 0) return NOTIFY_DONE;
-  } while (buffer[rp].p.hdr.offset < begin);
+    if (RD_next(s->reader, &s->next) <= 0) return 0;
+  } while (s->next.offset_ns < begin);
 
   /*
-   * If new packet is after end of alloted time, don't insert into list
-   * and set 'end' to zero to avoid reading any more packets from
-   * file.
+   * If new packet is after end of alloted time, don't queue it and mark
+   * the stream done to avoid reading any more packets from file.
    */
-  if (buffer[rp].p.hdr.offset > end) {
-    buffer[rp].p.hdr.length = 0; /* erase again */
-    end = 0;
-    return NOTIFY_DONE;
+  if (s->next.offset_ns > end) {
+    s->done = 1;
+    return 0;
   }
 
-  r = (rtp_hdr_t *)buffer[rp].p.data;
+  r = (rtp_hdr_t *)s->next.data;
 
-  /* Remember wallclock and recording time of first valid packet. */
-  if (first < 0) {
-    start = now;
-    first = buffer[rp].p.hdr.offset;
-  }
-  buffer[rp].p.hdr.offset -= first;
+  /* The first valid packet of every stream plays at the common start. */
+  if (s->first < 0) s->first = s->next.offset_ns;
+  s->next.offset_ns -= s->first;
 
-  if (buffer[rp].p.hdr.plen && r->version == 2 && !wallclock) {
+  if (s->next.plen && r->version == 2 && !wallclock) {
     ts  = ntohl(r->ts);
     pt  = r->pt;
-    if ((ssrc = find(ntohl(r->ssrc)))) {
+    if ((ssrc = ssrcmap_find(s->sources, ntohl(r->ssrc)))) {
     /* found in the list of sources: compute playout instant */
 	double d;
+	uint32_t rate = clock_rate(pt);
 	t = ssrc->rtts;
-	d = payload[pt].rate ? ((1.0)*(int)(ts - t.ts)) / payload[pt].rate : 0;
+	d = rate ? ((1.0)*(int)(ts - t.ts)) / rate : 0;
 	next.tv_sec  = t.rt.tv_sec  + (int)d;
 	next.tv_usec = t.rt.tv_usec + (d - (int)d) * 1000000;
 	if (verbose) {
-	  printf(". %1.3f t=%6lu pt=%u ts=%lu,%lu rp=%2d b=%d d=%f\n",
-		tdbl(&next),
-		(unsigned long)buffer[rp].p.hdr.offset, (unsigned int)r->pt,
-		(unsigned long)ts, (unsigned long)t.ts, rp, b, d);
+	  printf(". %1.3f t=%6lu pt=%u ts=%lu,%lu d=%f\n",
+		tdbl(&start) + tdbl(&next),
+		(unsigned long)(s->next.offset_ns / 1000000),
+		(unsigned int)r->pt, (unsigned long)ts, (unsigned long)t.ts,
+		d);
 	}
-
-    /*
-      next.tv_sec  = t->rt.tv_sec  + (int)d;
-      next.tv_usec = t->rt.tv_usec + (d - (int)d) * 1000000;
-	*/
-
     } else {
 	/* not on source list: insert and play based on wallclock. */
-	next.tv_sec  = start.tv_sec  +  buffer[rp].p.hdr.offset / 1000;
-	next.tv_usec = start.tv_usec + (buffer[rp].p.hdr.offset % 1000) * 1000;
-	ssrc = calloc(1, sizeof(struct ssrc));
-	ssrc->ssrc = ntohl(r->ssrc);
-	insert(ssrc);
+	next.tv_sec  = s->next.offset_ns / 1000000000;
+	next.tv_usec = (s->next.offset_ns % 1000000000) / 1000;
+	ssrc = ssrcmap_insert(s->sources, ntohl(r->ssrc));
     }
   }
   else {
   /* RTCP or vat or playing back by wallclock: compute next playout time */
-    next.tv_sec  = start.tv_sec  + buffer[rp].p.hdr.offset/1000;
-    next.tv_usec = start.tv_usec + (buffer[rp].p.hdr.offset%1000) * 1000;
+    next.tv_sec  = s->next.offset_ns / 1000000000;
+    next.tv_usec = (s->next.offset_ns % 1000000000) / 1000;
   }
 
   if (next.tv_usec >= 1000000) {
@@ -247,54 +305,522 @@ static Notify_value play_handler(Notify_client client)
     ssrc->rtts.ts = ts;
   }
 
-  timer_set(&next, play_handler, (Notify_client)rp, 0);
+  /* speed up or slow down, or send right away */
+  if (speed != 1) {
+    double d = speed ? tdbl(&next) / speed : 0;
+
+    next.tv_sec  = (long)d;
+    next.tv_usec = (d - (long)d) * 1e6;
+  }
+  s->next_due = next;
+  return 1;
+} /* play_read */
+
+
+/*
+* Copy s->next into the ring.  Returns 0 if there is no room.
+*/
+static int ring_put(stream_t *s)
+{
+  uint32_t need = (sizeof(packet_t) + s->next.length + 7) & ~7;
+  uint64_t head = s->head;
+  uint32_t left = s->size - head % s->size;
+  uint32_t skip = left < need ? left : 0;
+  packet_t *p;
+
+  if (s->size - (head - RING_LOAD(&s->tail)) < (uint64_t)skip + need)
+    return 0;
+  if (skip) {
+    /* does not fit before the end: mark it and start over */
+    if (left >= sizeof(packet_t))
+      ((packet_t *)(s->ring + head % s->size))->size = 0;
+    head += skip;
+  }
+  p = (packet_t *)(s->ring + head % s->size);
+  p->due       = s->next_due;
+  p->offset_ns = s->next.offset_ns;
+  p->size      = need;
+  p->length    = s->next.length;
+  p->plen      = s->next.plen;
+  memcpy(p + 1, s->next.data, s->next.length);
+  RING_STORE(&s->head, head + need);
+  return 1;
+} /* ring_put */
+
+
+/*
+* Before playback, when nothing has been taken off the ring of stream
+* 's' and it has not wrapped, double it until it holds twice what has
+* been read, so that it keeps 'lookahead' at the rate of the file.
+*/
+static void ring_reserve(stream_t *s)
+{
+  uint64_t need = 2 * (s->head + sizeof(packet_t) + s->next.length + 8);
+  char *ring;
+
+  while (s->size < need && s->size < RING_MAX) {
+    if (!(ring = realloc(s->ring, 2 * s->size))) return;
+    s->ring = ring;
+    s->size *= 2;
+  }
+} /* ring_reserve */
+
+
+/*
+* Return the packet of the ring at position '*pos', moved past the end
+* marker if there is one, or NULL if there are no more packets.
+*/
+static packet_t *ring_peek(stream_t *s, uint64_t *pos)
+{
+  uint64_t head = RING_LOAD(&s->head);
+  uint32_t left;
+  packet_t *p;
+
+  if (*pos == head) return NULL;
+  left = s->size - *pos % s->size;
+  p = (packet_t *)(s->ring + *pos % s->size);
+  if (left < sizeof(packet_t) || p->size == 0) {
+    *pos += left;
+    p = (packet_t *)s->ring;
+  }
+  return p;
+} /* ring_peek */
+
+
+/*
+* Read stream 's' into its ring until it is 'lookahead' ahead of the
+* playback clock or the ring is full.  Returns -1 when all is read.
+*/
+static int play_fill(stream_t *s)
+{
+  struct timeval now, limit;
+
+  for (;;) {
+    if (!s->pending) {
+      if (!play_read(s)) {
+        RING_STORE(&s->eof, 1);
+        return -1;
+      }
+      s->pending = 1;
+    }
+
+    /* far enough ahead, once something is queued */
+    now.tv_sec = now.tv_usec = 0;
+    if (playing) {
+      timer_now(&now);
+      timersub(&now, &start, &now);
+    }
+    timeradd(&now, &lookahead, &limit);
+    if (s->head != 0 && timercmp(&s->last_due, &limit, >)) return 0;
+
+    if (!playing) ring_reserve(s);
+    if (!ring_put(s)) return 0;
+    s->last_due = s->next_due;
+    s->pending = 0;
+  }
+} /* play_fill */
+
+
+#if HAVE_PTHREAD
+/*
+* Reader thread: keep the ring of stream 'arg' filled.  In between it
+* sleeps until the timer handler has freed half the ring and played
+* half the lookahead, rather than for each packet sent.
+*/
+static void *play_reader(void *arg)
+{
+  stream_t *s = arg;
+  struct timeval half;
+
+  half.tv_sec  = lookahead.tv_sec / 2;
+  half.tv_usec = (lookahead.tv_sec % 2 * 1000000 + lookahead.tv_usec) / 2;
+  while (play_fill(s) >= 0) {
+    pthread_mutex_lock(&s->lock);
+    s->refill_tail = s->head > s->size / 2 ? s->head - s->size / 2 : 0;
+    timersub(&s->last_due, &half, &s->refill_due);
+    s->waiting = 1;
+    while (s->waiting) pthread_cond_wait(&s->wake, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+} /* play_reader */
+#endif
+
+
+/*
+* Print the packet 'p' of stream 's' as it is sent.
+*/
+static void play_verbose(stream_t *s, packet_t *p)
+{
+  struct timeval now;           /* current time */
+  rtp_hdr_t *r;
+
+  timer_now(&now);
+  printf("! %1.3f %s(%3d;%3d) t=%6lu",
+    tdbl(&now), p->plen ? "RTP " : "RTCP",
+    p->length, p->plen,
+    (unsigned long)(p->offset_ns / 1000000));
+
+  if (p->plen) {
+    r = (rtp_hdr_t *)(p + 1);
+    printf(" pt=%u ssrc=%8lx %cts=%9lu seq=%5u",
+      (unsigned int)r->pt,
+      (unsigned long)ntohl(r->ssrc), r->m ? '*' : ' ',
+      (unsigned long)ntohl(r->ts), ntohs(r->seq));
+  }
+  printf("\n");
+} /* play_verbose */
+
+
+/*
+* Send the packets p[0..n-1] of stream 's' in this order,
+* with one sendmmsg() for each run of packets on the same socket.
+* Where the kernel can segment UDP, a run of equal-sized packets goes
+* out as one datagram that it splits again.
+*/
+static void play_send(stream_t *s, packet_t **p, int n)
+{
+#if HAVE_SENDMMSG
+  struct mmsghdr msg[PLAY_BATCH];
+  struct iovec iov[PLAY_BATCH];
+#if HAVE_UDP_SEGMENT
+  char control[PLAY_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+  int i = 0;
+
+  while (i < n) {
+    int type = p[i]->plen == 0;  /* RTCP goes to the odd port */
+    int m, k, sent;
+
+    for (m = 0; i < n && (p[i]->plen == 0) == type; m++) {
+      size_t len = p[i]->length;
+      int segs = 1;
+
+      memset(&msg[m], 0, sizeof(msg[m]));
+      msg[m].msg_hdr.msg_iov = &iov[i];
+      iov[i].iov_base = (char *)(p[i] + 1);
+      iov[i++].iov_len = len;
+#if HAVE_UDP_SEGMENT
+      if (len < s->gso) {
+        /* equal segments, only the last one may be shorter */
+        while (i < n && segs < GSO_MAX && (segs + 1) * len <= 65000 &&
+               p[i]->length <= len &&
+               (p[i]->plen == 0) == type) {
+          iov[i].iov_base = (char *)(p[i] + 1);
+          iov[i].iov_len = p[i]->length;
+          segs++;
+          if (iov[i++].iov_len < len) break;
+        }
+        if (segs > 1) {
+          struct cmsghdr *cm;
+          uint16_t size = len;
+
+          msg[m].msg_hdr.msg_control = control[m];
+          msg[m].msg_hdr.msg_controllen = sizeof(control[m]);
+          cm = CMSG_FIRSTHDR(&msg[m].msg_hdr);
+          cm->cmsg_level = SOL_UDP;
+          cm->cmsg_type  = UDP_SEGMENT;
+          cm->cmsg_len   = CMSG_LEN(sizeof(size));
+          memcpy(CMSG_DATA(cm), &size, sizeof(size));
+        }
+      }
+#endif
+      msg[m].msg_hdr.msg_iovlen = segs;
+    }
+
+    for (k = 0; k < m; k += sent) {
+      sent = sendmmsg(s->sock[type], msg + k, m - k, 0);
+      TRACE(TRACE_SEND, sent > 0 ? sent : 0);
+      if (sent < 0) {
+#if HAVE_UDP_SEGMENT
+        if (msg[k].msg_hdr.msg_iovlen > 1) {
+          /* segmentation refused: send the packets one by one */
+          struct iovec *v = msg[k].msg_hdr.msg_iov;
+          size_t j;
+
+          /*
+          * EINVAL is a segment larger than the path MTU: packets that
+          * long are sent one by one from now on, but shorter ones can
+          * still be offloaded.  Anything else means GSO does not work.
+          */
+          s->gso = errno == EINVAL ? v[0].iov_len : 0;
+          for (j = 0; j < msg[k].msg_hdr.msg_iovlen; j++) {
+            if (send(s->sock[type], v[j].iov_base, v[j].iov_len, 0) < 0)
+              perror("write");
+          }
+        }
+        else
+#endif
+        perror("write");
+        sent = 1;  /* skip the message that failed */
+      }
+    }
+  }
+#else
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (send(s->sock[p[i]->plen == 0],
+        (char *)(p[i] + 1), p[i]->length, 0) < 0) {
+      perror("write");
+    }
+    TRACE(TRACE_SEND, 1);
+  }
+#endif
+} /* play_send */
+
+
+/*
+* Timer handler of a stream: send the packets that are due, or due
+* within 'window', then set the timer for the next one.
+*/
+static Notify_value play_handler(Notify_client client)
+{
+  static struct timeval retry = {0, 1000};
+  stream_t *s = &streams[client];
+  packet_t *p[PLAY_BATCH];
+  struct timeval now, limit, w;
+  uint64_t pos;
+  int i, n, eof;
+
+#if !HAVE_PTHREAD
+  play_fill(s);
+#endif
+  w.tv_sec  = window / 1000000;
+  w.tv_usec = window % 1000000;
+  timer_now(&now);
+  timersub(&now, &start, &now);  /* on the playback clock */
+  timeradd(&now, &w, &limit);
+
+  do {
+    pos = s->tail;
+    for (n = 0; n < PLAY_BATCH; n++) {
+      if (!(p[n] = ring_peek(s, &pos)) || timercmp(&p[n]->due, &limit, >))
+        break;
+      if (verbose > 0) play_verbose(s, p[n]);
+      pos += p[n]->size;
+    }
+    if (n > 0) {
+      play_send(s, p, n);
+      s->stalled = 0;
+      sent_packets += n;
+      for (i = 0; i < n; i++) sent_bytes += p[i]->length;
+      timer_now(&last_sent);
+    }
+    RING_STORE(&s->tail, pos);
+  } while (n == PLAY_BATCH);
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&s->lock);
+  if (s->waiting && s->tail >= s->refill_tail &&
+      !timercmp(&now, &s->refill_due, <)) {
+    s->waiting = 0;
+    pthread_cond_signal(&s->wake);
+  }
+  pthread_mutex_unlock(&s->lock);
+#endif
+
+  /* the reader is done if it said so before we looked */
+  eof = RING_LOAD(&s->eof);
+  pos = s->tail;
+  if ((p[0] = ring_peek(s, &pos))) {
+    timeradd(&start, &p[0]->due, &now);
+    timer_set(&now, play_handler, client, 0);
+  }
+  else if (!eof) {
+    /* ran dry: the reader fell behind, look again soon */
+    if (!s->stalled) s->stalls++;
+    s->stalled = 1;
+    timer_set(&retry, play_handler, client, 1);
+  }
   return NOTIFY_DONE;
 } /* play_handler */
 
 
+/*
+* Create and connect the output sockets of stream 's'.
+*/
+static void play_connect(stream_t *s, int sourceport)
+{
+  struct sockaddr_in from;
+  int on = 1;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    s->sock[i] = socket(PF_INET, SOCK_DGRAM, 0);
+    if (s->sock[i] < 0) {
+      perror("socket");
+      exit(1);
+    }
+    s->sin.sin_port = htons(ntohs(s->sin.sin_port) + i);
+
+    if (sourceport) {
+      memset((char *)(&from), 0, sizeof(struct sockaddr_in));
+      from.sin_family      = PF_INET;
+      from.sin_addr.s_addr = INADDR_ANY;
+      from.sin_port        = htons(sourceport + i);
+
+      if (setsockopt(s->sock[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        perror("SO_REUSEADDR");
+        exit(1);
+      }
+
+#ifdef SO_REUSEPORT
+      if (setsockopt(s->sock[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("SO_REUSEPORT");
+        exit(1);
+      }
+#endif
+
+      if (bind(s->sock[i], (struct sockaddr *)&from, sizeof(from)) < 0) {
+        perror("bind");
+        exit(1);
+      }
+    }
+
+    if (connect(s->sock[i], (struct sockaddr *)&s->sin, sizeof(s->sin)) < 0) {
+      perror("connect");
+      exit(1);
+    }
+
+    if (IN_CLASSD(ntohl(s->sin.sin_addr.s_addr)) &&
+        (setsockopt(s->sock[i], IPPROTO_IP, IP_MULTICAST_TTL, &s->ttl,
+                 sizeof(s->ttl)) < 0)) {
+      perror("IP_MULTICAST_TTL");
+      exit(1);
+    }
+  }
+} /* play_connect */
+
+
+/*
+* Parse address/port[/ttl] into 's', playing to localhost if no
+* address is given.  Return -1 if invalid.
+*/
+static int play_address(stream_t *s, char *addr)
+{
+  if (hpt(addr, &s->sin, &s->ttl) == -1) return -1;
+  if (s->sin.sin_addr.s_addr == INADDR_ANY) {
+    struct hostent *host;
+    struct in_addr *local;
+    if ((host = gethostbyname("localhost")) == NULL) {
+      perror("gethostbyname()");
+      exit(1);
+    }
+    local = (struct in_addr *)host->h_addr_list[0];
+    s->sin.sin_addr = *local;
+  }
+  return 0;
+} /* play_address */
+
+
+/*
+* Open input file of stream 's' and read its header.
+*/
+static void play_open(stream_t *s)
+{
+  struct timeval recorded;
+
+  if (s->file && !(s->in = fopen(s->file, "rb"))) {
+    perror(s->file);
+    exit(1);
+  }
+  if (RD_header(s->in, &s->sin, &recorded, verbose) < 0) {
+    fprintf(stderr, "%s: Invalid header\n", s->file ? s->file : "stdin");
+    exit(1);
+  }
+  if ((s->reader = RD_open(s->in)) == NULL) {
+    perror("RD_open");
+    exit(1);
+  }
+  s->size = RING_MIN;
+  if ((s->ring = malloc(s->size)) == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  if ((s->sources = ssrcmap_new(sizeof(struct ssrc))) == NULL) {
+    perror("ssrcmap_new");
+    exit(1);
+  }
+  s->first = -1;
+  s->gso = 65536;
+#if HAVE_PTHREAD
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+#endif
+
+  /* skip ahead to begin time using the seek index, if any */
+  if (begin > 0) {
+    char *index = NULL;
+
+    if (s->file && (index = malloc(strlen(s->file) + 5)))
+      sprintf(index, "%s.idx", s->file);
+    if (RD_find(s->reader, begin, index) < 0 && verbose)
+      fprintf(stderr, "Input not seekable, skipping to begin time.\n");
+    free(index);
+  }
+} /* play_open */
+
 
 int main(int argc, char *argv[])
 {
-  unsigned char ttl = 1;
-  static struct sockaddr_in sin;
-  static struct sockaddr_in from;
-  struct timeval start;
+  stream_t def;        /* destination of files without their own */
   int sourceport = 0;  /* source port */
-  int on = 1;          /* flag */
   int i;
   int c;
   extern char *optarg;
   extern int optind;
 
   /* For NT, we need to start the socket; dummy function otherwise */
+  trace_init();
   startupSocket();
 
-  in = stdin; /* Changed below if -f specified */
+  if ((streams = calloc(argc, sizeof(*streams))) == NULL) {
+    perror("calloc");
+    exit(1);
+  }
 
   /* parse command line arguments */
-  while ((c = getopt(argc, argv, "b:e:f:p:Ts:vh")) != EOF) {
+  while ((c = getopt(argc, argv, "b:e:f:L:p:P:r:Ts:vw:h")) != EOF) {
     switch(c) {
     case 'b':
-      begin = atof(optarg) * 1000;
+      begin = atof(optarg) * 1e9;
       break;
     case 'e':
-      end = atof(optarg) * 1000;
+      end = atof(optarg) * 1e9;
       break;
     case 'f':
-      if (!(in = fopen(optarg, "rb"))) {
-        perror(optarg);
-        exit(1);
+      streams[nstreams++].file = optarg;
+      break;
+    case 'L':  /* lookahead */
+      {
+        double d = atof(optarg);
+
+        if (d <= 0) usage(argv[0]);
+        lookahead.tv_sec  = (long)d;
+        lookahead.tv_usec = (d - (long)d) * 1e6;
       }
       break;
+    case 'P':  /* precise timing */
+      precise = atol(optarg);
+      if (precise < 0) usage(argv[0]);
+      break;
     case 'T':
       wallclock = 1;
       break;
+    case 'r':  /* playback speed */
+      speed = atof(optarg);
+      if (speed < 0) usage(argv[0]);
+      break;
     case 's':  /* locked source port */
       sourceport = atoi(optarg);
       break;
     case 'v':
       verbose = 1;
       break;
+    case 'w':  /* coalescing window */
+      window = atol(optarg);
+      if (window < 0) usage(argv[0]);
+      break;
     case '?':
     case 'h':
       usage(argv[0]);
@@ -302,84 +828,60 @@ int main(int argc, char *argv[])
     }
   }
 
-//  ftell(in);
-
-  if (optind < argc) {
-    if (hpt(argv[optind], &sin, &ttl) == -1) {
-      fprintf(stderr, "%s: Invalid host. %s\n", argv[0], argv[optind]);
-      usage(argv[0]);
-      exit(1);
-    }
-    if (sin.sin_addr.s_addr == INADDR_ANY) {
-      struct hostent *host;
-      struct in_addr *local;
-      if ((host = gethostbyname("localhost")) == NULL) {
-        perror("gethostbyname()");
-        exit(1);
-      }
-      local = (struct in_addr *)host->h_addr_list[0];
-      sin.sin_addr = *local;
-    }
+  memset(&def, 0, sizeof(def));
+  def.ttl = 1;
+  if (optind < argc && play_address(&def, argv[optind]) == -1) {
+    fprintf(stderr, "%s: Invalid host. %s\n", argv[0], argv[optind]);
+    usage(argv[0]);
   }
 
-  /* read header of input file */
-  if (RD_header(in, &sin, &start, verbose) < 0) {
-    fprintf(stderr, "Invalid header\n");
-    exit(1);
+  /* without -f, play standard input */
+  if (nstreams == 0) {
+    streams[nstreams++].in = stdin;
   }
 
-  /* create/connect sockets if they don't exist already */
-  if (!sock[0]) {
-    for (i = 0; i < 2; i++) {
-      sock[i] = socket(PF_INET, SOCK_DGRAM, 0);
-      if (sock[i] < 0) {
-        perror("socket");
-        exit(1);
-      }
-      sin.sin_port = htons(ntohs(sin.sin_port) + i);
-
-      if (sourceport) {
-        memset((char *)(&from), 0, sizeof(struct sockaddr_in));
-        from.sin_family      = PF_INET;
-        from.sin_addr.s_addr = INADDR_ANY;
-        from.sin_port        = htons(sourceport + i);
-
-        if (setsockopt(sock[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
-          perror("SO_REUSEADDR");
-          exit(1);
-        }
-
-  #ifdef SO_REUSEPORT
-        if (setsockopt(sock[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
-          perror("SO_REUSEPORT");
-          exit(1);
-        }
-  #endif
-
-        if (bind(sock[i], (struct sockaddr *)&from, sizeof(from)) < 0) {
-          perror("bind");
-          exit(1);
-        }
+  /* file=address/port[/ttl] plays the file to its own destination */
+  for (i = 0; i < nstreams; i++) {
+    stream_t *s = &streams[i];
+    char *addr = s->file ? strrchr(s->file, '=') : NULL;
+
+    s->sin = def.sin;
+    s->ttl = def.ttl;
+    if (addr) {
+      *addr++ = '\0';
+      if (*s->file == '\0' || play_address(s, addr) == -1) {
+        fprintf(stderr, "%s: Invalid host. %s\n", argv[0], addr);
+        usage(argv[0]);
       }
+    }
+    play_open(s);
+    play_connect(s, sourceport);
+  }
 
-      if (connect(sock[i], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
-        perror("connect");
-        exit(1);
-      }
+  if (precise >= 0) {
+    notify_set_precise(precise);
+    timer_stats(1);
+    atexit(report);
+  }
 
-      if (IN_CLASSD(ntohl(sin.sin_addr.s_addr)) &&
-          (setsockopt(sock[i], IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
-                   sizeof(ttl)) < 0)) {
-        perror("IP_MULTICAST_TTL");
-        exit(1);
-      }
+  /* read ahead, then all streams start now */
+  for (i = 0; i < nstreams; i++) play_fill(&streams[i]);
+  atexit(play_report);
+  timer_now(&start);
+  playing = 1;
+  for (i = 0; i < nstreams; i++) {
+#if HAVE_PTHREAD
+    if (pthread_create(&streams[i].thread, NULL, play_reader, &streams[i])) {
+      perror("pthread_create");
+      exit(1);
     }
+#endif
+    play_handler(i);
   }
-
-  /* initialize event queue */
-  first = -1;
-  for (i = 0; i < READAHEAD; i++) play_handler(-1);
   notify_start();
+#if HAVE_PTHREAD
+  for (i = 0; i < nstreams; i++) pthread_join(streams[i].thread, NULL);
+#endif
 
   return 0;
 } /* main */
@@ -28,33 +28,78 @@
  * SUCH DAMAGE.
  */
 
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
 #include <sys/types.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <signal.h>
 #include <time.h>
 
 #ifndef WIN32
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
 
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "notify.h"
 #include "rtp.h"
 #include "multimer.h"
-#include "sysdep.h"
+#include "trace.h"
 
 extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 
 static int verbose = 0;
+static FILE *vout;   /* where verbose output goes, stdout by default */
 static FILE *in;
 static int sock[2];  /* output sockets */
 static int loop = 0; /* play file indefinitely if set */
+static long precise = -1; /* precise timing: busy-wait (usec) */
+static char *sr_ntp;      /* NTP timestamp of the last SR generated */
+static int sr_ntp_sec;    /* its seconds are from the clock, not given */
+
+/*
+* Compiled schedule, written by "rtpsend -c": the line
+* "#!rtpsend1.0\n" followed by one schedule_packet_t, in network byte
+* order, for each packet, and then the packet itself.
+*/
+#define RTPSEND_MAGIC "#!rtpsend1.0\n"
+
+typedef struct {
+  uint32_t sec;       /* send time in the script */
+  uint32_t usec;
+  uint16_t length;    /* packet bytes that follow */
+  uint8_t  type;      /* 0 for RTP, 1 for RTCP */
+  uint8_t  flags;     /* SCHEDULE_NTP_SEC */
+  uint16_t ntp;       /* offset of an SR NTP timestamp to be set to
+                         the time of sending, 0 if none */
+  uint16_t padding;
+} schedule_packet_t;
+
+#define SCHEDULE_NTP_SEC 1  /* set its seconds, not just the fraction */
+
+/* schedule entry, pointing into the loaded file */
+typedef struct {
+  struct timeval time;
+  int type;
+  int length;
+  int ntp;
+  int flags;
+  char *data;
+} schedule_t;
+
+static schedule_t *schedule;  /* loaded compiled schedule, if any */
+static int scheduled;         /* entries in 'schedule' */
 
 
 /*
@@ -71,12 +116,20 @@ typedef struct node {
 static void usage(char *argv0)
 {
   fprintf(stderr,
-    "usage: %s [-alv] [-f file] [-s port] address/port[/ttl]\n",
-    argv0);
+    "usage: %s [-alv] [-f file] [-P spin] [-s port] address/port[/ttl]\n"
+    "       %s [-av] -g spec [-P spin] [-s port] address/port[/ttl]\n"
+    "       %s [-v] -c file [-o outfile]\n",
+    argv0, argv0, argv0);
   exit(1);
 } /* usage */
 
 
+static void report(void)
+{
+  timer_report(stderr);
+} /* report */
+
+
 /*
 * Convert hexadecimal numbers in 'text' to binary in 'buffer'.
 * Ignore embedded whitespace.
@@ -415,6 +468,7 @@ static int rtcp_write_sr(node_t *list, char *packet)
   int len = 0, total = RTCP_SR_HDR_LEN, count = 0;
   rtcp_t *r = (rtcp_t *)packet;
   struct timeval now;
+  int ntp = 1;  /* seconds from the clock, unless given */
 
   gettimeofday(&now, 0);
   r->common.length  = 0;
@@ -439,8 +493,10 @@ static int rtcp_write_sr(node_t *list, char *packet)
         r->common.count = n->num;
       else if (strcmp(n->type, "len") == 0)
         r->common.length = htons(n->num);
-      else if (strcmp(n->type, "ntp") == 0)  /* PP: two words */
+      else if (strcmp(n->type, "ntp") == 0) {  /* PP: two words */
         r->r.sr.ntp_sec = htonl(n->num);
+        ntp = 0;
+      }
       else if (strcmp(n->type, "ts") == 0)
         r->r.sr.rtp_ts = htonl(n->num);
       else if (strcmp(n->type, "psent") == 0)
@@ -466,6 +522,8 @@ static int rtcp_write_sr(node_t *list, char *packet)
   if (r->common.count == 0)
     r->common.count = count;
 
+  sr_ntp = (char *)&r->r.sr.ntp_sec;
+  sr_ntp_sec = ntp;
   return total;
 } /* rtcp_write_sr */
 
@@ -750,7 +808,7 @@ static int generate(char *text, char *data, struct timeval *time, int *type)
      casts) */
   long tv_usec;
 
-  if (verbose) printf("%s", text);
+  if (verbose) fputs(text, vout ? vout : stdout);
   if (sscanf(text, "%ld.%ld %s", &(time->tv_sec), &tv_usec, type_name) < 3) {
     fprintf(stderr, "Line {%s} is invalid.\n", text);
     exit(2);
@@ -772,6 +830,39 @@ static int generate(char *text, char *data, struct timeval *time, int *type)
 
 #define MAX_TEXT_LINE 4096
 
+static char line[MAX_TEXT_LINE];  /* last line read (may be next packet) */
+
+/*
+* Read the next packet description from 'in' into 'text', joining
+* continuation lines, which start with white space.  Returns its
+* length, 0 at the end of the file.
+*/
+static int read_text(FILE *in, char *text)
+{
+  char *s = text;
+
+  if (line[0]) {
+    strcpy(text, line);
+    s += strlen(text);
+  }
+  line[0] = '\0';
+  while (fgets(line, sizeof(line), in)) {
+    if (line[0] == '#') {
+      line[0] = '\0';
+      continue;
+    }
+    else if (s != text && !isspace((int)line[0])) break;
+    else {
+      strcpy(s, line);
+      s += strlen(line);
+    }
+    line[0] = '\0';
+  }
+  *s = '\0';
+  return s - text;
+} /* read_text */
+
+
 /*
 * Timer handler; sends any pending packets and parses next one.
 * First packet is played out immediately.
@@ -785,20 +876,20 @@ static Notify_value send_handler(Notify_client client)
     char data[1500];
   } packet;
   FILE *in = (FILE *)client;
-  static char line[MAX_TEXT_LINE];       /* last line read (may be next packet) */
   char text[MAX_TEXT_LINE];              /* current line from the file, including cont. lines */
   static int isfirstpacket = 1; /* is this the first packet? */
   struct timeval this_tv;       /* time this packet is being sent */
   static struct timeval basetime;        /* base time (first packet) */
   struct timeval next_tv;       /* time for next packet */
   struct timeval past_tv;       /* to determine the time to sent is in past */
-  char *s;
 
-  gettimeofday(&this_tv, NULL);
+  timer_now(&this_tv);
 
   /* send any pending packet */
-  if (packet.length && send(sock[packet.type], packet.data, packet.length, 0) < 0) {
-    perror("write");
+  if (packet.length) {
+    if (send(sock[packet.type], packet.data, packet.length, 0) < 0)
+      perror("write");
+    TRACE(TRACE_SEND, 1);
   }
 
   /* read line; continuation lines start with white space */
@@ -813,19 +904,7 @@ static Notify_value send_handler(Notify_client client)
       return NOTIFY_DONE;
    }
   }
-  s = text;
-  if (line[0]) {
-    strcpy(text, line);
-    s += strlen(text);
-  }
-  while (fgets(line, sizeof(line), in)) {
-    if (line[0] == '#') continue;
-    else if (s != text && !isspace((int)line[0])) break;
-    else {
-      strcpy(s, line);
-      s += strlen(line);
-    }
-  }
+  read_text(in, text);
 
   packet.length = generate(text, packet.data, &packet.time, &packet.type);
   /* very first packet: send immediately */
@@ -849,34 +928,637 @@ static Notify_value send_handler(Notify_client client)
 } /* send_handler */
 
 
+/*
+* Compile the packet descriptions in 'in' into a schedule of ready-made
+* packets in 'out'.
+*/
+static void compile(FILE *in, FILE *out)
+{
+  char text[MAX_TEXT_LINE];
+  char data[1500];
+  schedule_packet_t p;
+  struct timeval time, last;
+  int length, type;
+
+  fputs(RTPSEND_MAGIC, out);
+  timerclear(&last);
+  while (read_text(in, text) > 0) {
+    sr_ntp = 0;
+    sr_ntp_sec = 0;
+    length = generate(text, data, &time, &type);
+    if (length < 0 || length > (int)sizeof(data)) {
+      fprintf(stderr, "Packet at %ld.%06ld is too long (%d bytes).\n",
+        (long)time.tv_sec, (long)time.tv_usec, length);
+      exit(2);
+    }
+    if (timercmp(&time, &last, <)) {
+      fprintf(stderr, "Non-monotonic time %ld.%ld - sent immediately.\n",
+        (long)time.tv_sec, (long)time.tv_usec);
+    }
+    last = time;
+    p.sec      = htonl(time.tv_sec);
+    p.usec     = htonl(time.tv_usec);
+    p.length   = htons(length);
+    p.type     = type;
+    p.flags    = sr_ntp_sec ? SCHEDULE_NTP_SEC : 0;
+    p.ntp      = htons(sr_ntp && sr_ntp + 8 - data <= length ?
+                   sr_ntp - data : 0);
+    p.padding  = 0;
+    if (fwrite(&p, sizeof(p), 1, out) < 1 ||
+        (length > 0 && fwrite(data, length, 1, out) < 1)) {
+      perror("fwrite");
+      exit(1);
+    }
+  }
+  if (fflush(out) != 0) {
+    perror("fflush");
+    exit(1);
+  }
+} /* compile */
+
+
+/*
+* Load the compiled schedule in 'in', after its first line, into
+* 'schedule'.
+*/
+static void load(FILE *in)
+{
+  schedule_packet_t p;
+  char *buf = 0, *s;
+  size_t size = 0, len = 0, n;
+  int max = 0;
+
+  /* the whole file, then an index into it */
+  do {
+    if (len == size) {
+      size = size ? 2 * size : 1 << 20;
+      if (!(buf = realloc(buf, size))) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    n = fread(buf + len, 1, size - len, in);
+    len += n;
+  } while (n > 0);
+
+  for (s = buf; s + sizeof(p) <= buf + len; s += sizeof(p) + ntohs(p.length)) {
+    memcpy(&p, s, sizeof(p));
+    if (s + sizeof(p) + ntohs(p.length) > buf + len) break;
+    if (scheduled == max) {
+      max = max ? 2 * max : 1024;
+      if (!(schedule = realloc(schedule, max * sizeof(schedule_t)))) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    schedule[scheduled].time.tv_sec  = (int32_t)ntohl(p.sec);
+    schedule[scheduled].time.tv_usec = ntohl(p.usec);
+    schedule[scheduled].type   = p.type != 0;
+    schedule[scheduled].length = ntohs(p.length);
+    schedule[scheduled].ntp    = ntohs(p.ntp);
+    schedule[scheduled].flags  = p.flags;
+    schedule[scheduled].data   = s + sizeof(p);
+    scheduled++;
+  }
+  if (s != buf + len) {
+    fprintf(stderr, "Compiled schedule is truncated.\n");
+    exit(2);
+  }
+} /* load */
+
+
+/*
+* Send 'n' packets of the schedule from 'e', all of type 'type'.
+*/
+static void send_packets(schedule_t *e, int n, int type)
+{
+  struct timeval now;
+  int i;
+
+  /* sender reports carry the time they are sent */
+  for (i = 0; i < n; i++) {
+    if (e[i].ntp) {
+      uint32_t word;
+
+      gettimeofday(&now, 0);
+      word = htonl((uint32_t)now.tv_sec + GETTIMEOFDAY_TO_NTP_OFFSET);
+      if (e[i].flags & SCHEDULE_NTP_SEC) memcpy(e[i].data + e[i].ntp, &word, 4);
+      word = htonl(usec2ntp((u_int)now.tv_usec));
+      memcpy(e[i].data + e[i].ntp + 4, &word, 4);
+    }
+  }
+#if HAVE_SENDMMSG
+  {
+    struct mmsghdr msg[64];
+    struct iovec iov[64];
+    int k, sent;
+
+    while (n > 0) {
+      k = n < 64 ? n : 64;
+      memset(msg, 0, k * sizeof(msg[0]));
+      for (i = 0; i < k; i++) {
+        iov[i].iov_base = e[i].data;
+        iov[i].iov_len  = e[i].length;
+        msg[i].msg_hdr.msg_iov    = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+      }
+      for (i = 0; i < k; i += sent) {
+        sent = sendmmsg(sock[type], msg + i, k - i, 0);
+        TRACE(TRACE_SEND, sent > 0 ? sent : 0);
+        if (sent < 0) {
+          perror("write");
+          sent = 1;  /* skip the packet that failed */
+        }
+      }
+      e += k;
+      n -= k;
+    }
+  }
+#else
+  for (i = 0; i < n; i++) {
+    if (send(sock[type], e[i].data, e[i].length, 0) < 0) perror("write");
+    TRACE(TRACE_SEND, 1);
+  }
+#endif
+} /* send_packets */
+
+
+/*
+* Timer handler for a compiled schedule: sends each run of packets of
+* the same type that is due together, and sets the timer for the next.
+*/
+static Notify_value play_handler(Notify_client client)
+{
+  static int next = 0;          /* next entry to send */
+  static int isfirstpacket = 1;
+  static struct timeval basetime;
+  struct timeval now, due, gap;
+  int n;
+
+  timer_now(&now);
+  if (isfirstpacket) {
+    isfirstpacket = 0;
+    timersub(&now, &schedule[0].time, &basetime);
+  }
+
+  for (;;) {
+    /* packets due by now, as a run of the same type */
+    for (n = 0; next + n < scheduled; n++) {
+      timeradd(&basetime, &schedule[next + n].time, &due);
+      if (timercmp(&due, &now, >) ||
+          schedule[next + n].type != schedule[next].type) break;
+    }
+    if (n == 0) break;
+    send_packets(&schedule[next], n, schedule[next].type);
+    next += n;
+    if (next < scheduled) continue;
+
+    if (!loop) {
+      notify_stop();
+      exit(0);
+    }
+    /* go again, one packet interval after the last packet */
+    timersub(&schedule[scheduled - 1].time, &schedule[0].time, &gap);
+    timeradd(&basetime, &gap, &basetime);
+    if (scheduled > 1) {
+      timersub(&schedule[scheduled - 1].time, &schedule[scheduled - 2].time,
+        &gap);
+      timeradd(&basetime, &gap, &basetime);
+    }
+    next = 0;
+    printf("Rewound input file\n");
+    break;
+  }
+
+  timeradd(&basetime, &schedule[next].time, &due);
+  timer_set(&due, play_handler, client, 0);
+  return NOTIFY_DONE;
+} /* play_handler */
+
+
+/*
+* Create a socket sending to 'to', from 'sourceport' if non-zero.
+*/
+static int open_socket(struct sockaddr_in *to, int sourceport, u_char ttl,
+  int alert)
+{
+  static u_char ra[4] = {148, 4, 0, 1};  /* router alert option for RTP */
+  struct sockaddr_in from;
+  int on = 1;  /* flag */
+  int s;
+
+  s = socket(PF_INET, SOCK_DGRAM, 0);
+  if (s < 0) {
+    perror("socket");
+    exit(1);
+  }
+
+  if (sourceport) {
+    memset((char *)(&from), 0, sizeof(struct sockaddr_in));
+    from.sin_family      = PF_INET;
+    from.sin_addr.s_addr = INADDR_ANY;
+    from.sin_port        = htons(sourceport);
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+      perror("SO_REUSEADDR");
+      exit(1);
+    }
+
+#ifdef SO_REUSEPORT
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+      perror("SO_REUSEPORT");
+      exit(1);
+    }
+#endif
+
+    if (bind(s, (struct sockaddr *)&from, sizeof(from)) < 0) {
+      perror("bind");
+      exit(1);
+    }
+  }
+
+  if (connect(s, (struct sockaddr *)to, sizeof(*to)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+
+  if (IN_CLASSD(to->sin_addr.s_addr) &&
+      (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                 sizeof(ttl)) < 0)) {
+    perror("IP_MULTICAST_TTL");
+    exit(1);
+  }
+  if (alert &&
+      (setsockopt(s, IPPROTO_IP, IP_OPTIONS, (void *)ra,
+                sizeof(ra)) < 0)) {
+    perror("IP router alert option");
+    exit(1);
+  }
+  return s;
+} /* open_socket */
+
+
+/*
+* Generator mode: 'streams' parametric RTP streams, each sending 'rate'
+* packets a second of 'len' payload bytes of type 'pt'.  The packets
+* are built once by rtp() into an arena and only their sequence number
+* and timestamp are patched in place before each send.
+*/
+#define GEN_BATCH 64   /* packets per sendmmsg() */
+
+static struct {
+  int streams;         /* number of SSRCs */
+  int pt;              /* payload type */
+  int len;             /* payload bytes */
+  double rate;         /* packets per second and stream */
+  uint32_t clock;      /* timestamp units per second */
+  uint32_t ssrc;       /* first SSRC, the others follow */
+  int threads;         /* sending threads, each with its own socket */
+  double time;         /* seconds to run, 0 until interrupted */
+  int stride;          /* arena bytes per packet */
+  char *arena;         /* all packets */
+} gen = { .streams = 1, .len = 160, .rate = 50, .clock = 8000, .threads = 1 };
+
+typedef struct {
+  int sock;
+  int first, n;               /* streams sent by this thread */
+  int64_t start;              /* ns, monotonic; first packet is due */
+  unsigned long sent;         /* packets sent */
+  unsigned long errors;       /* failed sends */
+  double late_sum, late_max;  /* scheduling error (usec) */
+  unsigned long late_hist[32];  /* error in powers of two usec */
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+} gen_thread_t;
+
+static volatile sig_atomic_t gen_stop;
+
+
+static void gen_interrupt(int sig)
+{
+  gen_stop = 1;
+} /* gen_interrupt */
+
+
+/*
+* Parse the -g specification, comma-separated parameter=value pairs.
+*/
+static int gen_parse(char *spec)
+{
+  char *word;
+
+  for (word = strtok(spec, ","); word; word = strtok(0, ",")) {
+    char *value = strchr(word, '=');
+
+    if (!value) return -1;
+    *value++ = '\0';
+    if (strcmp(word, "streams") == 0) gen.streams = atoi(value);
+    else if (strcmp(word, "pt") == 0) gen.pt = atoi(value);
+    else if (strcmp(word, "len") == 0) gen.len = atoi(value);
+    else if (strcmp(word, "rate") == 0) gen.rate = atof(value);
+    else if (strcmp(word, "clock") == 0) gen.clock = strtoul(value, 0, 0);
+    else if (strcmp(word, "ssrc") == 0) gen.ssrc = strtoul(value, 0, 0);
+    else if (strcmp(word, "threads") == 0) gen.threads = atoi(value);
+    else if (strcmp(word, "time") == 0) gen.time = atof(value);
+    else return -1;
+  }
+  if (gen.streams < 1 || gen.pt < 0 || gen.pt > 127 || gen.len < 0 ||
+      gen.len > 65507 - 12 || gen.rate <= 0 || gen.threads < 1 ||
+      gen.time < 0) return -1;
+  if (gen.threads > gen.streams) gen.threads = gen.streams;
+  return 0;
+} /* gen_parse */
+
+
+static int64_t gen_now(void)
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  timer_now(&tv);
+  return (int64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+} /* gen_now */
+
+
+static uint32_t gen_seed;
+
+static uint32_t gen_random(void)
+{
+  gen_seed = gen_seed * 1103515245 + 12345;
+  return (gen_seed >> 16) | (gen_seed << 16);
+} /* gen_random */
+
+/*
+* Build the packets of all streams: random initial sequence numbers
+* and timestamps as RFC 3550 asks, random payload.
+*/
+static void gen_build(void)
+{
+  char text[128];
+  int i, j;
+
+  gen_seed = (uint32_t)time(0) ^ (uint32_t)gen_now();
+  if (gen.ssrc == 0) gen.ssrc = gen_random();
+  gen.stride = (12 + gen.len + 63) & ~63;  /* one cache line or more */
+  if (!(gen.arena = malloc((size_t)gen.streams * gen.stride))) {
+    perror("malloc");
+    exit(1);
+  }
+  for (i = 0; i < gen.streams; i++) {
+    char *packet = gen.arena + (size_t)i * gen.stride;
+
+    snprintf(text, sizeof(text), "pt=%d ssrc=%lu seq=%lu ts=%lu len=%d",
+      gen.pt, (unsigned long)(uint32_t)(gen.ssrc + i),
+      (unsigned long)(gen_random() & 0xffff), (unsigned long)gen_random(),
+      12 + gen.len);
+    rtp(text, packet);
+    for (j = 12; j < 12 + gen.len; j++) packet[j] = gen_random() >> 24;
+  }
+} /* gen_build */
+
+
+/*
+* Wait until 'due' (ns): sleep, then busy-wait the last 'precise' usec.
+*/
+static void gen_wait(int64_t due)
+{
+  int64_t wake = due - (precise > 0 ? precise * 1000 : 0);
+  int64_t now = gen_now();
+
+  if (now < wake) {
+#if HAVE_CLOCK_NANOSLEEP
+    struct timespec ts;
+
+    ts.tv_sec  = wake / 1000000000;
+    ts.tv_nsec = wake % 1000000000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#else
+    struct timeval timeout;
+
+    timeout.tv_sec  = (wake - now) / 1000000000;
+    timeout.tv_usec = (wake - now) % 1000000000 / 1000;
+    select(0, 0, 0, 0, &timeout);
+#endif
+  }
+  if (precise >= 0) while (gen_now() < due);
+} /* gen_wait */
+
+
+/*
+* Send the streams of thread 't' until stopped or its time is up.
+* Packet k of the thread belongs to stream k % n and is due k / pps
+* seconds after the start, so the streams are evenly interleaved.
+*/
+static void *gen_main(void *arg)
+{
+  gen_thread_t *t = arg;
+  double interval = 1e9 / (gen.rate * t->n);  /* ns between packets */
+  uint32_t step = (uint32_t)(gen.clock / gen.rate + 0.5);
+  unsigned long total = gen.time * gen.rate * t->n + 0.5;
+  int64_t end = t->start + (int64_t)(gen.time * 1e9);
+  int batch = t->n < GEN_BATCH ? t->n : GEN_BATCH;
+  unsigned long k = 0;
+  int next = 0;   /* stream of packet k */
+#if HAVE_SENDMMSG
+  struct mmsghdr msg[GEN_BATCH];
+  struct iovec iov[GEN_BATCH];
+#endif
+  rtp_hdr_t *h[GEN_BATCH];
+
+  while (!gen_stop && (gen.time == 0 || k < total)) {
+    int64_t due = t->start + (int64_t)(k * interval);
+    int64_t now;
+    double late;
+    int i, b;
+
+    gen_wait(due);
+    now = gen_now();
+    if (gen.time != 0 && now >= end) break;  /* fell behind */
+    late = (now - due) / 1e3;
+    t->late_sum += late;
+    if (late > t->late_max) t->late_max = late;
+    for (b = 0; late >= 1 && b < 31; late /= 2) b++;
+    t->late_hist[b]++;
+
+    /* everything due by now, but each stream at most once */
+    for (i = 0; i < batch && (gen.time == 0 || k < total) &&
+                t->start + (int64_t)(k * interval) <= now; i++, k++) {
+      h[i] = (rtp_hdr_t *)(gen.arena + (size_t)(t->first + next) * gen.stride);
+#if HAVE_SENDMMSG
+      memset(&msg[i], 0, sizeof(msg[i]));
+      iov[i].iov_base = (char *)h[i];
+      iov[i].iov_len  = 12 + gen.len;
+      msg[i].msg_hdr.msg_iov    = &iov[i];
+      msg[i].msg_hdr.msg_iovlen = 1;
+#endif
+      if (++next == t->n) next = 0;
+    }
+
+#if HAVE_SENDMMSG
+    for (b = 0; b < i; ) {
+      int sent = sendmmsg(t->sock, msg + b, i - b, 0);
+
+      TRACE(TRACE_SEND, sent > 0 ? sent : 0);
+      if (sent < 0) {
+        if (t->errors++ == 0) perror("write");
+        sent = 1;  /* skip the packet that failed */
+      }
+      else t->sent += sent;
+      b += sent;
+    }
+#else
+    for (b = 0; b < i; b++) {
+      if (send(t->sock, (char *)h[b], 12 + gen.len, 0) < 0) {
+        if (t->errors++ == 0) perror("write");
+      }
+      else t->sent++;
+      TRACE(TRACE_SEND, 1);
+    }
+#endif
+
+    /* next packet of each stream */
+    for (b = 0; b < i; b++) {
+      h[b]->seq = htons(ntohs(h[b]->seq) + 1);
+      h[b]->ts  = htonl(ntohl(h[b]->ts) + step);
+    }
+  }
+  return 0;
+} /* gen_main */
+
+
+/*
+* Run the generator on 'to' until interrupted or done, then report
+* the achieved rate and the scheduling error on stderr.
+*/
+static int gen_run(struct sockaddr_in *to, int sourceport, u_char ttl,
+  int alert)
+{
+  gen_thread_t *t;
+  unsigned long sent = 0, errors = 0, hist[32], n = 0, p99 = 0;
+  double late_sum = 0, late_max = 0, elapsed;
+  int64_t start;
+  int i, b;
+
+#if !HAVE_PTHREAD
+  if (gen.threads > 1) {
+    fprintf(stderr, "rtpsend: no thread support, sending from one thread\n");
+    gen.threads = 1;
+  }
+#endif
+  gen_build();
+  if (!(t = calloc(gen.threads, sizeof(*t)))) {
+    perror("calloc");
+    exit(1);
+  }
+  for (i = 0; i < gen.threads; i++) {
+    t[i].first = (int)((long)gen.streams * i / gen.threads);
+    t[i].n = (int)((long)gen.streams * (i + 1) / gen.threads) - t[i].first;
+    t[i].sock = i ? open_socket(to, sourceport, ttl, alert) : sock[0];
+  }
+  if (verbose) {
+    fprintf(stderr, "%d streams from ssrc %lu, pt %d, %d bytes, "
+      "%.2f packets/s, %d threads\n", gen.streams, (unsigned long)gen.ssrc,
+      gen.pt, gen.len, gen.rate, gen.threads);
+  }
+
+  signal(SIGINT, gen_interrupt);
+  signal(SIGTERM, gen_interrupt);
+  start = gen_now() + 1000000;  /* leave a millisecond to start threads */
+  for (i = 0; i < gen.threads; i++) t[i].start = start;
+#if HAVE_PTHREAD
+  for (i = 1; i < gen.threads; i++) {
+    if (pthread_create(&t[i].thread, NULL, gen_main, &t[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+#endif
+  gen_main(&t[0]);
+#if HAVE_PTHREAD
+  for (i = 1; i < gen.threads; i++) pthread_join(t[i].thread, NULL);
+#endif
+  elapsed = (gen_now() - start) / 1e9;
+
+  memset(hist, 0, sizeof(hist));
+  for (i = 0; i < gen.threads; i++) {
+    sent   += t[i].sent;
+    errors += t[i].errors;
+    late_sum += t[i].late_sum;
+    if (t[i].late_max > late_max) late_max = t[i].late_max;
+    for (b = 0; b < 32; b++) {
+      hist[b] += t[i].late_hist[b];
+      n += t[i].late_hist[b];
+    }
+  }
+  /* upper bound of the bucket of the 99th percentile */
+  for (b = 0; b < 32; b++) {
+    p99 += hist[b];
+    if (p99 >= n * 0.99) break;
+  }
+  if (elapsed <= 0) elapsed = 1e-9;
+
+  fprintf(stderr, "%lu packets in %.3f s: %.0f packets/s (%.0f requested), "
+    "%.1f Mbit/s, %lu send errors\n", sent, elapsed, sent / elapsed,
+    gen.streams * gen.rate, sent * (12 + gen.len) * 8 / elapsed / 1e6,
+    errors);
+  fprintf(stderr, "scheduling error over %lu batches: mean %.1f us, "
+    "99%% < %lu us, max %.1f us\n", n, n ? late_sum / n : 0,
+    b < 32 ? 1UL << b : 0, late_max);
+  return 0;
+} /* gen_run */
+
+
 int main(int argc, char *argv[])
 {
   unsigned char ttl = 16;
   static struct sockaddr_in sin;
-  static struct sockaddr_in from;
+  struct sockaddr_in to;
   int i;
   int c;
   int alert = 0;       /* insert IP router alert option if possible */
   int sourceport = 0;  /* source port */
-  int on = 1;          /* flag */
-  static u_char ra[4] = {148, 4, 0, 1};  /* router alert option for RTP */
+  int generator = 0;   /* generate streams instead of reading packets */
   char *filename = 0;
+  char *script = 0;    /* compile this */
+  char *outfile = 0;   /* compiled schedule */
   extern char *optarg;
   extern int optind;
 
   /* parse command line arguments */
+  trace_init();
   startupSocket();
-  while ((c = getopt(argc, argv, "f:als:v?h")) != EOF) {
+  while ((c = getopt(argc, argv, "c:f:g:alo:P:s:v?h")) != EOF) {
     switch(c) {
+    case 'c':
+      script = optarg;
+      break;
+    case 'o':
+      outfile = optarg;
+      break;
     case 'f':
       filename = optarg;
       break;
+    case 'g':
+      if (gen_parse(optarg) < 0) usage(argv[0]);
+      generator = 1;
+      break;
     case 'a':
       alert = 1;
       break;
     case 'l':  /* loop */
       loop = 1;
       break;
+    case 'P':  /* precise timing */
+      precise = atol(optarg);
+      if (precise < 0) usage(argv[0]);
+      break;
     case 's':  /* locked source port */
       sourceport = atoi(optarg);
       break;
@@ -890,16 +1572,47 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (filename) {
-    in = fopen(filename, "r");
-    if (!in) {
-      perror(filename);
+  /* compile only */
+  if (script) {
+    FILE *out = stdout;
+
+    if (!(in = fopen(script, "r"))) {
+      perror(script);
+      exit(1);
+    }
+    if (outfile && !(out = fopen(outfile, "wb"))) {
+      perror(outfile);
+      exit(1);
+    }
+    if (out == stdout) vout = stderr;
+    compile(in, out);
+    if (out != stdout && fclose(out) != 0) {
+      perror(outfile);
       exit(1);
     }
+    return 0;
   }
-  else {
-    in = stdin;
-    loop = 0;
+
+  if (!generator) {
+    if (filename) {
+      in = fopen(filename, "rb");
+      if (!in) {
+        perror(filename);
+        exit(1);
+      }
+    }
+    else in = stdin;
+
+    /* a compiled schedule, or the first line of the text */
+    if (fgets(line, sizeof(line), in) && strcmp(line, RTPSEND_MAGIC) == 0) {
+      line[0] = '\0';
+      load(in);  /* rewound in memory, so it can loop from stdin */
+      if (scheduled == 0) return 0;
+    }
+    else {
+      if (line[0] == '#') line[0] = '\0';
+      if (!filename) loop = 0;
+    }
   }
 
   if (optind < argc) {
@@ -921,58 +1634,21 @@ int main(int argc, char *argv[])
   }
 
   /* create/connect sockets */
+  to = sin;
   for (i = 0; i < 2; i++) {
-    sock[i] = socket(PF_INET, SOCK_DGRAM, 0);
-    if (sock[i] < 0) {
-      perror("socket");
-      exit(1);
-    }
     sin.sin_port = htons(ntohs(sin.sin_port) + i);
+    sock[i] = open_socket(&sin, sourceport ? sourceport + i : 0, ttl, alert);
+  }
+  if (generator) return gen_run(&to, sourceport, ttl, alert);
 
-    if (sourceport) {
-      memset((char *)(&from), 0, sizeof(struct sockaddr_in));
-      from.sin_family      = PF_INET;
-      from.sin_addr.s_addr = INADDR_ANY;
-      from.sin_port        = htons(sourceport + i);
-
-      if (setsockopt(sock[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
-        perror("SO_REUSEADDR");
-        exit(1);
-      }
-
-#ifdef SO_REUSEPORT
-      if (setsockopt(sock[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
-        perror("SO_REUSEPORT");
-        exit(1);
-      }
-#endif
-
-      if (bind(sock[i], (struct sockaddr *)&from, sizeof(from)) < 0) {
-        perror("bind");
-        exit(1);
-      }
-    }
-
-    if (connect(sock[i], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
-      perror("connect");
-      exit(1);
-    }
-
-    if (IN_CLASSD(sin.sin_addr.s_addr) &&
-        (setsockopt(sock[i], IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
-                   sizeof(ttl)) < 0)) {
-      perror("IP_MULTICAST_TTL");
-      exit(1);
-    }
-    if (alert &&
-        (setsockopt(sock[i], IPPROTO_IP, IP_OPTIONS, (void *)ra,
-                  sizeof(ra)) < 0)) {
-      perror("IP router alert option");
-      exit(1);
-    }
+  if (precise >= 0) {
+    notify_set_precise(precise);
+    timer_stats(1);
+    atexit(report);
   }
 
-  send_handler((Notify_client)in);
+  if (schedule) play_handler(0);
+  else send_handler((Notify_client)in);
   notify_start();
   return 0;
 } /* main */
@@ -0,0 +1,228 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Decode a trace file written by the tools with RTPTRACE set, see
+* trace.h: the time between related trace points of each thread, as
+* percentiles, or with -r every record.
+*/
+
+#include "sysdep.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+static const char *events[TRACE_EVENTS] = {
+  "wakeup", "recv", "handler", "handled", "write", "written", "timer",
+  "timed", "send"
+};
+
+/* time from the latest 'from' of a thread to its next 'to' */
+static const struct {
+  const char *name;
+  int from, to;
+} spans[] = {
+  {"wakeup-recv",  TRACE_WAKEUP,  TRACE_RECV},     /* socket ready to data */
+  {"recv-handler", TRACE_RECV,    TRACE_HANDLER},  /* batch to first packet */
+  {"handler",      TRACE_HANDLER, TRACE_HANDLED},
+  {"write",        TRACE_WRITE,   TRACE_WRITTEN},
+  {"timer",        TRACE_TIMER,   TRACE_TIMED},
+  {"timer-send",   TRACE_TIMER,   TRACE_SEND},
+  {"recv-send",    TRACE_RECV,    TRACE_SEND},     /* through a translator */
+  {"recv-gap",     TRACE_RECV,    TRACE_RECV},
+  {"send-gap",     TRACE_SEND,    TRACE_SEND}
+};
+#define SPANS (sizeof(spans) / sizeof(spans[0]))
+
+typedef struct {
+  uint64_t *v;
+  size_t n, size;
+} samples_t;
+
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-r] [file]\n", argv0);
+} /* usage */
+
+
+static void add(samples_t *s, uint64_t v)
+{
+  uint64_t *p;
+
+  if (s->n == s->size) {
+    s->size = s->size ? 2 * s->size : 1024;
+    if (!(p = realloc(s->v, s->size * sizeof(*p)))) {
+      perror("realloc");
+      exit(1);
+    }
+    s->v = p;
+  }
+  s->v[s->n++] = v;
+} /* add */
+
+
+static int compare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+} /* compare */
+
+
+/*
+* Print the distribution of samples 's', 'scale' of them to a
+* microsecond, as one line.
+*/
+static void show(const char *type, const char *name, samples_t *s,
+  double scale)
+{
+  static const double q[] = {0.5, 0.9, 0.99, 0.999};
+  static const char *qname[] = {"p50", "p90", "p99", "p999"};
+  double sum = 0;
+  size_t i;
+
+  if (s->n == 0) return;
+  qsort(s->v, s->n, sizeof(s->v[0]), compare);
+  for (i = 0; i < s->n; i++) sum += s->v[i];
+  printf("%s name=%s count=%lu mean_us=%.3f", type, name,
+    (unsigned long)s->n, sum / s->n / scale);
+  for (i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+    printf(" %s_us=%.3f", qname[i], s->v[(size_t)((s->n - 1) * q[i])] / scale);
+  printf(" max_us=%.3f\n", s->v[s->n - 1] / scale);
+} /* show */
+
+
+int main(int argc, char *argv[])
+{
+  trace_header_t h;
+  trace_record_t *r;
+  samples_t span[SPANS], late;
+  uint64_t count[TRACE_EVENTS];
+  uint64_t *pending;            /* per thread and span: time of 'from' */
+  unsigned threads = 0;
+  FILE *in = stdin;
+  int raw = 0, c;
+  size_t i, k;
+  extern int optind;
+
+  while ((c = getopt(argc, argv, "rh")) != EOF) {
+    switch (c) {
+    case 'r':
+      raw = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (optind < argc - 1) {
+    usage(argv[0]);
+    exit(1);
+  }
+  if (optind < argc && !(in = fopen(argv[optind], "rb"))) {
+    perror(argv[optind]);
+    exit(1);
+  }
+
+  if (fread(&h, sizeof(h), 1, in) != 1 ||
+      memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0) {
+    fprintf(stderr, "not a trace file\n");
+    exit(1);
+  }
+  if (h.version != TRACE_VERSION || h.size != sizeof(trace_record_t)) {
+    fprintf(stderr, "trace file of another version or byte order\n");
+    exit(1);
+  }
+  /* the writer never has more, so anything else is corrupt */
+  if (h.count > TRACE_RECORDS || h.count > SIZE_MAX / sizeof(*r) - 1 ||
+      h.count > h.total) {
+    fprintf(stderr, "corrupt trace file: %llu records\n",
+      (unsigned long long)h.count);
+    exit(1);
+  }
+  if (!(r = malloc(h.count * sizeof(*r) + 1))) {
+    perror("malloc");
+    exit(1);
+  }
+  h.count = fread(r, sizeof(*r), h.count, in);
+
+  for (i = 0; i < h.count; i++) {
+    if (r[i].event < TRACE_EVENTS && r[i].thread >= threads)
+      threads = r[i].thread + 1;
+  }
+  if (!(pending = calloc((size_t)threads * SPANS + 1, sizeof(*pending)))) {
+    perror("calloc");
+    exit(1);
+  }
+  memset(span, 0, sizeof(span));
+  memset(&late, 0, sizeof(late));
+  memset(count, 0, sizeof(count));
+
+  for (i = 0; i < h.count; i++) {
+    uint64_t *p = &pending[(size_t)r[i].thread * SPANS];
+    int e = r[i].event;
+
+    if (e >= TRACE_EVENTS) continue;  /* caught half written */
+    count[e]++;
+    if (raw)
+      printf("%.9f %u %s %lu\n", (r[i].ns - r[0].ns) / 1e9, r[i].thread,
+        events[e], (unsigned long)r[i].arg);
+    if (e == TRACE_TIMER) add(&late, r[i].arg);
+    for (k = 0; k < SPANS; k++) {
+      if (e == spans[k].to && p[k]) {
+        if (r[i].ns >= p[k]) add(&span[k], r[i].ns - p[k]);
+        p[k] = 0;
+      }
+      if (e == spans[k].from) p[k] = r[i].ns;
+    }
+  }
+  if (raw) return 0;
+
+  printf("trace records=%llu lost=%llu threads=%u seconds=%.6f\n",
+    (unsigned long long)h.count, (unsigned long long)(h.total - h.count),
+    threads, h.count ? (r[h.count - 1].ns - r[0].ns) / 1e9 : 0.);
+  for (k = 0; k < TRACE_EVENTS; k++) {
+    if (count[k])
+      printf("event name=%s count=%llu\n", events[k],
+        (unsigned long long)count[k]);
+  }
+  for (k = 0; k < SPANS; k++) show("span", spans[k].name, &span[k], 1000);
+  show("value", "timer-late", &late, 1);
+  return 0;
+} /* main */
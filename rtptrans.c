@@ -45,16 +45,30 @@
 
 #include "sysdep.h"
 
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#if HAVE_PTHREAD && defined(SO_REUSEPORT)
+#define WORKERS 1   /* -w supported */
+#else
+#define WORKERS 0
+#endif
+
 #include "rtp.h"
 #include "rtpdump.h"
 #include "notify.h"
 #include "multimer.h"
 #include "vat.h"
+#include "ssrcmap.h"
+#include "fanout.h"
+#include "rtpparse.h"
+#include "counters.h"
+#include "trace.h"
 
 extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 
 #define PAD(x,n) (((n) - ((x) & (n-1))) & (n-1))
-#define MAX_HOST 10
 
 static int debug = 0;
 static int hostc = 0;
@@ -62,118 +76,167 @@ static int multi_sock[3] = {0,0,0};
 static struct {
   int sock;
   struct sockaddr_in sin;
-} side[MAX_HOST][3];  /* [host][proto] */
+  int leg;          /* fan-out leg for proto 0 and 1 */
+} (*side)[3];       /* [host][proto], hostc entries */
 
 /*
- * create a linked list for traversing the sequence numbers of the different
- * streams arriving over a multicast link to a unicast network
+ * Sequence state of each data stream arriving over a multicast link to
+ * a unicast network, keyed by source address.  We need to keep the
+ * sequence number of the last sent packet for each stream.  Streams
+ * not heard from for STREAM_IDLE seconds are dropped; the table is swept
+ * every STREAM_SWEEP seconds and 'seen' holds the sweep generation of
+ * the last packet.
  */
-typedef struct stream_id{
+#define STREAM_IDLE  600
+#define STREAM_SWEEP 60
+
+typedef struct {
   int seq;
-  int addr;
   int next_ts;
-  struct stream_id* next;
-} STREAM;
+  unsigned long seen;
+} stream;
+
+/*
+ * Worker threads.  Each worker has its own event loop, receive sockets
+ * for the unicast hosts, stream table and fan-out tables, so that the
+ * packet path takes no locks.  The unicast receive sockets of all
+ * workers share their ports with SO_REUSEPORT, and the kernel keeps
+ * each source on one worker.  Multicast is received by worker 0 only,
+ * as every socket in a group would get a copy.  The destinations are
+ * set up before the threads start and not changed afterwards.
+ * Worker 0 runs on the main thread with the default event loop.
+ */
+typedef struct {
+  notify_loop_t *loop;
+  fanout_t *fan[2];               /* destinations per proto (RTP, RTCP) */
+  ssrcmap_t *streams;
+  unsigned long generation;       /* sweeps so far */
+  struct {
+    unsigned long lookups;        /* find_stream() calls */
+    unsigned long created;        /* new streams */
+    unsigned long expired;        /* idle streams dropped */
+  } stats;
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+} worker_t;
+
+static worker_t *worker;
+static int workers = 1;
+
+/* counters of each receive socket, by socket_handler() client */
+static counters_t **rx_counters;
 
-typedef struct stream_id stream;
 
 /*
- * We need to keep in memory the sequence number of the last sent packet
- * for each data stream.
+ * Return the next RTP sequence number for the stream from 'addr',
+ * creating the stream if necessary.
  */
-static stream *head;   /* start of list */
-static stream *middle; /* middle of the list, keeping this pointer reduces the
-                        * avarage searching path to a 1/4 of the list instead of
-                        * 1/2.
-                        */
-static stream *last;   /* Last seen stream, as the probability that the next
-                        * packet will belong to the last seen one this reduces
-                        * the searching path even further.
-                        */
-static int list_len;
-
-static int create_stream(int addr, int next)
+static int find_stream(worker_t *w, int addr, int ts, int next, int m)
 {
-  stream *elem;
-  int i;
-  stream* new_stream=( stream *) malloc(sizeof( stream));
-  if(new_stream==NULL) {
-    perror("can not create a new steam identifier ");
-    exit (0);
-  }
-  /* init created stream */
-  new_stream->next=NULL;
-  new_stream->addr=addr;
-  new_stream->seq=addr;
-  new_stream->next_ts=next;
-  if(head==NULL) { /* initialize the list */
-    head=new_stream;
-    middle=new_stream;
-    list_len=1;
-    new_stream->seq=rand();
-    last=new_stream;
-    return new_stream->seq;
-  }
-  new_stream->seq=rand(); /* init the first sequence number for this stream */
-  if((list_len++)%2) {
-    for(elem=head, i=1; i<(list_len/2)+(list_len%2);i++,elem=elem->next);
-    middle=elem;
-  }
-  /* organize the list in order of the ssrc */
-  if(head->addr>addr) {
-    new_stream->next=head;
-    head=new_stream;
-    last=new_stream;
-    return new_stream->seq;
-  }
+  stream *s;
 
-  for(elem=head;elem->next!=NULL;elem=elem->next) {
-    if(elem->next->addr>addr) {
-      new_stream->next=elem->next;
-      elem->next=new_stream;
-      last=new_stream;
-      return new_stream->seq;
+  w->stats.lookups++;
+  if (!(s = ssrcmap_find(w->streams, addr))) {
+    if (!(s = ssrcmap_insert(w->streams, addr))) {
+      perror("can not create a new stream identifier");
+      exit(1);
     }
+    w->stats.created++;
+    s->seq = rand();  /* init the first sequence number for this stream */
   }
-      ;
-  if(elem->next==NULL) {
-    elem->next=new_stream;
-    last=new_stream;
-    return new_stream->seq;
+  else {
+    s->seq += 1;
+    if (ts != s->next_ts && !m)
+      s->seq += 1;  /* approximate missing some packets */
   }
-  return new_stream->seq;
-}
+  s->next_ts = next;
+  s->seen = w->generation;
+  return s->seq;
+} /* find_stream */
 
 
 /*
- * Add a stream to the list.
+ * ssrcmap_foreach() callback: drop stream if idle.
  */
-static int find_stream(int addr, int ts, int next, int m)
+static int stream_idle(uint32_t addr, void *entry, void *arg)
 {
-  stream *element;
-  /* packet belongs to the last seen stream */
-  if ((last!=NULL)&&(addr==last->addr)) {
-     last->seq+=1;
-     if (ts != last->next_ts && !m)
-       last->seq+=1;   /* approximate missing some packets */
-     last->next_ts = next;
-     return(last->seq);
+  worker_t *w = arg;
+  stream *s = entry;
+
+  if (w->generation - s->seen < STREAM_IDLE / STREAM_SWEEP) return 0;
+  w->stats.expired++;
+  return 1;
+} /* stream_idle */
+
+
+/*
+ * Timer handler: expire idle streams of worker 'client'.
+ */
+static Notify_value sweep_handler(Notify_client client)
+{
+  worker_t *w = &worker[client];
+  struct timeval interval;
+
+  w->generation++;
+  ssrcmap_foreach(w->streams, stream_idle, w);
+  interval.tv_sec  = STREAM_SWEEP;
+  interval.tv_usec = 0;
+  timer_set_ex(w->loop, &interval, sweep_handler, client, 1);
+  return NOTIFY_DONE;
+} /* sweep_handler */
+
+
+/*
+ * Print stream table statistics, summed over the workers.  Other
+ * workers keep running, so their counts may be slightly behind.
+ */
+static void stream_report(FILE *out)
+{
+  unsigned long lookups = 0, created = 0, expired = 0;
+  unsigned int live = 0;
+  int i;
+
+  for (i = 0; i < workers; i++) {
+    live    += ssrcmap_count(worker[i].streams);
+    lookups += worker[i].stats.lookups;
+    created += worker[i].stats.created;
+    expired += worker[i].stats.expired;
   }
-  if((middle!=NULL)&&(addr>=middle->addr))
-    element=middle;
-  else
-    element=head;
-  for(; (element!=NULL)&&(element->addr<=addr); element=element->next) {
-    if(element->addr==addr) {
-      element->seq+=1;
-       if (ts != element->next_ts && !m)
-         element->seq += 1;  /* approximate missing some packets */
-       element->next_ts = next;
-      return (element->seq);
-    }
+  fprintf(out, "streams: %u live, %lu lookups, %lu created, %lu expired\n",
+    live, lookups, created, expired);
+} /* stream_report */
+
+
+#ifdef SIGUSR1
+/*
+ * SIGUSR1 is passed through a pipe so that the report is printed
+ * from the event loop rather than from the signal handler.
+ */
+static int report_pipe[2] = {-1, -1};
+
+static Notify_value report_signal(Notify_client client, int sig,
+  Notify_signal_mode mode)
+{
+  char c = 0;
+
+  if (write(report_pipe[1], &c, 1) < 0) {
+    /* pipe full: a report is pending anyway */
   }
-  return(create_stream(addr, next));
-}
+  return NOTIFY_DONE;
+} /* report_signal */
+
+static Notify_value report_handler(Notify_client client, int fd)
+{
+  char buf[64];
+
+  if (read(fd, buf, sizeof(buf)) > 0) {
+    stream_report(stderr);
+    counters_report(stderr, COUNTERS_TEXT);
+  }
+  return NOTIFY_DONE;
+} /* report_handler */
+#endif /* SIGUSR1 */
 
 struct sdes_msg {
   rtcp_common_t header;
@@ -181,66 +244,122 @@ struct sdes_msg {
 };
 
 /*
-* Handle file input events from network sockets.
+* Receive a packet of at most 'size' bytes from 'sock' into 'buf' and
+* its sender into 'from'.  Where the system tells, the number of
+* packets the socket dropped so far goes to 'ctr'.
+*/
+static int receive(int sock, char *buf, int size, struct sockaddr_in *from,
+  counters_t *ctr)
+{
+#ifdef SO_RXQ_OVFL
+  char control[CMSG_SPACE(sizeof(uint32_t))];
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  struct iovec iov;
+  uint32_t drops;
+  int len;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = buf;
+  iov.iov_len  = size;
+  msg.msg_name       = from;
+  msg.msg_namelen    = sizeof(*from);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+  len = recvmsg(sock, &msg, 0);
+  TRACE(TRACE_RECV, len >= 0);
+  if (len < 0) return len;
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+      counters_set(ctr, CTR_DROPS, drops);
+    }
+  }
+  return len;
+#else
+  socklen_t addr_len = sizeof(*from);
+  int len;
+
+  len = recvfrom(sock, buf, size, 0, (struct sockaddr *)from, &addr_len);
+  TRACE(TRACE_RECV, len >= 0);
+  return len;
+#endif
+} /* receive */
+
+
+/*
+* Ask for the drop count of receive socket 'sock', see receive().
+*/
+static void count_drops(int sock)
+{
+#ifdef SO_RXQ_OVFL
+  int on = 1;
+
+  if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, (char *)&on, sizeof(on)) < 0)
+    perror("setsockopt: SO_RXQ_OVFL");
+#endif
+} /* count_drops */
+
+/*
+* Handle file input events from network sockets.  The client is
+* (worker * hostc + host) * 2 + proto.
 */
 static Notify_value socket_handler(Notify_client client, int sock)
 {
+  worker_t *w = &worker[(client >> 1) / hostc];
+  counters_t *ctr = rx_counters[client];
   int len;
-  int proto;
+  int proto, from;
   struct sockaddr_in sin_from;
-  socklen_t addr_len;
   char packet[8192];
-  int i;
-  const int VAT_LEN=8;
-  vat_hdr_t *vat_hdr;
-  rtp_hdr_t *rtp_hdr;
+  struct iovec iov[2];
+  rtp_info_t r;
+  vat_ctrl_t vc;
   rtp_hdr_t rtp_hdr_send;
 
   proto = ((int)client & 1);
+  from  = side[(client >> 1) % hostc][proto].leg;  /* do not send back */
   /* Read packet data from socket. */
-  addr_len = sizeof(sin_from);
-  len = recvfrom(sock, packet, sizeof(packet), 0,
-        (struct sockaddr *)&sin_from, &addr_len);
-  rtp_hdr=(rtp_hdr_t *)packet;
+  if ((len = receive(sock, packet, sizeof(packet), &sin_from, ctr)) < 0)
+    return NOTIFY_DONE;
+  rtp_parse(packet, len, &r);
+  counters_add(ctr, CTR_RX_PACKETS, 1);
+  counters_add(ctr, CTR_RX_BYTES, len);
+  /* translated vat streams get the sender address as SSRC */
+  if (!proto && r.error == RTPP_OK)
+    counters_ssrc(ctr, r.version == 2 ? r.ssrc :
+      ntohl(sin_from.sin_addr.s_addr), len);
   if (debug) {
     struct timeval now;
 
     gettimeofday(&now, 0);
     printf("%0.3f %s %4d [%s/%d]\n",
       now.tv_sec + now.tv_usec/1e6,
-      rtp_hdr->version==2 ? (proto ? "RTCP" : "RTP ") :
-        rtp_hdr->version==0 ? (proto ? "vatC" : "vat ") : "UKWN", len,
+      r.version==2 ? (proto ? "RTCP" : "RTP ") :
+        r.version==0 ? (proto ? "vatC" : "vat ") : "UKWN", len,
       inet_ntoa(sin_from.sin_addr), ntohs(sin_from.sin_port));
   }
 
   /* do not translate packets that already use RTP or arrive over the unicast
    link*/
-  if ((rtp_hdr->version==2)||((sock!=multi_sock[0])&&(sock!=multi_sock[1]))) {
-    rtp_hdr=(rtp_hdr_t *)packet;
-    for (i = 0; i < hostc; i++) {
-      if (side[i][proto].sock != sock
-          && side[i][proto].sin.sin_addr.s_addr != INADDR_ANY) {
-        if (sendto(side[i][2].sock, packet, len, 0,
-        (struct sockaddr *)&side[i][proto].sin,
-	sizeof(side[i][proto].sin)) == -1) {
-		perror("sendto RTPC");
-	}
-      }
-    }
+  if ((r.version==2)||((sock!=multi_sock[0])&&(sock!=multi_sock[1]))) {
+    iov[0].iov_base = packet;
+    iov[0].iov_len  = len;
+    fanout_send(w->fan[proto], iov, 1, from, 0);
   }
   else {
-    struct msghdr msg;
     if (!proto) { /* translate VAT packets */
-      struct iovec iov[2];
       char type;
-      int samples = len-VAT_LEN;
-      vat_hdr=(vat_hdr_t *)packet;
+      int samples = r.plen;
 
-      if(vat_hdr->flags&VATHF_NEWTS)
+      if (r.error) return NOTIFY_DONE;
+      if(r.flags&VATHF_NEWTS)
         rtp_hdr_send.m = 1;
       else
         rtp_hdr_send.m = 0;
-      type= vat_hdr->flags&VATHF_FMTMASK;
+      type= r.flags&VATHF_FMTMASK;
 
       switch (type) {
 
@@ -270,59 +389,22 @@ static Notify_value socket_handler(Notify_client client, int sock)
         break;
       }
       rtp_hdr_send.ssrc    = sin_from.sin_addr.s_addr;
-      rtp_hdr_send.seq     = find_stream(rtp_hdr_send.ssrc, vat_hdr->ts,
-         vat_hdr->ts + samples, rtp_hdr_send.m);
+      rtp_hdr_send.seq     = find_stream(w, rtp_hdr_send.ssrc, r.vts,
+         r.vts + samples, rtp_hdr_send.m);
       rtp_hdr_send.version = RTP_VERSION;
       rtp_hdr_send.p       = 0;
       rtp_hdr_send.x       = 0;
       rtp_hdr_send.cc      = 0;
-      rtp_hdr_send.ts      = vat_hdr->ts;
-
-#if WIN32
-      /* Windows does not support sendmsg(), use copying instead;
-       * contributed by Lutz Grueneberg <gruen@rvs.uni-hannover.de>. */
-      {
-        unsigned char mbuf[10000];
-        int mlength = 0;
-        memcpy (&mbuf[mlength], (char *)&(rtp_hdr_send), sizeof(rtp_hdr_t)-4);
-        mlength += sizeof(rtp_hdr_t)-4;
-        memcpy (&mbuf[mlength], packet+VAT_LEN, len-VAT_LEN);
-        mlength += len-VAT_LEN;
-        for (i = 0; i < hostc; i++) {
-          if (side[i][proto].sock != sock) {
-            if (sendto(side[i][2].sock, mbuf, mlength, 0,
-                        &(side[i][proto].sin), sizeof(side[i][proto].sin))!=
-                mlength)
-              perror("sendmsg RTCP");
-          }
-        }
-      }
-#else
+      rtp_hdr_send.ts      = htonl(r.vts);
+
+      /* header is built once and shared by all legs */
       iov[0].iov_base = (char *)&(rtp_hdr_send);
       iov[0].iov_len = sizeof(rtp_hdr_t)-4;
-      iov[1].iov_base = packet+VAT_LEN;
-      iov[1].iov_len = len-VAT_LEN;
-      msg.msg_iov = iov;
-      msg.msg_iovlen = 2;
-      for (i = 0; i < hostc; i++) {
-        if (side[i][proto].sock != sock) {
-          msg.msg_name = (char*) &side[i][proto].sin;
-          msg.msg_namelen = sizeof(side[i][proto].sin);
-#if HAVE_MSGCONTROL
-          msg.msg_control = 0;
-          msg.msg_controllen = 0;
-#else
-          msg.msg_accrights = 0;
-          msg.msg_accrightslen = 0;
-#endif
-          if ((sendmsg(side[i][2].sock, &msg,0))!=
-            iov[0].iov_len +iov[1].iov_len)
-            perror("sendmsg RTCP");
-          }
-       }
-#endif /* WIN32 */
+      iov[1].iov_base = (char *)r.payload;
+      iov[1].iov_len = r.plen;
+      fanout_send(w->fan[proto], iov, 2, from, 1);
     }
-    else if (((struct CtrlMsgHdr *)packet)->type == 1) /* vat ID messages */{
+    else if (vat_ctrl_parse(packet, len, &vc) == 0 && vc.type == 1) /* vat ID messages */{
       rtcp_t *rtcp_msg;
       struct sdes_msg *ctl_msg;
       rtcp_sdes_item_t *item;
@@ -369,15 +451,10 @@ static Notify_value socket_handler(Notify_client client, int sock)
       ctl_msg->sdes.src=sin_from.sin_addr.s_addr;
       ctl_msg->header.length=((length-8) >> 2) - 1;
 
-      for (i = 0; i < hostc; i++) {
-        if (side[i][proto].sock != sock) {
-          if (sendto(side[i][2].sock,(char *)rtcp_msg,
-             ((rtcp_msg->common.length+1)+(ctl_msg->header.length+1))*4,
-             0, (struct sockaddr *)&side[i][proto].sin,
-             sizeof(side[i][proto].sin)) < 0)
-          perror("sendto RTCP");
-        }
-      }
+      iov[0].iov_base = (char *)rtcp_msg;
+      iov[0].iov_len  =
+        ((rtcp_msg->common.length+1)+(ctl_msg->header.length+1))*4;
+      fanout_send(w->fan[proto], iov, 1, from, 1);
       free(rtcp_msg);
     }/* control messages */
   }
@@ -385,12 +462,75 @@ static Notify_value socket_handler(Notify_client client, int sock)
 } /* socket_handler */
 
 
+#if WORKERS
+/*
+* Open another receive socket of a worker on the port of unicast
+* address 'sin'.
+*/
+static int worker_socket(struct sockaddr_in *sin)
+{
+  struct sockaddr_in any = *sin;
+  int reuse = 1;
+  int sock;
+
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+    perror("socket");
+    exit(1);
+  }
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse,
+      sizeof(reuse)) == -1)
+    perror("setsockopt: reuseaddr");
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&reuse,
+      sizeof(reuse)) == -1) {
+    perror("setsockopt: reuseport");
+    exit(1);
+  }
+  any.sin_addr.s_addr = INADDR_ANY;
+  if (bind(sock, (struct sockaddr *)&any, sizeof(any)) < 0) {
+    perror("bind unicast");
+    exit(1);
+  }
+  count_drops(sock);
+  return sock;
+} /* worker_socket */
+
+
+/*
+* Thread of workers other than 0.
+*/
+static void *worker_main(void *arg)
+{
+  worker_t *w = arg;
+  int c;
+
+  if ((c = notify_start_ex(w->loop)) != NOTIFY_OK) {
+    fprintf(stderr, "worker %d: Notifier error %d.\n", (int)(w - worker), c);
+    perror("select");
+  }
+  return 0;
+} /* worker_main */
+#endif /* WORKERS */
+
+
 static void usage(char *argv0)
 {
-  fprintf(stderr, "usage: %s address/port[/ttl] address/port[/ttl] [...]\n",
-	argv0);
+  fprintf(stderr, "usage: %s [-d] [-M [address/]port] [-m seconds] "
+    "[-w workers] address/port[/ttl] address/port[/ttl] [...]\n", argv0);
 }
 
+
+/*
+* Name of the counters of host 'sin', proto 'proto'.
+*/
+static const char *counters_name(struct sockaddr_in *sin, int proto)
+{
+  static char name[64];
+
+  snprintf(name, sizeof(name), "%s %s/%d", proto ? "rtcp" : "rtp",
+    inet_ntoa(sin->sin_addr), ntohs(sin->sin_port) + proto);
+  return name;
+} /* counters_name */
+
 int main(int argc, char *argv[])
 {
   int c;
@@ -399,21 +539,48 @@ int main(int argc, char *argv[])
     unsigned char ttl;
     struct sockaddr_in sin;
     struct ip_mreq mreq;
-  } host[MAX_HOST];
+  } *host;
   struct sockaddr_in sin;   /* generic bind */
   extern int optind;
   char loop = 0;  /* multicast loop */
   int reuse = 1;  /* reuse address */
-  int i, j;
+  int ucast_sock = -1;  /* send socket shared by unicast hosts */
+  char *metrics = 0;    /* serve counters on this port */
+  double interval = 0;  /* seconds between lines of counters */
+  int i, j, m, w;
 
 
   /* Set up socket. */
+  trace_init();
   startupSocket();
-  while ((c = getopt(argc, argv, "d?h")) != EOF) {
+  while ((c = getopt(argc, argv, "dM:m:w:?h")) != EOF) {
     switch(c) {
     case 'd':
       debug = 1;
       break;
+    case 'M':
+      metrics = optarg;
+      break;
+    case 'm':
+      interval = atof(optarg);
+      if (interval <= 0) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'w':
+      workers = atoi(optarg);
+      if (workers < 1) {
+        usage(argv[0]);
+        exit(1);
+      }
+#if !WORKERS
+      if (workers > 1) {
+        fprintf(stderr, "%s: -w is not supported on this system\n", argv[0]);
+        exit(1);
+      }
+#endif
+      break;
     case '?':
     case 'h':
       usage(argv[0]);
@@ -428,14 +595,25 @@ int main(int argc, char *argv[])
   }
 
   /* Parse host descriptions. */
+  host = calloc(argc - optind, sizeof(*host));
+  side = calloc(argc - optind, sizeof(*side));
+  worker = calloc(workers, sizeof(worker_t));
+  rx_counters = calloc(workers * (argc - optind) * 2, sizeof(counters_t *));
+  if (!host || !side || !worker || !rx_counters) {
+    perror("calloc");
+    exit(1);
+  }
+  worker[0].loop = notify_loop_default();
+  for (w = 1; w < workers; w++) {
+    if (!(worker[w].loop = notify_loop_new())) {
+      perror("notify_loop_new");
+      exit(1);
+    }
+  }
   for (i = 0; i < argc - optind; i++) {
-    if (i >= MAX_HOST)
-	    break;
-
     host[i].ttl  = 16;
     host[i].name = argv[optind+i];
-    if (hpt(host[i].name, (struct sockaddr_in*) &host[i].sin.sin_addr,
-    &host[i].ttl) == -1) {
+    if (hpt(host[i].name, &host[i].sin, &host[i].ttl) == -1) {
       fprintf(stderr, "Invalid host specification %s\n", host[i].name);
       usage(argv[0]);
       exit(1);
@@ -451,6 +629,12 @@ int main(int argc, char *argv[])
   /* Create/bind sockets. */
   for (i = 0; i < hostc; i++) { /* hosts (unicast or multicast) */
     for (j = 0; j < 3; j++) { /* receive ports (RTP, RTCP), send */
+      /* unicast needs no per-host TTL, so all share one send socket */
+      if (j == 2 && ucast_sock >= 0
+          && !IN_CLASSD(ntohl(host[i].sin.sin_addr.s_addr))) {
+        side[i][j].sock = ucast_sock;
+        break;
+      }
       side[i][j].sock = socket(PF_INET, SOCK_DGRAM, 0);
       if (side[i][j].sock < 0) {
         perror("socket");
@@ -503,19 +687,107 @@ again:
       } /* multicast */
       /* unicast */
       else {
+#if WORKERS
+        /* the other workers bind this port too */
+        if (j < 2 && workers > 1 && setsockopt(side[i][j].sock, SOL_SOCKET,
+            SO_REUSEPORT, (char *)&reuse, sizeof(reuse)) == -1) {
+          perror("setsockopt: reuseport");
+          exit(1);
+        }
+#endif
         sin.sin_addr.s_addr = INADDR_ANY;
         if (bind(side[i][j].sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
           perror("bind unicast");
           exit(1);
         }
+        if (j == 2) ucast_sock = side[i][j].sock;
       }
       if (j < 2) {
-        notify_set_input_func((Notify_client)j, socket_handler,
+        count_drops(side[i][j].sock);
+        rx_counters[i*2 + j] = counters_new(counters_name(&host[i].sin, j), 1);
+        notify_set_input_func((Notify_client)(i*2 + j), socket_handler,
           side[i][j].sock);
       }
     } /* for j (protocols) */
   } /* for i (hosts) */
 
+#if WORKERS
+  /* receive sockets of the other workers, unicast only */
+  for (w = 1; w < workers; w++) {
+    for (i = 0; i < hostc; i++) {
+      if (IN_CLASSD(ntohl(host[i].sin.sin_addr.s_addr))) continue;
+      for (j = 0; j < 2; j++) {
+        rx_counters[(w * hostc + i) * 2 + j] =
+          counters_new(counters_name(&host[i].sin, j), 1);
+        notify_set_input_func_ex(worker[w].loop,
+          (Notify_client)((w * hostc + i) * 2 + j), socket_handler,
+          worker_socket(&side[i][j].sin));
+      }
+    }
+  }
+#endif
+
+  /*
+  * Destination legs, unicast hosts first so that their sends on the
+  * shared socket go out in a single batch.  Every worker has its own
+  * copy, with the same leg numbers.
+  */
+  for (w = 0; w < workers; w++) {
+    for (j = 0; j < 2; j++) {
+      if (!(worker[w].fan[j] = fanout_new())) {
+        perror("fanout_new");
+        exit(1);
+      }
+      for (m = 0; m < 2; m++) {
+        for (i = 0; i < hostc; i++) {
+          if ((IN_CLASSD(ntohl(host[i].sin.sin_addr.s_addr)) ? 1 : 0) != m)
+            continue;
+          side[i][j].leg = fanout_add(worker[w].fan[j], side[i][2].sock,
+            &side[i][j].sin);
+          if (side[i][j].leg < 0) {
+            perror("fanout_add");
+            exit(1);
+          }
+          fanout_counters(worker[w].fan[j], side[i][j].leg,
+            counters_new(counters_name(&host[i].sin, j), 0));
+        }
+      }
+    }
+  }
+
+  /* stream tables, idle expiry and SIGUSR1 statistics */
+  for (w = 0; w < workers; w++) {
+    char name[32];
+
+    if (!(worker[w].streams = ssrcmap_new(sizeof(stream)))) {
+      perror("ssrcmap_new");
+      exit(1);
+    }
+    snprintf(name, sizeof(name), "worker %d", w);
+    timer_counters_ex(worker[w].loop, counters_new(name, 0));
+    sweep_handler(w);
+  }
+  if ((metrics || interval > 0) && counters_serve(metrics, interval) < 0) {
+    perror(metrics ? metrics : "counters");
+    exit(1);
+  }
+#ifdef SIGUSR1
+  if (pipe(report_pipe) == 0) {
+    notify_set_input_func((Notify_client)0, report_handler, report_pipe[0]);
+    notify_set_signal_func((Notify_client)0, report_signal, SIGUSR1,
+      NOTIFY_ASYNC);
+  }
+#endif
+
+#if WORKERS
+  for (w = 1; w < workers; w++) {
+    if ((c = pthread_create(&worker[w].thread, 0, worker_main, &worker[w]))) {
+      fprintf(stderr, "%s: pthread_create: %s\n", argv[0], strerror(c));
+      exit(1);
+    }
+  }
+#endif
+
   if ((c = notify_start()) != NOTIFY_OK) {
     fprintf(stderr, "%s: Notifier error %d.\n", argv[0], c);
     perror("select");
@@ -0,0 +1,282 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Open addressing hash table with linear probing, keyed by SSRC.
+* Slots hold the key and a pointer to the entry, so probing does not
+* touch the entries; deletion shifts the following cluster back
+* instead of leaving tombstones.  Entries come from a pool that grows
+* in chunks and recycles removed entries through a free list.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssrcmap.h"
+
+#define ALIGN(x) (((x) + 15) & ~(size_t)15)
+#define CHUNK    64     /* entries allocated at a time */
+#define MINSLOTS 16     /* initial table size, power of 2 */
+
+typedef struct entry {
+  struct entry *next;   /* next free entry */
+  uint32_t ssrc;
+  int used;
+  /* user data follows at ALIGN(sizeof(struct entry)) */
+} entry_t;
+
+typedef struct chunk {
+  struct chunk *next;
+  /* CHUNK entries follow at ALIGN(sizeof(struct chunk)) */
+} chunk_t;
+
+typedef struct {
+  uint32_t ssrc;
+  entry_t *e;           /* NULL if slot is empty */
+} slot_t;
+
+struct ssrcmap {
+  slot_t *slot;
+  unsigned bits;        /* table has 1 << bits slots */
+  unsigned count;       /* entries in use */
+  size_t esize;         /* bytes per pool entry */
+  chunk_t *chunks;      /* pool */
+  entry_t *free;        /* free entries in pool */
+};
+
+#define DATA(e)    ((void *)((char *)(e) + ALIGN(sizeof(entry_t))))
+#define ENTRY(c,i) ((entry_t *)((char *)(c) + ALIGN(sizeof(chunk_t)) + \
+                    (i) * m->esize))
+
+
+/*
+* Return home slot of 'ssrc'.  SSRCs are random, but other keys such as
+* addresses are not, so mix the bits (Fibonacci hashing).
+*/
+static unsigned home(ssrcmap_t *m, uint32_t ssrc)
+{
+  return (uint32_t)(ssrc * 2654435769U) >> (32 - m->bits);
+} /* home */
+
+
+/*
+* Find slot holding 'ssrc' or the empty slot where it would go.
+*/
+static unsigned probe(ssrcmap_t *m, uint32_t ssrc)
+{
+  unsigned mask = (1U << m->bits) - 1;
+  unsigned i = home(m, ssrc);
+
+  while (m->slot[i].e && m->slot[i].ssrc != ssrc) i = (i + 1) & mask;
+  return i;
+} /* probe */
+
+
+/*
+* Double the table.  Returns 0 if ok, -1 if out of memory.
+*/
+static int grow(ssrcmap_t *m)
+{
+  slot_t *old = m->slot;
+  unsigned n = 1U << m->bits;
+  unsigned i;
+
+  m->slot = calloc(2 * n, sizeof(slot_t));
+  if (!m->slot) {
+    m->slot = old;
+    return -1;
+  }
+  m->bits++;
+  for (i = 0; i < n; i++) {
+    if (old[i].e) m->slot[probe(m, old[i].ssrc)] = old[i];
+  }
+  free(old);
+  return 0;
+} /* grow */
+
+
+/*
+* Get an entry from the pool.
+*/
+static entry_t *alloc_entry(ssrcmap_t *m)
+{
+  entry_t *e;
+  chunk_t *c;
+  int i;
+
+  if (!m->free) {
+    if (!(c = malloc(ALIGN(sizeof(chunk_t)) + CHUNK * m->esize))) return 0;
+    c->next = m->chunks;
+    m->chunks = c;
+    for (i = CHUNK - 1; i >= 0; i--) {
+      e = ENTRY(c, i);
+      e->used = 0;
+      e->next = m->free;
+      m->free = e;
+    }
+  }
+  e = m->free;
+  m->free = e->next;
+  return e;
+} /* alloc_entry */
+
+
+/*
+* Create a map with entries of 'size' bytes.
+*/
+ssrcmap_t *ssrcmap_new(size_t size)
+{
+  ssrcmap_t *m = calloc(1, sizeof(ssrcmap_t));
+
+  if (!m) return 0;
+  m->bits = 4;
+  m->esize = ALIGN(sizeof(entry_t)) + ALIGN(size);
+  if (!(m->slot = calloc(MINSLOTS, sizeof(slot_t)))) {
+    free(m);
+    return 0;
+  }
+  return m;
+} /* ssrcmap_new */
+
+
+/*
+* Free map and all its entries.
+*/
+void ssrcmap_free(ssrcmap_t *m)
+{
+  chunk_t *c, *next;
+
+  if (!m) return;
+  for (c = m->chunks; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  free(m->slot);
+  free(m);
+} /* ssrcmap_free */
+
+
+/*
+* Return entry for 'ssrc', or NULL if there is none.
+*/
+void *ssrcmap_find(ssrcmap_t *m, uint32_t ssrc)
+{
+  slot_t *s = &m->slot[probe(m, ssrc)];
+
+  return s->e ? DATA(s->e) : 0;
+} /* ssrcmap_find */
+
+
+/*
+* Return entry for 'ssrc', creating a zeroed one if there is none.
+* Returns NULL if out of memory.
+*/
+void *ssrcmap_insert(ssrcmap_t *m, uint32_t ssrc)
+{
+  slot_t *s = &m->slot[probe(m, ssrc)];
+  entry_t *e;
+
+  if (s->e) return DATA(s->e);
+
+  /* keep load factor at or below 3/4 */
+  if ((m->count + 1) * 4 > (3U << m->bits)) {
+    if (grow(m) < 0) return 0;
+    s = &m->slot[probe(m, ssrc)];
+  }
+  if (!(e = alloc_entry(m))) return 0;
+  e->ssrc = ssrc;
+  e->used = 1;
+  memset(DATA(e), 0, m->esize - ALIGN(sizeof(entry_t)));
+  s->ssrc = ssrc;
+  s->e = e;
+  m->count++;
+  return DATA(e);
+} /* ssrcmap_insert */
+
+
+/*
+* Remove entry for 'ssrc'.  Returns 0 if removed, -1 if not found.
+*/
+int ssrcmap_remove(ssrcmap_t *m, uint32_t ssrc)
+{
+  unsigned mask = (1U << m->bits) - 1;
+  unsigned i = probe(m, ssrc), j, k;
+  entry_t *e = m->slot[i].e;
+
+  if (!e) return -1;
+  e->used = 0;
+  e->next = m->free;
+  m->free = e;
+  m->count--;
+
+  /* shift back entries whose probe sequence passes the hole */
+  for (j = i;;) {
+    j = (j + 1) & mask;
+    if (!m->slot[j].e) break;
+    k = home(m, m->slot[j].ssrc);
+    /* stays if its home lies cyclically in (i, j] */
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+    m->slot[i] = m->slot[j];
+    i = j;
+  }
+  m->slot[i].e = 0;
+  return 0;
+} /* ssrcmap_remove */
+
+
+/*
+* Return number of entries.
+*/
+unsigned ssrcmap_count(ssrcmap_t *m)
+{
+  return m->count;
+} /* ssrcmap_count */
+
+
+/*
+* Call 'func' for each entry; if it returns non-zero, the entry is
+* removed.  'func' must not insert entries.
+*/
+void ssrcmap_foreach(ssrcmap_t *m,
+  int (*func)(uint32_t ssrc, void *entry, void *arg), void *arg)
+{
+  chunk_t *c;
+  entry_t *e;
+  int i;
+
+  /* walk the pool, which removal does not reorder */
+  for (c = m->chunks; c; c = c->next) {
+    for (i = 0; i < CHUNK; i++) {
+      e = ENTRY(c, i);
+      if (e->used && func(e->ssrc, DATA(e), arg))
+        ssrcmap_remove(m, e->ssrc);
+    }
+  }
+} /* ssrcmap_foreach */
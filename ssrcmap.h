@@ -0,0 +1,54 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Map from a 32-bit key (usually an SSRC) to a fixed-size entry.
+* Entries are allocated from a pool, zeroed on insertion, and do not
+* move while they are in the map, so pointers to them stay valid until
+* they are removed.
+*/
+#ifndef SSRCMAP_H
+#define SSRCMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ssrcmap ssrcmap_t;
+
+extern ssrcmap_t *ssrcmap_new(size_t size);
+extern void ssrcmap_free(ssrcmap_t *m);
+extern void *ssrcmap_find(ssrcmap_t *m, uint32_t ssrc);
+extern void *ssrcmap_insert(ssrcmap_t *m, uint32_t ssrc);
+extern int ssrcmap_remove(ssrcmap_t *m, uint32_t ssrc);
+extern unsigned ssrcmap_count(ssrcmap_t *m);
+extern void ssrcmap_foreach(ssrcmap_t *m,
+  int (*func)(uint32_t ssrc, void *entry, void *arg), void *arg);
+
+#endif /* SSRCMAP_H */
@@ -0,0 +1,473 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Per-SSRC stream statistics for rtpdump -F stats.  Each source has a
+* small fixed entry in an SSRC map; only the bytes per second grow
+* with the length of the recording.
+*/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "sysdep.h"
+#include "payload.h"
+#include "rtpparse.h"
+#include "ssrcmap.h"
+#include "stats.h"
+
+extern struct pt payload[];
+
+#define SEQ_WINDOW 64  /* sequence numbers remembered for duplicates */
+#define JITTER_PTS 8   /* payload types followed per source */
+
+/* RFC 3550 interarrival jitter of the packets of one payload type */
+typedef struct {
+  uint8_t pt, used;
+  uint8_t has_transit;
+  uint32_t rate;               /* clock rate of 'pt', 0 if unknown */
+  int32_t transit;             /* arrival - timestamp, clock units */
+  int32_t first_transit;       /* of the first packet, for stats_merge() */
+  double jitter;               /* estimate, clock units */
+  uint64_t updates;            /* of 'jitter' */
+} jitter_t;
+
+typedef struct {
+  uint64_t packets, bytes;
+  uint64_t first_ns, last_ns;  /* arrival of first and last packet */
+  uint32_t base_seq;           /* first sequence number */
+  uint32_t max_seq;            /* highest, extended by the cycles */
+  uint64_t seen;               /* bit i: max_seq - i was received */
+  uint32_t duplicates;
+  uint32_t reordered;          /* arrived after a higher one */
+  uint8_t pt;                  /* of the first packet */
+  /*
+   * [0] for 'pt'.  A part of a recording may start with another
+   * payload type; the others are followed for stats_merge().
+   */
+  jitter_t jitter[JITTER_PTS];
+  uint32_t nseconds;           /* bytes[] in use and allocated */
+  uint32_t maxseconds;
+  uint32_t *bytes_per_second;  /* since the first packet of all */
+} source_t;
+
+struct stats {
+  ssrcmap_t *sources;
+  uint32_t last_ssrc;          /* the source of the last packet ... */
+  source_t *last;              /* ... looked up again most of the time */
+  int started;
+  uint64_t base_ns;            /* first packet of all, or stats_base() */
+  uint64_t rtcp_packets, rtcp_bytes;
+  uint64_t invalid;            /* not RTP version 2 */
+};
+
+
+/*
+* Clock rate of payload type 'pt', 0 if not a static type we know.
+*/
+static uint32_t clock_rate(int pt)
+{
+  int i;
+
+  for (i = 0; payload[i].enc && i < pt; i++);
+  return payload[i].enc ? payload[i].rate : 0;
+} /* clock_rate */
+
+
+stats_t *stats_new(void)
+{
+  stats_t *st = calloc(1, sizeof(*st));
+
+  if (st && !(st->sources = ssrcmap_new(sizeof(source_t)))) {
+    free(st);
+    return NULL;
+  }
+  return st;
+} /* stats_new */
+
+
+static int source_free(uint32_t ssrc, void *entry, void *arg)
+{
+  free(((source_t *)entry)->bytes_per_second);
+  return 0;
+} /* source_free */
+
+
+void stats_free(stats_t *st)
+{
+  if (!st) return;
+  ssrcmap_foreach(st->sources, source_free, NULL);
+  ssrcmap_free(st->sources);
+  free(st);
+} /* stats_free */
+
+
+/*
+* Measure the seconds of the rates from 'base_ns' rather than from the
+* first packet, so that statistics gathered over parts of a recording
+* can be merged.
+*/
+void stats_base(stats_t *st, uint64_t base_ns)
+{
+  st->started = 1;
+  st->base_ns = base_ns;
+} /* stats_base */
+
+
+/*
+* Count 'len' bytes in second 'sec' of source 's'.
+*/
+static void source_bytes(source_t *s, uint32_t sec, int len)
+{
+  if (sec >= s->maxseconds) {
+    uint32_t max = s->maxseconds ? s->maxseconds : 64;
+    uint32_t *b;
+
+    while (max <= sec) max *= 2;
+    if (!(b = realloc(s->bytes_per_second, max * sizeof(*b)))) return;
+    memset(b + s->maxseconds, 0, (max - s->maxseconds) * sizeof(*b));
+    s->bytes_per_second = b;
+    s->maxseconds = max;
+  }
+  s->bytes_per_second[sec] += len;
+  if (sec >= s->nseconds) s->nseconds = sec + 1;
+} /* source_bytes */
+
+
+/*
+* Jitter of payload type 'pt' of source 's', NULL if there are too
+* many types.
+*/
+static jitter_t *source_jitter(source_t *s, int pt)
+{
+  jitter_t *j;
+
+  for (j = s->jitter; j < s->jitter + JITTER_PTS; j++) {
+    if (j->used && j->pt == pt) return j;
+    if (!j->used) {
+      j->used = 1;
+      j->pt = pt;
+      j->rate = clock_rate(pt);
+      return j;
+    }
+  }
+  return NULL;
+} /* source_jitter */
+
+
+/*
+* Sequence number 'seq' of source 's': count duplicates and packets
+* that arrived late.  Return 0 for a duplicate.
+*/
+static int source_seq(source_t *s, uint16_t seq)
+{
+  uint16_t delta = seq - (uint16_t)s->max_seq;
+
+  if (s->packets == 1) {
+    s->base_seq = s->max_seq = seq;
+    s->seen = 1;
+    return 1;
+  }
+  if (delta == 0) {
+    s->duplicates++;
+    return 0;
+  }
+  if (delta < 0x8000) {
+    /* ahead; a smaller number means it wrapped into the next cycle */
+    s->seen = delta < SEQ_WINDOW ? (s->seen << delta) | 1 : 1;
+    s->max_seq += delta;
+    return 1;
+  }
+  delta = (uint16_t)s->max_seq - seq;  /* behind by this many */
+  if (delta < SEQ_WINDOW) {
+    if (s->seen & ((uint64_t)1 << delta)) {
+      s->duplicates++;
+      return 0;
+    }
+    s->seen |= (uint64_t)1 << delta;
+  }
+  s->reordered++;
+  return 1;
+} /* source_seq */
+
+
+/*
+* Account for RTP data packet 'data' of 'len' bytes that arrived at
+* 'time_ns'.
+*/
+void stats_rtp(stats_t *st, uint64_t time_ns, const void *data, int len)
+{
+  rtp_info_t r;
+  source_t *s;
+  jitter_t *j;
+
+  if (rtp_parse(data, len, &r) != RTPP_OK || r.version != 2) {
+    st->invalid++;
+    return;
+  }
+  if (!st->started) {
+    st->started = 1;
+    st->base_ns = time_ns;
+  }
+  if (time_ns < st->base_ns) time_ns = st->base_ns;
+
+  if (st->last && st->last_ssrc == r.ssrc) s = st->last;
+  else if (!(s = ssrcmap_find(st->sources, r.ssrc))) {
+    if (!(s = ssrcmap_insert(st->sources, r.ssrc))) return;
+    s->first_ns = time_ns;
+    s->pt = r.pt;
+  }
+  st->last = s;
+  st->last_ssrc = r.ssrc;
+
+  s->packets++;
+  s->bytes += len;
+  s->last_ns = time_ns;
+  source_bytes(s, (uint32_t)((time_ns - st->base_ns) / 1000000000), len);
+  if (!source_seq(s, r.seq)) return;
+
+  /* interarrival jitter, RFC 3550 6.4.1 and A.8 */
+  if ((j = source_jitter(s, r.pt)) && j->rate) {
+    uint32_t arrival = time_ns / 1000000000 * j->rate +
+      time_ns % 1000000000 * j->rate / 1000000000;
+    int32_t transit = arrival - r.ts;
+
+    if (j->has_transit) {
+      int32_t d = transit - j->transit;
+
+      if (d < 0) d = -d;
+      j->jitter += (d - j->jitter) / 16;
+      j->updates++;
+    }
+    else j->first_transit = transit;
+    j->transit = transit;
+    j->has_transit = 1;
+  }
+} /* stats_rtp */
+
+
+void stats_rtcp(stats_t *st, int len)
+{
+  st->rtcp_packets++;
+  st->rtcp_bytes += len;
+} /* stats_rtcp */
+
+
+/*
+* (15/16)^n, what is left of a jitter estimate after n more updates.
+*/
+static double decay(uint64_t n)
+{
+  double f = 15 / 16.0, r = 1;
+
+  for (; n; n >>= 1, f *= f) {
+    if (n & 1) r *= f;
+  }
+  return r;
+} /* decay */
+
+
+/*
+* Continue jitter estimate 'a' with 'b', which started from nothing
+* at the next packet.  The estimate is linear in its start value, so
+* this gives the same as one estimate over both.
+*/
+static void jitter_merge(jitter_t *a, const jitter_t *b)
+{
+  int32_t d;
+
+  if (!b->has_transit) return;
+  if (!a->has_transit) {
+    *a = *b;
+    return;
+  }
+  d = b->first_transit - a->transit;
+  if (d < 0) d = -d;
+  a->jitter += (d - a->jitter) / 16;
+  a->jitter = a->jitter * decay(b->updates) + b->jitter;
+  a->updates += b->updates + 1;
+  a->transit = b->transit;
+} /* jitter_merge */
+
+
+/*
+* Append source 'b', seen after source 'a' in the recording, to 'a'.
+* Packets around the boundary are only checked against the last
+* sequence numbers of 'a'.
+*/
+static void source_merge(source_t *a, source_t *b)
+{
+  int16_t d = (uint16_t)b->base_seq - (uint16_t)a->max_seq;
+  uint32_t span = b->max_seq - b->base_seq;
+  uint32_t k;
+  int i;
+
+  a->packets += b->packets;
+  a->bytes   += b->bytes;
+  a->last_ns  = b->last_ns;
+  a->duplicates += b->duplicates;
+  a->reordered  += b->reordered;
+  if (d > 0) {
+    a->max_seq += d + span;
+    a->seen = b->seen;
+  }
+  else {
+    if (d == 0 || (-d < SEQ_WINDOW && (a->seen & ((uint64_t)1 << -d))))
+      a->duplicates++;
+    else a->reordered++;
+    if (d + (int32_t)span > 0) {
+      a->max_seq += d + span;
+      a->seen = b->seen;
+    }
+  }
+
+  /* only the jitter of the first payload type is shown */
+  for (i = 0; i < JITTER_PTS && b->jitter[i].used; i++) {
+    if (b->jitter[i].pt == a->pt) jitter_merge(&a->jitter[0], &b->jitter[i]);
+  }
+
+  for (k = 0; k < b->nseconds; k++) {
+    if (b->bytes_per_second[k]) source_bytes(a, k, b->bytes_per_second[k]);
+  }
+} /* source_merge */
+
+
+static int merge(uint32_t ssrc, void *entry, void *arg)
+{
+  stats_t *st = arg;
+  source_t *a, *b = entry;
+
+  if ((a = ssrcmap_find(st->sources, ssrc))) source_merge(a, b);
+  else if ((a = ssrcmap_insert(st->sources, ssrc))) {
+    *a = *b;
+    b->bytes_per_second = NULL;
+  }
+  return 0;
+} /* merge */
+
+
+/*
+* Add statistics 'from', gathered over the part of the recording that
+* follows that of 'st', to 'st'.  Both must have the same stats_base().
+* 'from' is left to be freed.
+*/
+void stats_merge(stats_t *st, stats_t *from)
+{
+  if (!st->started) {
+    st->started = from->started;
+    st->base_ns = from->base_ns;
+  }
+  ssrcmap_foreach(from->sources, merge, st);
+  st->rtcp_packets += from->rtcp_packets;
+  st->rtcp_bytes   += from->rtcp_bytes;
+  st->invalid      += from->invalid;
+} /* stats_merge */
+
+
+typedef struct {
+  uint32_t ssrc;
+  source_t *s;
+} sorted_t;
+
+static int collect(uint32_t ssrc, void *entry, void *arg)
+{
+  sorted_t **p = arg;
+
+  (*p)->ssrc = ssrc;
+  (*p)->s = entry;
+  (*p)++;
+  return 0;
+} /* collect */
+
+static int by_ssrc(const void *a, const void *b)
+{
+  uint32_t x = ((const sorted_t *)a)->ssrc, y = ((const sorted_t *)b)->ssrc;
+
+  return x < y ? -1 : x > y;
+} /* by_ssrc */
+
+
+/*
+* Write the statistics to 'out', one line of parameter=value pairs per
+* source, then its bit rate of each second, then the RTCP totals.
+*/
+void stats_write(stats_t *st, FILE *out)
+{
+  unsigned n = ssrcmap_count(st->sources);
+  sorted_t *all = malloc((n ? n : 1) * sizeof(*all)), *p = all;
+  unsigned i;
+  uint32_t k;
+
+  if (!all) {
+    perror("malloc");
+    return;
+  }
+  ssrcmap_foreach(st->sources, collect, &p);
+  qsort(all, n, sizeof(*all), by_ssrc);
+
+  for (i = 0; i < n; i++) {
+    source_t *s = all[i].s;
+    uint64_t expected = s->max_seq - s->base_seq + 1;
+    uint64_t received = s->packets - s->duplicates;
+    const jitter_t *j = &s->jitter[0];
+    double duration = (s->last_ns - s->first_ns) / 1e9;
+
+    fprintf(out, "stream ssrc=0x%08lx pt=%u packets=%llu bytes=%llu "
+      "start=%.6f duration=%.6f expected=%llu lost=%lld duplicates=%lu "
+      "reordered=%lu", (unsigned long)all[i].ssrc, s->pt,
+      (unsigned long long)s->packets, (unsigned long long)s->bytes,
+      (s->first_ns - st->base_ns) / 1e9, duration,
+      (unsigned long long)expected, (long long)(expected - received),
+      (unsigned long)s->duplicates, (unsigned long)s->reordered);
+    if (j->rate) {
+      fprintf(out, " jitter=%.0f jitter_ms=%.3f", j->jitter,
+        j->jitter * 1000 / j->rate);
+    }
+    fprintf(out, " kbps=%.3f\n",
+      duration > 0 ? s->bytes * 8 / duration / 1000 : 0);
+  }
+  for (i = 0; i < n; i++) {
+    source_t *s = all[i].s;
+
+    for (k = (s->first_ns - st->base_ns) / 1000000000; k < s->nseconds; k++) {
+      fprintf(out, "rate ssrc=0x%08lx second=%lu bytes=%lu kbps=%.3f\n",
+        (unsigned long)all[i].ssrc, (unsigned long)k,
+        (unsigned long)s->bytes_per_second[k],
+        s->bytes_per_second[k] * 8 / 1000.0);
+    }
+  }
+  fprintf(out, "rtcp packets=%llu bytes=%llu\n",
+    (unsigned long long)st->rtcp_packets, (unsigned long long)st->rtcp_bytes);
+  if (st->invalid)
+    fprintf(out, "invalid packets=%llu\n", (unsigned long long)st->invalid);
+  free(all);
+} /* stats_write */
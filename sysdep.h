@@ -38,6 +38,8 @@
 
 #if defined(WIN32) || defined(__WIN32__)
 
+#define HAVE_CLOCK_GETTIME	0
+#define HAVE_CLOCK_NANOSLEEP	0
 #define HAVE_ERR		0
 #define HAVE_GETOPT		0
 #define HAVE_GETTIMEOFDAY	0
@@ -47,6 +49,18 @@
 #define HAVE_LSOCKET		0
 #define HAVE_BIGENDIAN		0
 #define HAVE_MSGCONTROL		0
+#define HAVE_RECVMMSG		0
+#define HAVE_SENDMMSG		0
+#define HAVE_UDP_SEGMENT	0
+#define HAVE_TIMESTAMPNS	0
+#define HAVE_TIMESTAMPING	0
+#define HAVE_MMAP		0
+#define HAVE_TPACKET		0
+#define HAVE_EPOLL		0
+#define HAVE_KQUEUE		0
+#define HAVE_PTHREAD		0
+#define HAVE_ZLIB		0
+#define HAVE_ZSTD		0
 #define RTP_BIG_ENDIAN		0
 
 #include <winsock2.h>
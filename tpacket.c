@@ -0,0 +1,303 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Packet ring capture.  The socket is an AF_PACKET datagram socket, so
+* frames start at the IP header whatever the link type.  A classic BPF
+* program passes unfragmented UDP packets to the capture destinations
+* only; everything else stays in the kernel.  The ring is a
+* TPACKET_V3 ring of variable-size frames in large blocks, which the
+* kernel hands over when full or after a short timeout, so quiet
+* sessions are not held back.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#if HAVE_TPACKET
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+
+#include "rtpdump.h"
+#include "tpacket.h"
+
+#define TPACKET_TIMEOUT 10    /* ms until a partly filled block is handed over */
+#define TPACKET_SNAP    0xffff
+
+struct tpacket {
+  int fd;
+  char *ring;
+  size_t size;
+  int blocks;
+  int cur;                    /* block being read */
+  char *pkt;                  /* next frame in it, NULL if not taken yet */
+  uint32_t left;              /* frames left in it */
+  tpacket_dest_t *dest;
+  int ndest;
+  uint64_t drops;
+};
+
+
+/*
+* BPF program that accepts UDP to the 'n' destinations 'd'.  Each
+* destination has its own accepting return, so that all jumps stay
+* short however many destinations there are.
+*/
+static struct sock_filter *filter(const tpacket_dest_t *d, int n, int *len)
+{
+  struct sock_filter *f = malloc((8 + 6 * n) * sizeof(*f)), *p = f;
+  int i;
+
+  if (!f) return NULL;
+  /* unfragmented UDP, X = IP header length */
+  *p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9);
+  *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+  *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+  *p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6);
+  *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 0, 1);
+  *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+  *p++ = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+
+  for (i = 0; i < n; i++) {
+    if (d[i].addr) {
+      *p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16);
+      *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+        ntohl(d[i].addr), 0, 4);
+    }
+    *p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2);
+    *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+      ntohs(d[i].port), 1, 0);
+    *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+      ntohs(d[i].port) + 1, 0, 1);
+    *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, TPACKET_SNAP);
+  }
+  *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+  *len = p - f;
+  return f;
+} /* filter */
+
+
+/*
+* Open a ring of 'blocks' blocks (0 for the default) capturing UDP to
+* the 'n' destinations 'd' on interface 'ifname', or on all interfaces
+* for "any".  Returns NULL with errno set on failure.
+*/
+tpacket_t *tpacket_open(const char *ifname, const tpacket_dest_t *d,
+  int n, int blocks)
+{
+  tpacket_t *t = calloc(1, sizeof(tpacket_t));
+  struct tpacket_req3 req;
+  struct sock_fprog prog;
+  struct sockaddr_ll ll;
+  int v, len, ts = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+  if (!t) return NULL;
+  t->fd = -1;
+  if (blocks <= 0) blocks = TPACKET_BLOCKS;
+  if (!(t->dest = malloc(n * sizeof(*d)))) goto fail;
+  memcpy(t->dest, d, n * sizeof(*d));
+  t->ndest = n;
+
+  /* protocol 0 receives nothing until bound, after the filter is set */
+  if ((t->fd = socket(AF_PACKET, SOCK_DGRAM, 0)) < 0) goto fail;
+  if (!(prog.filter = filter(d, n, &len))) goto fail;
+  prog.len = len;
+  v = setsockopt(t->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+  free(prog.filter);
+  if (v < 0) goto fail;
+
+  v = TPACKET_V3;
+  if (setsockopt(t->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0)
+    goto fail;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = TPACKET_BLOCK;
+  req.tp_block_nr   = blocks;
+  req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+  req.tp_frame_nr   = req.tp_block_size / req.tp_frame_size * blocks;
+  req.tp_retire_blk_tov = TPACKET_TIMEOUT;
+  if (setsockopt(t->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    goto fail;
+  t->blocks = blocks;
+  t->size = (size_t)TPACKET_BLOCK * blocks;
+  t->ring = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+  if (t->ring == MAP_FAILED) {
+    t->ring = NULL;
+    goto fail;
+  }
+
+  /* hardware receive times where the interface has them */
+  setsockopt(t->fd, SOL_PACKET, PACKET_TIMESTAMP, &ts, sizeof(ts));
+#ifdef PACKET_IGNORE_OUTGOING
+  v = 1;
+  setsockopt(t->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &v, sizeof(v));
+#endif
+
+  memset(&ll, 0, sizeof(ll));
+  ll.sll_family   = AF_PACKET;
+  ll.sll_protocol = htons(ETH_P_IP);
+  if (strcmp(ifname, "any") != 0 &&
+      (ll.sll_ifindex = if_nametoindex(ifname)) == 0)
+    goto fail;
+  if (bind(t->fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) goto fail;
+  return t;
+
+fail:
+  v = errno;
+  tpacket_close(t);
+  errno = v;
+  return NULL;
+} /* tpacket_open */
+
+
+/*
+* Descriptor that becomes readable when a block is ready.
+*/
+int tpacket_fd(tpacket_t *t)
+{
+  return t->fd;
+} /* tpacket_fd */
+
+
+/*
+* Return the next captured packet in 'f'.  Returns 1 if there is one,
+* 0 if no more are ready.  Blocks go back to the kernel once all
+* their packets have been taken.
+*/
+int tpacket_next(tpacket_t *t, tpacket_frame_t *f)
+{
+  struct tpacket_block_desc *bd;
+  struct tpacket3_hdr *h;
+  struct sockaddr_ll *ll;
+  unsigned char *ip, *udp;
+  unsigned ihl, caplen, ulen;
+  uint32_t daddr;
+  uint16_t dport;
+  int i;
+
+  for (;;) {
+    bd = (struct tpacket_block_desc *)(t->ring + (size_t)t->cur * TPACKET_BLOCK);
+    if (!t->pkt) {
+      if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+            TP_STATUS_USER))
+        return 0;
+      t->pkt  = (char *)bd + bd->hdr.bh1.offset_to_first_pkt;
+      t->left = bd->hdr.bh1.num_pkts;
+    }
+    if (t->left == 0) {
+      __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+        __ATOMIC_RELEASE);
+      t->cur = (t->cur + 1) % t->blocks;
+      t->pkt = NULL;
+      continue;
+    }
+    h = (struct tpacket3_hdr *)t->pkt;
+    t->pkt += h->tp_next_offset;
+    t->left--;
+
+    ll = (struct sockaddr_ll *)((char *)h +
+      TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (ll->sll_pkttype == PACKET_OUTGOING) continue;
+
+    /* IP and UDP headers, as far as captured */
+    ip = (unsigned char *)h + h->tp_net;
+    caplen = h->tp_snaplen;
+    if (caplen < 20 || (ihl = (ip[0] & 0x0f) * 4) < 20 || caplen < ihl + 8)
+      continue;
+    udp = ip + ihl;
+    memcpy(&daddr, ip + 16, 4);
+    memcpy(&dport, udp + 2, 2);
+    for (i = 0; i < t->ndest; i++) {
+      if (t->dest[i].addr && t->dest[i].addr != daddr) continue;
+      if (dport == t->dest[i].port) {
+        f->ctrl = 0;
+        break;
+      }
+      if (ntohs(dport) == ntohs(t->dest[i].port) + 1) {
+        f->ctrl = 1;
+        break;
+      }
+    }
+    if (i == t->ndest) continue;
+
+    ulen = (udp[4] << 8 | udp[5]);
+    if (ulen < 8) continue;
+    ulen -= 8;
+    f->data = (char *)udp + 8;
+    f->len  = ulen < caplen - ihl - 8 ? ulen : caplen - ihl - 8;
+    f->dest = i;
+    memcpy(&f->saddr, ip + 12, 4);
+    memcpy(&f->sport, udp, 2);
+    f->ts.tv_sec  = h->tp_sec;
+    f->ts.tv_nsec = h->tp_nsec;
+    f->flags = (h->tp_status & TP_STATUS_TS_RAW_HARDWARE) ? RD_F_HWTIME : 0;
+    return 1;
+  }
+} /* tpacket_next */
+
+
+/*
+* Packets the kernel dropped because the ring was full, so far.
+*/
+uint64_t tpacket_drops(tpacket_t *t)
+{
+  struct tpacket_stats_v3 st;
+  socklen_t len = sizeof(st);
+
+  /* the kernel resets its counters on every read */
+  if (getsockopt(t->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+    t->drops += st.tp_drops;
+  return t->drops;
+} /* tpacket_drops */
+
+
+void tpacket_close(tpacket_t *t)
+{
+  if (!t) return;
+  if (t->ring) munmap(t->ring, t->size);
+  if (t->fd >= 0) close(t->fd);
+  free(t->dest);
+  free(t);
+} /* tpacket_close */
+
+#endif /* HAVE_TPACKET */
@@ -0,0 +1,74 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Capture from a TPACKET_V3 packet ring (Linux).  The kernel filters
+* UDP packets to the capture addresses with a BPF program and
+* fills blocks of a ring shared with the process, which takes all
+* packets of a block without a system call per packet.
+*/
+#ifndef TPACKET_H
+#define TPACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TPACKET_BLOCK  (1024 * 1024)  /* ring block size */
+#define TPACKET_BLOCKS 64             /* default blocks in ring */
+
+typedef struct tpacket tpacket_t;
+
+/* destination to capture: RTP at 'port', RTCP at 'port' + 1 */
+typedef struct {
+  uint32_t addr;       /* network order, 0 for any */
+  uint16_t port;       /* network order */
+} tpacket_dest_t;
+
+/* a captured UDP packet */
+typedef struct {
+  char *data;          /* UDP payload, valid until the next call */
+  int len;
+  int dest;            /* index of the matching tpacket_dest_t */
+  int ctrl;            /* sent to 'port' + 1 */
+  uint32_t saddr;      /* sender, network order */
+  uint16_t sport;
+  uint32_t flags;      /* RD_F_HWTIME for a hardware timestamp */
+  struct timespec ts;  /* receive time */
+} tpacket_frame_t;
+
+extern tpacket_t *tpacket_open(const char *ifname, const tpacket_dest_t *d,
+  int n, int blocks);
+extern int tpacket_fd(tpacket_t *t);
+extern int tpacket_next(tpacket_t *t, tpacket_frame_t *f);
+extern uint64_t tpacket_drops(tpacket_t *t);
+extern void tpacket_close(tpacket_t *t);
+
+#endif /* TPACKET_H */
@@ -0,0 +1,175 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Trace ring, see trace.h.  Threads claim records with one relaxed
+* atomic increment and fill them in without locking; a dump taken
+* while others trace may catch a record half written, which the
+* decoder shrugs off as one odd sample.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "trace.h"
+
+trace_record_t *trace_ring;     /* NULL while not tracing */
+static const char *trace_file;
+static uint64_t trace_next;     /* index of the next record */
+
+#if HAVE_PTHREAD
+static uint16_t threads;
+static __thread int thread_id;  /* 1 + the thread's number, 0 if none yet */
+#define NEXT()  __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED)
+#define TOTAL() __atomic_load_n(&trace_next, __ATOMIC_RELAXED)
+#else
+#define NEXT()  (trace_next++)
+#define TOTAL() trace_next
+#endif
+
+
+/*
+* Record 'event' with argument 'arg' at the current time.
+*/
+void trace_add(int event, uint32_t arg)
+{
+#if HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  trace_record_t *r;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  r = &trace_ring[NEXT() & (TRACE_RECORDS - 1)];
+  r->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  r->arg = arg;
+  r->event = event;
+#if HAVE_PTHREAD
+  if (thread_id == 0)
+    thread_id = 1 + __atomic_fetch_add(&threads, 1, __ATOMIC_RELAXED);
+  r->thread = thread_id - 1;
+#else
+  r->thread = 0;
+#endif
+#endif
+} /* trace_add */
+
+
+/*
+* Write the ring to the trace file, oldest record first.  Only calls
+* write(), so that it can be used from a signal handler.
+*/
+void trace_dump(void)
+{
+#ifndef WIN32
+  trace_header_t h;
+  uint64_t total = TOTAL();
+  uint64_t first;
+  size_t len;
+  int fd;
+
+  if (!trace_ring) return;
+  if ((fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.version = TRACE_VERSION;
+  h.size = sizeof(trace_record_t);
+  h.total = total;
+  h.count = total < TRACE_RECORDS ? total : TRACE_RECORDS;
+  first = (total - h.count) & (TRACE_RECORDS - 1);
+  /* the oldest records up to the end of the ring, then from its start */
+  len = (h.count < TRACE_RECORDS - first ? h.count : TRACE_RECORDS - first) *
+    sizeof(trace_record_t);
+  if (write(fd, &h, sizeof(h)) < 0 ||
+      write(fd, &trace_ring[first], len) < 0 ||
+      write(fd, trace_ring, h.count * sizeof(trace_record_t) - len) < 0)
+    (void) write(2, "trace: write failed\n", 20);
+  close(fd);
+#endif
+} /* trace_dump */
+
+
+#if !defined(WIN32) && HAVE_CLOCK_GETTIME
+static void dump_signal(int sig)
+{
+  trace_dump();
+} /* dump_signal */
+
+
+/*
+* Terminated by signal 'sig' that the program does not catch: dump the
+* trace, then terminate as it would have.
+*/
+static void fatal_signal(int sig)
+{
+  trace_dump();
+  signal(sig, SIG_DFL);
+  raise(sig);
+} /* fatal_signal */
+#endif
+
+
+/*
+* Start tracing into the file named by RTPTRACE, if set.  Call it
+* first thing in main(): signals that the program does not catch
+* itself later dump the trace before terminating it.
+*/
+void trace_init(void)
+{
+#if !defined(WIN32) && HAVE_CLOCK_GETTIME
+  static const int sigs[] = {SIGINT, SIGTERM, SIGHUP};
+  const char *file = getenv("RTPTRACE");
+  unsigned i;
+
+  if (!file || !*file || trace_ring) return;
+  if (!(trace_ring = calloc(TRACE_RECORDS, sizeof(trace_record_t)))) {
+    perror("trace");
+    return;
+  }
+  trace_file = file;
+  atexit(trace_dump);
+  signal(SIGUSR2, dump_signal);
+  for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+    void (*old)(int) = signal(sigs[i], fatal_signal);
+
+    if (old != SIG_DFL) signal(sigs[i], old);  /* e.g. ignored, nohup */
+  }
+#endif
+} /* trace_init */
@@ -0,0 +1,85 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Trace of the tools' own timing: with RTPTRACE set to a file name,
+* each trace point appends its event and the CLOCK_MONOTONIC time to
+* a ring in memory, which is written to the file at exit and on
+* SIGUSR2, and read by rtptrace(1).  Without RTPTRACE, a trace point
+* costs a test of a global pointer.  Include sysdep.h first.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+enum {
+  TRACE_WAKEUP,         /* select() returned */
+  TRACE_RECV,           /* receive returned, arg packets */
+  TRACE_HANDLER,        /* packet handler entered, arg bytes */
+  TRACE_HANDLED,        /* ... returned */
+  TRACE_WRITE,          /* write to a file started, arg bytes */
+  TRACE_WRITTEN,        /* ... completed */
+  TRACE_TIMER,          /* timer handler dispatched, arg lateness usec */
+  TRACE_TIMED,          /* ... returned */
+  TRACE_SEND,           /* send returned, arg packets */
+  TRACE_EVENTS
+};
+
+#define TRACE_RECORDS (1 << 20)  /* in the ring, a power of two */
+#define TRACE_MAGIC   "RTPTRACE"
+#define TRACE_VERSION 1
+
+typedef struct {
+  uint64_t ns;          /* CLOCK_MONOTONIC */
+  uint32_t arg;
+  uint16_t event;
+  uint16_t thread;      /* in the order threads first traced */
+} trace_record_t;
+
+/* trace file: header, then the records, oldest first, host byte order */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;        /* of a record */
+  uint64_t total;       /* records traced, more than written if it wrapped */
+  uint64_t count;       /* records that follow */
+} trace_header_t;
+
+extern trace_record_t *trace_ring;
+extern void trace_init(void);
+extern void trace_add(int event, uint32_t arg);
+extern void trace_dump(void);
+
+#define TRACE(event, arg) do { \
+    if (trace_ring) trace_add(event, arg); \
+  } while (0)
+
+#endif /* TRACE_H */
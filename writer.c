@@ -0,0 +1,660 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Shared asynchronous writer.  Each file has a ring buffer indexed by
+* file offset: the caller appends records at 'wpos' and hands the
+* ring over up to 'qpos' whenever a chunk fills up or on a flush; the
+* writer thread writes from 'rpos' up to there.  Files with data
+* handed over wait in a queue.  When the ring is full, the caller
+* either waits for the writer or drops the record.
+*
+* Since a byte's place in the ring follows from its file offset,
+* writes that start on an aligned offset also start on an aligned
+* address.  With WRITER_DIRECT, aligned runs are written with
+* O_DIRECT; the unaligned head and tail of the file are not.  A file
+* can be retired rather than closed, so the caller need not wait for
+* it to be written.  Without threads, handed over data is written
+* right away.
+*
+* A file can also have an encoder, e.g., for compression.  The caller
+* then appends whole frames, each stored behind its length, and the
+* writer thread passes each frame through the encoder on its way out.
+*/
+
+#include "sysdep.h"  /* first, for _GNU_SOURCE */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "writer.h"
+#include "trace.h"
+
+struct writer_file {
+  writer_t *w;
+  int fd;
+  char *mem;                  /* allocation holding the ring */
+  char *ring;                 /* aligned ring of 'size' bytes */
+  size_t size;
+  int flags;                  /* WRITER_DROP, WRITER_DIRECT */
+  int direct;                 /* O_DIRECT is currently set on 'fd' */
+  uint64_t base;              /* file offset at writer_open() */
+  uint64_t wpos;              /* end of data appended by the caller */
+  uint64_t qpos;              /* end of data handed to the writer */
+  uint64_t rpos;              /* end of data written */
+  uint64_t rseen;             /* 'rpos' as last seen by the caller */
+  int final;                  /* closing: write the unaligned tail too */
+  int queued;                 /* in the writer's queue */
+  void (*done)(void *);       /* retired: call when written, then free */
+  void *arg;
+  writer_encode_t encode;     /* frame encoder, or 0 */
+  void *ctx;
+  char *tmp;                  /* frame that wraps around the ring */
+  size_t tmpsize;
+  writer_file_t *next;
+  writer_stats_t st;
+};
+
+struct writer {
+#if HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t work;        /* queue not empty, or stop */
+  pthread_cond_t done;        /* data was written */
+  pthread_t thread;
+#endif
+  writer_file_t *head, *tail; /* files with data handed over */
+  int stop;
+};
+
+
+/*
+* Write all of 'len' bytes of 'buf' to 'fd', exiting on error.
+*/
+static void write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  TRACE(TRACE_WRITE, len);
+  while (len > 0) {
+    if ((n = write(fd, buf, len)) < 0) {
+      if (errno == EINTR) continue;
+      perror("write");
+      exit(1);
+    }
+    buf += n;
+    len -= n;
+  }
+  TRACE(TRACE_WRITTEN, 0);
+} /* write_all */
+
+
+/*
+* Turn O_DIRECT on or off for 'f'.  Return -1 if that fails.
+*/
+static int set_direct(writer_file_t *f, int on)
+{
+#ifdef O_DIRECT
+  int fl;
+
+  if (f->direct == on) return 0;
+  if ((fl = fcntl(f->fd, F_GETFL)) < 0 ||
+      fcntl(f->fd, F_SETFL, on ? fl | O_DIRECT : fl & ~O_DIRECT) < 0)
+    return -1;
+  f->direct = on;
+  return 0;
+#else
+  return on ? -1 : 0;
+#endif
+} /* set_direct */
+
+
+/*
+* End of the data the writer may write now.  With O_DIRECT, the
+* unaligned tail is held back until the file is closed.
+*/
+static uint64_t write_end(writer_file_t *f)
+{
+  if ((f->flags & WRITER_DIRECT) && !f->final)
+    return f->qpos - f->qpos % WRITER_ALIGN;
+  return f->qpos;
+} /* write_end */
+
+
+/*
+* Copy 'n' bytes at file offset 'from' out of the ring of 'f'.
+*/
+static void ring_copy(writer_file_t *f, uint64_t from, char *buf, size_t n)
+{
+  size_t i = from % f->size, k = n;
+
+  if (k > f->size - i) k = f->size - i;
+  memcpy(buf, f->ring + i, k);
+  memcpy(buf + k, f->ring, n - k);
+} /* ring_copy */
+
+
+/*
+* Pass the frames of 'f' from 'from' up to 'to' through the encoder
+* and write the result.  Exits if out of memory.
+*/
+static void encode_out(writer_file_t *f, uint64_t from, uint64_t to)
+{
+  const char *p, *out;
+  uint32_t n;
+  size_t len;
+
+  while (from + sizeof(n) <= to) {
+    ring_copy(f, from, (char *)&n, sizeof(n));
+    from += sizeof(n);
+    if (from % f->size + n <= f->size) {
+      p = f->ring + from % f->size;
+    }
+    else {
+      if (n > f->tmpsize) {
+        free(f->tmp);
+        if (!(f->tmp = malloc(n))) {
+          perror("writer");
+          exit(1);
+        }
+        f->tmpsize = n;
+      }
+      ring_copy(f, from, f->tmp, n);
+      p = f->tmp;
+    }
+    len = f->encode(f->ctx, p, n, &out);
+    write_all(f->fd, out, len);
+    from += n;
+  }
+} /* encode_out */
+
+
+/*
+* Write the data of 'f' from 'from' up to 'to'.  Aligned runs go out
+* with O_DIRECT if requested, the rest through the page cache.
+*/
+static void write_out(writer_file_t *f, uint64_t from, uint64_t to)
+{
+  size_t i, n;
+
+  if (f->encode) {
+    encode_out(f, from, to);
+    return;
+  }
+  while (from < to) {
+    i = from % f->size;
+    n = to - from;
+    if (n > f->size - i) n = f->size - i;
+    if (f->flags & WRITER_DIRECT) {
+      if (from % WRITER_ALIGN) {
+        if (n > WRITER_ALIGN - from % WRITER_ALIGN)
+          n = WRITER_ALIGN - from % WRITER_ALIGN;
+        set_direct(f, 0);
+      }
+      else if (n >= WRITER_ALIGN) {
+        n -= n % WRITER_ALIGN;
+        set_direct(f, 1);
+      }
+      else {
+        set_direct(f, 0);
+      }
+    }
+    write_all(f->fd, f->ring + i, n);
+    from += n;
+  }
+} /* write_out */
+
+
+#if HAVE_PTHREAD
+/*
+* Writer thread: write handed over data until stopped and drained.
+* A file gets one turn per visit and goes to the back of the queue
+* if more was handed over meanwhile.
+*/
+static void *writer_main(void *arg)
+{
+  writer_t *w = arg;
+  writer_file_t *f;
+  uint64_t from, to;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->head && !w->stop) pthread_cond_wait(&w->work, &w->lock);
+    if (!(f = w->head)) break;
+    if (!(w->head = f->next)) w->tail = 0;
+    f->queued = 0;
+    from = f->rpos;
+    to = write_end(f);
+    pthread_mutex_unlock(&w->lock);
+
+    if (to > from) write_out(f, from, to);
+
+    pthread_mutex_lock(&w->lock);
+    if (to > from) f->rpos = to;
+    if (write_end(f) > f->rpos && !f->queued) {
+      f->queued = 1;
+      f->next = 0;
+      if (w->tail) w->tail->next = f;
+      else w->head = f;
+      w->tail = f;
+    }
+    else if (f->done && f->rpos == f->wpos) {
+      /* retired and written: nobody else refers to it any more */
+      pthread_mutex_unlock(&w->lock);
+      set_direct(f, 0);
+      f->done(f->arg);
+      free(f->tmp);
+      free(f->mem);
+      free(f);
+      pthread_mutex_lock(&w->lock);
+    }
+    pthread_cond_broadcast(&w->done);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+} /* writer_main */
+#endif
+
+
+/*
+* Create a writer and start its thread.  Return 0 on failure.
+*/
+writer_t *writer_new(void)
+{
+  writer_t *w = calloc(1, sizeof(writer_t));
+
+  if (!w) return 0;
+#if HAVE_PTHREAD
+  pthread_mutex_init(&w->lock, 0);
+  pthread_cond_init(&w->work, 0);
+  pthread_cond_init(&w->done, 0);
+  if ((errno = pthread_create(&w->thread, 0, writer_main, w))) {
+    free(w);
+    return 0;
+  }
+#endif
+  return w;
+} /* writer_new */
+
+
+/*
+* Write everything queued and stop the writer.  Files must have been
+* closed with writer_close() first.
+*/
+void writer_free(writer_t *w)
+{
+  if (!w) return;
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_signal(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, 0);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->work);
+  pthread_cond_destroy(&w->done);
+#endif
+  free(w);
+} /* writer_free */
+
+
+/*
+* Start buffered output to 'fd', which stays owned by the caller, with
+* a ring of about 'size' bytes (0 for the default).  Return 0 if out
+* of memory.
+*/
+writer_file_t *writer_open(writer_t *w, int fd, size_t size, int flags)
+{
+  writer_file_t *f = calloc(1, sizeof(writer_file_t));
+  off_t off;
+
+  if (!f) return 0;
+  if (size == 0) size = WRITER_SIZE;
+  size = (size + WRITER_CHUNK - 1) / WRITER_CHUNK * WRITER_CHUNK;
+  if (size < 2 * WRITER_CHUNK) size = 2 * WRITER_CHUNK;
+  if (!(f->mem = malloc(size + WRITER_ALIGN))) {
+    free(f);
+    return 0;
+  }
+  f->ring = f->mem + (WRITER_ALIGN - (uintptr_t)f->mem % WRITER_ALIGN);
+  f->w     = w;
+  f->fd    = fd;
+  f->size  = size;
+  f->flags = flags;
+  f->st.size = size;
+
+  /* ring positions are file offsets; pipes start at zero */
+  if ((off = lseek(fd, 0, SEEK_CUR)) < 0) {
+    off = 0;
+    f->flags &= ~WRITER_DIRECT;
+  }
+  f->base = f->wpos = f->qpos = f->rpos = f->rseen = off;
+  if ((f->flags & WRITER_DIRECT) &&
+      (set_direct(f, 1) < 0 || set_direct(f, 0) < 0)) {
+    fprintf(stderr, "O_DIRECT not supported, writing through the cache\n");
+    f->flags &= ~WRITER_DIRECT;
+  }
+  return f;
+} /* writer_open */
+
+
+
+/*
+* Hand the data of 'f' up to 'pos' to the writer.
+*/
+static void writer_hand(writer_file_t *f, uint64_t pos)
+{
+#if HAVE_PTHREAD
+  writer_t *w = f->w;
+
+  pthread_mutex_lock(&w->lock);
+  f->qpos = pos;
+  f->rseen = f->rpos;
+  if (!f->queued && write_end(f) > f->rpos) {
+    f->queued = 1;
+    f->next = 0;
+    if (w->tail) w->tail->next = f;
+    else w->head = f;
+    w->tail = f;
+    pthread_cond_signal(&w->work);
+  }
+  pthread_mutex_unlock(&w->lock);
+#else
+  uint64_t to;
+
+  f->qpos = pos;
+  if ((to = write_end(f)) > f->rpos) {
+    write_out(f, f->rpos, to);
+    f->rpos = to;
+  }
+  f->rseen = f->rpos;
+#endif
+} /* writer_hand */
+
+
+/*
+* Wait until the writer has written at least up to 'pos'.
+*/
+static void writer_wait(writer_file_t *f, uint64_t pos)
+{
+#if HAVE_PTHREAD
+  writer_t *w = f->w;
+
+  pthread_mutex_lock(&w->lock);
+  while (f->rpos < pos) pthread_cond_wait(&w->done, &w->lock);
+  f->rseen = f->rpos;
+  pthread_mutex_unlock(&w->lock);
+#endif
+} /* writer_wait */
+
+
+/*
+* Write out everything appended to 'f', including an unaligned tail,
+* and wait for it.
+*/
+static void writer_drain(writer_file_t *f)
+{
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&f->w->lock);
+  f->final = 1;
+  pthread_mutex_unlock(&f->w->lock);
+#else
+  f->final = 1;
+#endif
+  writer_hand(f, f->wpos);
+  writer_wait(f, f->wpos);
+} /* writer_drain */
+
+
+/*
+* Make room for 'len' more bytes in the ring of 'f'.  Return -1 if the
+* record is to be dropped instead.
+*/
+static int writer_space(writer_file_t *f, size_t len)
+{
+  uint64_t need = f->wpos + len - f->size;  /* rpos needed */
+
+  writer_hand(f, f->wpos);
+  if (f->rseen >= need) return 0;
+  if (f->flags & WRITER_DROP) return -1;
+  f->st.stalls++;
+  writer_wait(f, need);
+  return 0;
+} /* writer_space */
+
+
+/*
+* Pass everything appended to 'f' from now on through 'encode' with
+* 'ctx'.  Each writer_write() is then one frame; frames are encoded
+* in the writer thread and never split.  Turns off WRITER_DIRECT.
+*/
+void writer_encode(writer_file_t *f, writer_encode_t encode, void *ctx)
+{
+  writer_drain(f);
+  f->final = 0;
+  f->flags &= ~WRITER_DIRECT;
+  set_direct(f, 0);
+  f->encode = encode;
+  f->ctx = ctx;
+} /* writer_encode */
+
+
+/*
+* Append 'n' bytes of 'buf' to the ring of 'f'.
+*/
+static void ring_put(writer_file_t *f, const void *buf, size_t n)
+{
+  const char *p = buf;
+  size_t i, k;
+
+  for (k = 0; k < n; k += i) {
+    size_t at = f->wpos % f->size;
+
+    i = n - k;
+    if (i > f->size - at) i = f->size - at;
+    memcpy(f->ring + at, p + k, i);
+    f->wpos += i;
+  }
+} /* ring_put */
+
+
+/*
+* Append one record of 'n' iovecs to 'f'.  Return 0, or -1 if the
+* record was dropped because the ring is full.
+*/
+int writer_writev(writer_file_t *f, struct iovec *iov, int n)
+{
+  size_t len = 0, k;
+  uint32_t flen;
+  int j;
+
+  for (j = 0; j < n; j++) len += iov[j].iov_len;
+
+  /* too large to buffer, write in order with the rest */
+  if (len > f->size / 2) {
+    writer_drain(f);
+    f->final = 0;  /* the writer is idle for 'f' */
+    set_direct(f, 0);
+    if (f->encode) {
+      const char *p, *out;
+
+      if (n == 1) p = iov[0].iov_base;
+      else {
+        if (len > f->tmpsize) {
+          free(f->tmp);
+          if (!(f->tmp = malloc(len))) {
+            perror("writer");
+            exit(1);
+          }
+          f->tmpsize = len;
+        }
+        for (k = 0, j = 0; j < n; k += iov[j++].iov_len)
+          memcpy(f->tmp + k, iov[j].iov_base, iov[j].iov_len);
+        p = f->tmp;
+      }
+      k = f->encode(f->ctx, p, len, &out);
+      write_all(f->fd, out, k);
+    }
+    else {
+      for (j = 0; j < n; j++) write_all(f->fd, iov[j].iov_base, iov[j].iov_len);
+    }
+    f->wpos += len;
+    f->qpos = f->rpos = f->rseen = f->wpos;
+    f->st.records++;
+    return 0;
+  }
+
+  flen = len;
+  if (f->encode) len += sizeof(flen);  /* frames go behind their length */
+  if (f->wpos + len - f->rseen > f->size && writer_space(f, len) < 0) {
+    f->st.dropped++;
+    return -1;
+  }
+  if (f->encode) ring_put(f, &flen, sizeof(flen));
+  for (j = 0; j < n; j++) ring_put(f, iov[j].iov_base, iov[j].iov_len);
+  f->st.records++;
+  if (f->wpos - f->rseen > f->st.high) f->st.high = f->wpos - f->rseen;
+
+  /* a frame is complete, or a chunk filled up */
+  if (f->encode) writer_hand(f, f->wpos);
+  else if (f->wpos - f->wpos % WRITER_CHUNK > f->qpos)
+    writer_hand(f, f->wpos - f->wpos % WRITER_CHUNK);
+  return 0;
+} /* writer_writev */
+
+
+/*
+* Append a record of 'len' bytes of 'buf' to 'f'.
+*/
+int writer_write(writer_file_t *f, const void *buf, size_t len)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void *)buf;
+  iov.iov_len  = len;
+  return writer_writev(f, &iov, 1);
+} /* writer_write */
+
+
+/*
+* Hand everything appended to 'f' to the writer.
+*/
+void writer_flush(writer_file_t *f)
+{
+  if (f->wpos > f->qpos) writer_hand(f, f->wpos);
+} /* writer_flush */
+
+
+/*
+* Return the bytes appended to 'f' and not yet written.
+*/
+size_t writer_queued(writer_file_t *f)
+{
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&f->w->lock);
+  f->rseen = f->rpos;
+  pthread_mutex_unlock(&f->w->lock);
+#endif
+  return f->wpos - f->rseen;
+} /* writer_queued */
+
+
+/*
+* Return the counters of 'f'.
+*/
+void writer_stats(writer_file_t *f, writer_stats_t *st)
+{
+#if HAVE_PTHREAD
+  pthread_mutex_lock(&f->w->lock);
+  f->rseen = f->rpos;
+  pthread_mutex_unlock(&f->w->lock);
+#endif
+  *st = f->st;
+  st->written = f->rseen - f->base;
+} /* writer_stats */
+
+
+/*
+* Write out everything buffered for 'f' in the background, then call
+* 'done' with 'arg' and free 'f'.  The descriptor is not closed, but
+* 'done' may close it.  'f' must not be used after this.
+*/
+void writer_retire(writer_file_t *f, void (*done)(void *), void *arg)
+{
+#if HAVE_PTHREAD
+  writer_t *w = f->w;
+
+  pthread_mutex_lock(&w->lock);
+  f->final = 1;
+  f->done = done;
+  f->arg = arg;
+  f->qpos = f->wpos;
+  if (!f->queued) {
+    f->queued = 1;
+    f->next = 0;
+    if (w->tail) w->tail->next = f;
+    else w->head = f;
+    w->tail = f;
+    pthread_cond_signal(&w->work);
+  }
+  pthread_mutex_unlock(&w->lock);
+#else
+  writer_close(f);
+  done(arg);
+#endif
+} /* writer_retire */
+
+
+/*
+* Write out everything buffered for 'f' and free it.  The descriptor
+* is not closed.
+*/
+void writer_close(writer_file_t *f)
+{
+  if (!f) return;
+  writer_drain(f);
+  set_direct(f, 0);
+  free(f->tmp);
+  free(f->mem);
+  free(f);
+} /* writer_close */
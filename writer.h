@@ -0,0 +1,85 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Asynchronous output for dump files.  Records are copied into a
+* per-file ring buffer; a writer thread shared by all files writes it
+* out in large chunks, so a slow disk does not hold up packet
+* reception.
+*/
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WRITER_CHUNK (128 * 1024)       /* bytes per write */
+#define WRITER_ALIGN 4096               /* alignment for O_DIRECT */
+#define WRITER_SIZE  (8 * WRITER_CHUNK) /* default ring size */
+
+/* writer_open() flags */
+#define WRITER_DROP   1   /* drop records rather than wait for space */
+#define WRITER_DIRECT 2   /* bypass the page cache where possible */
+
+typedef struct writer writer_t;
+typedef struct writer_file writer_file_t;
+
+typedef struct writer_stats {
+  uint64_t records;   /* records accepted */
+  uint64_t dropped;   /* records dropped because the ring was full */
+  uint64_t stalls;    /* times the caller waited for space */
+  uint64_t written;   /* bytes written to the file */
+  size_t high;        /* most bytes buffered at once */
+  size_t size;        /* ring size */
+} writer_stats_t;
+
+/*
+* Frame encoder, see writer_encode(): returns the bytes to write for
+* 'len' bytes of 'in' in 'out', valid until the next call.
+*/
+typedef size_t (*writer_encode_t)(void *ctx, const char *in, size_t len,
+  const char **out);
+
+extern writer_t *writer_new(void);
+extern void writer_free(writer_t *w);
+extern writer_file_t *writer_open(writer_t *w, int fd, size_t size,
+  int flags);
+extern void writer_encode(writer_file_t *f, writer_encode_t encode,
+  void *ctx);
+extern int writer_write(writer_file_t *f, const void *buf, size_t len);
+extern int writer_writev(writer_file_t *f, struct iovec *iov, int n);
+extern void writer_flush(writer_file_t *f);
+extern void writer_stats(writer_file_t *f, writer_stats_t *st);
+extern size_t writer_queued(writer_file_t *f);
+extern void writer_retire(writer_file_t *f, void (*done)(void *),
+  void *arg);
+extern void writer_close(writer_file_t *f);
+
+#endif /* WRITER_H */